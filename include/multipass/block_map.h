@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_BLOCK_MAP_H
+#define MULTIPASS_BLOCK_MAP_H
+
+#include "path.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace multipass
+{
+/*
+ * The checksums of a file's fixed-size blocks, zsync-style, for rebuilding a new version of the file out of an old one.
+ * Served as JSON next to the file, under its name plus block_map_suffix.
+ */
+struct BlockMap
+{
+    qint64 block_size;
+    qint64 size;                          // of the whole file
+    QString sha256;                       // of the whole file, as lowercase hex
+    std::vector<QByteArray> block_hashes; // SHA-256 of each block, cut to 16 bytes; the last block may be short
+};
+
+constexpr auto block_map_suffix = ".blockmap";
+constexpr qint64 default_block_map_block_size = 64 * 1024; // the qcow2 cluster size, which image data is aligned to
+
+// Which blocks of a file can be had from an older version of it, and which need downloading
+struct DeltaPlan
+{
+    std::vector<std::pair<qint64, qint64>> copies;  // (offset in the file, offset in the older version)
+    std::vector<std::pair<qint64, qint64>> missing; // (offset, length), with adjacent blocks merged
+    qint64 reused_bytes;                            // including blocks of zeros, which need neither
+};
+
+BlockMap make_block_map(const Path& file_path, qint64 block_size = default_block_map_block_size); // throws
+QByteArray block_map_to_json(const BlockMap& block_map);
+std::optional<BlockMap> block_map_from_json(const QByteArray& json); // nothing if malformed
+
+/*
+ * Matches the blocks in the map against the blocks of seed_path. Only block boundaries of the seed are looked at, not
+ * every byte offset as rsync does: image data moves between versions in whole clusters, so that finds what there is.
+ */
+DeltaPlan plan_delta(const BlockMap& block_map, const Path& seed_path); // throws
+
+// Sizes the file and copies the reusable blocks into it from the seed, leaving holes for zeros; throws
+void copy_reused_blocks(const BlockMap& block_map, const DeltaPlan& plan, const Path& seed_path, QFile& file);
+} // namespace multipass
+#endif // MULTIPASS_BLOCK_MAP_H
@@ -46,6 +46,7 @@ public:
     virtual void read_console() = 0;
     virtual void write_console() = 0;
     virtual void exit_console() = 0;
+    virtual bool is_interactive() const = 0; // whether the channel got a pty, because the terminal is live
 
     static UPtr make_console(ssh_channel channel, Terminal* term);
     static void setup_environment();
@@ -39,6 +39,7 @@ constexpr auto default_disk_size = "5G";
 constexpr auto default_cpu_cores = min_cpu_cores;
 constexpr auto default_timeout = std::chrono::seconds(300);
 constexpr auto image_resize_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(5min).count();
+constexpr auto image_flatten_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(30min).count();
 
 constexpr auto home_automount_dir = "Home";
 
@@ -50,6 +51,8 @@ constexpr auto winterm_profile_guid =
 
 constexpr auto bridged_network_name = "bridged";
 
+constexpr auto instance_names_file = "multipass_instances"; // published by the daemon next to its socket
+
 constexpr auto settings_extension = ".conf";
 constexpr auto daemon_settings_root = "local";
 
@@ -62,12 +65,25 @@ constexpr auto autostart_key = "client.gui.autostart";                // idem
 constexpr auto winterm_key = "client.apps.windows-terminal.profiles"; // idem
 constexpr auto hotkey_key = "client.gui.hotkey";                      // idem
 constexpr auto mirror_key = "local.image.mirror";                     // idem; this defines the mirror of simple streams
+constexpr auto ssh_mux_key = "client.ssh.multiplex-idle";             // idem; seconds to keep SSH sessions, 0 disables
+constexpr auto client_ssh_ciphers_key = "client.ssh.ciphers";         // idem; empty picks ciphers suited to the CPU
+constexpr auto daemon_ssh_ciphers_key = "local.ssh.ciphers";          // idem
+constexpr auto thin_disks_key = "local.image.thin-disks";             // idem; qemu disks as overlays on cached images
+constexpr auto warm_pool_key = "local.warm-pool";                     // idem; "<image>[/<cpus>/<mem>/<disk>]=<n>,..."
+constexpr auto warm_pool_memory_key = "local.warm-pool.memory";       // idem; memory all warm instances may take
+constexpr auto download_rate_key = "local.image.download-rate";       // idem; bytes per second, empty for no limit
+constexpr auto mirror_server_key = "local.image.mirror-server";       // idem; "[<address>:]<port>" to serve images on
+constexpr auto image_cache_size_key = "local.image.cache-size";        // idem; LRU-evict source images beyond it if set
+constexpr auto max_downloads_key = "local.image.max-downloads";        // idem; images downloaded at once
 
 [[maybe_unused]] // hands off clang-format
 constexpr auto key_examples = {autostart_key, driver_key, mounts_key};
 
 constexpr auto petenv_default = "primary";
+constexpr auto ssh_mux_default = "0";
 constexpr auto hotkey_default = "Ctrl+Alt+U";                         // idem; translates to Cmd+Opt+U on macOS
+constexpr auto warm_pool_memory_default = "4G";
+constexpr auto max_downloads_default = "3"; // enough for an image, a kernel and an initrd at once
 
 constexpr auto timeout_exit_code = 5;
 
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MULTIPASS_IMAGE_FORMAT_H
+#define MULTIPASS_IMAGE_FORMAT_H
+
+#include "path.h"
+
+#include <QString>
+
+#include <optional>
+
+namespace multipass
+{
+struct ImageFormatInfo
+{
+    enum class Format
+    {
+        raw,
+        qcow2
+    };
+
+    Format format;
+    qint64 virtual_size;  // in bytes
+    int version;          // qcow2 only
+    qint64 cluster_size;  // qcow2 only
+    QString backing_file; // qcow2 only; as recorded in the image, so possibly relative to it
+};
+
+/*
+ * Works out the format and virtual size of an image from its header, without running qemu-img. Returns nothing if the
+ * image cannot be read, has a malformed qcow2 header, or is in one of the other formats that qemu-img knows, in which
+ * case callers should ask qemu-img instead.
+ */
+std::optional<ImageFormatInfo> probe_image_format(const Path& image_path);
+
+/*
+ * Whether an image's header holds together, as far as qemu-img check would start: a qcow2 header must parse and place
+ * its L1 and refcount tables within the file. Images in other formats need only be readable and non-empty.
+ */
+bool has_sane_header(const Path& image_path);
+} // namespace multipass
+#endif // MULTIPASS_IMAGE_FORMAT_H
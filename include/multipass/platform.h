@@ -61,6 +61,9 @@ public:
     virtual int chmod(const char* path, unsigned int mode) const;
     virtual bool set_permissions(const multipass::Path path, const QFileDevice::Permissions permissions) const;
     virtual bool link(const char* target, const char* link) const;
+    // Copies all of source_fd into target_fd without going through userspace (e.g. as a reflink), keeping holes;
+    // false if no such shortcut worked, in which case target_fd's contents and both file offsets are unspecified
+    virtual bool copy_file_data(int source_fd, int target_fd) const;
     virtual bool symlink(const char* target, const char* link, bool is_dir) const;
     virtual int utime(const char* path, int atime, int mtime) const;
     virtual QString get_username() const;
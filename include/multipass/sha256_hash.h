@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MULTIPASS_SHA256_HASH_H
+#define MULTIPASS_SHA256_HASH_H
+
+#include "disabled_copy_move.h"
+
+#include <QByteArray>
+#include <QString>
+
+#include <cstddef>
+#include <memory>
+
+struct evp_md_ctx_st;
+
+namespace multipass
+{
+// Incremental SHA-256, backed by OpenSSL so that it uses the CPU's SHA extensions where it has them
+class Sha256Hash : private DisabledCopyMove
+{
+public:
+    Sha256Hash();
+
+    void add_data(const char* data, std::size_t size);
+    void add_data(const QByteArray& data);
+    void reset();
+    QString hex_result(); // as lowercase hex; call reset() before adding more data
+
+private:
+    std::unique_ptr<evp_md_ctx_st, void (*)(evp_md_ctx_st*)> context;
+};
+} // namespace multipass
+#endif // MULTIPASS_SHA256_HASH_H
@@ -46,6 +46,9 @@ public:
     int exec(const std::vector<std::vector<std::string>>& args_list);
     void connect();
 
+    // The command line that exec(args_list) runs: each args vector quoted and chained with "&&"
+    static std::string to_cmd_line(const std::vector<std::vector<std::string>>& args_list);
+
 private:
     void handle_ssh_events();
     int exec_string(const std::string& cmd_line);
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SSH_MUX_H
+#define MULTIPASS_SSH_MUX_H
+
+#include <QString>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+/*
+ * Client-side SSH connection multiplexing, in the spirit of OpenSSH's ControlMaster.
+ *
+ * A per-user agent (multipass_ssh_mux) keeps one authenticated SSH session per instance alive and serves clients over
+ * a unix socket. Each client connection carries a single conversation: a request frame naming the target and the
+ * command, answered with a started (or refused) frame, followed by stdin frames from the client and stdout/stderr
+ * frames from the agent, ending with an exit status (or error) frame. Frames are a one byte type, a four byte
+ * big-endian payload length and the payload itself.
+ */
+namespace multipass
+{
+namespace ssh_mux
+{
+enum class FrameType : std::uint8_t
+{
+    request = 0,       // client -> agent: JSON object describing the target and the command
+    stdin_data = 1,    // client -> agent
+    stdin_eof = 2,     // client -> agent
+    window_change = 3, // client -> agent: "<columns> <rows>"
+    stdout_data = 4,   // agent -> client
+    stderr_data = 5,   // agent -> client
+    exit_status = 6,   // agent -> client: decimal exit code; ends the conversation
+    error = 7,         // agent -> client: error message; ends the conversation
+    started = 8,       // agent -> client: answers the request once the command runs
+    refused = 9        // agent -> client: answers the request if the command could not be started; ends it
+};
+
+constexpr std::uint32_t max_frame_payload = 1024 * 1024;
+constexpr auto agent_name = "multipass_ssh_mux";
+
+struct Frame
+{
+    FrameType type;
+    std::string payload;
+};
+
+// Accumulates bytes read from a stream and splits them into frames
+class FrameReader
+{
+public:
+    void feed(const char* data, std::size_t size);
+    std::optional<Frame> next(); // throws std::runtime_error on a malformed frame
+
+private:
+    std::string buffer;
+};
+
+std::string encode_frame(FrameType type, const std::string& payload);
+bool write_frame(int fd, FrameType type, const std::string& payload);
+
+struct Target
+{
+    std::string host;
+    int port;
+    std::string username;
+    std::string priv_key_blob;
+    std::string ciphers; // as in client.ssh.ciphers; empty to pick ones suited to the CPU
+};
+
+QString socket_path();
+
+/*
+ * Run cmd_line (or a login shell, if it is empty) on the target through the multiplexing agent, starting the agent if
+ * it is not running yet. The agent drops sessions (and eventually exits) after idle_timeout without use.
+ * Returns the remote exit status, or std::nullopt if no agent could be reached or the agent could not start the
+ * command (e.g. it failed to connect to the instance), in which case the caller should connect directly.
+ */
+std::optional<int> exec(const Target& target, const std::string& cmd_line, std::chrono::seconds idle_timeout);
+} // namespace ssh_mux
+} // namespace multipass
+#endif // MULTIPASS_SSH_MUX_H
@@ -25,6 +25,7 @@
 #include <chrono>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace multipass
 {
@@ -33,18 +34,29 @@ class SSHSession
 {
 public:
     SSHSession(const std::string& host, int port, const std::chrono::milliseconds timeout = std::chrono::seconds(1));
+    // An empty cipher list falls back on the preference below
     SSHSession(const std::string& host, int port, const std::string& ssh_username, const SSHKeyProvider& key_provider,
-               const std::chrono::milliseconds timeout = std::chrono::seconds(20));
+               const std::chrono::milliseconds timeout = std::chrono::seconds(20), const std::string& ciphers = {});
 
     SSHProcess exec(const std::string& cmd);
 
     void force_shutdown();
     operator ssh_session() const;
 
+    // Comma-separated cipher list for sessions created from now on without one of their own; empty to pick one suited
+    // to this CPU
+    static void set_cipher_preference(const std::string& ciphers);
+
+    // The names in a comma-separated cipher list that libssh cannot negotiate, to reject preferences before use
+    static std::vector<std::string> unknown_ciphers(const std::string& ciphers);
+
+    // Whether the CPU implements AES, which puts AES-GCM ahead of ChaCha20 when there is no preference
+    static bool has_hardware_aes();
+
 private:
     SSHSession(const std::string& host, int port, const std::string& ssh_username, const SSHKeyProvider* key_provider);
     SSHSession(const std::string& host, int port, const std::string& ssh_username, const SSHKeyProvider* key_provider,
-               const std::chrono::milliseconds timeout = std::chrono::seconds(20));
+               const std::chrono::milliseconds timeout = std::chrono::seconds(20), const std::string& ciphers = {});
     void set_option(ssh_options_e type, const void* value);
     std::unique_ptr<ssh_session_struct, void (*)(ssh_session)> session;
 };
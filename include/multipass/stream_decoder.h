@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_STREAM_DECODER_H
+#define MULTIPASS_STREAM_DECODER_H
+
+#include <cstddef>
+
+#include <QString>
+
+namespace multipass
+{
+// Decodes a compressed stream that arrives in pieces, writing the decoded data to a file as it goes
+class StreamDecoder
+{
+public:
+    virtual ~StreamDecoder() = default;
+
+    virtual void feed(const char* data, std::size_t size) = 0; // throws std::runtime_error on bad data or failed writes
+    virtual QString finish() = 0; // throws if the stream is incomplete; returns the SHA-256 of the decoded data, as hex
+};
+} // namespace multipass
+#endif // MULTIPASS_STREAM_DECODER_H
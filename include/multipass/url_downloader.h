@@ -26,14 +26,20 @@
 #include <QByteArray>
 #include <QDateTime>
 #include <QNetworkAccessManager>
+#include <QString>
+#include <QStringList>
 
 #include <atomic>
 #include <chrono>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
 
 #define MP_NETMGRFACTORY multipass::NetworkManagerFactory::instance()
 
 class QUrl;
-class QString;
 namespace multipass
 {
 class NetworkManagerFactory : public Singleton<NetworkManagerFactory>
@@ -44,24 +50,54 @@ public:
     virtual std::unique_ptr<QNetworkAccessManager> make_network_manager(const Path& cache_dir_path) const;
 };
 
+// What a server identified a resource by, for asking it for the resource again only if it changed
+struct HttpValidators
+{
+    QByteArray etag;
+    QByteArray last_modified;
+};
+
 class URLDownloader : private DisabledCopyMove
 {
 public:
     URLDownloader(std::chrono::milliseconds timeout);
     URLDownloader(const Path& cache_dir, std::chrono::milliseconds timeout);
     virtual ~URLDownloader() = default;
-    virtual void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                             const ProgressMonitor& monitor);
+    // Returns the SHA-256 of the downloaded file, as lowercase hex; empty if it is not known
+    virtual QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                                const ProgressMonitor& monitor);
+    // Decodes xz or zstd data, going by the URL's suffix, into decoded_file_name as it arrives; returns the SHA-256 of
+    // the data as downloaded
+    virtual QString download_decoded_to(const QUrl& url, const QString& decoded_file_name, int64_t size,
+                                        const int download_type, const ProgressMonitor& monitor);
+    // Writes the given (offset, length) byte ranges of url into the same places in file_name, which must exist
+    virtual void download_ranges_to(const QUrl& url, const QString& file_name,
+                                    const std::vector<std::pair<qint64, qint64>>& ranges, const int download_type,
+                                    const ProgressMonitor& monitor);
     virtual QByteArray download(const QUrl& url);
+    // Sends validators along and updates them from the reply; returns nothing if the server says nothing changed
+    virtual std::optional<QByteArray> download_if_modified(const QUrl& url, HttpValidators& validators);
     virtual QDateTime last_modified(const QUrl& url);
     virtual void abort_all_downloads();
+    // Caps the combined rate of all downloads to files; 0 lifts the cap
+    void set_bandwidth_limit(qint64 bytes_per_second);
+    // The files that download_to keeps in dir_path while a download is under way or waiting to be resumed
+    static QStringList partial_download_files(const QString& dir_path);
 
 protected:
     std::atomic_bool abort_downloads{false};
 
 private:
+    qint64 read_buffer_size() const;
+    // What downloads book their data with to keep to the bandwidth limit; empty when there is none
+    std::function<std::chrono::steady_clock::duration(qint64)> pacing();
+    std::chrono::steady_clock::duration book_transfer(qint64 bytes);
+
     const Path cache_dir_path;
     std::chrono::milliseconds timeout;
+    std::atomic<qint64> bandwidth_limit{0};
+    std::mutex booking_mutex;
+    std::chrono::steady_clock::time_point next_transfer_time;
 };
 }
 #endif // MULTIPASS_URL_DOWNLOADER_H
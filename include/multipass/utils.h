@@ -73,6 +73,13 @@ std::string contents_of(const multipass::Path& file_path);
 bool invalid_target_path(const QString& target_path);
 QTemporaryFile create_temp_file_with_path(const QString& filename_template);
 void remove_directories(const std::vector<QString>& dirs);
+bool write_sparse(QFileDevice& file, const char* data, qint64 size); // seeks over blocks of zeros, leaving holes
+bool finish_sparse(QFileDevice& file); // sets the size of a file that write_sparse() may have left ending in a hole
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+// Writes everything or fails, retrying short and interrupted writes and waiting out non-blocking descriptors. Sockets
+// are written without raising SIGPIPE when the peer has gone away.
+bool write_all(int fd, const char* data, std::size_t size);
+#endif
 
 // filesystem mount helpers
 void make_target_dir(SSHSession& session, const std::string& root, const std::string& relative_target);
@@ -94,6 +101,8 @@ bool process_log_on_error(const QString& program, const QStringList& arguments,
 
 // networking helpers
 void validate_server_address(const std::string& value);
+QString unix_socket_path(const std::string& server_address); // empty if the address is not a unix socket
+QString instance_names_file_for(const std::string& server_address); // empty if the address is not a unix socket
 bool valid_hostname(const std::string& name_string);
 std::string generate_mac_address();
 bool valid_mac_address(const std::string& mac);
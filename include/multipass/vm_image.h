@@ -35,6 +35,7 @@ public:
     std::string current_release;
     std::string release_date;
     std::vector<std::string> aliases;
+    Path backing_path; // the cached image that this one is a qcow2 overlay on, if any
 };
 }
 #endif // MULTIPASS_VIRTUAL_MACHINE_IMAGE_H
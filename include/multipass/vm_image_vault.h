@@ -23,12 +23,14 @@
 #include "memory_size.h"
 #include "path.h"
 #include "progress_monitor.h"
+#include "stream_decoder.h"
 #include "vm_image_info.h"
 
 #include <QDir>
 #include <QFile>
 #include <QString>
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <optional>
@@ -47,8 +49,15 @@ QString filename_for(const Path& path);
 QString copy(const QString& file_name, const QDir& output_dir);
 void delete_file(const Path& path);
 QString compute_image_hash(const Path& image_path);
-void verify_image_download(const Path& image_path, const QString& image_hash);
-QString extract_image(const Path& image_path, const ProgressMonitor& monitor, const bool delete_file = false);
+// download_hash is what the downloader computed on the way in, if anything; otherwise the file is read back to hash it
+void verify_image_download(const Path& image_path, const QString& image_hash, const QString& download_hash = {});
+// The suffix of a compressed image format that can be decoded (".xz" or ".zst"); empty for anything else
+QString compression_suffix(const QString& file_name);
+std::unique_ptr<StreamDecoder> make_stream_decoder(const QString& compressed_file_name, const Path& decoded_file_path);
+// Returns the SHA-256 of the decoded data, as lowercase hex
+QString decode_image(const Path& compressed_path, const Path& decoded_path, const ProgressMonitor& monitor);
+QString extract_image(const Path& image_path, const ProgressMonitor& monitor, const bool delete_file = false,
+                      QString* decoded_hash = nullptr);
 std::unordered_map<std::string, VMImageHost*> configure_image_host_map(const std::vector<VMImageHost*>& image_hosts);
 
 class DeleteOnException
@@ -73,6 +82,24 @@ private:
 
 class Query;
 class VMImage;
+
+// What the source images kept in a vault take, as reported to clients
+struct ImageCacheUsage
+{
+    struct Image
+    {
+        std::string id;
+        std::string release;
+        std::string remote;
+        long long size; // in bytes, kernel and initrd included
+        std::chrono::system_clock::time_point last_used;
+        bool in_use; // instances are backed by it, so it cannot be evicted
+    };
+
+    std::vector<Image> images;
+    long long size_budget; // in bytes, zero for no limit
+};
+
 class VMImageVault : private DisabledCopyMove
 {
 public:
@@ -88,7 +115,19 @@ public:
     virtual void prune_expired_images() = 0;
     virtual void update_images(const FetchType& fetch_type, const PrepareAction& prepare,
                                const ProgressMonitor& monitor) = 0;
+    // Re-verifies the stored source images at a gentle pace, quarantining and fetching again any that are damaged
+    virtual void scrub_images(const FetchType& fetch_type, const PrepareAction& prepare,
+                              const ProgressMonitor& monitor) = 0;
     virtual MemorySize minimum_image_size_for(const std::string& id) = 0;
+    // Makes the named instance's image standalone, if it is an overlay on a cached image; the instance must be stopped
+    virtual void flatten(const std::string& name) = 0;
+    // The source images kept around for launching further instances, with the ids they were fetched by
+    virtual std::vector<VMImage> cached_images() = 0;
+    // Evicts the least recently used source images whenever they take more than size_budget (zero for no limit)
+    virtual void set_size_budget(const MemorySize& size_budget) = 0;
+    // Caps how many images are downloaded at once; interactive fetches go ahead of background ones for free slots
+    virtual void set_max_downloads(int max_downloads) = 0;
+    virtual ImageCacheUsage cache_usage() = 0;
     virtual VMImageHost* image_host_for(const std::string& remote_name) const = 0;
     virtual std::vector<std::pair<std::string, VMImageInfo>> all_info_for(const Query& query) const = 0;
 
@@ -20,27 +20,62 @@
 
 #include <multipass/path.h>
 #include <multipass/progress_monitor.h>
+#include <multipass/sha256_hash.h>
+#include <multipass/stream_decoder.h>
 
+#include <cstddef>
 #include <memory>
+#include <vector>
 
 #include <QFile>
+#include <QString>
 
 #include <xz.h>
 
 namespace multipass
 {
-class XzImageDecoder
+// Decodes an xz stream that arrives in pieces, writing the decoded data to a file as it goes
+class XzStreamDecoder : public StreamDecoder
 {
 public:
-    XzImageDecoder(const Path& xz_file_path);
+    explicit XzStreamDecoder(const Path& decoded_file_path);
 
-    void decode_to(const Path& decoded_file_path, const ProgressMonitor& monitor);
+    void feed(const char* data, std::size_t size) override;
+    QString finish() override;
 
     using XzDecoderUPtr = std::unique_ptr<xz_dec, decltype(xz_dec_end)*>;
 
 private:
-    QFile xz_file;
+    void run(const char* data, std::size_t size);
+    void flush();
+
+    QFile decoded_file;
     XzDecoderUPtr xz_decoder;
+    std::vector<char> decoded_data;
+    struct xz_buf decode_buf;
+    Sha256Hash hash;
+    bool stream_ended = false;
+};
+
+/*
+ * Decodes an xz file. Files made of several blocks (as written by `xz -T`) have their blocks decoded concurrently, on
+ * up to max_threads threads (0 meaning one per core); other files go through an XzStreamDecoder.
+ */
+class XzImageDecoder
+{
+public:
+    XzImageDecoder(const Path& xz_file_path, int max_threads = 0);
+
+    // Returns the SHA-256 of the decoded data, as lowercase hex
+    QString decode_to(const Path& decoded_file_path, const ProgressMonitor& monitor);
+
+    using XzDecoderUPtr = XzStreamDecoder::XzDecoderUPtr;
+
+private:
+    QString decode_stream_to(const Path& decoded_file_path, const ProgressMonitor& monitor);
+
+    QFile xz_file;
+    const int max_threads;
 };
 } // namespace multipass
 #endif // MULTIPASS_XZ_IMAGE_DECODER_H
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_ZSTD_IMAGE_DECODER_H
+#define MULTIPASS_ZSTD_IMAGE_DECODER_H
+
+#include <multipass/path.h>
+#include <multipass/progress_monitor.h>
+#include <multipass/sha256_hash.h>
+#include <multipass/stream_decoder.h>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <QFile>
+#include <QString>
+
+struct ZSTD_DCtx_s;
+
+namespace multipass
+{
+// Decodes a zstd stream (one or more frames) that arrives in pieces, writing the decoded data to a file as it goes
+class ZstdStreamDecoder : public StreamDecoder
+{
+public:
+    explicit ZstdStreamDecoder(const Path& decoded_file_path);
+
+    void feed(const char* data, std::size_t size) override;
+    QString finish() override;
+
+private:
+    struct ContextDeleter
+    {
+        void operator()(ZSTD_DCtx_s* context) const;
+    };
+
+    void flush(std::size_t size);
+
+    QFile decoded_file;
+    std::unique_ptr<ZSTD_DCtx_s, ContextDeleter> context;
+    std::vector<char> decoded_data;
+    Sha256Hash hash;
+    bool frame_ended = false;
+};
+
+class ZstdImageDecoder
+{
+public:
+    explicit ZstdImageDecoder(const Path& zstd_file_path);
+
+    // Returns the SHA-256 of the decoded data, as lowercase hex
+    QString decode_to(const Path& decoded_file_path, const ProgressMonitor& monitor);
+
+private:
+    QFile zstd_file;
+};
+} // namespace multipass
+#endif // MULTIPASS_ZSTD_IMAGE_DECODER_H
@@ -22,6 +22,7 @@
 #include "cmd/delete.h"
 #include "cmd/exec.h"
 #include "cmd/find.h"
+#include "cmd/flatten.h"
 #include "cmd/get.h"
 #include "cmd/help.h"
 #include "cmd/info.h"
@@ -84,6 +85,7 @@ mp::Client::Client(ClientConfig& config)
     add_command<cmd::Purge>(aliases);
     add_command<cmd::Exec>(aliases);
     add_command<cmd::Find>();
+    add_command<cmd::Flatten>();
     add_command<cmd::Get>();
     add_command<cmd::Help>();
     add_command<cmd::Info>();
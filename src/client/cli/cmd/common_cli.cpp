@@ -24,6 +24,11 @@
 #include <multipass/constants.h>
 #include <multipass/exceptions/cmd_exceptions.h>
 #include <multipass/exceptions/settings_exceptions.h>
+#include <multipass/settings/settings.h>
+
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+#include <multipass/ssh/ssh_mux.h>
+#endif
 
 #include <QCommandLineOption>
 #include <QString>
@@ -147,6 +152,21 @@ QString multipass::cmd::describe_common_settings_keys()
            " get --keys` to obtain the full list of available settings at any given time.";
 }
 
+std::optional<int> multipass::cmd::exec_multiplexed(const mp::SSHInfo& ssh_info, const std::string& cmd_line)
+{
+#ifdef MULTIPASS_PLATFORM_WINDOWS
+    return std::nullopt;
+#else
+    const auto idle_timeout = std::chrono::seconds{MP_SETTINGS.get_as<int>(mp::ssh_mux_key)};
+    if (idle_timeout.count() <= 0)
+        return std::nullopt;
+
+    return mp::ssh_mux::exec({ssh_info.host(), ssh_info.port(), ssh_info.username(), ssh_info.priv_key_base64(),
+                              MP_SETTINGS.get(mp::client_ssh_ciphers_key).toStdString()},
+                             cmd_line, idle_timeout);
+#endif
+}
+
 void multipass::cmd::add_timeout(multipass::ArgParser* parser)
 {
     QCommandLineOption timeout_option(
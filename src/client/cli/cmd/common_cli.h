@@ -26,6 +26,9 @@
 
 #include <QString>
 
+#include <optional>
+#include <string>
+
 using RpcMethod = multipass::Rpc::StubInterface;
 
 namespace multipass
@@ -50,6 +53,10 @@ ReturnCode run_cmd_and_retry(const QStringList& args, const ArgParser* parser, s
 ReturnCode return_code_from(const SettingsException& e);
 QString describe_common_settings_keys();
 
+// Runs cmd_line (or a shell, if empty) through the SSH multiplexing agent, when enabled and available on this platform.
+// Returns std::nullopt when the caller needs to connect directly.
+std::optional<int> exec_multiplexed(const SSHInfo& ssh_info, const std::string& cmd_line);
+
 // parser helpers
 void add_timeout(multipass::ArgParser*);
 int parse_timeout(const multipass::ArgParser* parser);
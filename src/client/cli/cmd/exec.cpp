@@ -17,8 +17,10 @@
 
 #include "exec.h"
 #include "common_cli.h"
+#include "ssh_info_cache.h"
 
 #include <multipass/cli/argparser.h>
+#include <multipass/cli/client_common.h>
 #include <multipass/ssh/ssh_client.h>
 
 namespace mp = multipass;
@@ -42,6 +44,54 @@ auto is_dir_mounted(const QStringList& split_current_dir, const QStringList& spl
 
     return true;
 }
+
+std::optional<std::string> map_working_directory(const mp::MountInfo& mount_info)
+{
+    // The host directory on which the user is executing the command.
+    QString clean_exec_dir = QDir::cleanPath(QDir::current().canonicalPath());
+    QStringList split_exec_dir = clean_exec_dir.split('/');
+
+    std::optional<std::string> work_dir;
+    for (const auto& mount : mount_info.mount_paths())
+    {
+        auto source_dir = QDir(QString::fromStdString(mount.source_path()));
+        auto clean_source_dir = QDir::cleanPath(source_dir.absolutePath());
+        QStringList split_source_dir = clean_source_dir.split('/');
+
+        // If the directory is mounted, we need to `cd` to it in the instance before executing the command.
+        if (is_dir_mounted(split_exec_dir, split_source_dir))
+        {
+            for (int i = 0; i < split_source_dir.size(); ++i)
+                split_exec_dir.removeFirst();
+            work_dir = mount.target_path() + '/' + split_exec_dir.join('/').toStdString();
+        }
+    }
+
+    return work_dir;
+}
+
+std::vector<std::vector<std::string>> make_args_list(const std::optional<std::string>& dir,
+                                                     const std::vector<std::string>& args)
+{
+    std::vector<std::vector<std::string>> all_args;
+    if (dir)
+    {
+        if (args[0] == "sudo")
+        {
+            // If we are running through 'sudo' and need to change directory, it might happen that the default user
+            // does not have access to the folder and thus the cd command will fail. Additionally, `cd` cannot be
+            // ran with sudo, what forces us to run everything through `sh`.
+            auto sh_args = fmt::format("cd {} && {}", *dir, fmt::join(args, " "));
+            all_args = {{"sudo", "sh", "-c", sh_args}};
+        }
+        else
+            all_args = {{"cd", *dir}, {args}};
+    }
+    else
+        all_args = {{args}};
+
+    return all_args;
+}
 } // namespace
 
 mp::ReturnCode cmd::Exec::run(mp::ArgParser* parser)
@@ -59,6 +109,7 @@ mp::ReturnCode cmd::Exec::run(mp::ArgParser* parser)
         args.push_back(parser->positionalArguments().at(i).toStdString());
 
     std::optional<std::string> work_dir;
+    bool map_work_dir = false;
     if (parser->isSet(work_dir_option_name))
     {
         // If the user asked for a working directory, prepend the appropriate `cd`.
@@ -69,51 +120,34 @@ mp::ReturnCode cmd::Exec::run(mp::ArgParser* parser)
         // Decide whether the working directory must be mapped. There are two cases to consider:
         // 1. when executing an alias, see if the working directory is set to "map";
         // 2. when not executing an alias, see if the user did not specify the no-mapping argument.
-        // If one of these two things is true, then prepend the appropriate `cd` to the command to be ran.
-        if ((parser->executeAlias() && parser->executeAlias()->working_directory == "map") ||
-            (!parser->executeAlias() && !parser->isSet(no_dir_mapping_option)))
+        // If one of these two things is true, then prepend the appropriate `cd` to the command to be ran. The mount
+        // map comes along with the SSH info, so there is no need for a separate `info` round trip.
+        map_work_dir = (parser->executeAlias() && parser->executeAlias()->working_directory == "map") ||
+                       (!parser->executeAlias() && !parser->isSet(no_dir_mapping_option));
+    }
+
+    const auto server_address = mp::client::get_server_address();
+    if (auto cached_info = cached_ssh_info(server_address, instance_name))
+    {
+        if (map_work_dir)
+            work_dir = map_working_directory(cached_info->mount_info());
+
+        if (auto cached_ret = exec_with_cached_info(*cached_info, work_dir, args, term))
+            return *cached_ret;
+
+        drop_cached_ssh_info(server_address, instance_name);
+    }
+
+    auto on_success = [this, &args, &work_dir, &instance_name, &server_address, map_work_dir](mp::SSHInfoReply& reply) {
+        if (!reply.ssh_info().empty())
         {
-            // The host directory on which the user is executing the command.
-            QString clean_exec_dir = QDir::cleanPath(QDir::current().canonicalPath());
-            QStringList split_exec_dir = clean_exec_dir.split('/');
-
-            auto on_info_success = [&work_dir, &split_exec_dir](mp::InfoReply& reply) {
-                for (const auto& mount : reply.info(0).mount_info().mount_paths())
-                {
-                    auto source_dir = QDir(QString::fromStdString(mount.source_path()));
-                    auto clean_source_dir = QDir::cleanPath(source_dir.absolutePath());
-                    QStringList split_source_dir = clean_source_dir.split('/');
-
-                    // If the directory is mounted, we need to `cd` to it in the instance before executing the command.
-                    if (is_dir_mounted(split_exec_dir, split_source_dir))
-                    {
-                        for (int i = 0; i < split_source_dir.size(); ++i)
-                            split_exec_dir.removeFirst();
-                        work_dir = mount.target_path() + '/' + split_exec_dir.join('/').toStdString();
-                    }
-                }
-
-                return ReturnCode::Ok;
-            };
-
-            auto on_info_failure = [this](grpc::Status& status) {
-                return standard_failure_handler_for(name(), cerr, status);
-            };
-
-            info_request.set_verbosity_level(parser->verbosityLevel());
-
-            InstanceNames instance_names;
-            auto info_instance_name = instance_names.add_instance_name();
-            info_instance_name->append(instance_name);
-            info_request.mutable_instance_names()->CopyFrom(instance_names);
-            info_request.set_no_runtime_information(true);
-
-            dispatch(&RpcMethod::info, info_request, on_info_success, on_info_failure);
-            // TODO: what to do with the returned value?
+            const auto& ssh_info = reply.ssh_info().begin()->second;
+            cache_ssh_info(server_address, instance_name, ssh_info);
+
+            if (map_work_dir)
+                work_dir = map_working_directory(ssh_info.mount_info());
         }
-    }
 
-    auto on_success = [this, &args, &work_dir](mp::SSHInfoReply& reply) {
         return exec_success(reply, work_dir, args, term);
     };
 
@@ -163,27 +197,55 @@ mp::ReturnCode cmd::Exec::exec_success(const mp::SSHInfoReply& reply, const std:
 
     try
     {
+        const auto args_list = make_args_list(dir, args);
+        if (auto multiplexed_ret = exec_multiplexed(ssh_info, mp::SSHClient::to_cmd_line(args_list)))
+            return static_cast<mp::ReturnCode>(*multiplexed_ret);
+
         auto console_creator = [&term](auto channel) { return Console::make_console(channel, term); };
         mp::SSHClient ssh_client{host, port, username, priv_key_blob, console_creator};
 
-        std::vector<std::vector<std::string>> all_args;
-        if (dir)
-        {
-            if (args[0] == "sudo")
-            {
-                // If we are running through 'sudo' and need to change directory, it might happen that the default user
-                // does not have access to the folder and thus the cd command will fail. Additionally, `cd` cannot be
-                // ran with sudo, what forces us to run everything through `sh`.
-                auto sh_args = fmt::format("cd {} && {}", *dir, fmt::join(args, " "));
-                all_args = {{"sudo", "sh", "-c", sh_args}};
-            }
-            else
-                all_args = {{"cd", *dir}, {args}};
-        }
-        else
-            all_args = {{args}};
+        return static_cast<mp::ReturnCode>(ssh_client.exec(args_list));
+    }
+    catch (const std::exception& e)
+    {
+        term->cerr() << "exec failed: " << e.what() << "\n";
+        return ReturnCode::CommandFail;
+    }
+}
+
+std::optional<mp::ReturnCode> cmd::Exec::exec_with_cached_info(const mp::SSHInfo& ssh_info,
+                                                               const std::optional<std::string>& dir,
+                                                               const std::vector<std::string>& args, mp::Terminal* term)
+{
+    const auto args_list = make_args_list(dir, args);
+
+    try
+    {
+        if (auto multiplexed_ret = exec_multiplexed(ssh_info, mp::SSHClient::to_cmd_line(args_list)))
+            return static_cast<mp::ReturnCode>(*multiplexed_ret);
+    }
+    catch (const std::exception& e)
+    {
+        term->cerr() << "exec failed: " << e.what() << "\n";
+        return ReturnCode::CommandFail;
+    }
 
-        return static_cast<mp::ReturnCode>(ssh_client.exec(all_args));
+    std::unique_ptr<mp::SSHClient> ssh_client;
+    try
+    {
+        auto console_creator = [&term](auto channel) { return Console::make_console(channel, term); };
+        ssh_client = std::make_unique<mp::SSHClient>(ssh_info.host(), ssh_info.port(), ssh_info.username(),
+                                                     ssh_info.priv_key_base64(), console_creator);
+    }
+    catch (const std::exception&)
+    {
+        // The instance may have been stopped or restarted elsewhere since the info was cached; ask the daemon.
+        return std::nullopt;
+    }
+
+    try
+    {
+        return static_cast<mp::ReturnCode>(ssh_client->exec(args_list));
     }
     catch (const std::exception& e)
     {
@@ -46,9 +46,13 @@ public:
 
 private:
     SSHInfoRequest ssh_info_request;
-    InfoRequest info_request;
     AliasDict aliases;
 
+    // Returns nullopt when the cached info no longer allows connecting to the instance
+    static std::optional<ReturnCode> exec_with_cached_info(const SSHInfo& ssh_info,
+                                                           const std::optional<std::string>& dir,
+                                                           const std::vector<std::string>& args, Terminal* term);
+
     ParseCode parse_args(ArgParser* parser);
 };
 } // namespace cmd
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "flatten.h"
+#include "common_cli.h"
+
+#include "animated_spinner.h"
+#include "common_callbacks.h"
+
+#include <multipass/cli/argparser.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+
+mp::ReturnCode cmd::Flatten::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [](mp::FlattenReply& reply) { return ReturnCode::Ok; };
+
+    AnimatedSpinner spinner{cout};
+    auto on_failure = [this, &spinner](grpc::Status& status) {
+        spinner.stop();
+        return standard_failure_handler_for(name(), cerr, status);
+    };
+
+    spinner.start(instance_action_message_for(request.instance_names(), "Flattening the disk of "));
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::flatten, request, on_success, on_failure,
+                    make_logging_spinner_callback<FlattenRequest, FlattenReply>(spinner, cerr));
+}
+
+std::string cmd::Flatten::name() const
+{
+    return "flatten";
+}
+
+QString cmd::Flatten::short_help() const
+{
+    return QStringLiteral("Make instance disks standalone");
+}
+
+QString cmd::Flatten::description() const
+{
+    return QStringLiteral("Copy into the disks of the named instances whatever they still\n"
+                          "read from the cached images they were launched from, so that\n"
+                          "they no longer depend on those images. This only changes\n"
+                          "anything for instances launched with local.image.thin-disks\n"
+                          "on. The instances must be stopped.");
+}
+
+mp::ParseCode cmd::Flatten::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("name", "Names of instances to flatten", "<name> [<name> ...]");
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (parser->positionalArguments().count() < 1)
+    {
+        cerr << "Name argument is required\n";
+        return ParseCode::CommandLineError;
+    }
+
+    request.mutable_instance_names()->CopyFrom(add_instance_names(parser));
+
+    return status;
+}
@@ -19,11 +19,56 @@
 #include "common_cli.h"
 
 #include <multipass/cli/argparser.h>
+#include <multipass/cli/client_common.h>
+#include <multipass/cli/format_utils.h>
 #include <multipass/cli/formatter.h>
+#include <multipass/format.h>
+#include <multipass/utils.h>
+
+#include <QFile>
+#include <QFileInfo>
 
 namespace mp = multipass;
 namespace cmd = multipass::cmd;
 
+namespace
+{
+const QString cached_option_name{"cached"};
+
+// Prints the names and states that the daemon publishes next to its socket, if they are current. The daemon rewrites
+// them whenever it persists its instances, and on startup, so they are only stale if it restarted in the meantime.
+bool print_cached_instances(std::ostream& cout)
+{
+    const auto server_address = mp::client::get_server_address();
+    const QFileInfo socket_info{mp::utils::unix_socket_path(server_address)};
+    const QFileInfo names_info{mp::utils::instance_names_file_for(server_address)};
+
+    if (!socket_info.exists() || !names_info.exists() || names_info.lastModified() < socket_info.lastModified())
+        return false;
+
+    QFile names_file{names_info.filePath()};
+    if (!names_file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    auto output = fmt::format("Name,State\n");
+    while (!names_file.atEnd())
+    {
+        const auto fields = QString{names_file.readLine()}.trimmed().split(',');
+
+        mp::InstanceStatus instance_status;
+        mp::InstanceStatus::Status status;
+        if (fields.size() != 2 || !mp::InstanceStatus::Status_Parse(fields[1].toStdString(), &status))
+            return false;
+
+        instance_status.set_status(status);
+        output += fmt::format("{},{}\n", fields[0], mp::format::status_string_for(instance_status));
+    }
+
+    cout << output;
+    return true;
+}
+} // namespace
+
 mp::ReturnCode cmd::List::run(mp::ArgParser* parser)
 {
     auto ret = parse_args(parser);
@@ -32,6 +77,9 @@ mp::ReturnCode cmd::List::run(mp::ArgParser* parser)
         return parser->returnCodeFrom(ret);
     }
 
+    if (parser->isSet(cached_option_name) && print_cached_instances(cout))
+        return ReturnCode::Ok;
+
     auto on_success = [this](ListReply& reply) {
         cout << chosen_formatter->format(reply);
 
@@ -76,7 +124,11 @@ mp::ParseCode cmd::List::parse_args(mp::ArgParser* parser)
     QCommandLineOption noIpv4Option("no-ipv4", "Do not query the instances for the IPv4's they are using");
     noIpv4Option.setFlags(QCommandLineOption::HiddenFromHelp);
 
-    parser->addOptions({formatOption, noIpv4Option});
+    QCommandLineOption cachedOption(cached_option_name,
+                                    "Print just names and states, as last published by the daemon, when current");
+    cachedOption.setFlags(QCommandLineOption::HiddenFromHelp);
+
+    parser->addOptions({formatOption, noIpv4Option, cachedOption});
 
     auto status = parser->commandParse(this);
 
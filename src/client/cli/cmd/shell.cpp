@@ -72,6 +72,9 @@ mp::ReturnCode cmd::Shell::run(mp::ArgParser* parser)
 
         try
         {
+            if (auto multiplexed_ret = exec_multiplexed(ssh_info, /* cmd_line = */ {}))
+                return static_cast<ReturnCode>(*multiplexed_ret);
+
             auto console_creator = [this](auto channel) { return Console::make_console(channel, term); };
             mp::SSHClient ssh_client{host, port, username, priv_key_blob, console_creator};
             ssh_client.connect();
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ssh_info_cache.h"
+
+#include <multipass/constants.h>
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/standard_paths.h>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+namespace cmd = multipass::cmd;
+
+namespace
+{
+constexpr auto category = "ssh-info-cache";
+constexpr auto owner_only = QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner;
+
+QString cache_dir_path()
+{
+    const auto cache_dir = QDir{MP_STDPATHS.writableLocation(mp::StandardPaths::GenericCacheLocation)};
+    return cache_dir.filePath(QStringLiteral("%1/ssh-info").arg(mp::client_name));
+}
+
+// Server addresses hold characters that cannot go in file names, so each daemon's entries go under a hash of the
+// address
+QString cache_file_path_for(const std::string& server_address, const std::string& instance_name)
+{
+    const auto server_hash =
+        QCryptographicHash::hash(QByteArray::fromStdString(server_address), QCryptographicHash::Sha256).toHex();
+
+    return QDir{cache_dir_path()}.filePath(
+        QStringLiteral("%1/%2").arg(QString::fromLatin1(server_hash), QString::fromStdString(instance_name)));
+}
+
+bool make_private_dir(const QString& path)
+{
+    return QDir{}.mkpath(path) && QFile::setPermissions(path, owner_only);
+}
+} // namespace
+
+std::optional<mp::SSHInfo> cmd::cached_ssh_info(const std::string& server_address, const std::string& instance_name)
+{
+    const auto path = cache_file_path_for(server_address, instance_name);
+    const QFileInfo cache_file_info{path};
+
+    if (!cache_file_info.exists())
+        return std::nullopt;
+
+    const auto age = std::chrono::seconds(cache_file_info.lastModified().secsTo(QDateTime::currentDateTime()));
+    if (age < std::chrono::seconds::zero() || age >= ssh_info_cache_ttl)
+    {
+        QFile::remove(path);
+        return std::nullopt;
+    }
+
+    QFile cache_file{path};
+    if (!cache_file.open(QIODevice::ReadOnly))
+        return std::nullopt;
+
+    mp::SSHInfo ssh_info;
+    const auto contents = cache_file.readAll();
+    if (!ssh_info.ParseFromArray(contents.constData(), contents.size()))
+    {
+        mpl::log(mpl::Level::debug, category, fmt::format("Dropping malformed cache entry for \"{}\"", instance_name));
+        cache_file.remove();
+        return std::nullopt;
+    }
+
+    return ssh_info;
+}
+
+void cmd::cache_ssh_info(const std::string& server_address, const std::string& instance_name,
+                         const SSHInfo& ssh_info)
+{
+    // The daemon says not to while the instance is about to shut down, so that its warning is not skipped
+    if (!ssh_info.cacheable())
+        return;
+
+    // The entry carries the instance's private key, so it must only ever be readable by the current user
+    const auto path = cache_file_path_for(server_address, instance_name);
+    if (!make_private_dir(cache_dir_path()) || !make_private_dir(QFileInfo{path}.absolutePath()))
+        return;
+
+    QSaveFile cache_file{path};
+    if (!cache_file.open(QIODevice::WriteOnly) ||
+        !cache_file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner))
+        return;
+
+    const auto contents = ssh_info.SerializeAsString();
+    if (cache_file.write(contents.data(), contents.size()) != static_cast<qint64>(contents.size()) ||
+        !cache_file.commit())
+        mpl::log(mpl::Level::debug, category, fmt::format("Could not cache SSH info for \"{}\"", instance_name));
+}
+
+void cmd::drop_cached_ssh_info(const std::string& server_address, const std::string& instance_name)
+{
+    QFile::remove(cache_file_path_for(server_address, instance_name));
+}
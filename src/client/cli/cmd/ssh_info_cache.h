@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SSH_INFO_CACHE_H
+#define MULTIPASS_SSH_INFO_CACHE_H
+
+#include <multipass/rpc/multipass.grpc.pb.h>
+
+#include <chrono>
+#include <optional>
+#include <string>
+
+namespace multipass
+{
+namespace cmd
+{
+// How long the SSH credentials and mount map of an instance are reused before asking the daemon again
+constexpr auto ssh_info_cache_ttl = std::chrono::seconds(10);
+
+// Entries are per daemon, and expired ones are deleted as they are found, since they carry the instance's private key
+std::optional<SSHInfo> cached_ssh_info(const std::string& server_address, const std::string& instance_name);
+void cache_ssh_info(const std::string& server_address, const std::string& instance_name, const SSHInfo& ssh_info);
+void drop_cached_ssh_info(const std::string& server_address, const std::string& instance_name);
+} // namespace cmd
+} // namespace multipass
+
+#endif // MULTIPASS_SSH_INFO_CACHE_H
@@ -20,6 +20,8 @@
 #include <multipass/cli/client_common.h>
 #include <multipass/console.h>
 #include <multipass/constants.h>
+#include <multipass/settings/settings.h>
+#include <multipass/ssh/ssh_session.h>
 #include <multipass/top_catch_all.h>
 
 #include <QCoreApplication>
@@ -37,6 +39,7 @@ int main_impl(int argc, char* argv[])
     auto term = mp::Terminal::make_terminal();
 
     mp::client::register_global_settings_handlers();
+    mp::SSHSession::set_cipher_preference(MP_SETTINGS.get(mp::client_ssh_ciphers_key).toStdString());
 
     mp::ClientConfig config{mp::client::get_server_address(), mp::client::get_cert_provider(), term.get()};
     mp::Client client{config};
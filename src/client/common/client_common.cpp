@@ -28,6 +28,7 @@
 #include <multipass/settings/custom_setting_spec.h>
 #include <multipass/settings/persistent_settings_handler.h>
 #include <multipass/settings/settings.h>
+#include <multipass/ssh/ssh_session.h>
 #include <multipass/standard_paths.h>
 #include <multipass/utils.h>
 
@@ -56,6 +57,25 @@ QString petenv_interpreter(QString val)
     return val;
 }
 
+QString ssh_mux_interpreter(QString val)
+{
+    bool ok;
+    if (val.toInt(&ok); !ok || val.toInt() < 0)
+        throw mp::InvalidSettingException{mp::ssh_mux_key, val, "Need a non-negative number of seconds"};
+
+    return val;
+}
+
+QString ssh_ciphers_interpreter(QString val)
+{
+    if (const auto unknown = mp::SSHSession::unknown_ciphers(val.toStdString()); !unknown.empty())
+        throw mp::InvalidSettingException{mp::client_ssh_ciphers_key, val,
+                                          QString::fromStdString(fmt::format("Unknown cipher(s): '{}'",
+                                                                             fmt::join(unknown, "', '")))};
+
+    return val;
+}
+
 mp::ReturnCode return_code_for(const grpc::StatusCode& code)
 {
     return code == grpc::StatusCode::UNAVAILABLE ? mp::ReturnCode::DaemonFail : mp::ReturnCode::CommandFail;
@@ -182,6 +202,8 @@ void mp::client::register_global_settings_handlers()
     auto settings = MP_PLATFORM.extra_client_settings(); // platform settings override inserts with the same key below
     settings.insert(std::make_unique<BoolSettingSpec>(autostart_key, autostart_default));
     settings.insert(std::make_unique<CustomSettingSpec>(mp::petenv_key, petenv_default, petenv_interpreter));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::ssh_mux_key, ssh_mux_default, ssh_mux_interpreter));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::client_ssh_ciphers_key, "", ssh_ciphers_interpreter));
     settings.insert(std::make_unique<CustomSettingSpec>(mp::hotkey_key, default_hotkey(), [](QString val) {
         return mp::platform::interpret_setting(mp::hotkey_key, val);
     }));
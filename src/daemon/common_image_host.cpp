@@ -25,6 +25,8 @@
 #include <multipass/exceptions/unsupported_alias_exception.h>
 #include <multipass/exceptions/unsupported_remote_exception.h>
 
+#include <QtConcurrent/QtConcurrent>
+
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 
@@ -33,8 +35,9 @@ namespace
 constexpr auto category = "VMImageHost";
 }
 
-mp::CommonVMImageHost::CommonVMImageHost(std::chrono::seconds manifest_time_to_live)
-  : manifest_time_to_live{manifest_time_to_live}, last_update{}
+mp::CommonVMImageHost::CommonVMImageHost(std::chrono::seconds manifest_time_to_live,
+                                         std::chrono::seconds max_manifest_staleness)
+  : manifest_time_to_live{manifest_time_to_live}, max_manifest_staleness{max_manifest_staleness}, last_update{}
 {
     // careful: the functor below relies on polymorphic behavior, which is not available in constructors
     // fine here as the call is deferred to after the constructor is done (independently of connection type)
@@ -56,6 +59,7 @@ mp::CommonVMImageHost::CommonVMImageHost(std::chrono::seconds manifest_time_to_l
 void mp::CommonVMImageHost::for_each_entry_do(const Action& action)
 {
     update_manifests();
+    std::shared_lock<std::shared_mutex> lock{manifest_mutex};
 
     for_each_entry_do_impl(action);
 }
@@ -63,22 +67,77 @@ void mp::CommonVMImageHost::for_each_entry_do(const Action& action)
 auto mp::CommonVMImageHost::info_for_full_hash(const std::string& full_hash) -> VMImageInfo
 {
     update_manifests();
+    std::shared_lock<std::shared_mutex> lock{manifest_mutex};
 
     return info_for_full_hash_impl(full_hash);
 }
 
+/*
+ * Expired manifests keep being served while they update in the background, so that lookups do not wait on the network
+ * and survive it being down. That lasts until they are max_manifest_staleness old, counting from the last update that
+ * got all of them; lookups then wait for an update, which drops whatever it cannot get.
+ */
 void mp::CommonVMImageHost::update_manifests()
 {
+    std::lock_guard<std::mutex> lock{update_mutex};
+
+    if (background_update_start && background_update.isFinished())
+    {
+        record_update(*background_update_start);
+        background_update_start.reset();
+    }
+
     const auto now = std::chrono::steady_clock::now();
-    if ((now - last_update) > manifest_time_to_live || need_extra_update)
+    if ((now - last_update) <= manifest_time_to_live && !need_extra_update)
+        return;
+
+    if (last_good_update && (now - *last_good_update) <= max_manifest_staleness)
     {
-        need_extra_update = false;
+        if (!background_update_start)
+        {
+            need_extra_update = false;
+            background_update_start = now;
+            background_update = QtConcurrent::run([this] {
+                try
+                {
+                    fetch_manifests(true);
+                }
+                catch (const std::exception& e)
+                {
+                    on_manifest_update_failure(e.what());
+                }
+            });
+        }
 
-        clear();
-        fetch_manifests();
+        return;
+    }
+
+    if (background_update_start)
+    {
+        background_update.waitForFinished();
+        record_update(*background_update_start);
+        background_update_start.reset();
 
-        last_update = now;
+        if (!need_extra_update)
+            return;
     }
+
+    need_extra_update = false;
+    fetch_manifests(false);
+    record_update(now);
+}
+
+void mp::CommonVMImageHost::wait_for_background_update()
+{
+    std::lock_guard<std::mutex> lock{update_mutex};
+    background_update.waitForFinished();
+}
+
+void mp::CommonVMImageHost::record_update(std::chrono::steady_clock::time_point started)
+{
+    last_update = started;
+    if (!need_extra_update)
+        last_good_update = started;
 }
 
 void mp::CommonVMImageHost::on_manifest_empty(const std::string& details)
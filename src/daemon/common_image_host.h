@@ -20,10 +20,15 @@
 
 #include "multipass/vm_image_host.h"
 
+#include <QFuture>
 #include <QStringList>
 #include <QTimer>
 
+#include <atomic>
 #include <chrono>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 
 namespace multipass
 {
@@ -31,12 +36,13 @@ namespace multipass
 class CommonVMImageHost : public VMImageHost
 {
 public:
-    CommonVMImageHost(std::chrono::seconds manifest_time_to_live);
+    CommonVMImageHost(std::chrono::seconds manifest_time_to_live, std::chrono::seconds max_manifest_staleness);
     void for_each_entry_do(const Action& action) final;
     VMImageInfo info_for_full_hash(const std::string& full_hash) final;
 
 protected:
-    void update_manifests();
+    void update_manifests();           // call before taking manifest_mutex
+    void wait_for_background_update(); // call from the destructor of the final class
     void on_manifest_update_failure(const std::string& details);
     void on_manifest_empty(const std::string& details);
     void check_remote_is_supported(const std::string& remote_name) const;
@@ -45,13 +51,23 @@ protected:
 
     virtual void for_each_entry_do_impl(const Action& action) = 0;
     virtual VMImageInfo info_for_full_hash_impl(const std::string& full_hash) = 0;
-    virtual void clear() = 0;
-    virtual void fetch_manifests() = 0;
+    // Replaces the manifests with whatever can be fetched of them, under an exclusive lock on manifest_mutex; with
+    // keep_stale, remotes that fail to update keep their current manifests
+    virtual void fetch_manifests(bool keep_stale) = 0;
+
+    std::shared_mutex manifest_mutex; // shared by lookups for as long as they use the manifests
 
 private:
+    void record_update(std::chrono::steady_clock::time_point started);
+
     std::chrono::seconds manifest_time_to_live;
+    std::chrono::seconds max_manifest_staleness;
+    std::mutex update_mutex;
     std::chrono::steady_clock::time_point last_update;
-    bool need_extra_update = true;
+    std::optional<std::chrono::steady_clock::time_point> last_good_update; // when all manifests were last updated
+    std::atomic<bool> need_extra_update{true};
+    std::optional<std::chrono::steady_clock::time_point> background_update_start;
+    QFuture<void> background_update;
     QTimer manifest_single_shot;
 };
 
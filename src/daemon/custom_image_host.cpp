@@ -159,8 +159,9 @@ auto full_image_info_for(const QMap<QString, CustomImageInfo>& custom_image_info
 } // namespace
 
 mp::CustomVMImageHost::CustomVMImageHost(const QString& arch, URLDownloader* downloader,
-                                         std::chrono::seconds manifest_time_to_live)
-    : CommonVMImageHost{manifest_time_to_live},
+                                         std::chrono::seconds manifest_time_to_live,
+                                         std::chrono::seconds max_manifest_staleness)
+    : CommonVMImageHost{manifest_time_to_live, max_manifest_staleness},
       arch{arch},
       url_downloader{downloader},
       custom_image_info{},
@@ -168,9 +169,18 @@ mp::CustomVMImageHost::CustomVMImageHost(const QString& arch, URLDownloader* dow
 {
 }
 
+mp::CustomVMImageHost::~CustomVMImageHost()
+{
+    wait_for_background_update();
+}
+
 std::optional<mp::VMImageInfo> mp::CustomVMImageHost::info_for(const Query& query)
 {
     check_alias_is_supported(query.release, query.remote_name);
+    check_remote_is_supported(query.remote_name);
+
+    update_manifests();
+    std::shared_lock<std::shared_mutex> lock{manifest_mutex};
 
     auto custom_manifest = manifest_from(query.remote_name);
 
@@ -201,6 +211,11 @@ mp::VMImageInfo mp::CustomVMImageHost::info_for_full_hash_impl(const std::string
 std::vector<mp::VMImageInfo> mp::CustomVMImageHost::all_images_for(const std::string& remote_name,
                                                                    const bool allow_unsupported)
 {
+    check_remote_is_supported(remote_name);
+
+    update_manifests();
+    std::shared_lock<std::shared_mutex> lock{manifest_mutex};
+
     std::vector<mp::VMImageInfo> images;
     auto custom_manifest = manifest_from(remote_name);
 
@@ -230,38 +245,43 @@ std::vector<std::string> mp::CustomVMImageHost::supported_remotes()
     return remotes;
 }
 
-void mp::CustomVMImageHost::fetch_manifests()
+void mp::CustomVMImageHost::fetch_manifests(bool keep_stale)
 {
+    decltype(custom_image_info) fetched;
+    std::vector<std::string> failed;
+
     for (const auto& spec : {std::make_pair(no_remote, multipass_image_info[arch])})
     {
         try
         {
             check_remote_is_supported(spec.first);
 
-            custom_image_info.emplace(spec.first, full_image_info_for(spec.second, url_downloader));
+            fetched.emplace(spec.first, full_image_info_for(spec.second, url_downloader));
         }
         catch (mp::DownloadException& e)
         {
             on_manifest_update_failure(e.what());
+            failed.push_back(spec.first);
         }
         catch (const mp::UnsupportedRemoteException&)
         {
             continue;
         }
     }
-}
 
-void mp::CustomVMImageHost::clear()
-{
-    custom_image_info.clear();
+    std::unique_lock<std::shared_mutex> lock{manifest_mutex};
+
+    for (const auto& remote_name : failed)
+    {
+        if (auto current = custom_image_info.find(remote_name); keep_stale && current != custom_image_info.end())
+            fetched.emplace(remote_name, std::move(current->second));
+    }
+
+    custom_image_info = std::move(fetched);
 }
 
 mp::CustomManifest* mp::CustomVMImageHost::manifest_from(const std::string& remote_name)
 {
-    check_remote_is_supported(remote_name);
-
-    update_manifests();
-
     auto it = custom_image_info.find(remote_name);
     if (it == custom_image_info.end())
         throw std::runtime_error(fmt::format("Remote \"{}\" is unknown or unreachable.", remote_name));
@@ -41,7 +41,9 @@ struct CustomManifest
 class CustomVMImageHost final : public CommonVMImageHost
 {
 public:
-    CustomVMImageHost(const QString& arch, URLDownloader* downloader, std::chrono::seconds manifest_time_to_live);
+    CustomVMImageHost(const QString& arch, URLDownloader* downloader, std::chrono::seconds manifest_time_to_live,
+                      std::chrono::seconds max_manifest_staleness = std::chrono::seconds{0});
+    ~CustomVMImageHost() override;
 
     std::optional<VMImageInfo> info_for(const Query& query) override;
     std::vector<std::pair<std::string, VMImageInfo>> all_info_for(const Query& query) override;
@@ -51,8 +53,7 @@ public:
 protected:
     void for_each_entry_do_impl(const Action& action) override;
     VMImageInfo info_for_full_hash_impl(const std::string& full_hash) override;
-    void fetch_manifests() override;
-    void clear() override;
+    void fetch_manifests(bool keep_stale) override;
 
 private:
     CustomManifest* manifest_from(const std::string& remote_name);
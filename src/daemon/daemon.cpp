@@ -76,6 +76,7 @@
 #include <cassert>
 #include <cerrno>  // TODO hk migration, remove
 #include <cstring> // TODO hk migration, remove
+#include <filesystem>
 #include <functional>
 #include <iterator> // TODO hk migration, remove
 #include <optional>
@@ -98,6 +99,8 @@ using error_string = std::string;
 
 constexpr auto category = "daemon";
 constexpr auto instance_db_name = "multipassd-vm-instances.json";
+constexpr auto warm_pool_db_name = "multipassd-warm-pool.json";
+constexpr auto mirror_refresh_interval = std::chrono::minutes(10);
 constexpr auto reboot_cmd = "sudo reboot";
 constexpr auto stop_ssh_cmd = "sudo systemctl stop ssh";
 const std::string sshfs_error_template = "Error enabling mount support in '{}'"
@@ -667,6 +670,8 @@ auto connect_rpc(mp::DaemonRpc& rpc, mp::Daemon& daemon)
     QObject::connect(&rpc, &mp::DaemonRpc::on_set, &daemon, &mp::Daemon::set);
     QObject::connect(&rpc, &mp::DaemonRpc::on_keys, &daemon, &mp::Daemon::keys);
     QObject::connect(&rpc, &mp::DaemonRpc::on_authenticate, &daemon, &mp::Daemon::authenticate);
+    QObject::connect(&rpc, &mp::DaemonRpc::on_image_cache, &daemon, &mp::Daemon::image_cache);
+    QObject::connect(&rpc, &mp::DaemonRpc::on_flatten, &daemon, &mp::Daemon::flatten);
 }
 
 enum class InstanceGroup
@@ -703,13 +708,17 @@ struct InstanceSelectionReport
     MissingInstanceList missing_instances;
 };
 
-LinearInstanceSelection select_all(InstanceTable& instances)
+// Warm instances are the daemon's own, so they are only ever acted upon when named
+LinearInstanceSelection select_all(InstanceTable& instances, const mp::WarmPool& warm_pool)
 {
     LinearInstanceSelection selection;
     selection.reserve(instances.size());
 
     for (auto it = instances.begin(); it != instances.end(); ++it)
-        selection.push_back(it);
+    {
+        if (!warm_pool.contains(it->first))
+            selection.push_back(it);
+    }
 
     return selection;
 }
@@ -734,15 +743,16 @@ void rank_instance(const std::string& name, const InstanceTrail& trail, Instance
 // careful to keep the original `names` around while the returned selection is in use!
 template <typename InstanceNames>
 InstanceSelectionReport select_instances(InstanceTable& operative_instances, InstanceTable& deleted_instances,
-                                         const InstanceNames& names, InstanceGroup no_name_means)
+                                         const InstanceNames& names, InstanceGroup no_name_means,
+                                         const mp::WarmPool& warm_pool)
 {
     InstanceSelectionReport ret{};
     if (names.empty() && no_name_means != InstanceGroup::None)
     {
         if (no_name_means == InstanceGroup::Operative || no_name_means == InstanceGroup::All)
-            ret.operative_selection = select_all(operative_instances);
+            ret.operative_selection = select_all(operative_instances, warm_pool);
         if (no_name_means == InstanceGroup::Deleted || no_name_means == InstanceGroup::All)
-            ret.deleted_selection = select_all(deleted_instances);
+            ret.deleted_selection = select_all(deleted_instances, warm_pool);
     }
     else
     {
@@ -926,9 +936,10 @@ std::pair<InstanceTrail, grpc::Status> find_instance_and_react(InstanceTable& op
 template <typename InstanceNames>
 std::pair<InstanceSelectionReport, grpc::Status>
 select_instances_and_react(InstanceTable& operative_instances, InstanceTable& deleted_instances,
-                           const InstanceNames& names, InstanceGroup no_name_means, const SelectionReaction& reaction)
+                           const InstanceNames& names, InstanceGroup no_name_means, const SelectionReaction& reaction,
+                           const mp::WarmPool& warm_pool)
 {
-    auto instance_selection = select_instances(operative_instances, deleted_instances, names, no_name_means);
+    auto instance_selection = select_instances(operative_instances, deleted_instances, names, no_name_means, warm_pool);
     return {instance_selection, grpc_status_for_selection(instance_selection, reaction)};
 }
 
@@ -1046,6 +1057,52 @@ mp::InstanceStatus::Status grpc_instance_status_for(const mp::VirtualMachine::St
     }
 }
 
+// Lets shell completion list instances without a round trip through the daemon. The file is replaced atomically and
+// is readable by whoever may connect to the socket. It reports the state the daemon last saw, rather than asking each
+// backend again, so that publishing never waits on the hypervisor.
+void publish_instance_names(const std::string& server_address,
+                            const std::unordered_map<std::string, mp::VirtualMachine::ShPtr>& operative_instances,
+                            const std::unordered_map<std::string, mp::VirtualMachine::ShPtr>& deleted_instances,
+                            const mp::WarmPool& warm_pool)
+{
+    const QFileInfo socket_info{mp::utils::unix_socket_path(server_address)};
+    if (!socket_info.exists())
+        return;
+
+    std::string contents;
+    for (const auto& [name, vm] : operative_instances)
+    {
+        if (!warm_pool.contains(name))
+            contents += fmt::format("{},{}\n", name,
+                                    mp::InstanceStatus::Status_Name(grpc_instance_status_for(vm->state)));
+    }
+    for (const auto& [name, vm] : deleted_instances)
+        contents += fmt::format("{},{}\n", name, mp::InstanceStatus::Status_Name(mp::InstanceStatus::DELETED));
+
+    const auto path = mp::utils::instance_names_file_for(server_address);
+    const auto temp_path = path + ".tmp";
+    const auto read_permissions = QFileDevice::ReadOwner | QFileDevice::ReadUser | QFileDevice::ReadGroup |
+                                  QFileDevice::ReadOther;
+
+    QFile temp_file{temp_path};
+    if (!temp_file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        temp_file.write(contents.data(), contents.size()) != static_cast<qint64>(contents.size()))
+    {
+        mpl::log(mpl::Level::debug, category,
+                 fmt::format("Could not write {}: {}", temp_path, temp_file.errorString()));
+        return;
+    }
+    temp_file.close();
+
+    MP_PLATFORM.chown(temp_path.toStdString().c_str(), socket_info.ownerId(), socket_info.groupId());
+    MP_PLATFORM.set_permissions(temp_path, socket_info.permissions() & read_permissions);
+
+    std::error_code err;
+    std::filesystem::rename(temp_path.toStdString(), path.toStdString(), err); // replaces the old file atomically
+    if (err)
+        mpl::log(mpl::Level::debug, category, fmt::format("Could not publish {}: {}", path, err.message()));
+}
+
 // Computes the final size of an image, but also checks if the value given by the user is bigger than or equal than
 // the size of the image.
 mp::MemorySize compute_final_image_size(const mp::MemorySize image_size,
@@ -1166,6 +1223,36 @@ void add_aliases(google::protobuf::RepeatedPtrField<mp::FindReply_ImageInfo>* co
     }
 }
 
+void populate_mount_info(const std::unordered_map<std::string, mp::VMMount>& mounts, mp::MountInfo* mount_info)
+{
+    mount_info->set_longest_path_len(0);
+
+    for (const auto& mount : mounts)
+    {
+        if (mount.second.source_path.size() > mount_info->longest_path_len())
+        {
+            mount_info->set_longest_path_len(mount.second.source_path.size());
+        }
+
+        auto entry = mount_info->add_mount_paths();
+        entry->set_source_path(mount.second.source_path);
+        entry->set_target_path(mount.first);
+
+        for (const auto& uid_mapping : mount.second.uid_mappings)
+        {
+            auto uid_pair = entry->mutable_mount_maps()->add_uid_mappings();
+            uid_pair->set_host_id(uid_mapping.first);
+            uid_pair->set_instance_id(uid_mapping.second);
+        }
+        for (const auto& gid_mapping : mount.second.gid_mappings)
+        {
+            auto gid_pair = entry->mutable_mount_maps()->add_gid_mappings();
+            gid_pair->set_host_id(gid_mapping.first);
+            gid_pair->set_instance_id(gid_mapping.second);
+        }
+    }
+}
+
 auto timeout_for(const int requested_timeout, const int blueprint_timeout)
 {
     if (requested_timeout > 0)
@@ -1188,6 +1275,138 @@ register_instance_mod(std::unordered_map<std::string, mp::VMSpecs>& vm_instance_
         vm_instance_specs, vm_instances, deleted_instances, preparing_instances, std::move(instance_persister)));
 }
 
+mp::WarmPool make_warm_pool(const QString& data_dir)
+{
+    std::vector<mp::WarmPool::Profile> profiles;
+    mp::MemorySize memory_budget;
+
+    try
+    {
+        profiles = mp::WarmPool::parse_profiles(MP_SETTINGS.get(mp::warm_pool_key));
+        if (!profiles.empty())
+            memory_budget = mp::MemorySize{MP_SETTINGS.get(mp::warm_pool_memory_key).toStdString()};
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Not keeping any instances warm: {}", e.what()));
+        profiles.clear();
+    }
+
+    return {std::move(profiles), memory_budget, QDir{data_dir}.filePath(warm_pool_db_name)};
+}
+
+qint64 download_rate_limit()
+{
+    try
+    {
+        const auto rate = MP_SETTINGS.get(mp::download_rate_key);
+        return rate.isEmpty() ? 0 : mp::MemorySize{rate.toStdString()}.in_bytes();
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Not limiting the download rate: {}", e.what()));
+        return 0;
+    }
+}
+
+mp::MemorySize image_cache_size_budget()
+{
+    try
+    {
+        const auto budget = MP_SETTINGS.get(mp::image_cache_size_key);
+        return budget.isEmpty() ? mp::MemorySize{} : mp::MemorySize{budget.toStdString()};
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Not limiting the image cache size: {}", e.what()));
+        return mp::MemorySize{};
+    }
+}
+
+int max_downloads()
+{
+    const auto default_max_downloads = std::stoi(mp::max_downloads_default);
+    try
+    {
+        bool ok{false};
+        const auto setting = MP_SETTINGS.get(mp::max_downloads_key);
+        if (const auto max_downloads = setting.toInt(&ok); ok && max_downloads > 0)
+            return max_downloads;
+
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Invalid number of downloads at once \"{}\", downloading up to {}", setting,
+                             default_max_downloads));
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Downloading up to {} images at once: {}", default_max_downloads, e.what()));
+    }
+
+    return default_max_downloads;
+}
+
+// The remotes that daemon_config.cpp points at the image mirror setting, which a mirror therefore stands in for
+std::vector<mp::ImageMirror::Remote> mirrored_remotes()
+{
+    const QString official_host{"https://cloud-images.ubuntu.com/"};
+
+    std::vector<mp::ImageMirror::Remote> remotes;
+    for (const auto path : {"releases/", "daily/", "buildd/daily/"})
+        remotes.push_back({path, official_host + path});
+
+    return remotes;
+}
+
+std::unique_ptr<mp::ImageMirror> make_image_mirror(const mp::DaemonConfig& config)
+{
+    const auto listen_address = MP_SETTINGS.get(mp::mirror_server_key);
+    if (listen_address.isEmpty())
+        return nullptr;
+
+    try
+    {
+        const auto [address, port] = mp::ImageMirror::parse_listen_address(listen_address);
+        auto mirror = std::make_unique<mp::ImageMirror>(
+            mirrored_remotes(), config.url_downloader.get(), [&vault = *config.vault] { return vault.cached_images(); },
+            mirror_refresh_interval);
+
+        mirror->listen(address, port);
+        return mirror;
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Not serving cached images: {}", e.what()));
+        return nullptr;
+    }
+}
+
+// Stands in for a client when the daemon launches instances of its own accord
+template <typename W, typename R>
+class DiscardingServerReaderWriter : public grpc::ServerReaderWriterInterface<W, R>
+{
+public:
+    void SendInitialMetadata() override
+    {
+    }
+
+    bool Write(const W&, grpc::WriteOptions) override
+    {
+        return true;
+    }
+
+    bool NextMessageSize(uint32_t* size) override
+    {
+        *size = 0;
+        return false;
+    }
+
+    bool Read(R*) override
+    {
+        return false;
+    }
+};
+
 class CustomQemuImgProcessSpec : public mp::QemuImgProcessSpec // TODO hk migration, remove
 {
 public:
@@ -1230,8 +1449,18 @@ public:
 
 } // namespace
 
+struct mp::Daemon::WarmLaunch
+{
+    LaunchRequest request;
+    DiscardingServerReaderWriter<LaunchReply, LaunchRequest> server;
+    std::promise<grpc::Status> status_promise;
+    std::future<grpc::Status> status{status_promise.get_future()};
+};
+
 mp::Daemon::Daemon(std::unique_ptr<const DaemonConfig> the_config)
     : config{std::move(the_config)},
+      warm_pool{make_warm_pool(
+          mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name()))},
       vm_instance_specs{load_db(
           mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name()),
           mp::utils::backend_directory_path(config->cache_directory, config->factory->get_backend_directory_name()))},
@@ -1240,6 +1469,9 @@ mp::Daemon::Daemon(std::unique_ptr<const DaemonConfig> the_config)
                                                  preparing_instances, [this] { persist_instances(); })}
 {
     connect_rpc(daemon_rpc, *this);
+    config->url_downloader->set_bandwidth_limit(download_rate_limit());
+    config->vault->set_size_budget(image_cache_size_budget());
+    config->vault->set_max_downloads(max_downloads());
     std::vector<std::string> invalid_specs;
 
     try
@@ -1340,8 +1572,11 @@ mp::Daemon::Daemon(std::unique_ptr<const DaemonConfig> the_config)
 
     if (!invalid_specs.empty())
         persist_instances();
+    else
+        publish_instance_names(config->server_address, operative_instances, deleted_instances, warm_pool);
 
     config->vault->prune_expired_images();
+    image_mirror = make_image_mirror(*config);
 
     // Fire timer every six hours to perform maintenance on source images such as
     // pruning expired images and updating to newly released images.
@@ -1382,10 +1617,32 @@ mp::Daemon::Daemon(std::unique_ptr<const DaemonConfig> the_config)
                 {
                     mpl::log(mpl::Level::error, category, fmt::format("Error updating images: {}", e.what()));
                 }
+
+                try
+                {
+                    config->vault->scrub_images(config->factory->fetch_type(), prepare_action, download_monitor);
+                }
+                catch (const std::exception& e)
+                {
+                    mpl::log(mpl::Level::error, category, fmt::format("Error scrubbing images: {}", e.what()));
+                }
             });
         }
     });
     source_images_maintenance_task.start(config->image_refresh_timer);
+
+    // Warm instances are restored like any other; forget those that are gone and discard those no longer wanted
+    connect(&warm_launch_timer, &QTimer::timeout, this, &Daemon::check_warm_launches);
+    for (const auto& name : warm_pool.instances())
+    {
+        if (operative_instances.find(name) == operative_instances.end())
+            warm_pool.remove(name);
+    }
+
+    for (const auto& name : warm_pool.stray_instances())
+        discard_warm_instance(name);
+
+    refill_warm_pool();
 }
 
 mp::Daemon::~Daemon()
@@ -1439,13 +1696,19 @@ try // clang-format on
 {
     PurgeReply response;
 
-    for (const auto& del : deleted_instances)
+    for (auto it = deleted_instances.begin(); it != deleted_instances.end();)
     {
-        release_resources(del.first);
-        response.add_purged_instances(del.first);
+        if (warm_pool.contains(it->first))
+        {
+            ++it;
+            continue;
+        }
+
+        release_resources(it->first);
+        response.add_purged_instances(it->first);
+        it = deleted_instances.erase(it);
     }
 
-    deleted_instances.clear();
     persist_instances();
 
     server->Write(response);
@@ -1641,32 +1904,7 @@ try // clang-format on
             have_mounts = true;
 
         if (MP_SETTINGS.get_as<bool>(mp::mounts_key))
-        {
-            for (const auto& mount : vm_specs.mounts)
-            {
-                if (mount.second.source_path.size() > mount_info->longest_path_len())
-                {
-                    mount_info->set_longest_path_len(mount.second.source_path.size());
-                }
-
-                auto entry = mount_info->add_mount_paths();
-                entry->set_source_path(mount.second.source_path);
-                entry->set_target_path(mount.first);
-
-                for (const auto& uid_mapping : mount.second.uid_mappings)
-                {
-                    auto uid_pair = entry->mutable_mount_maps()->add_uid_mappings();
-                    uid_pair->set_host_id(uid_mapping.first);
-                    uid_pair->set_instance_id(uid_mapping.second);
-                }
-                for (const auto& gid_mapping : mount.second.gid_mappings)
-                {
-                    auto gid_pair = entry->mutable_mount_maps()->add_gid_mappings();
-                    gid_pair->set_host_id(gid_mapping.first);
-                    gid_pair->set_instance_id(gid_mapping.second);
-                }
-            }
-        }
+            populate_mount_info(vm_specs.mounts, mount_info);
 
         if (!request->no_runtime_information() && mp::utils::is_running(present_state))
         {
@@ -1702,7 +1940,7 @@ try // clang-format on
 
     auto [instance_selection, status] =
         select_instances_and_react(operative_instances, deleted_instances, request->instance_names().instance_name(),
-                                   InstanceGroup::All, require_existing_instances_reaction);
+                                   InstanceGroup::All, require_existing_instances_reaction, warm_pool);
 
     if (status.ok())
     {
@@ -1736,6 +1974,9 @@ try // clang-format on
     for (const auto& instance : operative_instances)
     {
         const auto& name = instance.first;
+        if (warm_pool.contains(name))
+            continue;
+
         const auto& vm = instance.second;
         auto present_state = vm->current_state();
         auto entry = response.add_instances();
@@ -1921,7 +2162,7 @@ try // clang-format on
 
     auto [instance_selection, status] =
         select_instances_and_react(operative_instances, deleted_instances, request->instance_names().instance_name(),
-                                   InstanceGroup::Deleted, recover_reaction);
+                                   InstanceGroup::Deleted, recover_reaction, warm_pool);
 
     if (status.ok())
     {
@@ -1955,7 +2196,7 @@ try // clang-format on
 
     auto [instance_selection, status] =
         select_instances_and_react(operative_instances, deleted_instances, request->instance_name(),
-                                   InstanceGroup::None, require_operative_instances_reaction);
+                                   InstanceGroup::None, require_operative_instances_reaction, warm_pool);
 
     if (status.ok())
     {
@@ -1989,7 +2230,7 @@ try // clang-format on
         {grpc::StatusCode::OK}, {grpc::StatusCode::ABORTED}, {grpc::StatusCode::ABORTED}};
     auto [instance_selection, status] =
         select_instances_and_react(operative_instances, deleted_instances, request->instance_names().instance_name(),
-                                   InstanceGroup::Operative, custom_reaction);
+                                   InstanceGroup::Operative, custom_reaction, warm_pool);
 
     if (!status.ok())
         return status_promise->set_value(
@@ -2058,7 +2299,7 @@ try // clang-format on
 
     auto [instance_selection, status] =
         select_instances_and_react(operative_instances, deleted_instances, request->instance_names().instance_name(),
-                                   InstanceGroup::Operative, require_operative_instances_reaction);
+                                   InstanceGroup::Operative, require_operative_instances_reaction, warm_pool);
 
     if (status.ok())
     {
@@ -2093,7 +2334,7 @@ try // clang-format on
 
     auto [instance_selection, status] =
         select_instances_and_react(operative_instances, deleted_instances, request->instance_names().instance_name(),
-                                   InstanceGroup::Operative, require_operative_instances_reaction);
+                                   InstanceGroup::Operative, require_operative_instances_reaction, warm_pool);
 
     if (status.ok())
     {
@@ -2125,7 +2366,7 @@ try // clang-format on
 
     auto [instance_selection, status] =
         select_instances_and_react(operative_instances, deleted_instances, request->instance_names().instance_name(),
-                                   InstanceGroup::Operative, require_operative_instances_reaction);
+                                   InstanceGroup::Operative, require_operative_instances_reaction, warm_pool);
 
     if (!status.ok())
     {
@@ -2166,7 +2407,7 @@ try // clang-format on
 
     auto [instance_selection, status] =
         select_instances_and_react(operative_instances, deleted_instances, request->instance_names().instance_name(),
-                                   InstanceGroup::All, require_existing_instances_reaction);
+                                   InstanceGroup::All, require_existing_instances_reaction, warm_pool);
 
     if (status.ok())
     {
@@ -2191,6 +2432,7 @@ try // clang-format on
             }
             else
             {
+                warm_pool.remove(name); // a warm instance deleted by name is no longer the pool's
                 deleted_instances[name] = std::move(instance);
                 vm_instance_specs[name].deleted = true;
             }
@@ -2341,6 +2583,10 @@ try
     MP_SETTINGS.set(QString::fromStdString(key), QString::fromStdString(val));
     mpl::log(mpl::Level::debug, category, fmt::format("Succeeded setting {}={}", key, val));
 
+    // Sessions pick the preference up as they get created, so new ciphers apply from the next connection on
+    if (key == mp::daemon_ssh_ciphers_key)
+        mp::SSHSession::set_cipher_preference(MP_SETTINGS.get(mp::daemon_ssh_ciphers_key).toStdString());
+
     status_promise->set_value(need_migration ? migrate_from_hyperkit(server)
                                              : grpc::Status::OK); // TODO hk migration, revert
 }
@@ -2411,6 +2657,88 @@ catch (const std::exception& e)
     status_promise->set_value(grpc::Status(grpc::StatusCode::INTERNAL, e.what(), ""));
 }
 
+void mp::Daemon::image_cache(const ImageCacheRequest* request,
+                             grpc::ServerReaderWriterInterface<ImageCacheReply, ImageCacheRequest>* server,
+                             std::promise<grpc::Status>* status_promise)
+try
+{
+    mpl::ClientLogger<ImageCacheReply, ImageCacheRequest> logger{mpl::level_from(request->verbosity_level()),
+                                                                 *config->logger, server};
+
+    const auto usage = config->vault->cache_usage();
+
+    ImageCacheReply reply;
+    reply.set_size_budget(usage.size_budget);
+
+    long long total_size = 0;
+    for (const auto& image : usage.images)
+    {
+        auto entry = reply.add_images();
+        entry->set_id(image.id);
+        entry->set_release(image.release);
+        entry->set_remote(image.remote);
+        entry->set_size(image.size);
+        entry->set_last_used(
+            std::chrono::duration_cast<std::chrono::seconds>(image.last_used.time_since_epoch()).count());
+        entry->set_in_use(image.in_use);
+
+        total_size += image.size;
+    }
+    reply.set_total_size(total_size);
+
+    mpl::log(mpl::Level::debug, category,
+             fmt::format("Returning {} cached images taking {} bytes", reply.images_size(), total_size));
+    server->Write(reply);
+
+    status_promise->set_value(grpc::Status::OK);
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::INTERNAL, e.what(), ""));
+}
+
+void mp::Daemon::flatten(const FlattenRequest* request,
+                         grpc::ServerReaderWriterInterface<FlattenReply, FlattenRequest>* server,
+                         std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
+{
+    mpl::ClientLogger<FlattenReply, FlattenRequest> logger{mpl::level_from(request->verbosity_level()), *config->logger,
+                                                           server};
+
+    auto [instance_selection, status] =
+        select_instances_and_react(operative_instances, deleted_instances, request->instance_names().instance_name(),
+                                   InstanceGroup::None, require_operative_instances_reaction, warm_pool);
+
+    if (status.ok())
+    {
+        // Rebasing a disk under a running instance would corrupt it. Flattening runs here rather than off the daemon
+        // thread, like other disk changes, so that nothing can start the instance in the meantime
+        for (const auto& vm_it : instance_selection.operative_selection)
+        {
+            const auto state = vm_it->second->current_state();
+            if (state != VirtualMachine::State::stopped && state != VirtualMachine::State::off)
+            {
+                status = grpc::Status{grpc::StatusCode::FAILED_PRECONDITION,
+                                      fmt::format("instance \"{}\" must be stopped to flatten its disk", vm_it->first),
+                                      ""};
+                break;
+            }
+        }
+    }
+
+    if (status.ok())
+    {
+        for (const auto& vm_it : instance_selection.operative_selection)
+            config->vault->flatten(vm_it->first);
+    }
+
+    status_promise->set_value(status);
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
+}
+
 void mp::Daemon::on_shutdown()
 {
 }
@@ -2445,6 +2773,22 @@ void mp::Daemon::persist_state_for(const std::string& name, const VirtualMachine
 {
     vm_instance_specs[name].state = state;
     persist_instances();
+
+    // A warm instance that stops running is no good for a launch any more. Instances report their state from any
+    // thread, so the pool is seen to on the daemon's
+    if (state != VirtualMachine::State::starting && !mp::utils::is_running(state))
+    {
+        QMetaObject::invokeMethod(
+            this,
+            [this, name] {
+                if (warm_pool.contains(name) && warm_launches.find(name) == warm_launches.end())
+                {
+                    mpl::log(mpl::Level::info, category, fmt::format("Warm instance {} stopped running", name));
+                    discard_warm_instance(name);
+                }
+            },
+            Qt::QueuedConnection);
+    }
 }
 
 void mp::Daemon::update_metadata_for(const std::string& name, const QJsonObject& metadata)
@@ -2470,12 +2814,15 @@ void mp::Daemon::persist_instances()
     QDir data_dir{
         mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name())};
     mp::write_json(instance_records_json, data_dir.filePath(instance_db_name));
+
+    publish_instance_names(config->server_address, operative_instances, deleted_instances, warm_pool);
 }
 
 void mp::Daemon::release_resources(const std::string& instance)
 {
     config->factory->remove_resources_for(instance);
     config->vault->remove(instance);
+    warm_pool.remove(instance);
 
     auto spec_it = vm_instance_specs.find(instance);
     if (spec_it != cend(vm_instance_specs))
@@ -2538,6 +2885,32 @@ void mp::Daemon::create_vm(const CreateRequest* request,
     //       need a refactoring to do so.
     auto timeout = timeout_for(request->timeout(), config->blueprint_provider->blueprint_timeout(blueprint_name));
 
+    // Only launches that leave the name to us can take a warm instance, since instances cannot be renamed
+    if (start && checked_args.instance_name.empty() && blueprint_name.empty())
+    {
+        if (const auto warm_name = claim_warm_instance(request, checked_args.mem_size, checked_args.disk_space))
+        {
+            mpl::log(mpl::Level::info, category, fmt::format("Launching {} from the warm pool", *warm_name));
+
+            LaunchReply reply;
+            reply.set_create_message("Starting " + *warm_name);
+            server->Write(reply);
+
+            auto future_watcher = create_future_watcher([this, server, warm_name] {
+                LaunchReply reply;
+                reply.set_vm_instance_name(*warm_name);
+                config->update_prompt->populate_if_time_to_show(reply.mutable_update_info());
+                server->Write(reply);
+            });
+            future_watcher->setFuture(QtConcurrent::run(this,
+                                                        &Daemon::async_wait_for_ready_all<LaunchReply, LaunchRequest>,
+                                                        server, std::vector<std::string>{*warm_name}, timeout,
+                                                        status_promise, std::string()));
+
+            return refill_warm_pool();
+        }
+    }
+
     preparing_instances.insert(name);
 
     auto prepare_future_watcher = new QFutureWatcher<VMFullDescription>();
@@ -2790,6 +3163,149 @@ void mp::Daemon::create_vm(const CreateRequest* request,
     prepare_future_watcher->setFuture(QtConcurrent::run(make_vm_description));
 }
 
+void mp::Daemon::refill_warm_pool()
+{
+    while (const auto profile = warm_pool.next_to_refill())
+    {
+        const auto name = name_from("", "", *config->name_generator, operative_instances);
+
+        auto warm_launch = std::make_unique<WarmLaunch>();
+        auto& request = warm_launch->request;
+        request.set_instance_name(name);
+        request.set_num_cores(profile->num_cores);
+        request.set_mem_size(std::to_string(profile->mem_size.in_bytes()));
+        if (profile->disk_space)
+            request.set_disk_space(std::to_string(profile->disk_space->in_bytes()));
+
+        if (const auto separator = profile->image.find(':'); separator != std::string::npos)
+        {
+            request.set_remote_name(profile->image.substr(0, separator));
+            request.set_image(profile->image.substr(separator + 1));
+        }
+        else
+        {
+            request.set_image(profile->image);
+        }
+
+        mpl::log(mpl::Level::info, category, fmt::format("Warming up {} from {}", name, profile->image));
+        warm_pool.add(*profile, name);
+
+        auto& launched = *warm_launches.emplace(name, std::move(warm_launch)).first->second;
+        launch(&launched.request, &launched.server, &launched.status_promise);
+    }
+
+    if (!warm_launches.empty() && !warm_launch_timer.isActive())
+        warm_launch_timer.start(1000);
+}
+
+void mp::Daemon::check_warm_launches()
+{
+    for (auto it = warm_launches.begin(); it != warm_launches.end();)
+    {
+        const auto& [name, warm_launch] = *it;
+        if (warm_launch->status.wait_for(0s) != std::future_status::ready)
+        {
+            ++it;
+            continue;
+        }
+
+        // A launch that failed after its instance was claimed is the claiming client's to deal with
+        if (const auto status = warm_launch->status.get(); status.ok())
+        {
+            mpl::log(mpl::Level::info, category, fmt::format("{} is warm", name));
+        }
+        else if (warm_pool.contains(name))
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Could not warm up {}: {}", name, status.error_message()));
+            discard_warm_instance(name);
+        }
+
+        it = warm_launches.erase(it);
+    }
+
+    if (warm_launches.empty())
+        warm_launch_timer.stop();
+}
+
+std::optional<std::string> mp::Daemon::claim_warm_instance(const CreateRequest* request, const MemorySize& mem_size,
+                                                           const std::optional<MemorySize>& disk_space)
+{
+    // Warm instances were configured with no user data and no extra networks, so they cannot stand in for launches
+    // that ask for them
+    if (!request->cloud_init_user_data().empty() || request->network_options_size() > 0)
+        return std::nullopt;
+
+    auto image = request->image().empty() ? std::string{"default"} : request->image();
+    if (!request->remote_name().empty())
+        image = request->remote_name() + ":" + image;
+
+    const auto profile = warm_pool.profile_for(image, request->num_cores(), mem_size, disk_space);
+    if (!profile)
+        return std::nullopt;
+
+    for (const auto& name : warm_pool.instances_of(*profile))
+    {
+        auto it = operative_instances.find(name);
+        if (it == operative_instances.end())
+            continue;
+
+        const auto state = it->second->current_state();
+        if (discarding_warm_instances.count(name) ||
+            (state != VirtualMachine::State::running && state != VirtualMachine::State::starting))
+            continue;
+
+        warm_pool.remove(name);
+        return name;
+    }
+
+    return std::nullopt;
+}
+
+/*
+ * Shutting an instance down can take a while, so it happens off the daemon's thread. The instance stays in the pool,
+ * and so out of sight, until it is gone; it just cannot be claimed in the meantime.
+ */
+void mp::Daemon::discard_warm_instance(const std::string& name)
+{
+    auto it = operative_instances.find(name);
+    if (it == operative_instances.end())
+    {
+        warm_pool.remove(name);
+        return;
+    }
+
+    if (!discarding_warm_instances.insert(name).second)
+        return;
+
+    mpl::log(mpl::Level::info, category, fmt::format("Removing {} from the warm pool", name));
+    mounts[name].clear();
+
+    auto future_watcher = create_future_watcher([this, name] {
+        discarding_warm_instances.erase(name);
+
+        if (auto it = operative_instances.find(name); it != operative_instances.end())
+        {
+            release_resources(name);
+            operative_instances.erase(it);
+            persist_instances();
+        }
+    });
+
+    future_watcher->setFuture(QtConcurrent::run([vm = it->second, name] {
+        try
+        {
+            vm->shutdown();
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category, fmt::format("Could not stop warm instance {}: {}", name, e.what()));
+        }
+
+        return AsyncOperationStatus{grpc::Status::OK, nullptr};
+    }));
+}
+
 grpc::Status mp::Daemon::reboot_vm(VirtualMachine& vm)
 {
     if (vm.state == VirtualMachine::State::delayed_shutdown)
@@ -2875,6 +3391,12 @@ grpc::Status mp::Daemon::get_ssh_info_for_vm(VirtualMachine& vm, SSHInfoReply& r
     ssh_info.set_port(vm.ssh_port());
     ssh_info.set_priv_key_base64(config->ssh_key_provider->private_key_as_base64());
     ssh_info.set_username(vm.ssh_username());
+    ssh_info.set_cacheable(vm.state != VirtualMachine::State::delayed_shutdown);
+
+    // Served from the in-memory specs, so that `exec` can map its working directory without an extra `info` call
+    if (MP_SETTINGS.get_as<bool>(mp::mounts_key))
+        populate_mount_info(vm_instance_specs[name].mounts, ssh_info.mutable_mount_info());
+
     (*response.mutable_ssh_info())[name] = ssh_info;
 
     return grpc::Status::OK;
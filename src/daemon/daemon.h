@@ -20,7 +20,9 @@
 
 #include "daemon_config.h"
 #include "daemon_rpc.h"
+#include "image_mirror.h"
 #include "vm_specs.h"
+#include "warm_pool.h"
 
 #include <multipass/delayed_shutdown_timer.h>
 #include <multipass/mount_handler.h>
@@ -31,6 +33,7 @@
 #include <future>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -135,6 +138,14 @@ public slots:
                               grpc::ServerReaderWriterInterface<AuthenticateReply, AuthenticateRequest>* server,
                               std::promise<grpc::Status>* status_promise);
 
+    virtual void image_cache(const ImageCacheRequest* request,
+                             grpc::ServerReaderWriterInterface<ImageCacheReply, ImageCacheRequest>* server,
+                             std::promise<grpc::Status>* status_promise);
+
+    virtual void flatten(const FlattenRequest* request,
+                         grpc::ServerReaderWriterInterface<FlattenReply, FlattenRequest>* server,
+                         std::promise<grpc::Status>* status_promise);
+
 private:
     void release_resources(const std::string& instance);
     void create_vm(const CreateRequest* request, grpc::ServerReaderWriterInterface<CreateReply, CreateRequest>* server,
@@ -147,6 +158,13 @@ private:
     void stop_mounts(const std::string& name);
     MountHandler::UPtr make_mount(VirtualMachine* vm, const std::string& target, const VMMount& mount);
 
+    struct WarmLaunch;
+    void refill_warm_pool();
+    void check_warm_launches();
+    std::optional<std::string> claim_warm_instance(const CreateRequest* request, const MemorySize& mem_size,
+                                                   const std::optional<MemorySize>& disk_space);
+    void discard_warm_instance(const std::string& name);
+
     struct AsyncOperationStatus
     {
         grpc::Status status;
@@ -169,6 +187,7 @@ private:
         grpc::ServerReaderWriterInterface<SetReply, SetRequest>* server); // TODO temporary code, remove
 
     std::unique_ptr<const DaemonConfig> config;
+    WarmPool warm_pool;
     std::unordered_map<std::string, VMSpecs> vm_instance_specs;
     std::unordered_map<std::string, VirtualMachine::ShPtr> operative_instances;
     std::unordered_map<std::string, VirtualMachine::ShPtr> deleted_instances;
@@ -183,6 +202,10 @@ private:
     QFuture<void> image_update_future;
     SettingsHandler* instance_mod_handler;
     std::unordered_map<std::string, std::unordered_map<std::string, MountHandler::UPtr>> mounts;
+    std::unordered_map<std::string, std::unique_ptr<WarmLaunch>> warm_launches;
+    std::unordered_set<std::string> discarding_warm_instances;
+    QTimer warm_launch_timer;
+    std::unique_ptr<ImageMirror> image_mirror;
 };
 } // namespace multipass
 #endif // MULTIPASS_DAEMON_H
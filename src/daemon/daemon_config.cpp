@@ -46,6 +46,7 @@ namespace mpl = multipass::logging;
 namespace
 {
 constexpr auto manifest_ttl = std::chrono::minutes{5};
+constexpr auto max_manifest_staleness = std::chrono::hours{24}; // beyond which lookups wait for updated manifests
 
 std::string server_name_from(const std::string& server_address)
 {
@@ -136,7 +137,8 @@ std::unique_ptr<const mp::DaemonConfig> mp::DaemonConfigBuilder::build()
     if (image_hosts.empty())
     {
         image_hosts.push_back(std::make_unique<mp::CustomVMImageHost>(QSysInfo::currentCpuArchitecture(),
-                                                                      url_downloader.get(), manifest_ttl));
+                                                                      url_downloader.get(), manifest_ttl,
+                                                                      max_manifest_staleness));
         image_hosts.push_back(std::make_unique<mp::UbuntuVMImageHost>(
             std::vector<std::pair<std::string, UbuntuVMImageRemote>>{
                 {mp::release_remote, UbuntuVMImageRemote{"https://cloud-images.ubuntu.com/", "releases/",
@@ -146,7 +148,7 @@ std::unique_ptr<const mp::DaemonConfig> mp::DaemonConfigBuilder::build()
                 {mp::snapcraft_remote, UbuntuVMImageRemote{"https://cloud-images.ubuntu.com/", "buildd/daily/",
                                                            std::make_optional<QString>(mp::mirror_key)}},
                 {mp::appliance_remote, UbuntuVMImageRemote{"https://cdimage.ubuntu.com/", "ubuntu-core/appliances/"}}},
-            url_downloader.get(), manifest_ttl));
+            url_downloader.get(), manifest_ttl, max_manifest_staleness));
     }
     if (vault == nullptr)
     {
@@ -16,14 +16,19 @@
  */
 
 #include "daemon_init_settings.h"
+#include "image_mirror.h"
+#include "warm_pool.h"
 
 #include <multipass/constants.h>
+#include <multipass/exceptions/invalid_memory_size_exception.h>
+#include <multipass/format.h>
 #include <multipass/platform.h>
 #include <multipass/settings/basic_setting_spec.h>
 #include <multipass/settings/bool_setting_spec.h>
 #include <multipass/settings/custom_setting_spec.h>
 #include <multipass/settings/persistent_settings_handler.h>
 #include <multipass/settings/settings.h>
+#include <multipass/ssh/ssh_session.h>
 #include <multipass/utils.h>
 
 #include <QCoreApplication>
@@ -66,10 +71,11 @@ QString image_mirror_interpreter(QString val)
         return val;
     }
 
-    if (!val.startsWith("https://"))
+    // Plain HTTP is fine for mirrors on the local network: whatever they serve is checked against the official site
+    if (!val.startsWith("https://") && !val.startsWith("http://"))
     {
         throw mp::InvalidSettingException(mp::mirror_key, val,
-                                          "The hostname of mirror must contain protocol name: https");
+                                          "The hostname of mirror must contain protocol name: https or http");
     }
 
     if (!val.endsWith("/"))
@@ -79,6 +85,96 @@ QString image_mirror_interpreter(QString val)
     return val;
 }
 
+QString warm_pool_interpreter(QString val)
+{
+    try
+    {
+        mp::WarmPool::parse_profiles(val);
+    }
+    catch (const std::runtime_error& e)
+    {
+        throw mp::InvalidSettingException(mp::warm_pool_key, val, e.what());
+    }
+
+    return val;
+}
+
+QString ssh_ciphers_interpreter(QString val)
+{
+    if (const auto unknown = mp::SSHSession::unknown_ciphers(val.toStdString()); !unknown.empty())
+        throw mp::InvalidSettingException(mp::daemon_ssh_ciphers_key, val,
+                                          QString::fromStdString(fmt::format("Unknown cipher(s): '{}'",
+                                                                             fmt::join(unknown, "', '"))));
+
+    return val;
+}
+
+QString warm_pool_memory_interpreter(QString val)
+{
+    try
+    {
+        [[maybe_unused]] mp::MemorySize budget{val.toStdString()};
+    }
+    catch (const mp::InvalidMemorySizeException&)
+    {
+        throw mp::InvalidSettingException(mp::warm_pool_memory_key, val, "Invalid memory size");
+    }
+
+    return val;
+}
+
+QString download_rate_interpreter(QString val)
+{
+    try
+    {
+        [[maybe_unused]] mp::MemorySize rate{val.isEmpty() ? "0" : val.toStdString()};
+    }
+    catch (const mp::InvalidMemorySizeException&)
+    {
+        throw mp::InvalidSettingException(mp::download_rate_key, val, "Invalid rate, expected bytes per second");
+    }
+
+    return val;
+}
+
+QString image_cache_size_interpreter(QString val)
+{
+    try
+    {
+        [[maybe_unused]] mp::MemorySize budget{val.isEmpty() ? "0" : val.toStdString()};
+    }
+    catch (const mp::InvalidMemorySizeException&)
+    {
+        throw mp::InvalidSettingException(mp::image_cache_size_key, val, "Invalid size");
+    }
+
+    return val;
+}
+
+QString max_downloads_interpreter(QString val)
+{
+    bool ok{false};
+    if (const auto max_downloads = val.toInt(&ok); !ok || max_downloads < 1)
+        throw mp::InvalidSettingException(mp::max_downloads_key, val, "Invalid number, expected a positive integer");
+
+    return val;
+}
+
+QString mirror_server_interpreter(QString val)
+{
+    try
+    {
+        if (!val.isEmpty())
+            mp::ImageMirror::parse_listen_address(val);
+    }
+    catch (const std::runtime_error& e)
+    {
+        throw mp::InvalidSettingException(mp::mirror_server_key, val, e.what());
+    }
+
+    return val;
+}
+
 } // namespace
 
 void mp::daemon::monitor_and_quit_on_settings_change() // temporary
@@ -100,6 +196,16 @@ void mp::daemon::register_global_settings_handlers()
         return val.isEmpty() ? val : MP_UTILS.generate_scrypt_hash_for(val);
     }));
     settings.insert(std::make_unique<CustomSettingSpec>(mp::mirror_key, "", image_mirror_interpreter));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::daemon_ssh_ciphers_key, "", ssh_ciphers_interpreter));
+    settings.insert(std::make_unique<BoolSettingSpec>(mp::thin_disks_key, "false"));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::warm_pool_key, "", warm_pool_interpreter));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::warm_pool_memory_key, mp::warm_pool_memory_default,
+                                                        warm_pool_memory_interpreter));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::download_rate_key, "", download_rate_interpreter));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::mirror_server_key, "", mirror_server_interpreter));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::image_cache_size_key, "", image_cache_size_interpreter));
+    settings.insert(std::make_unique<CustomSettingSpec>(mp::max_downloads_key, mp::max_downloads_default,
+                                                        max_downloads_interpreter));
 
     MP_SETTINGS.register_handler(
         std::make_unique<PersistentSettingsHandler>(persistent_settings_filename(), std::move(settings)));
@@ -25,6 +25,8 @@
 #include <multipass/constants.h>
 #include <multipass/logging/log.h>
 #include <multipass/platform_unix.h>
+#include <multipass/settings/settings.h>
+#include <multipass/ssh/ssh_session.h>
 #include <multipass/top_catch_all.h>
 #include <multipass/utils.h>
 #include <multipass/version.h>
@@ -77,6 +79,7 @@ int main_impl(int argc, char* argv[])
     UnixSignalHandler handler;
 
     mp::daemon::register_global_settings_handlers();
+    mp::SSHSession::set_cipher_preference(MP_SETTINGS.get(mp::daemon_ssh_ciphers_key).toStdString());
 
     auto builder = mp::cli::parse(app);
     auto config = builder.build();
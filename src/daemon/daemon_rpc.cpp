@@ -366,6 +366,27 @@ grpc::Status mp::DaemonRpc::keys(grpc::ServerContext* context, grpc::ServerReade
         std::bind(&DaemonRpc::on_keys, this, &request, server, std::placeholders::_1), client_cert_from(context));
 }
 
+grpc::Status mp::DaemonRpc::image_cache(grpc::ServerContext* context,
+                                        grpc::ServerReaderWriter<ImageCacheReply, ImageCacheRequest>* server)
+{
+    ImageCacheRequest request;
+    server->Read(&request);
+
+    return verify_client_and_dispatch_operation(
+        std::bind(&DaemonRpc::on_image_cache, this, &request, server, std::placeholders::_1),
+        client_cert_from(context));
+}
+
+grpc::Status mp::DaemonRpc::flatten(grpc::ServerContext* context,
+                                    grpc::ServerReaderWriter<FlattenReply, FlattenRequest>* server)
+{
+    FlattenRequest request;
+    server->Read(&request);
+
+    return verify_client_and_dispatch_operation(
+        std::bind(&DaemonRpc::on_flatten, this, &request, server, std::placeholders::_1), client_cert_from(context));
+}
+
 template <typename OperationSignal>
 grpc::Status mp::DaemonRpc::verify_client_and_dispatch_operation(OperationSignal signal, const std::string& client_cert)
 {
@@ -98,6 +98,11 @@ signals:
     void on_authenticate(const AuthenticateRequest* request,
                          grpc::ServerReaderWriter<AuthenticateReply, AuthenticateRequest>* server,
                          std::promise<grpc::Status>* status_promise);
+    void on_image_cache(const ImageCacheRequest* request,
+                        grpc::ServerReaderWriter<ImageCacheReply, ImageCacheRequest>* server,
+                        std::promise<grpc::Status>* status_promise);
+    void on_flatten(const FlattenRequest* request, grpc::ServerReaderWriter<FlattenReply, FlattenRequest>* server,
+                    std::promise<grpc::Status>* status_promise);
 
 private:
     template <typename OperationSignal>
@@ -145,6 +150,10 @@ protected:
     grpc::Status keys(grpc::ServerContext* context, grpc::ServerReaderWriter<KeysReply, KeysRequest>* server) override;
     grpc::Status authenticate(grpc::ServerContext* context,
                               grpc::ServerReaderWriter<AuthenticateReply, AuthenticateRequest>* server) override;
+    grpc::Status image_cache(grpc::ServerContext* context,
+                             grpc::ServerReaderWriter<ImageCacheReply, ImageCacheRequest>* server) override;
+    grpc::Status flatten(grpc::ServerContext* context,
+                         grpc::ServerReaderWriter<FlattenReply, FlattenRequest>* server) override;
 };
 } // namespace multipass
 #endif // MULTIPASS_DAEMON_RPC_H
@@ -17,16 +17,20 @@
 
 #include "default_vm_image_vault.h"
 
+#include <multipass/block_map.h>
+#include <multipass/constants.h>
 #include <multipass/exceptions/aborted_download_exception.h>
 #include <multipass/exceptions/create_image_exception.h>
 #include <multipass/exceptions/image_vault_exceptions.h>
 #include <multipass/exceptions/unsupported_image_exception.h>
+#include <multipass/image_format.h>
 #include <multipass/json_writer.h>
 #include <multipass/logging/log.h>
 #include <multipass/platform.h>
 #include <multipass/process/qemuimg_process_spec.h>
 #include <multipass/query.h>
 #include <multipass/rpc/multipass.grpc.pb.h>
+#include <multipass/sha256_hash.h>
 #include <multipass/url_downloader.h>
 #include <multipass/utils.h>
 #include <multipass/vm_image.h>
@@ -34,6 +38,7 @@
 
 #include <multipass/format.h>
 
+#include <QDateTime>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -41,6 +46,8 @@
 #include <QtConcurrent/QtConcurrent>
 
 #include <exception>
+#include <numeric>
+#include <thread>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -50,6 +57,10 @@ namespace
 constexpr auto category = "image vault";
 constexpr auto instance_db_name = "multipassd-instance-image-records.json";
 constexpr auto image_db_name = "multipassd-image-records.json";
+constexpr auto quarantine_dir_name = "quarantine";
+constexpr mp::days partial_download_expiry{14}; // how long an interrupted download is kept around to be resumed
+constexpr auto scrub_chunk_size = 1024 * 1024;
+constexpr auto scrub_rate = 32LL * 1024 * 1024; // bytes per second, so that scrubbing stays out of the way of instances
 
 auto query_to_json(const mp::Query& query)
 {
@@ -71,6 +82,7 @@ auto image_to_json(const mp::VMImage& image)
     json.insert("original_release", QString::fromStdString(image.original_release));
     json.insert("current_release", QString::fromStdString(image.current_release));
     json.insert("release_date", QString::fromStdString(image.release_date));
+    json.insert("backing_path", image.backing_path);
 
     QJsonArray aliases;
     for (const auto& alias : image.aliases)
@@ -90,6 +102,8 @@ auto record_to_json(const mp::VaultRecord& record)
     json.insert("image", image_to_json(record.image));
     json.insert("query", query_to_json(record.query));
     json.insert("last_accessed", static_cast<qint64>(record.last_accessed.time_since_epoch().count()));
+    json.insert("content_hash", QString::fromStdString(record.content_hash));
+    json.insert("image_hash", QString::fromStdString(record.image_hash));
     return json;
 }
 
@@ -131,6 +145,7 @@ std::unordered_map<std::string, mp::VaultRecord> load_db(const QString& db_name)
         auto original_release = image["original_release"].toString().toStdString();
         auto current_release = image["current_release"].toString().toStdString();
         auto release_date = image["release_date"].toString().toStdString();
+        auto backing_path = image["backing_path"].toString();
 
         std::vector<std::string> aliases;
         for (QJsonValueRef entry : image["aliases"].toArray())
@@ -162,10 +177,16 @@ std::unordered_map<std::string, mp::VaultRecord> load_db(const QString& db_name)
             last_accessed = std::chrono::system_clock::time_point(duration);
         }
 
+        auto content_hash = record["content_hash"].toString().toStdString();
+        auto image_hash = record["image_hash"].toString().toStdString();
+
         reconstructed_records[key] = {
-            {image_path, kernel_path, initrd_path, image_id, original_release, current_release, release_date, aliases},
+            {image_path, kernel_path, initrd_path, image_id, original_release, current_release, release_date, aliases,
+             backing_path},
             {"", release.toStdString(), persistent.toBool(), remote_name.toStdString(), query_type},
-            last_accessed};
+            last_accessed,
+            content_hash,
+            image_hash};
     }
     return reconstructed_records;
 }
@@ -193,8 +214,75 @@ void delete_image_dir(const mp::Path& image_path)
     }
 }
 
+// Whether dir_path holds a download that is under way, or that stopped recently enough to be worth resuming
+bool holds_live_partial_download(const mp::Path& dir_path)
+{
+    const auto oldest = QDateTime::currentDateTime().addSecs(
+        -std::chrono::duration_cast<std::chrono::seconds>(partial_download_expiry).count());
+
+    const auto files = mp::URLDownloader::partial_download_files(dir_path);
+    return std::any_of(files.cbegin(), files.cend(),
+                       [&oldest](const auto& file) { return QFileInfo{file}.lastModified() > oldest; });
+}
+
+// Hashes a file no faster than scrub_rate; returns nothing if stopped on the way
+std::optional<std::string> scrub_hash(const mp::Path& path, const std::atomic<bool>& stopping)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly))
+        throw std::runtime_error(fmt::format("cannot open {}: {}", path, file.errorString()));
+
+    mp::Sha256Hash hash;
+    std::vector<char> buffer(scrub_chunk_size);
+    const auto chunk_time = std::chrono::microseconds{1000000LL * scrub_chunk_size / scrub_rate};
+    auto next_read = std::chrono::steady_clock::now();
+
+    qint64 bytes_read;
+    while ((bytes_read = file.read(buffer.data(), buffer.size())) > 0)
+    {
+        if (stopping)
+            return std::nullopt;
+
+        hash.add_data(buffer.data(), bytes_read);
+        next_read += chunk_time;
+        std::this_thread::sleep_until(next_read);
+    }
+
+    if (bytes_read < 0)
+        throw std::runtime_error(fmt::format("cannot read {}: {}", path, file.errorString()));
+
+    return hash.hex_result().toStdString();
+}
+
+// What is wrong with a stored image, given the hash of its contents, if anything
+std::string scrub_problem_with(const mp::VaultRecord& record, const std::string& hash)
+{
+    if (!mp::has_sane_header(record.image.image_path))
+        return "its header is broken";
+    if (!record.image_hash.empty() && hash != record.image_hash)
+        return "its contents changed";
+    if ((!record.image.kernel_path.isEmpty() && !QFile::exists(record.image.kernel_path)) ||
+        (!record.image.initrd_path.isEmpty() && !QFile::exists(record.image.initrd_path)))
+        return "its kernel or initrd is missing";
+
+    return {};
+}
+
+// What an image takes on disk, along with the kernel and initrd stored next to it
+long long stored_size_of(const mp::Path& image_path)
+{
+    long long size = 0;
+    for (const auto& entry : QFileInfo{image_path}.absoluteDir().entryInfoList(QDir::Files))
+        size += entry.size();
+
+    return size;
+}
+
 mp::MemorySize get_image_size(const mp::Path& image_path)
 {
+    if (const auto info = mp::probe_image_format(image_path))
+        return mp::MemorySize{std::to_string(info->virtual_size)};
+
     QStringList qemuimg_parameters{{"info", image_path}};
     auto qemuimg_process =
         mp::platform::make_process(std::make_unique<mp::QemuImgProcessSpec>(qemuimg_parameters, image_path));
@@ -226,10 +314,32 @@ mp::MemorySize get_image_size(const mp::Path& image_path)
 
     return image_size;
 }
+
+bool is_qcow2(const mp::Path& image_path)
+{
+    const auto info = mp::probe_image_format(image_path);
+    return info && info->format == mp::ImageFormatInfo::Format::qcow2;
+}
+
+void run_qemu_img(const QStringList& qemuimg_parameters, const mp::Path& source_image, const mp::Path& target_image,
+                  const std::string& action, const int timeout = 30000)
+{
+    auto qemuimg_process = mp::platform::make_process(
+        std::make_unique<mp::QemuImgProcessSpec>(qemuimg_parameters, source_image, target_image));
+    auto process_state = qemuimg_process->execute(timeout);
+
+    if (!process_state.completed_successfully())
+    {
+        throw std::runtime_error(fmt::format("Cannot {}: qemu-img failed ({}) with output:\n{}", action,
+                                             process_state.failure_message(),
+                                             qemuimg_process->read_all_standard_error()));
+    }
+}
 } // namespace
 
 mp::DefaultVMImageVault::DefaultVMImageVault(std::vector<VMImageHost*> image_hosts, URLDownloader* downloader,
-                                             mp::Path cache_dir_path, mp::Path data_dir_path, mp::days days_to_expire)
+                                             mp::Path cache_dir_path, mp::Path data_dir_path, mp::days days_to_expire,
+                                             bool use_backing_images)
     : BaseVMImageVault{image_hosts},
       url_downloader{downloader},
       cache_dir{QDir(cache_dir_path).filePath("vault")},
@@ -237,6 +347,8 @@ mp::DefaultVMImageVault::DefaultVMImageVault(std::vector<VMImageHost*> image_hos
       instances_dir(data_dir.filePath("instances")),
       images_dir(cache_dir.filePath("images")),
       days_to_expire{days_to_expire},
+      use_backing_images{use_backing_images},
+      download_scheduler{std::stoi(mp::max_downloads_default)},
       prepared_image_records{load_db(cache_dir.filePath(image_db_name))},
       instance_image_records{load_db(data_dir.filePath(instance_db_name))}
 {
@@ -244,12 +356,21 @@ mp::DefaultVMImageVault::DefaultVMImageVault(std::vector<VMImageHost*> image_hos
 
 mp::DefaultVMImageVault::~DefaultVMImageVault()
 {
+    stopping = true;
     url_downloader->abort_all_downloads();
 }
 
 mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, const Query& query,
                                                  const PrepareAction& prepare, const ProgressMonitor& monitor,
                                                  const bool unlock, const std::optional<std::string>& checksum)
+{
+    return fetch_image_with(Priority::interactive, fetch_type, query, prepare, monitor, unlock, checksum);
+}
+
+mp::VMImage mp::DefaultVMImageVault::fetch_image_with(Priority priority, const FetchType& fetch_type,
+                                                      const Query& query, const PrepareAction& prepare,
+                                                      const ProgressMonitor& monitor, const bool unlock,
+                                                      const std::optional<std::string>& checksum)
 {
     {
         std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
@@ -274,10 +395,11 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
             throw std::runtime_error(fmt::format("Custom image `{}` does not exist.", image_url.path()));
 
         source_image.image_path = image_url.path();
+        QString decoded_hash;
 
-        if (source_image.image_path.endsWith(".xz"))
+        if (!mp::vault::compression_suffix(source_image.image_path).isEmpty())
         {
-            source_image.image_path = extract_image_from(query.name, source_image, monitor);
+            source_image.image_path = extract_image_from(query.name, source_image, monitor, &decoded_hash);
         }
         else
         {
@@ -289,11 +411,16 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
             auto info = get_kernel_query_info(query.name);
 
             source_image =
-                fetch_kernel_and_initrd(info, source_image, QFileInfo(source_image.image_path).absoluteDir(), monitor);
+                fetch_kernel_and_initrd(info, source_image, QFileInfo(source_image.image_path).absoluteDir(), monitor,
+                                        priority);
         }
 
         vm_image = prepare(source_image);
-        vm_image.id = mp::vault::compute_image_hash(vm_image.image_path).toStdString();
+
+        // An image that preparation left alone is still what was decoded, so there is no need to read it again
+        const auto untouched = !decoded_hash.isEmpty() && vm_image.image_path == source_image.image_path;
+        vm_image.id =
+            (untouched ? decoded_hash : mp::vault::compute_image_hash(vm_image.image_path)).toStdString();
 
         remove_source_images(source_image, vm_image);
 
@@ -309,7 +436,7 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
     {
         std::string id;
         std::optional<VMImage> source_image{std::nullopt};
-        QFuture<VMImage> future;
+        QFuture<PreparedImage> future;
 
         if (query.query_type == Query::Type::HttpDownload)
         {
@@ -330,10 +457,17 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
 
                 if (last_modified.isValid() && (last_modified.toString().toStdString() == record.image.release_date))
                 {
-                    return finalize_image_records(query, record.image, id);
+                    return finalize_image_records(query, record.image, id, record.content_hash, record.image_hash);
                 }
             }
 
+            // A checksum names the contents, so an image stored for another URL or alias does just as well
+            if (const auto stored = checksum ? stored_image_with(*checksum) : nullptr)
+            {
+                const auto prepared_image = stored->image;
+                return finalize_image_records(query, prepared_image, id, *checksum, stored->image_hash);
+            }
+
             auto running_future = get_image_future(id);
             if (running_future)
             {
@@ -359,15 +493,20 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
                 const auto image_filename = mp::vault::filename_for(image_url.path());
                 // Attempt to make a sane directory name based on the filename of the image
 
+                const auto compressed = !mp::vault::compression_suffix(image_filename).isEmpty();
                 const auto image_dir_name =
-                    QString("%1-%2").arg(image_filename.section(".", 0, image_filename.endsWith(".xz") ? -3 : -2),
+                    QString("%1-%2").arg(image_filename.section(".", 0, compressed ? -3 : -2),
                                          QLocale::c().toString(last_modified, "yyyyMMdd"));
+                const auto seed_image_path = previous_version_of(query);
+                seed_images[id] = seed_image_path;
+                evict_least_recently_used(0); // the size of a plain download is not known up front
                 const auto image_dir = MP_UTILS.make_dir(images_dir, image_dir_name);
 
                 // Had to use std::bind here to workaround the 5 allowable function arguments constraint of
                 // QtConcurrent::run()
                 future = QtConcurrent::run(std::bind(&DefaultVMImageVault::download_and_prepare_source_image, this,
-                                                     info, source_image, image_dir, fetch_type, prepare, monitor));
+                                                     info, source_image, image_dir, fetch_type, prepare, monitor,
+                                                     priority, seed_image_path));
 
                 in_progress_image_fetches[id] = future;
             }
@@ -395,7 +534,8 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
                         const auto prepared_image = record.second.image;
                         try
                         {
-                            return finalize_image_records(query, prepared_image, record.first);
+                            return finalize_image_records(query, prepared_image, record.first,
+                                                          record.second.content_hash, record.second.image_hash);
                         }
                         catch (const std::exception& e)
                         {
@@ -408,6 +548,20 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
                 }
             }
 
+            // Verified ids are the image hash, so the same image may already be stored under another remote or URL
+            if (const auto stored = info->verify ? stored_image_with(id) : nullptr)
+            {
+                const auto prepared_image = stored->image;
+                try
+                {
+                    return finalize_image_records(query, prepared_image, id, id, stored->image_hash);
+                }
+                catch (const std::exception& e)
+                {
+                    mpl::log(mpl::Level::warning, category, fmt::format("Cannot reuse stored image: {}", e.what()));
+                }
+            }
+
             auto running_future = get_image_future(id);
             if (running_future)
             {
@@ -416,13 +570,17 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
             }
             else
             {
+                const auto seed_image_path = previous_version_of(query);
+                seed_images[id] = seed_image_path;
+                evict_least_recently_used(info->size);
                 const auto image_dir =
                     MP_UTILS.make_dir(images_dir, QString("%1-%2").arg(info->release).arg(info->version));
 
                 // Had to use std::bind here to workaround the 5 allowable function arguments constraint of
                 // QtConcurrent::run()
                 future = QtConcurrent::run(std::bind(&DefaultVMImageVault::download_and_prepare_source_image, this,
-                                                     *info, source_image, image_dir, fetch_type, prepare, monitor));
+                                                     *info, source_image, image_dir, fetch_type, prepare, monitor,
+                                                     priority, seed_image_path));
 
                 in_progress_image_fetches[id] = future;
             }
@@ -430,15 +588,17 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
 
         try
         {
-            auto prepared_image = future.result();
+            const auto [prepared_image, content_hash, image_hash] = future.result();
             std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
             in_progress_image_fetches.erase(id);
-            return finalize_image_records(query, prepared_image, id);
+            seed_images.erase(id);
+            return finalize_image_records(query, prepared_image, id, content_hash, image_hash);
         }
         catch (const std::exception&)
         {
             std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
             in_progress_image_fetches.erase(id);
+            seed_images.erase(id);
             throw;
         }
     }
@@ -465,30 +625,56 @@ bool mp::DefaultVMImageVault::has_record_for(const std::string& name)
 
 void mp::DefaultVMImageVault::prune_expired_images()
 {
-    std::vector<decltype(prepared_image_records)::key_type> expired_keys;
+    std::vector<Path> expired_image_paths;
     std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
 
-    for (const auto& record : prepared_image_records)
+    for (auto it = prepared_image_records.begin(); it != prepared_image_records.end();)
     {
-        // Expire source images if they aren't persistent and haven't been accessed in 14 days
-        if (record.second.query.query_type == Query::Type::Alias && !record.second.query.persistent &&
-            record.second.last_accessed + days_to_expire <= std::chrono::system_clock::now())
+        const auto& record = it->second;
+
+        // Expire source images if they aren't persistent and haven't been accessed in 14 days, unless there is a size
+        // budget: then space, rather than age, decides what goes
+        if (size_budget == 0 && record.query.query_type == Query::Type::Alias && !record.query.persistent &&
+            record.last_accessed + days_to_expire <= std::chrono::system_clock::now())
         {
-            mpl::log(
-                mpl::Level::info, category,
-                fmt::format("Source image {} is expired. Removing it from the cache.", record.second.query.release));
-            expired_keys.push_back(record.first);
-            delete_image_dir(record.second.image.image_path);
+            if (is_backing_image(record.image.image_path))
+            {
+                mpl::log(mpl::Level::debug, category,
+                         fmt::format("Source image {} is expired, but instances are backed by it. Keeping it.",
+                                     record.query.release));
+                ++it;
+                continue;
+            }
+
+            mpl::log(mpl::Level::info, category,
+                     fmt::format("Source image {} is expired. Removing it from the cache.", record.query.release));
+            expired_image_paths.push_back(record.image.image_path);
+            it = prepared_image_records.erase(it);
         }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // The image itself goes with the last record that refers to it
+    for (const auto& image_path : expired_image_paths)
+    {
+        if (!is_referenced(image_path))
+            delete_image_dir(image_path);
     }
 
-    // Remove any image directories that have no corresponding database entry
+    evict_least_recently_used(0);
+
+    // Remove any image directories that have no corresponding database entry, except those of downloads that are still
+    // under way or can be resumed: their records only appear once they complete
     for (const auto& entry : images_dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot))
     {
         if (std::find_if(prepared_image_records.cbegin(), prepared_image_records.cend(),
                          [&entry](const std::pair<std::string, VaultRecord>& record) {
                              return record.second.image.image_path.contains(entry.absoluteFilePath());
-                         }) == prepared_image_records.cend())
+                         }) == prepared_image_records.cend() &&
+            !is_backing_image(entry.absoluteFilePath()) && !holds_live_partial_download(entry.absoluteFilePath()))
         {
             mpl::log(mpl::Level::info, category,
                      fmt::format("Source image {} is no longer valid. Removing it from the cache.",
@@ -497,9 +683,6 @@ void mp::DefaultVMImageVault::prune_expired_images()
         }
     }
 
-    for (const auto& key : expired_keys)
-        prepared_image_records.erase(key);
-
     persist_image_records();
 }
 
@@ -538,16 +721,17 @@ void mp::DefaultVMImageVault::update_images(const FetchType& fetch_type, const P
 
     for (const auto& key : keys_to_update)
     {
-        const auto& record = prepared_image_records[key];
+        const auto record = prepared_image_records[key];
         mpl::log(mpl::Level::info, category, fmt::format("Updating {} source image to latest", record.query.release));
         try
         {
-            fetch_image(fetch_type, record.query, prepare, monitor, false, std::nullopt);
+            fetch_image_with(Priority::background, fetch_type, record.query, prepare, monitor, false, std::nullopt);
 
-            // Remove old image
+            // Remove old image, unless other records or instances still refer to it; pruning removes it later
             std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
-            delete_image_dir(record.image.image_path);
             prepared_image_records.erase(key);
+            if (!is_referenced(record.image.image_path))
+                delete_image_dir(record.image.image_path);
             persist_image_records();
         }
         catch (const CreateImageException& e)
@@ -558,6 +742,159 @@ void mp::DefaultVMImageVault::update_images(const FetchType& fetch_type, const P
     }
 }
 
+void mp::DefaultVMImageVault::scrub_images(const FetchType& fetch_type, const PrepareAction& prepare,
+                                           const ProgressMonitor& monitor)
+{
+    mpl::log(mpl::Level::debug, category, "Scrubbing source images…");
+
+    // What was quarantined last time has been kept around for long enough to be looked at
+    const QDir quarantine_dir{cache_dir.filePath(quarantine_dir_name)};
+    QDir{quarantine_dir}.removeRecursively();
+
+    // One record per stored image, with whichever hash the records that share it know
+    std::vector<VaultRecord> images;
+    {
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        for (const auto& [id, record] : prepared_image_records)
+        {
+            auto image = std::find_if(images.begin(), images.end(), [&record](const VaultRecord& image) {
+                return image.image.image_path == record.image.image_path;
+            });
+
+            if (image == images.end())
+                images.push_back(record);
+            else if (image->image_hash.empty())
+                image->image_hash = record.image_hash;
+        }
+    }
+
+    std::vector<Query> queries_to_refetch;
+    for (const auto& image : images)
+    {
+        const auto& image_path = image.image.image_path;
+
+        std::string hash, problem;
+        try
+        {
+            const auto scrubbed_hash = scrub_hash(image_path, stopping);
+            if (!scrubbed_hash)
+                return;
+
+            hash = *scrubbed_hash;
+            problem = scrub_problem_with(image, hash);
+        }
+        catch (const std::exception& e)
+        {
+            problem = e.what();
+        }
+
+        // Reading took a while, so the image may have been evicted, updated or removed meanwhile
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        const auto has_image_path = [&image_path](const auto& record) {
+            return record.second.image.image_path == image_path;
+        };
+        if (std::none_of(prepared_image_records.cbegin(), prepared_image_records.cend(), has_image_path))
+            continue;
+
+        if (problem.empty())
+        {
+            for (auto& record : prepared_image_records)
+            {
+                if (has_image_path(record))
+                    record.second.image_hash = hash;
+            }
+        }
+        else if (is_backing_image(image_path))
+        {
+            mpl::log(mpl::Level::error, category,
+                     fmt::format("Source image {} is damaged ({}), but instances are backed by it. Keeping it.",
+                                 image.query.release, problem));
+            continue;
+        }
+        else
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Source image {} is damaged ({}). Quarantining it to fetch it again.",
+                                 image.query.release, problem));
+
+            for (auto it = prepared_image_records.begin(); it != prepared_image_records.end();)
+            {
+                if (!has_image_path(*it))
+                {
+                    ++it;
+                    continue;
+                }
+
+                // Images downloaded from plain URLs are fetched again when they are next launched
+                if (it->second.query.query_type == Query::Type::Alias)
+                    queries_to_refetch.push_back(it->second.query);
+                it = prepared_image_records.erase(it);
+            }
+
+            const auto image_dir = QFileInfo{image_path}.absoluteDir();
+            MP_UTILS.make_dir(quarantine_dir);
+            if (!QDir{}.rename(image_dir.absolutePath(), quarantine_dir.filePath(image_dir.dirName())))
+                delete_image_dir(image_path);
+        }
+
+        persist_image_records();
+    }
+
+    for (const auto& query : queries_to_refetch)
+    {
+        try
+        {
+            fetch_image_with(Priority::background, fetch_type, query, prepare, monitor, false, std::nullopt);
+            mpl::log(mpl::Level::info, category, fmt::format("Fetched source image {} again", query.release));
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot fetch source image {} again: {}", query.release, e.what()));
+        }
+    }
+}
+
+std::vector<mp::VMImage> mp::DefaultVMImageVault::cached_images()
+{
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+
+    std::vector<VMImage> images;
+    for (const auto& [id, record] : prepared_image_records)
+    {
+        images.push_back(record.image);
+        images.back().id = id;
+    }
+
+    return images;
+}
+
+void mp::DefaultVMImageVault::set_size_budget(const MemorySize& size_budget)
+{
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    this->size_budget = size_budget.in_bytes();
+}
+
+void mp::DefaultVMImageVault::set_max_downloads(int max_downloads)
+{
+    download_scheduler.set_max_concurrent(max_downloads);
+}
+
+mp::ImageCacheUsage mp::DefaultVMImageVault::cache_usage()
+{
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+
+    ImageCacheUsage usage{{}, size_budget};
+    for (const auto& image : stored_images())
+    {
+        const auto& query = image.record->query;
+        usage.images.push_back(
+            {image.id, query.release, query.remote_name, image.size, image.record->last_accessed, image.in_use});
+    }
+
+    return usage;
+}
+
 mp::MemorySize mp::DefaultVMImageVault::minimum_image_size_for(const std::string& id)
 {
     auto prepared_image_entry = prepared_image_records.find(id);
@@ -581,9 +918,39 @@ mp::MemorySize mp::DefaultVMImageVault::minimum_image_size_for(const std::string
     throw std::runtime_error(fmt::format("Cannot determine minimum image size for id \'{}\'", id));
 }
 
-mp::VMImage mp::DefaultVMImageVault::download_and_prepare_source_image(
-    const VMImageInfo& info, std::optional<VMImage>& existing_source_image, const QDir& image_dir,
-    const FetchType& fetch_type, const PrepareAction& prepare, const ProgressMonitor& monitor)
+void mp::DefaultVMImageVault::flatten(const std::string& name)
+{
+    VMImage image;
+    {
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        auto name_entry = instance_image_records.find(name);
+        if (name_entry == instance_image_records.end() || name_entry->second.image.backing_path.isEmpty())
+            return;
+
+        image = name_entry->second.image;
+    }
+
+    mpl::log(mpl::Level::info, category, fmt::format("Making the image of {} standalone", name));
+
+    // Rebasing onto no backing file pulls everything the overlay still reads from its backing image into it. That takes
+    // a while, so it runs unlocked; the record keeps the backing image from being pruned meanwhile
+    run_qemu_img({"rebase", "-f", "qcow2", "-b", "", image.image_path}, image.backing_path, image.image_path,
+                 "flatten instance image", mp::image_flatten_timeout);
+
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    if (auto name_entry = instance_image_records.find(name); name_entry != instance_image_records.end())
+    {
+        name_entry->second.image.backing_path.clear();
+        persist_instance_records();
+    }
+}
+
+auto mp::DefaultVMImageVault::download_and_prepare_source_image(const VMImageInfo& info,
+                                                               std::optional<VMImage>& existing_source_image,
+                                                               const QDir& image_dir, const FetchType& fetch_type,
+                                                               const PrepareAction& prepare,
+                                                               const ProgressMonitor& monitor, Priority priority,
+                                                               const Path& seed_image_path) -> PreparedImage
 {
     VMImage source_image;
     auto id = info.id;
@@ -605,34 +972,81 @@ mp::VMImage mp::DefaultVMImageVault::download_and_prepare_source_image(
         }
     }
 
+    /*
+     * zstd images are decoded as they download, so the compressed file never lands on disk: one core decodes zstd
+     * faster than networks deliver it, so waiting for the whole file would gain nothing. xz is several times slower to
+     * decode than that, and multi-block xz images only decode on all cores once their index, at the end, is in. So
+     * where there are several cores, xz images are downloaded whole (which also lets them resume) and decoded after.
+     */
+    const auto compression_suffix = mp::vault::compression_suffix(source_image.image_path);
+    const auto decode_after_download = compression_suffix == ".xz" && std::thread::hardware_concurrency() > 1;
+    const auto decode_while_downloading = !compression_suffix.isEmpty() && !decode_after_download;
+
+    auto decoded_image_path = source_image.image_path;
+    decoded_image_path.chop(compression_suffix.size());
+    if (decode_while_downloading)
+        source_image.image_path = decoded_image_path;
+
     mp::vault::DeleteOnException image_file{source_image.image_path};
+    mp::vault::DeleteOnException decoded_image_file{decoded_image_path};
 
     try
     {
-        url_downloader->download_to(info.image_location, source_image.image_path, info.size, LaunchProgress::IMAGE,
-                                    monitor);
+        const auto download_hash = download_scheduler.run(priority, [&] {
+            if (compression_suffix.isEmpty() && !seed_image_path.isEmpty() &&
+                seed_image_path != source_image.image_path)
+            {
+                if (auto hash = download_delta(info, seed_image_path, source_image.image_path, monitor))
+                    return *hash;
+            }
+
+            return decode_while_downloading
+                       ? url_downloader->download_decoded_to(info.image_location, source_image.image_path, info.size,
+                                                             LaunchProgress::IMAGE, monitor)
+                       : url_downloader->download_to(info.image_location, source_image.image_path, info.size,
+                                                     LaunchProgress::IMAGE, monitor);
+        });
 
         if (info.verify)
         {
             mpl::log(mpl::Level::debug, category, fmt::format("Verifying hash \"{}\"", id));
             monitor(LaunchProgress::VERIFY, -1);
-            mp::vault::verify_image_download(source_image.image_path, id);
+            mp::vault::verify_image_download(source_image.image_path, id, download_hash);
         }
 
-        if (fetch_type == FetchType::ImageKernelAndInitrd)
+        // Different URLs can serve the very same image, which then needs neither preparing nor storing again
+        const auto content_hash = (info.verify ? id : download_hash).toStdString();
+        if (!content_hash.empty())
         {
-            source_image = fetch_kernel_and_initrd(info, source_image, image_dir, monitor);
+            std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+            if (const auto stored = stored_image_with(content_hash);
+                stored && stored->image.image_path != decoded_image_path)
+            {
+                mpl::log(mpl::Level::debug, category,
+                         fmt::format("{} is already stored as {}", info.image_location, stored->image.image_path));
+                mp::vault::delete_file(source_image.image_path);
+                images_dir.rmdir(image_dir.absolutePath()); // only if nothing else is in there
+
+                return {stored->image, content_hash, stored->image_hash};
+            }
         }
 
-        if (source_image.image_path.endsWith(".xz"))
-        {
+        if (decode_after_download)
             source_image.image_path = mp::vault::extract_image(source_image.image_path, monitor, true);
+
+        if (fetch_type == FetchType::ImageKernelAndInitrd)
+        {
+            source_image = fetch_kernel_and_initrd(info, source_image, image_dir, monitor, priority);
         }
 
         auto prepared_image = prepare(source_image);
         remove_source_images(source_image, prepared_image);
 
-        return prepared_image;
+        // A file that is still the download itself is known by its hash from the start, so scrubbing can tell when
+        // it changes rather than take whatever it first reads for the reference
+        const auto stored_as_downloaded = !decode_while_downloading && !decode_after_download &&
+                                          prepared_image.image_path == source_image.image_path;
+        return {prepared_image, content_hash, stored_as_downloaded ? content_hash : std::string{}};
     }
     catch (const AbortedDownloadException&)
     {
@@ -644,16 +1058,82 @@ mp::VMImage mp::DefaultVMImageVault::download_and_prepare_source_image(
     }
 }
 
+/*
+ * Rebuilds a new version of an image out of the blocks it shares with an older one, downloading only the rest. That
+ * takes a block map published next to the image, as image mirrors do. Returns nothing when there is no block map, no
+ * hash to check the result against, or nothing to reuse, and when the result does not check out; the caller then
+ * downloads the image whole.
+ */
+std::optional<QString> mp::DefaultVMImageVault::download_delta(const VMImageInfo& info, const Path& seed_image_path,
+                                                               const Path& image_path, const ProgressMonitor& monitor)
+{
+    try
+    {
+        const auto block_map =
+            mp::block_map_from_json(url_downloader->download(QUrl{info.image_location + mp::block_map_suffix}));
+        if (!block_map || (info.size > 0 && block_map->size != info.size))
+            return std::nullopt;
+
+        const auto expected_hash = info.verify ? info.id : block_map->sha256;
+        if (expected_hash.isEmpty())
+            return std::nullopt;
+
+        const auto plan = mp::plan_delta(*block_map, seed_image_path);
+        if (plan.reused_bytes == 0)
+            return std::nullopt;
+
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Reusing {} of {} bytes of {} from {}", plan.reused_bytes, block_map->size,
+                             info.image_location, seed_image_path));
+
+        {
+            QFile image_file{image_path};
+            if (!image_file.open(QIODevice::WriteOnly))
+                throw std::runtime_error(fmt::format("cannot open {}: {}", image_path, image_file.errorString()));
+
+            mp::copy_reused_blocks(*block_map, plan, seed_image_path, image_file);
+        }
+
+        url_downloader->download_ranges_to(info.image_location, image_path, plan.missing, LaunchProgress::IMAGE,
+                                           monitor);
+
+        auto hash = mp::vault::compute_image_hash(image_path);
+        if (hash != expected_hash)
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Rebuilt {} does not match its hash; downloading it whole", info.image_location));
+            return std::nullopt;
+        }
+
+        return hash;
+    }
+    catch (const AbortedDownloadException&)
+    {
+        throw;
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::debug, category,
+                 fmt::format("Cannot rebuild {} from {}: {}", info.image_location, seed_image_path, e.what()));
+        return std::nullopt;
+    }
+}
+
 QString mp::DefaultVMImageVault::extract_image_from(const std::string& instance_name, const VMImage& source_image,
-                                                    const ProgressMonitor& monitor)
+                                                    const ProgressMonitor& monitor, QString* decoded_hash)
 {
     const auto name = QString::fromStdString(instance_name);
     const QDir output_dir{MP_UTILS.make_dir(instances_dir, name)};
-    QFileInfo file_info{source_image.image_path};
-    const auto image_name = file_info.fileName().remove(".xz");
+    auto image_name = QFileInfo{source_image.image_path}.fileName();
+    image_name.chop(mp::vault::compression_suffix(image_name).size());
     const auto image_path = output_dir.filePath(image_name);
 
-    return mp::vault::extract_image(image_path, monitor);
+    // The original is the user's own file, so it is decoded into the instance directory and left alone
+    const auto hash = mp::vault::decode_image(source_image.image_path, image_path, monitor);
+    if (decoded_hash)
+        *decoded_hash = hash;
+
+    return image_path;
 }
 
 mp::VMImage mp::DefaultVMImageVault::image_instance_from(const std::string& instance_name,
@@ -672,8 +1152,151 @@ mp::VMImage mp::DefaultVMImageVault::image_instance_from(const std::string& inst
             {}};
 }
 
+mp::VMImage mp::DefaultVMImageVault::overlay_instance_from(const std::string& instance_name,
+                                                           const VMImage& prepared_image)
+{
+    auto name = QString::fromStdString(instance_name);
+    const QDir output_dir{MP_UTILS.make_dir(instances_dir, name)};
+    const auto overlay_path = output_dir.filePath(mp::vault::filename_for(prepared_image.image_path));
+
+    // Every instance backed by the image only ever writes to its own overlay, so nothing should write to the image
+    QFile::setPermissions(prepared_image.image_path, QFile::ReadOwner | QFile::ReadGroup | QFile::ReadOther);
+
+    run_qemu_img({"create", "-f", "qcow2", "-F", "qcow2", "-b", prepared_image.image_path, overlay_path},
+                 prepared_image.image_path, overlay_path, "create instance image");
+
+    return {overlay_path,
+            mp::vault::copy(prepared_image.kernel_path, output_dir),
+            mp::vault::copy(prepared_image.initrd_path, output_dir),
+            prepared_image.id,
+            prepared_image.original_release,
+            prepared_image.current_release,
+            prepared_image.release_date,
+            {},
+            prepared_image.image_path};
+}
+
+bool mp::DefaultVMImageVault::is_backing_image(const Path& path) const
+{
+    return std::any_of(instance_image_records.cbegin(), instance_image_records.cend(), [&path](const auto& record) {
+        const auto& backing_path = record.second.image.backing_path;
+        return !backing_path.isEmpty() && (backing_path == path || backing_path.startsWith(path + '/'));
+    });
+}
+
+bool mp::DefaultVMImageVault::is_referenced(const Path& image_path) const
+{
+    return is_backing_image(image_path) ||
+           std::any_of(prepared_image_records.cbegin(), prepared_image_records.cend(),
+                       [&image_path](const auto& record) { return record.second.image.image_path == image_path; });
+}
+
+auto mp::DefaultVMImageVault::stored_images() const -> std::vector<StoredImage>
+{
+    std::vector<StoredImage> images;
+    for (const auto& [id, record] : prepared_image_records)
+    {
+        const auto& image_path = record.image.image_path;
+        auto image = std::find_if(images.begin(), images.end(), [&image_path](const StoredImage& image) {
+            return image.record->image.image_path == image_path;
+        });
+
+        if (image == images.end())
+            images.push_back({id, &record, stored_size_of(image_path), is_backing_image(image_path)});
+        else if (image->record->last_accessed < record.last_accessed)
+            *image = {id, &record, image->size, image->in_use};
+    }
+
+    return images;
+}
+
+void mp::DefaultVMImageVault::evict_least_recently_used(long long room_needed)
+{
+    if (size_budget == 0)
+        return;
+
+    auto images = stored_images();
+    auto total_size = std::accumulate(images.cbegin(), images.cend(), room_needed,
+                                      [](long long sum, const StoredImage& image) { return sum + image.size; });
+    if (total_size <= size_budget)
+        return;
+
+    std::sort(images.begin(), images.end(), [](const StoredImage& a, const StoredImage& b) {
+        return a.record->last_accessed < b.record->last_accessed;
+    });
+
+    std::vector<Path> evicted_image_paths;
+    for (const auto& image : images)
+    {
+        if (total_size <= size_budget)
+            break;
+
+        if (image.in_use || image.record->query.persistent || is_seed_image(image.record->image.image_path))
+            continue;
+
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Evicting source image {} ({} bytes) to keep the image cache within {} bytes",
+                             image.record->query.release, image.size, size_budget));
+        evicted_image_paths.push_back(image.record->image.image_path);
+        total_size -= image.size;
+    }
+
+    // Every record sharing an evicted image goes with it
+    for (const auto& image_path : evicted_image_paths)
+    {
+        for (auto it = prepared_image_records.begin(); it != prepared_image_records.end();)
+            it = it->second.image.image_path == image_path ? prepared_image_records.erase(it) : std::next(it);
+
+        delete_image_dir(image_path);
+    }
+
+    if (total_size > size_budget)
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("The image cache needs {} bytes, over its budget of {}: the remaining images are in use",
+                             total_size, size_budget));
+
+    if (!evicted_image_paths.empty())
+        persist_image_records();
+}
+
+auto mp::DefaultVMImageVault::stored_image_with(const std::string& content_hash) const -> const VaultRecord*
+{
+    for (const auto& record : prepared_image_records)
+    {
+        if (record.second.content_hash == content_hash && QFile::exists(record.second.image.image_path))
+            return &record.second;
+    }
+
+    return nullptr;
+}
+
+// Fetches under way may still read the previous versions of their images to download only what changed
+bool mp::DefaultVMImageVault::is_seed_image(const Path& path) const
+{
+    return std::any_of(seed_images.cbegin(), seed_images.cend(),
+                       [&path](const auto& seed_image) { return seed_image.second == path; });
+}
+
+// The stored image of an earlier fetch of the same release from the same remote, if it is still there
+mp::Path mp::DefaultVMImageVault::previous_version_of(const Query& query) const
+{
+    for (const auto& [id, record] : prepared_image_records)
+    {
+        if (record.query.query_type == query.query_type && record.query.remote_name == query.remote_name &&
+            record.query.release == query.release && QFile::exists(record.image.image_path))
+            return record.image.image_path;
+    }
+
+    return {};
+}
+
+/*
+ * The kernel and the initrd do not depend on each other, so they download side by side. Their progress reports go
+ * through the same monitor, which is not meant to be called from two threads at once.
+ */
 mp::VMImage mp::DefaultVMImageVault::fetch_kernel_and_initrd(const VMImageInfo& info, const VMImage& source_image,
-                                                             const QDir& image_dir, const ProgressMonitor& monitor)
+                                                             const QDir& image_dir, const ProgressMonitor& monitor,
+                                                             Priority priority)
 {
     auto image{source_image};
 
@@ -681,13 +1304,50 @@ mp::VMImage mp::DefaultVMImageVault::fetch_kernel_and_initrd(const VMImageInfo&
     image.initrd_path = image_dir.filePath(mp::vault::filename_for(info.initrd_location));
     mp::vault::DeleteOnException kernel_file{image.kernel_path};
     mp::vault::DeleteOnException initrd_file{image.initrd_path};
-    url_downloader->download_to(info.kernel_location, image.kernel_path, -1, LaunchProgress::KERNEL, monitor);
-    url_downloader->download_to(info.initrd_location, image.initrd_path, -1, LaunchProgress::INITRD, monitor);
+
+    std::mutex monitor_mutex;
+    ProgressMonitor serialized_monitor = [&monitor, &monitor_mutex](int progress_type, int percentage) {
+        std::lock_guard<decltype(monitor_mutex)> lock{monitor_mutex};
+        return monitor(progress_type, percentage);
+    };
+
+    auto download = [this, priority, &serialized_monitor](const QUrl& location, const QString& path, int type) {
+        download_scheduler.run(priority, [&] {
+            return url_downloader->download_to(location, path, -1, type, serialized_monitor);
+        });
+    };
+
+    // QtConcurrent would hand back anything but a QException as QUnhandledException, so keep the original
+    std::exception_ptr initrd_error;
+    auto initrd = QtConcurrent::run([&] {
+        try
+        {
+            download(info.initrd_location, image.initrd_path, LaunchProgress::INITRD);
+        }
+        catch (...)
+        {
+            initrd_error = std::current_exception();
+        }
+    });
+
+    try
+    {
+        download(info.kernel_location, image.kernel_path, LaunchProgress::KERNEL);
+    }
+    catch (...)
+    {
+        initrd.waitForFinished(); // it refers to this frame, so it has to end first
+        throw;
+    }
+
+    initrd.waitForFinished();
+    if (initrd_error)
+        std::rethrow_exception(initrd_error);
 
     return image;
 }
 
-std::optional<QFuture<mp::VMImage>> mp::DefaultVMImageVault::get_image_future(const std::string& id)
+auto mp::DefaultVMImageVault::get_image_future(const std::string& id) -> std::optional<QFuture<PreparedImage>>
 {
     auto it = in_progress_image_fetches.find(id);
     if (it != in_progress_image_fetches.end())
@@ -699,20 +1359,25 @@ std::optional<QFuture<mp::VMImage>> mp::DefaultVMImageVault::get_image_future(co
 }
 
 mp::VMImage mp::DefaultVMImageVault::finalize_image_records(const Query& query, const VMImage& prepared_image,
-                                                            const std::string& id)
+                                                            const std::string& id, const std::string& content_hash,
+                                                            const std::string& image_hash)
 {
     VMImage vm_image;
 
     if (!query.name.empty())
     {
-        vm_image = image_instance_from(query.name, prepared_image);
+        // Overlays need a qcow2 base; anything else still gets a copy of its own
+        vm_image = use_backing_images && is_qcow2(prepared_image.image_path)
+                       ? overlay_instance_from(query.name, prepared_image)
+                       : image_instance_from(query.name, prepared_image);
         instance_image_records[query.name] = {vm_image, query, std::chrono::system_clock::now()};
     }
 
     // Do not save the instance name for prepared images
     Query prepared_query{query};
     prepared_query.name = "";
-    prepared_image_records[id] = {prepared_image, prepared_query, std::chrono::system_clock::now()};
+    prepared_image_records[id] = {prepared_image, prepared_query, std::chrono::system_clock::now(), content_hash,
+                                  image_hash};
 
     persist_instance_records();
     persist_image_records();
@@ -18,6 +18,8 @@
 #ifndef MULTIPASS_DEFAULT_VM_IMAGE_VAULT_H
 #define MULTIPASS_DEFAULT_VM_IMAGE_VAULT_H
 
+#include "download_scheduler.h"
+
 #include <multipass/days.h>
 #include <multipass/query.h>
 #include <multipass/vm_image.h>
@@ -27,6 +29,7 @@
 #include <QDir>
 #include <QFuture>
 
+#include <atomic>
 #include <mutex>
 #include <optional>
 #include <unordered_map>
@@ -41,12 +44,15 @@ public:
     multipass::VMImage image;
     multipass::Query query;
     std::chrono::system_clock::time_point last_accessed;
+    std::string content_hash{}; // SHA-256 of the downloaded source image, when it is known
+    std::string image_hash{};   // SHA-256 of the stored image file, as downloaded or else as first scrubbed
 };
 class DefaultVMImageVault final : public BaseVMImageVault
 {
 public:
     DefaultVMImageVault(std::vector<VMImageHost*> image_host, URLDownloader* downloader, multipass::Path cache_dir_path,
-                        multipass::Path data_dir_path, multipass::days days_to_expire);
+                        multipass::Path data_dir_path, multipass::days days_to_expire,
+                        bool use_backing_images = false);
     ~DefaultVMImageVault();
 
     VMImage fetch_image(const FetchType& fetch_type, const Query& query, const PrepareAction& prepare,
@@ -57,19 +63,60 @@ public:
     void prune_expired_images() override;
     void update_images(const FetchType& fetch_type, const PrepareAction& prepare,
                        const ProgressMonitor& monitor) override;
+    void scrub_images(const FetchType& fetch_type, const PrepareAction& prepare,
+                      const ProgressMonitor& monitor) override;
     MemorySize minimum_image_size_for(const std::string& id) override;
+    void flatten(const std::string& name) override;
+    std::vector<VMImage> cached_images() override;
+    void set_size_budget(const MemorySize& size_budget) override;
+    void set_max_downloads(int max_downloads) override;
+    ImageCacheUsage cache_usage() override;
 
 private:
+    using Priority = DownloadScheduler::Priority;
+
+    struct PreparedImage
+    {
+        VMImage image;
+        std::string content_hash;
+        std::string image_hash; // when the stored file is known by a hash already
+    };
+
+    // A source image on disk, with the most recently used of the records that share it
+    struct StoredImage
+    {
+        std::string id;
+        const VaultRecord* record;
+        long long size;
+        bool in_use;
+    };
+
+    VMImage fetch_image_with(Priority priority, const FetchType& fetch_type, const Query& query,
+                             const PrepareAction& prepare, const ProgressMonitor& monitor, const bool unlock,
+                             const std::optional<std::string>& checksum);
     VMImage image_instance_from(const std::string& name, const VMImage& prepared_image);
-    VMImage download_and_prepare_source_image(const VMImageInfo& info, std::optional<VMImage>& existing_source_image,
-                                              const QDir& image_dir, const FetchType& fetch_type,
-                                              const PrepareAction& prepare, const ProgressMonitor& monitor);
+    VMImage overlay_instance_from(const std::string& name, const VMImage& prepared_image);
+    bool is_backing_image(const Path& path) const;
+    bool is_referenced(const Path& image_path) const;
+    const VaultRecord* stored_image_with(const std::string& content_hash) const;
+    Path previous_version_of(const Query& query) const;
+    bool is_seed_image(const Path& path) const;
+    std::vector<StoredImage> stored_images() const;
+    void evict_least_recently_used(long long room_needed);
+    PreparedImage download_and_prepare_source_image(const VMImageInfo& info,
+                                                    std::optional<VMImage>& existing_source_image,
+                                                    const QDir& image_dir, const FetchType& fetch_type,
+                                                    const PrepareAction& prepare, const ProgressMonitor& monitor,
+                                                    Priority priority, const Path& seed_image_path);
+    std::optional<QString> download_delta(const VMImageInfo& info, const Path& seed_image_path,
+                                          const Path& image_path, const ProgressMonitor& monitor);
     QString extract_image_from(const std::string& instance_name, const VMImage& source_image,
-                               const ProgressMonitor& monitor);
+                               const ProgressMonitor& monitor, QString* decoded_hash);
     VMImage fetch_kernel_and_initrd(const VMImageInfo& info, const VMImage& source_image, const QDir& image_dir,
-                                    const ProgressMonitor& monitor);
-    std::optional<QFuture<VMImage>> get_image_future(const std::string& id);
-    VMImage finalize_image_records(const Query& query, const VMImage& prepared_image, const std::string& id);
+                                    const ProgressMonitor& monitor, Priority priority);
+    std::optional<QFuture<PreparedImage>> get_image_future(const std::string& id);
+    VMImage finalize_image_records(const Query& query, const VMImage& prepared_image, const std::string& id,
+                                   const std::string& content_hash, const std::string& image_hash);
     VMImageInfo get_kernel_query_info(const std::string& name);
     void persist_image_records();
     void persist_instance_records();
@@ -80,11 +127,17 @@ private:
     const QDir instances_dir;
     const QDir images_dir;
     const days days_to_expire;
+    const bool use_backing_images;
     std::mutex fetch_mutex;
+    DownloadScheduler download_scheduler;
+    std::atomic<bool> stopping{false};
+    long long size_budget{0}; // in bytes; source images are evicted in LRU order to stay within it, if set
 
+    // Records with the same content hash refer to one stored image, which is only removed along with the last of them
     std::unordered_map<std::string, VaultRecord> prepared_image_records;
     std::unordered_map<std::string, VaultRecord> instance_image_records;
-    std::unordered_map<std::string, QFuture<VMImage>> in_progress_image_fetches;
+    std::unordered_map<std::string, QFuture<PreparedImage>> in_progress_image_fetches;
+    std::unordered_map<std::string, Path> seed_images; // by the id of the fetch that may read them
 };
 } // namespace multipass
 #endif // MULTIPASS_DEFAULT_VM_IMAGE_VAULT_H
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "download_scheduler.h"
+
+#include <algorithm>
+
+namespace mp = multipass;
+
+mp::DownloadScheduler::DownloadScheduler(int max_concurrent) : max_concurrent{std::max(max_concurrent, 1)}
+{
+}
+
+void mp::DownloadScheduler::set_max_concurrent(int max_concurrent)
+{
+    {
+        std::lock_guard<decltype(mutex)> lock{mutex};
+        this->max_concurrent = std::max(max_concurrent, 1);
+    }
+
+    slot_freed.notify_all();
+}
+
+int mp::DownloadScheduler::running() const
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    return running_downloads;
+}
+
+void mp::DownloadScheduler::acquire(Priority priority)
+{
+    std::unique_lock<decltype(mutex)> lock{mutex};
+
+    if (priority == Priority::interactive)
+    {
+        ++waiting_interactive;
+        slot_freed.wait(lock, [this] { return running_downloads < max_concurrent; });
+        --waiting_interactive;
+    }
+    else
+    {
+        slot_freed.wait(lock, [this] { return running_downloads < max_concurrent && waiting_interactive == 0; });
+    }
+
+    ++running_downloads;
+}
+
+void mp::DownloadScheduler::release()
+{
+    {
+        std::lock_guard<decltype(mutex)> lock{mutex};
+        --running_downloads;
+    }
+
+    // Everyone gets to check, as a waiting background download must not take the slot from an interactive one
+    slot_freed.notify_all();
+}
+
+mp::DownloadScheduler::Slot::Slot(DownloadScheduler& scheduler, Priority priority) : scheduler{scheduler}
+{
+    scheduler.acquire(priority);
+}
+
+mp::DownloadScheduler::Slot::~Slot()
+{
+    scheduler.release();
+}
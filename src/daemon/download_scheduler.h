@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_DOWNLOAD_SCHEDULER_H
+#define MULTIPASS_DOWNLOAD_SCHEDULER_H
+
+#include <multipass/disabled_copy_move.h>
+
+#include <condition_variable>
+#include <mutex>
+
+namespace multipass
+{
+/*
+ * Lets at most a given number of downloads run at once. Downloads wait for a free slot, and interactive ones (e.g. for
+ * a launch) always get the next free slot ahead of background ones (e.g. refreshing cached images), so that the latter
+ * only use the uplink when nobody is waiting on it.
+ */
+class DownloadScheduler : private DisabledCopyMove
+{
+public:
+    enum class Priority
+    {
+        interactive,
+        background
+    };
+
+    explicit DownloadScheduler(int max_concurrent);
+
+    // Blocks until the download may start, then runs it, handing back whatever it returns or throws
+    template <typename Download>
+    auto run(Priority priority, Download&& download) -> decltype(download())
+    {
+        Slot slot{*this, priority};
+        return download();
+    }
+
+    // Downloads already running carry on when the cap goes down
+    void set_max_concurrent(int max_concurrent);
+    int running() const;
+
+private:
+    class Slot
+    {
+    public:
+        Slot(DownloadScheduler& scheduler, Priority priority);
+        ~Slot();
+
+    private:
+        DownloadScheduler& scheduler;
+    };
+
+    void acquire(Priority priority);
+    void release();
+
+    int max_concurrent;
+    mutable std::mutex mutex;
+    std::condition_variable slot_freed;
+    int running_downloads{0};
+    int waiting_interactive{0};
+};
+} // namespace multipass
+#endif // MULTIPASS_DOWNLOAD_SCHEDULER_H
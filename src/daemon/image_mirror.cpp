@@ -0,0 +1,585 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "image_mirror.h"
+
+#include <multipass/block_map.h>
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/simple_streams_index.h>
+#include <multipass/url_downloader.h>
+#include <multipass/vm_image_vault.h>
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocale>
+#include <QTcpSocket>
+#include <QUrl>
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "image mirror";
+constexpr auto index_path = "streams/v1/index.json";
+constexpr auto http_date_format = "ddd, dd MMM yyyy hh:mm:ss 'GMT'";
+constexpr auto max_request_head_size = 16 * 1024;
+constexpr qint64 chunk_size = 256 * 1024;
+constexpr qint64 max_unsent_bytes = 1024 * 1024; // beyond this, the rest of a file waits for the socket to catch up
+
+struct ByteRange
+{
+    qint64 first;
+    qint64 last;
+};
+
+QByteArray http_date(const QDateTime& time)
+{
+    return QLocale::c().toString(time.toUTC(), http_date_format).toLatin1();
+}
+
+QDateTime parse_http_date(const QByteArray& value)
+{
+    auto time = QLocale::c().toDateTime(QString::fromLatin1(value.trimmed()), http_date_format);
+    time.setTimeSpec(Qt::UTC);
+    return time;
+}
+
+std::optional<QByteArray> header_value(const mp::ImageMirror::Headers& headers, const QByteArray& name)
+{
+    for (const auto& [header, value] : headers)
+        if (header == name)
+            return value;
+
+    return std::nullopt;
+}
+
+// If-None-Match uses the weak comparison, which ignores any W/ prefix
+bool any_etag_matches(const QByteArray& etags, const QByteArray& etag)
+{
+    for (auto candidate : etags.split(','))
+    {
+        candidate = candidate.trimmed();
+        if (candidate == "*" || (candidate.startsWith("W/") ? candidate.mid(2) : candidate) == etag)
+            return true;
+    }
+
+    return false;
+}
+
+bool same_second(const QDateTime& a, const QDateTime& b)
+{
+    return a.isValid() && b.isValid() && a.toSecsSinceEpoch() == b.toSecsSinceEpoch();
+}
+
+/*
+ * Reads a single "bytes=<first>-[<last>]" or "bytes=-<suffix length>" range, clipped to the size. A range that starts
+ * past the end comes back with first > last. Anything else, including several ranges, is ignored: serving the whole
+ * file is always a valid answer.
+ */
+std::optional<ByteRange> parse_range(const QByteArray& value, qint64 size)
+{
+    if (!value.startsWith("bytes=") || value.contains(','))
+        return std::nullopt;
+
+    const auto spec = value.mid(6).trimmed();
+    const auto dash = spec.indexOf('-');
+    if (dash < 0)
+        return std::nullopt;
+
+    const auto first_text = spec.left(dash).trimmed();
+    const auto last_text = spec.mid(dash + 1).trimmed();
+    auto first_ok = true, last_ok = true;
+
+    if (first_text.isEmpty())
+    {
+        const auto suffix_length = last_text.toLongLong(&last_ok);
+        if (!last_ok || suffix_length < 0)
+            return std::nullopt;
+
+        return ByteRange{std::max(size - suffix_length, qint64{0}), size - 1};
+    }
+
+    const auto first = first_text.toLongLong(&first_ok);
+    const auto last = last_text.isEmpty() ? size - 1 : last_text.toLongLong(&last_ok);
+    if (!first_ok || !last_ok || first < 0 || last < first)
+        return std::nullopt;
+
+    return ByteRange{first, std::min(last, size - 1)};
+}
+
+QByteArray reason_phrase(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 206:
+        return "Partial Content";
+    case 304:
+        return "Not Modified";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 416:
+        return "Range Not Satisfiable";
+    case 431:
+        return "Request Header Fields Too Large";
+    default:
+        return "Error";
+    }
+}
+
+// Mirrors the derivation in SimpleStreamsManifest, which is how peers will look for these files
+QString unpacked_file_path_prefix_from(const QString& image_location, const QString& image_key)
+{
+    QFileInfo info{image_location};
+    auto file_name = info.fileName().remove('-' + image_key).remove(".img");
+    return info.path().append("/unpacked/").append(file_name);
+}
+
+// One client connection, which may carry several requests in a row; it goes along with its socket
+class MirrorConnection : public QObject
+{
+public:
+    MirrorConnection(QTcpSocket* socket, const mp::ImageMirror& mirror)
+        : QObject{socket}, socket{socket}, mirror{mirror}
+    {
+        QObject::connect(socket, &QTcpSocket::readyRead, this, [this] {
+            buffer.append(this->socket->readAll());
+            handle_requests();
+        });
+        QObject::connect(socket, &QTcpSocket::bytesWritten, this, [this] {
+            if (unsent_body > 0 && send_body())
+                finish_response();
+        });
+        QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+
+private:
+    void handle_requests()
+    {
+        while (unsent_body == 0 && socket->state() == QAbstractSocket::ConnectedState)
+        {
+            const auto head_end = buffer.indexOf("\r\n\r\n");
+            if (head_end < 0)
+            {
+                if (buffer.size() > max_request_head_size)
+                    refuse(431);
+                return;
+            }
+
+            const auto lines = buffer.left(head_end).split('\n');
+            buffer.remove(0, head_end + 4);
+
+            const auto request_line = lines.front().simplified().split(' ');
+            if (request_line.size() != 3 || !request_line[2].startsWith("HTTP/1."))
+                return refuse(400);
+
+            mp::ImageMirror::Headers headers;
+            for (auto it = std::next(lines.cbegin()); it != lines.cend(); ++it)
+            {
+                const auto colon = it->indexOf(':');
+                if (colon > 0)
+                    headers.emplace_back(it->left(colon).trimmed().toLower(), it->mid(colon + 1).trimmed());
+            }
+
+            const auto& method = request_line[0];
+            const auto connection = header_value(headers, "connection").value_or("").toLower();
+            close_when_done = request_line[2] == "HTTP/1.0" ? connection != "keep-alive" : connection == "close";
+
+            respond(method, mirror.answer(method, request_line[1], headers));
+            if (unsent_body > 0 && !send_body())
+                return; // the rest goes out as the socket drains
+
+            if (close_when_done)
+                return socket->disconnectFromHost();
+        }
+    }
+
+    void respond(const QByteArray& method, const mp::ImageMirror::Response& response)
+    {
+        auto head = QByteArray{"HTTP/1.1 "} + QByteArray::number(response.status) + ' ' +
+                    reason_phrase(response.status) + "\r\n";
+        for (const auto& [name, value] : response.headers)
+            head += name + ": " + value + "\r\n";
+        if (response.status != 304)
+            head += "Content-Length: " + QByteArray::number(response.length) + "\r\n";
+        head += close_when_done ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+
+        socket->write(head);
+        if (method == "HEAD" || response.length == 0)
+            return;
+
+        if (response.file_path.isEmpty())
+        {
+            socket->write(response.body);
+            return;
+        }
+
+        file.setFileName(response.file_path);
+        if (!file.open(QIODevice::ReadOnly) || !file.seek(response.offset))
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot read {}: {}", response.file_path, file.errorString()));
+            file.close();
+            close_when_done = true; // the head is out already, so the client can only tell by the connection closing
+            socket->abort();
+            return;
+        }
+
+        unsent_body = response.length;
+    }
+
+    // Returns whether the whole body is out
+    bool send_body()
+    {
+        while (unsent_body > 0 && socket->bytesToWrite() < max_unsent_bytes)
+        {
+            const auto chunk = file.read(std::min(chunk_size, unsent_body));
+            if (chunk.isEmpty())
+            {
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Cannot read {}: {}", file.fileName(), file.errorString()));
+                unsent_body = 0;
+                file.close();
+                socket->abort();
+                return false;
+            }
+
+            socket->write(chunk);
+            unsent_body -= chunk.size();
+        }
+
+        if (unsent_body > 0)
+            return false;
+
+        file.close();
+        return true;
+    }
+
+    void finish_response()
+    {
+        if (close_when_done)
+            socket->disconnectFromHost();
+        else
+            handle_requests();
+    }
+
+    void refuse(int status)
+    {
+        close_when_done = true;
+        respond("", {status, {}, {}, {}, 0, 0});
+        socket->disconnectFromHost();
+    }
+
+    QTcpSocket* const socket;
+    const mp::ImageMirror& mirror;
+    QByteArray buffer;
+    QFile file;
+    qint64 unsent_body{0};
+    bool close_when_done{false};
+};
+} // namespace
+
+std::pair<QHostAddress, quint16> mp::ImageMirror::parse_listen_address(const QString& spec)
+{
+    const auto colon = spec.lastIndexOf(':');
+    auto address_part = colon < 0 ? QString{} : spec.left(colon);
+    if (address_part.startsWith('[') && address_part.endsWith(']'))
+        address_part = address_part.mid(1, address_part.size() - 2);
+
+    bool port_ok = false;
+    const auto port = spec.mid(colon + 1).toUShort(&port_ok);
+    if (!port_ok || port == 0)
+        throw std::runtime_error(fmt::format("invalid port in \"{}\"", spec));
+
+    QHostAddress address{QHostAddress::Any};
+    if (colon >= 0 && !address.setAddress(address_part))
+        throw std::runtime_error(fmt::format("invalid address in \"{}\"", spec));
+
+    return {address, port};
+}
+
+mp::ImageMirror::ImageMirror(std::vector<Remote> remotes, URLDownloader* downloader, CachedImages cached_images,
+                             std::chrono::milliseconds refresh_interval)
+    : remotes{std::move(remotes)},
+      url_downloader{downloader},
+      cached_images{std::move(cached_images)},
+      refresh_interval{refresh_interval}
+{
+}
+
+mp::ImageMirror::~ImageMirror()
+{
+    refresh_timer.stop();
+    refresh_future.waitForFinished();
+}
+
+void mp::ImageMirror::listen(const QHostAddress& address, quint16 port)
+{
+    if (!server.listen(address, port))
+        throw std::runtime_error(
+            fmt::format("cannot listen on {} port {}: {}", address.toString(), port, server.errorString()));
+
+    QObject::connect(&server, &QTcpServer::newConnection, &server, [this] {
+        while (auto socket = server.nextPendingConnection())
+            new MirrorConnection{socket, *this};
+    });
+
+    auto refresh_in_background = [this] {
+        if (!refresh_future.isRunning())
+            refresh_future = QtConcurrent::run([this] { refresh(); });
+    };
+
+    QObject::connect(&refresh_timer, &QTimer::timeout, &server, refresh_in_background);
+    refresh_timer.start(refresh_interval);
+    refresh_in_background();
+
+    mpl::log(mpl::Level::info, category,
+             fmt::format("Serving cached images on {} port {}", address.toString(), server.serverPort()));
+}
+
+quint16 mp::ImageMirror::port() const
+{
+    return server.serverPort();
+}
+
+void mp::ImageMirror::refresh()
+{
+    std::unordered_map<std::string, VMImage> images;
+    try
+    {
+        for (auto& image : cached_images())
+            images.emplace(image.id, std::move(image));
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Cannot list cached images: {}", e.what()));
+        return;
+    }
+
+    for (auto it = block_maps.begin(); it != block_maps.end();)
+        it = images.count(it->first) ? std::next(it) : block_maps.erase(it);
+
+    std::map<QString, Entry> fresh_catalog;
+    for (const auto& remote : remotes)
+    {
+        try
+        {
+            fresh_catalog.merge(catalog_for(remote, images));
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot refresh the mirror of {}: {}", remote.official_url, e.what()));
+
+            // Peers are better off with what was there before than with nothing
+            std::lock_guard<decltype(catalog_mutex)> lock{catalog_mutex};
+            for (const auto& [path, entry] : catalog)
+                if (path.startsWith(remote.path))
+                    fresh_catalog.emplace(path, entry);
+        }
+    }
+
+    std::lock_guard<decltype(catalog_mutex)> lock{catalog_mutex};
+    catalog = std::move(fresh_catalog);
+}
+
+auto mp::ImageMirror::answer(const QByteArray& method, const QByteArray& target, const Headers& headers) const
+    -> Response
+{
+    if (method != "GET" && method != "HEAD")
+        return {405, {{"Allow", "GET, HEAD"}}, {}, {}, 0, 0};
+
+    auto path = QUrl::fromPercentEncoding(target.split('?').front());
+    while (path.startsWith('/'))
+        path.remove(0, 1);
+
+    Entry entry;
+    {
+        std::lock_guard<decltype(catalog_mutex)> lock{catalog_mutex};
+        const auto it = catalog.find(path);
+        if (it == catalog.end())
+            return {404, {}, {}, {}, 0, 0};
+
+        entry = it->second;
+    }
+
+    auto size = static_cast<qint64>(entry.content.size());
+    if (!entry.file_path.isEmpty())
+    {
+        const QFileInfo info{entry.file_path};
+        if (!info.exists())
+            return {404, {}, {}, {}, 0, 0}; // pruned since the last refresh
+
+        size = info.size();
+    }
+
+    Headers response_headers{{"ETag", entry.etag},
+                             {"Last-Modified", http_date(entry.last_modified)},
+                             {"Accept-Ranges", "bytes"}};
+
+    const auto if_none_match = header_value(headers, "if-none-match");
+    const auto if_modified_since = header_value(headers, "if-modified-since");
+    if (if_none_match ? any_etag_matches(*if_none_match, entry.etag)
+                      : if_modified_since && entry.last_modified.toSecsSinceEpoch() <=
+                                                 parse_http_date(*if_modified_since).toSecsSinceEpoch())
+        return {304, response_headers, {}, {}, 0, 0};
+
+    response_headers.emplace_back("Content-Type", entry.content_type);
+
+    auto status = 200;
+    ByteRange range{0, size - 1};
+
+    // With If-Range, the range only applies if the client's copy is still current; otherwise it gets everything
+    const auto if_range = header_value(headers, "if-range");
+    const auto range_applies = !if_range || (if_range->startsWith('"') ? *if_range == entry.etag
+                                                                      : same_second(parse_http_date(*if_range),
+                                                                                    entry.last_modified));
+    if (const auto range_header = header_value(headers, "range"); range_header && range_applies)
+    {
+        if (const auto requested = parse_range(*range_header, size))
+        {
+            if (requested->first > requested->last)
+                return {416, {{"Content-Range", "bytes */" + QByteArray::number(size)}}, {}, {}, 0, 0};
+
+            status = 206;
+            range = *requested;
+            const auto content_range = fmt::format("bytes {}-{}/{}", range.first, range.last, size);
+            response_headers.emplace_back("Content-Range", QByteArray::fromStdString(content_range));
+        }
+    }
+
+    const auto length = range.last - range.first + 1;
+    return {status,
+            response_headers,
+            entry.file_path.isEmpty() ? entry.content.mid(range.first, length) : QByteArray{},
+            entry.file_path,
+            range.first,
+            length};
+}
+
+/*
+ * Versions are kept as they are upstream, since peers only take those that match the upstream manifest. An image only
+ * counts if it is stored under the name it has upstream: one that preparing changed would not match its hash.
+ */
+auto mp::ImageMirror::catalog_for(const Remote& remote, const std::unordered_map<std::string, VMImage>& images) const
+    -> std::map<QString, Entry>
+{
+    const auto index_json = url_downloader->download({remote.official_url + index_path});
+    const auto manifest_path = SimpleStreamsIndex::fromJson(index_json).manifest_path;
+
+    auto manifest = QJsonDocument::fromJson(url_downloader->download({remote.official_url + manifest_path})).object();
+    if (manifest.isEmpty())
+        throw std::runtime_error("invalid manifest");
+
+    std::map<QString, Entry> entries;
+    const auto now = QDateTime::currentDateTimeUtc();
+
+    auto add_content = [&entries, &remote, &now](const QString& path, const QByteArray& content) {
+        const auto hash = QCryptographicHash::hash(content, QCryptographicHash::Sha256).toHex();
+        entries[remote.path + path] = {{}, content, "application/json", '"' + hash + '"', now};
+    };
+
+    auto add_file = [&entries, &remote](const QString& path, const QString& file_path, QByteArray etag = {}) {
+        const QFileInfo info{file_path};
+        if (file_path.isEmpty() || !info.exists())
+            return false;
+
+        if (etag.isEmpty()) // size and modification time will do for files that are not known by their hash
+            etag = QByteArray::fromStdString(
+                fmt::format("{:x}-{:x}", info.size(), info.lastModified().toMSecsSinceEpoch()));
+
+        entries[remote.path + path] = {file_path, {}, "application/octet-stream", '"' + etag + '"',
+                                       info.lastModified()};
+        return true;
+    };
+
+    QJsonObject mirrored_products;
+    const auto products = manifest["products"].toObject();
+    for (auto product = products.constBegin(); product != products.constEnd(); ++product)
+    {
+        QJsonObject mirrored_versions;
+        const auto versions = product.value()["versions"].toObject();
+        for (auto version = versions.constBegin(); version != versions.constEnd(); ++version)
+        {
+            const auto items = version.value()["items"].toObject();
+            const auto image_key = items.contains("uefi1.img") ? "uefi1.img" : "disk1.img";
+            const auto item = items[image_key].toObject();
+            const auto image_location = item["path"].toString();
+            const auto sha256 = item["sha256"].toString();
+
+            const auto it = images.find(sha256.toStdString());
+            if (it == images.end() ||
+                QFileInfo{it->second.image_path}.fileName() != mp::vault::filename_for(image_location) ||
+                !add_file(image_location, it->second.image_path, sha256.toLatin1()))
+                continue;
+
+            if (const auto block_map = block_map_for(it->first, it->second.image_path))
+                add_content(image_location + mp::block_map_suffix, *block_map);
+
+            const auto prefix = unpacked_file_path_prefix_from(image_location, image_key);
+            add_file(prefix + "-vmlinuz-generic", it->second.kernel_path);
+            add_file(prefix + "-initrd-generic", it->second.initrd_path);
+
+            mirrored_versions.insert(version.key(), version.value());
+        }
+
+        if (!mirrored_versions.isEmpty())
+        {
+            auto mirrored_product = product.value().toObject();
+            mirrored_product["versions"] = mirrored_versions;
+            mirrored_products.insert(product.key(), mirrored_product);
+        }
+    }
+
+    manifest["products"] = mirrored_products;
+    add_content(manifest_path, QJsonDocument{manifest}.toJson(QJsonDocument::Compact));
+    add_content(index_path, index_json);
+
+    return entries;
+}
+
+// Making a block map takes reading the whole image, so it is done once per image for as long as the image is served
+std::optional<QByteArray> mp::ImageMirror::block_map_for(const std::string& id, const QString& image_path) const
+{
+    if (const auto it = block_maps.find(id); it != block_maps.end())
+        return it->second;
+
+    try
+    {
+        return block_maps.emplace(id, block_map_to_json(make_block_map(image_path))).first->second;
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Cannot map the blocks of {}: {}", image_path, e.what()));
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_IMAGE_MIRROR_H
+#define MULTIPASS_IMAGE_MIRROR_H
+
+#include <multipass/disabled_copy_move.h>
+#include <multipass/vm_image.h>
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFuture>
+#include <QHostAddress>
+#include <QString>
+#include <QTcpServer>
+#include <QTimer>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace multipass
+{
+class URLDownloader;
+
+/*
+ * Serves the cached images to other hosts over HTTP, laid out like the simplestreams remotes they came from, so that
+ * those hosts can name this one in their image mirror setting. Each remote's manifest is the upstream one, cut down to
+ * the versions whose images are cached here. Peers still check the versions against the upstream manifest and the
+ * images against their hashes, so plain HTTP does not let anyone slip them other images.
+ *
+ * Files come with ETag and Last-Modified validators. Conditional requests get 304 when nothing changed, and single
+ * byte ranges get 206, so peers can resume downloads and fetch large images in parallel ranges. Each image also comes
+ * with a block map, from which peers can rebuild it out of an older version and only download the blocks that changed.
+ */
+class ImageMirror : private DisabledCopyMove
+{
+public:
+    using CachedImages = std::function<std::vector<VMImage>()>;
+    using Headers = std::vector<std::pair<QByteArray, QByteArray>>;
+
+    struct Remote
+    {
+        QString path;         // where the mirror serves the remote, e.g. "releases/"
+        QString official_url; // where the remote comes from, e.g. "https://cloud-images.ubuntu.com/releases/"
+    };
+
+    struct Response
+    {
+        int status;
+        Headers headers;
+        QByteArray body;   // unless it comes from a file
+        QString file_path; // where the body comes from, if anywhere
+        qint64 offset;     // of the body in the file
+        qint64 length;     // of the body, wherever it comes from
+    };
+
+    // Reads "[<address>:]<port>", listening on all addresses when none is given; throws std::runtime_error
+    static std::pair<QHostAddress, quint16> parse_listen_address(const QString& spec);
+
+    ImageMirror(std::vector<Remote> remotes, URLDownloader* downloader, CachedImages cached_images,
+                std::chrono::milliseconds refresh_interval);
+    ~ImageMirror();
+
+    // Starts serving, and refreshing what is served in the background; throws std::runtime_error if it cannot listen
+    void listen(const QHostAddress& address, quint16 port);
+    quint16 port() const;
+
+    // Brings what is served up to date with the upstream manifests and the cached images; blocks on the network
+    void refresh();
+
+    // What the mirror answers to a request; header names are expected in lower case
+    Response answer(const QByteArray& method, const QByteArray& target, const Headers& headers) const;
+
+private:
+    struct Entry
+    {
+        QString file_path; // served from this file if set, from content otherwise
+        QByteArray content;
+        QByteArray content_type;
+        QByteArray etag;
+        QDateTime last_modified;
+    };
+
+    std::map<QString, Entry> catalog_for(const Remote& remote,
+                                         const std::unordered_map<std::string, VMImage>& images) const;
+    std::optional<QByteArray> block_map_for(const std::string& id, const QString& image_path) const;
+
+    const std::vector<Remote> remotes;
+    URLDownloader* const url_downloader;
+    const CachedImages cached_images;
+    const std::chrono::milliseconds refresh_interval;
+    QTcpServer server;
+    QTimer refresh_timer;
+    QFuture<void> refresh_future;
+    mutable std::mutex catalog_mutex;
+    std::map<QString, Entry> catalog; // by path
+    mutable std::unordered_map<std::string, QByteArray> block_maps; // by image id; only touched by refreshes
+};
+} // namespace multipass
+#endif // MULTIPASS_IMAGE_MIRROR_H
@@ -32,9 +32,10 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QUrl>
+#include <QtConcurrent/QtConcurrent>
 
 #include <algorithm>
-#include <unordered_set>
+#include <functional>
 
 namespace mp = multipass;
 
@@ -42,15 +43,6 @@ namespace
 {
 constexpr auto index_path = "streams/v1/index.json";
 
-auto download_manifest(const QString& host_url, mp::URLDownloader* url_downloader)
-{
-    auto json_index = url_downloader->download({host_url + index_path});
-    auto index = mp::SimpleStreamsIndex::fromJson(json_index);
-
-    auto json_manifest = url_downloader->download({host_url + index.manifest_path});
-    return json_manifest;
-}
-
 mp::VMImageInfo with_location_fully_resolved(const QString& host_url, const mp::VMImageInfo& info)
 {
     return {info.aliases,
@@ -78,11 +70,19 @@ auto key_from(const std::string& search_string)
 } // namespace
 
 mp::UbuntuVMImageHost::UbuntuVMImageHost(std::vector<std::pair<std::string, UbuntuVMImageRemote>> remotes,
-                                         URLDownloader* downloader, std::chrono::seconds manifest_time_to_live)
-    : CommonVMImageHost{manifest_time_to_live}, url_downloader{downloader}, remotes{std::move(remotes)}
+                                         URLDownloader* downloader, std::chrono::seconds manifest_time_to_live,
+                                         std::chrono::seconds max_manifest_staleness)
+    : CommonVMImageHost{manifest_time_to_live, max_manifest_staleness},
+      url_downloader{downloader},
+      remotes{std::move(remotes)}
 {
 }
 
+mp::UbuntuVMImageHost::~UbuntuVMImageHost()
+{
+    wait_for_background_update();
+}
+
 std::optional<mp::VMImageInfo> mp::UbuntuVMImageHost::info_for(const Query& query)
 {
     auto images = all_info_for(query);
@@ -106,6 +106,9 @@ std::vector<std::pair<std::string, mp::VMImageInfo>> mp::UbuntuVMImageHost::all_
     auto key = key_from(query.release);
     check_alias_is_supported(key.toStdString(), query.remote_name);
 
+    update_manifests();
+    std::shared_lock<std::shared_mutex> lock{manifest_mutex};
+
     std::vector<std::string> remotes_to_search;
 
     if (!query.remote_name.empty())
@@ -148,18 +151,11 @@ std::vector<std::pair<std::string, mp::VMImageInfo>> mp::UbuntuVMImageHost::all_
         }
         else
         {
-            std::unordered_set<std::string> found_hashes;
-
-            for (const auto& entry : manifest->products)
+            for (const auto* entry : match_hash_prefix(key, remote_name, query.allow_unsupported))
             {
-                if (entry.id.startsWith(key) && (entry.supported || query.allow_unsupported) &&
-                    found_hashes.find(entry.id.toStdString()) == found_hashes.end())
-                {
-                    images.push_back(std::make_pair(
-                        remote_name,
-                        with_location_fully_resolved(QString::fromStdString(remote_url_from(remote_name)), entry)));
-                    found_hashes.insert(entry.id.toStdString());
-                }
+                images.push_back(std::make_pair(
+                    remote_name,
+                    with_location_fully_resolved(QString::fromStdString(remote_url_from(remote_name)), *entry)));
             }
         }
     }
@@ -169,15 +165,11 @@ std::vector<std::pair<std::string, mp::VMImageInfo>> mp::UbuntuVMImageHost::all_
 
 mp::VMImageInfo mp::UbuntuVMImageHost::info_for_full_hash_impl(const std::string& full_hash)
 {
-    for (const auto& manifest : manifests)
+    auto it = index.by_full_hash.find(full_hash);
+    if (it != index.by_full_hash.end())
     {
-        for (const auto& product : manifest.second->products)
-        {
-            if (product.id.toStdString() == full_hash)
-            {
-                return with_location_fully_resolved(QString::fromStdString(remote_url_from(manifest.first)), product);
-            }
-        }
+        const auto& [remote_name, product] = it->second;
+        return with_location_fully_resolved(QString::fromStdString(remote_url_from(remote_name)), *product);
     }
 
     // TODO: Throw a specific exception type here so callers can be more specific about what to catch
@@ -188,6 +180,9 @@ mp::VMImageInfo mp::UbuntuVMImageHost::info_for_full_hash_impl(const std::string
 std::vector<mp::VMImageInfo> mp::UbuntuVMImageHost::all_images_for(const std::string& remote_name,
                                                                    const bool allow_unsupported)
 {
+    update_manifests();
+    std::shared_lock<std::shared_mutex> lock{manifest_mutex};
+
     std::vector<mp::VMImageInfo> images;
     auto manifest = manifest_from(remote_name);
 
@@ -232,27 +227,74 @@ std::vector<std::string> mp::UbuntuVMImageHost::supported_remotes()
     return supported_remotes;
 }
 
-void mp::UbuntuVMImageHost::fetch_manifests()
+/*
+ * Remotes are fetched side by side, each on a worker thread. A remote whose index and products are both unchanged since
+ * the last fetch keeps its parsed manifest.
+ */
+void mp::UbuntuVMImageHost::fetch_manifests(bool keep_stale)
 {
+    std::vector<RemoteFetch> fetches;
+
     for (const auto& [remote_name, remote_info] : remotes)
     {
         try
         {
             check_remote_is_supported(remote_name);
-            auto official_site = remote_info.get_official_url();
-            auto manifest_bytes_from_official = download_manifest(official_site, url_downloader);
+        }
+        catch (const mp::UnsupportedRemoteException&)
+        {
+            continue;
+        }
 
-            auto mirror_site = remote_info.get_mirror_url();
-            std::optional<QByteArray> manifest_bytes_from_mirror = std::nullopt;
-            if (mirror_site)
-            {
-                auto bytes = download_manifest(mirror_site.value(), url_downloader);
-                manifest_bytes_from_mirror = std::make_optional(bytes);
-            }
+        std::vector<StreamsSource> sources{{remote_info.get_official_url()}};
+        if (auto mirror_site = remote_info.get_mirror_url())
+            sources.push_back({*mirror_site});
+
+        const auto& previous_sources = manifest_sources[remote_name]; // only ever touched by the one update
+        auto reusable = previous_sources.size() == sources.size() &&
+                        std::any_of(manifests.cbegin(), manifests.cend(),
+                                    [&remote_name = remote_name](const auto& manifest) {
+                                        return manifest.first == remote_name;
+                                    });
+
+        for (auto i = 0u; i < sources.size(); ++i)
+        {
+            if (i < previous_sources.size() && previous_sources[i].host_url == sources[i].host_url)
+                sources[i] = previous_sources[i];
+            else
+                reusable = false;
+        }
+
+        fetches.push_back({remote_name, std::move(sources), reusable});
+    }
+
+    std::vector<QFuture<void>> futures;
+    for (auto& fetch : fetches)
+        futures.push_back(QtConcurrent::run([this, &fetch] { fetch_remote(fetch); }));
+
+    for (auto& future : futures)
+        future.waitForFinished();
+
+    std::unique_lock<std::shared_mutex> lock{manifest_mutex};
+    Manifests fetched;
+
+    for (auto& fetch : fetches)
+    {
+        const auto& remote_name = fetch.remote_name;
+        auto current = std::find_if(manifests.begin(), manifests.end(),
+                                    [&remote_name](const auto& manifest) { return manifest.first == remote_name; });
+        auto failed = false;
+
+        try
+        {
+            if (fetch.error)
+                std::rethrow_exception(fetch.error);
 
-            auto manifest = mp::SimpleStreamsManifest::fromJson(
-                manifest_bytes_from_official, manifest_bytes_from_mirror, mirror_site.value_or(official_site));
-            manifests.emplace_back(std::make_pair(remote_name, std::move(manifest)));
+            if (!fetch.manifest)
+                fetch.manifest = std::move(current->second);
+
+            fetched.emplace_back(std::make_pair(remote_name, std::move(fetch.manifest)));
+            manifest_sources[remote_name] = std::move(fetch.sources);
         }
         catch (mp::EmptyManifestException& /* e */)
         {
@@ -260,30 +302,101 @@ void mp::UbuntuVMImageHost::fetch_manifests()
         }
         catch (mp::GenericManifestException& e)
         {
+            failed = true;
             on_manifest_update_failure(e.what());
         }
         catch (mp::DownloadException& e)
         {
+            failed = true;
             on_manifest_update_failure(e.what());
         }
-        catch (const mp::UnsupportedRemoteException&)
+
+        if (failed && keep_stale && current != manifests.end())
+            fetched.emplace_back(std::make_pair(remote_name, std::move(current->second)));
+    }
+
+    // Index first, so that lookups never see manifests without their index
+    auto fetched_index = index_for(fetched);
+    manifests = std::move(fetched);
+    index = std::move(fetched_index);
+}
+
+// Fetches the products JSON of a simplestreams host, unless it and the index are unchanged since source was updated
+std::optional<QByteArray> mp::UbuntuVMImageHost::download_manifest(StreamsSource& source) const
+{
+    if (auto json_index = url_downloader->download_if_modified({source.host_url + index_path}, source.index_validators))
+    {
+        auto manifest_path = mp::SimpleStreamsIndex::fromJson(*json_index).manifest_path;
+        if (manifest_path != source.manifest_path)
         {
-            continue;
+            source.manifest_path = std::move(manifest_path);
+            source.manifest_validators = {};
         }
     }
+
+    return url_downloader->download_if_modified({source.host_url + source.manifest_path}, source.manifest_validators);
+}
+
+void mp::UbuntuVMImageHost::fetch_remote(RemoteFetch& fetch) const
+{
+    try
+    {
+        std::vector<std::optional<QByteArray>> manifest_bytes;
+        for (auto& source : fetch.sources)
+            manifest_bytes.push_back(download_manifest(source));
+
+        const auto unchanged = std::none_of(manifest_bytes.cbegin(), manifest_bytes.cend(),
+                                            [](const auto& bytes) { return bytes.has_value(); });
+        if (unchanged && fetch.reusable)
+            return;
+
+        // An unchanged host still needs parsing along with one that changed; the network cache has its copy
+        for (auto i = 0u; i < manifest_bytes.size(); ++i)
+        {
+            if (!manifest_bytes[i])
+                manifest_bytes[i] = url_downloader->download(
+                    {fetch.sources[i].host_url + fetch.sources[i].manifest_path});
+        }
+
+        const auto has_mirror = fetch.sources.size() > 1;
+        fetch.manifest = mp::SimpleStreamsManifest::fromJson(
+            *manifest_bytes.front(), has_mirror ? manifest_bytes.back() : std::nullopt, fetch.sources.back().host_url);
+    }
+    catch (...)
+    {
+        fetch.error = std::current_exception();
+    }
 }
 
-void mp::UbuntuVMImageHost::clear()
+// Products live in their manifests, so the pointers stay good when the manifests are moved
+auto mp::UbuntuVMImageHost::index_for(const Manifests& manifests) -> ManifestIndex
 {
-    manifests.clear();
+    ManifestIndex index;
+
+    for (const auto& [remote_name, manifest] : manifests)
+    {
+        auto& sorted = index.sorted_by_hash[remote_name];
+        sorted.reserve(manifest->products.size());
+
+        for (const auto& product : manifest->products)
+        {
+            index.by_full_hash.emplace(product.id.toStdString(), std::make_pair(remote_name, &product));
+            sorted.push_back(&product);
+        }
+
+        // Products with the same hash stay in manifest order, as they are in the same vector
+        std::sort(sorted.begin(), sorted.end(), [](const VMImageInfo* a, const VMImageInfo* b) {
+            return a->id < b->id || (a->id == b->id && std::less<>{}(a, b));
+        });
+    }
+
+    return index;
 }
 
 mp::SimpleStreamsManifest* mp::UbuntuVMImageHost::manifest_from(const std::string& remote)
 {
     check_remote_is_supported(remote);
 
-    update_manifests();
-
     auto it = std::find_if(manifests.begin(), manifests.end(),
                            [&remote](const std::pair<std::string, std::unique_ptr<SimpleStreamsManifest>>& element) {
                                return element.first == remote;
@@ -309,6 +422,30 @@ const mp::VMImageInfo* mp::UbuntuVMImageHost::match_alias(const QString& key,
     return nullptr;
 }
 
+// The products whose hash starts with key, once per hash and in manifest order
+std::vector<const mp::VMImageInfo*> mp::UbuntuVMImageHost::match_hash_prefix(const QString& key,
+                                                                             const std::string& remote,
+                                                                             bool allow_unsupported) const
+{
+    std::vector<const VMImageInfo*> matches;
+
+    auto sorted = index.sorted_by_hash.find(remote);
+    if (sorted == index.sorted_by_hash.end())
+        return matches;
+
+    auto it = std::lower_bound(sorted->second.cbegin(), sorted->second.cend(), key,
+                               [](const VMImageInfo* product, const QString& key) { return product->id < key; });
+
+    for (; it != sorted->second.cend() && (*it)->id.startsWith(key); ++it)
+    {
+        if (((*it)->supported || allow_unsupported) && (matches.empty() || matches.back()->id != (*it)->id))
+            matches.push_back(*it);
+    }
+
+    std::sort(matches.begin(), matches.end(), std::less<>{});
+    return matches;
+}
+
 std::string mp::UbuntuVMImageHost::remote_url_from(const std::string& remote_name)
 {
     std::string url;
@@ -22,10 +22,13 @@
 
 #include <multipass/constants.h>
 #include <multipass/simple_streams_manifest.h>
+#include <multipass/url_downloader.h>
 
 #include <QString>
 
+#include <exception>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -41,7 +44,9 @@ class UbuntuVMImageHost final : public CommonVMImageHost
 {
 public:
     UbuntuVMImageHost(std::vector<std::pair<std::string, UbuntuVMImageRemote>> remotes, URLDownloader* downloader,
-                      std::chrono::seconds manifest_time_to_live);
+                      std::chrono::seconds manifest_time_to_live,
+                      std::chrono::seconds max_manifest_staleness = std::chrono::seconds{0});
+    ~UbuntuVMImageHost() override;
 
     std::optional<VMImageInfo> info_for(const Query& query) override;
     std::vector<std::pair<std::string, VMImageInfo>> all_info_for(const Query& query) override;
@@ -51,17 +56,52 @@ public:
 protected:
     void for_each_entry_do_impl(const Action& action) override;
     VMImageInfo info_for_full_hash_impl(const std::string& full_hash) override;
-    void fetch_manifests() override;
-    void clear() override;
+    void fetch_manifests(bool keep_stale) override;
 
 private:
+    using Manifests = std::vector<std::pair<std::string, std::unique_ptr<SimpleStreamsManifest>>>;
+
+    // What a simplestreams host last served, to ask it for the index and products again only if they changed
+    struct StreamsSource
+    {
+        QString host_url;
+        HttpValidators index_validators{};
+        QString manifest_path{};
+        HttpValidators manifest_validators{};
+    };
+
+    // A remote's manifest, as fetched on a worker thread
+    struct RemoteFetch
+    {
+        std::string remote_name;
+        std::vector<StreamsSource> sources; // official first, then any mirror
+        bool reusable; // whether the current manifest came from the same hosts, so that it holds if they are unchanged
+        std::unique_ptr<SimpleStreamsManifest> manifest{}; // none if the current one holds
+        std::exception_ptr error{};
+    };
+
+    // Lookups by image hash, built along with the manifests they point into
+    struct ManifestIndex
+    {
+        // The remote and product of each full hash, the first remote having it winning
+        std::unordered_map<std::string, std::pair<std::string, const VMImageInfo*>> by_full_hash;
+        // Each remote's products sorted by hash, so that the ones with a given prefix are next to each other
+        std::unordered_map<std::string, std::vector<const VMImageInfo*>> sorted_by_hash;
+    };
+
+    static ManifestIndex index_for(const Manifests& manifests);
+    std::optional<QByteArray> download_manifest(StreamsSource& source) const;
+    void fetch_remote(RemoteFetch& fetch) const;
     SimpleStreamsManifest* manifest_from(const std::string& remote);
     const VMImageInfo* match_alias(const QString& key, const SimpleStreamsManifest& manifest) const;
-    std::vector<std::pair<std::string, std::unique_ptr<SimpleStreamsManifest>>> manifests;
+    std::vector<const VMImageInfo*> match_hash_prefix(const QString& key, const std::string& remote,
+                                                      bool allow_unsupported) const;
+    Manifests manifests;
+    ManifestIndex index;
+    std::unordered_map<std::string, std::vector<StreamsSource>> manifest_sources; // of each remote's manifest
     URLDownloader* const url_downloader;
     std::vector<std::pair<std::string, UbuntuVMImageRemote>> remotes;
     std::string remote_url_from(const std::string& remote_name);
-    QString index_path;
 };
 class UbuntuVMImageRemote
 {
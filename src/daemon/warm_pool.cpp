@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "warm_pool.h"
+
+#include <multipass/constants.h>
+#include <multipass/format.h>
+#include <multipass/json_writer.h>
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mp = multipass;
+
+namespace
+{
+auto invalid_entry(const QString& entry)
+{
+    return std::runtime_error(fmt::format("invalid warm pool entry \"{}\"", entry));
+}
+
+std::unordered_map<std::string, std::string> load_db(const QString& db_path)
+{
+    QFile db_file{db_path};
+    if (!db_file.open(QIODevice::ReadOnly))
+        return {};
+
+    std::unordered_map<std::string, std::string> warm_instances;
+    const auto records = QJsonDocument::fromJson(db_file.readAll()).object();
+    for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+        warm_instances[it.key().toStdString()] = it.value().toString().toStdString();
+
+    return warm_instances;
+}
+} // namespace
+
+std::string mp::WarmPool::Profile::key() const
+{
+    return fmt::format("{}/{}/{}/{}", image, num_cores, mem_size.in_bytes(),
+                       disk_space ? std::to_string(disk_space->in_bytes()) : "");
+}
+
+auto mp::WarmPool::parse_profiles(const QString& spec) -> std::vector<Profile>
+{
+    std::vector<Profile> profiles;
+    for (const auto& entry : spec.split(',', QString::SkipEmptyParts))
+    {
+        const auto separator = entry.lastIndexOf('=');
+        if (separator < 0)
+            throw invalid_entry(entry);
+
+        bool ok{false};
+        const auto count = entry.mid(separator + 1).trimmed().toInt(&ok);
+        const auto fields = entry.left(separator).trimmed().split('/');
+        if (!ok || count < 0 || fields.size() > 4 || fields[0].isEmpty())
+            throw invalid_entry(entry);
+
+        Profile profile{fields[0].toStdString(), std::stoi(mp::default_cpu_cores),
+                        MemorySize{mp::default_memory_size}, std::nullopt, count};
+
+        if (fields.size() > 1)
+        {
+            profile.num_cores = fields[1].toInt(&ok);
+            if (!ok || profile.num_cores < std::stoi(mp::min_cpu_cores))
+                throw invalid_entry(entry);
+        }
+
+        try
+        {
+            if (fields.size() > 2)
+                profile.mem_size = MemorySize{fields[2].toStdString()};
+            if (fields.size() > 3)
+                profile.disk_space = MemorySize{fields[3].toStdString()};
+        }
+        catch (const std::exception&)
+        {
+            throw invalid_entry(entry);
+        }
+
+        if (std::any_of(profiles.cbegin(), profiles.cend(),
+                        [&profile](const auto& other) { return other.key() == profile.key(); }))
+            throw std::runtime_error(fmt::format("warm pool profile \"{}\" is given more than once", entry));
+
+        profiles.push_back(std::move(profile));
+    }
+
+    return profiles;
+}
+
+mp::WarmPool::WarmPool(std::vector<Profile> profiles, const MemorySize& memory_budget, const QString& db_path)
+    : profiles{std::move(profiles)}, memory_budget{memory_budget}, db_path{db_path}, warm_instances{load_db(db_path)}
+{
+}
+
+auto mp::WarmPool::profile_for(const std::string& image, int num_cores, const MemorySize& mem_size,
+                               const std::optional<MemorySize>& disk_space) const -> const Profile*
+{
+    const auto cores = std::max(num_cores, std::stoi(mp::min_cpu_cores));
+    for (const auto& profile : profiles)
+    {
+        if (profile.image == image && profile.num_cores == cores && profile.mem_size == mem_size &&
+            profile.disk_space == disk_space)
+            return &profile;
+    }
+
+    return nullptr;
+}
+
+auto mp::WarmPool::next_to_refill() const -> const Profile*
+{
+    long long committed_bytes{0};
+    for (const auto& [name, key] : warm_instances)
+    {
+        if (const auto profile = find_profile(key))
+            committed_bytes += profile->mem_size.in_bytes();
+    }
+
+    for (const auto& profile : profiles)
+    {
+        if (instances_of(profile).size() < static_cast<std::size_t>(profile.size) &&
+            committed_bytes + profile.mem_size.in_bytes() <= memory_budget.in_bytes())
+            return &profile;
+    }
+
+    return nullptr;
+}
+
+void mp::WarmPool::add(const Profile& profile, const std::string& name)
+{
+    warm_instances[name] = profile.key();
+    persist();
+}
+
+void mp::WarmPool::remove(const std::string& name)
+{
+    if (warm_instances.erase(name))
+        persist();
+}
+
+bool mp::WarmPool::contains(const std::string& name) const
+{
+    return warm_instances.find(name) != warm_instances.end();
+}
+
+std::vector<std::string> mp::WarmPool::instances_of(const Profile& profile) const
+{
+    std::vector<std::string> names;
+    for (const auto& [name, key] : warm_instances)
+    {
+        if (key == profile.key())
+            names.push_back(name);
+    }
+
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+std::vector<std::string> mp::WarmPool::instances() const
+{
+    std::vector<std::string> names;
+    for (const auto& [name, key] : warm_instances)
+        names.push_back(name);
+
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+std::vector<std::string> mp::WarmPool::stray_instances() const
+{
+    std::vector<std::string> names;
+    for (const auto& [name, key] : warm_instances)
+    {
+        if (!find_profile(key))
+            names.push_back(name);
+    }
+
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+auto mp::WarmPool::find_profile(const std::string& key) const -> const Profile*
+{
+    auto it = std::find_if(profiles.cbegin(), profiles.cend(), [&key](const auto& profile) {
+        return profile.key() == key;
+    });
+
+    return it == profiles.cend() ? nullptr : &*it;
+}
+
+void mp::WarmPool::persist() const
+{
+    QJsonObject records;
+    for (const auto& [name, key] : warm_instances)
+        records.insert(QString::fromStdString(name), QString::fromStdString(key));
+
+    mp::write_json(records, db_path);
+}
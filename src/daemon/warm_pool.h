@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_WARM_POOL_H
+#define MULTIPASS_WARM_POOL_H
+
+#include <multipass/memory_size.h>
+
+#include <QString>
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace multipass
+{
+/*
+ * Bookkeeping for instances that the daemon keeps booted in the background, so that a launch matching one of the
+ * configured profiles can claim one instead of creating it from scratch. The daemon creates, claims and discards the
+ * instances themselves; the pool tracks which instances are warm, and persists that across daemon restarts.
+ */
+class WarmPool
+{
+public:
+    struct Profile
+    {
+        std::string image; // as given to launch, including any "<remote>:" prefix
+        int num_cores;
+        MemorySize mem_size;
+        std::optional<MemorySize> disk_space; // the launch default when not given
+        int size;                             // how many instances to keep warm
+
+        std::string key() const;
+    };
+
+    // Reads comma-separated "<image>[/<cpus>[/<memory>[/<disk>]]]=<count>" entries; throws std::runtime_error
+    static std::vector<Profile> parse_profiles(const QString& spec);
+
+    WarmPool(std::vector<Profile> profiles, const MemorySize& memory_budget, const QString& db_path);
+
+    // The profile a launch with these parameters matches, if any
+    const Profile* profile_for(const std::string& image, int num_cores, const MemorySize& mem_size,
+                               const std::optional<MemorySize>& disk_space) const;
+
+    // A profile that is short of instances and whose next instance fits in the memory budget, if any
+    const Profile* next_to_refill() const;
+
+    void add(const Profile& profile, const std::string& name);
+    void remove(const std::string& name);
+    bool contains(const std::string& name) const;
+    std::vector<std::string> instances_of(const Profile& profile) const;
+    std::vector<std::string> instances() const;
+
+    // Instances of profiles that are no longer configured
+    std::vector<std::string> stray_instances() const;
+
+private:
+    const Profile* find_profile(const std::string& key) const;
+    void persist() const;
+
+    const std::vector<Profile> profiles;
+    const MemorySize memory_budget;
+    const QString db_path;
+    std::unordered_map<std::string, std::string> warm_instances; // instance name -> profile key
+};
+} // namespace multipass
+#endif // MULTIPASS_WARM_POOL_H
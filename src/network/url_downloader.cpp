@@ -23,17 +23,29 @@
 #include <multipass/format.h>
 #include <multipass/logging/log.h>
 #include <multipass/platform.h>
+#include <multipass/sha256_hash.h>
 #include <multipass/version.h>
+#include <multipass/vm_image_vault.h>
 
 #include <QDir>
 #include <QEventLoop>
 #include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkDiskCache>
 #include <QNetworkReply>
+#include <QSaveFile>
 #include <QTimer>
 #include <QUrl>
 
+#include <algorithm>
+#include <functional>
 #include <memory>
+#include <numeric>
+#include <optional>
+#include <utility>
+#include <vector>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -41,7 +53,82 @@ namespace mpl = multipass::logging;
 namespace
 {
 constexpr auto category = "url downloader";
+constexpr qint64 ranged_download_threshold = 64LL * 1024 * 1024; // below this, a single stream does fine
+constexpr qint64 min_segment_size = 16LL * 1024 * 1024;
+constexpr int max_segments = 4; // Qt opens up to six connections per host
+constexpr qint64 journal_interval = 8LL * 1024 * 1024;
+constexpr qint64 throttled_read_buffer_size = 64LL * 1024; // keeps Qt from reading ahead of a bandwidth limit
+constexpr auto partial_suffix = ".part";
+constexpr auto journal_suffix = ".part.journal";
 using NetworkReplyUPtr = std::unique_ptr<QNetworkReply>;
+using RawHeaders = std::vector<std::pair<QByteArray, QByteArray>>;
+
+// Feeds [from, to) of the file to the hash, leaving the file positioned at to
+bool hash_file_range(QFile& file, qint64 from, qint64 to, mp::Sha256Hash& hash)
+{
+    std::vector<char> buffer(std::clamp(to - from, qint64{1}, qint64{1024 * 1024}));
+    if (!MP_FILEOPS.seek(file, from))
+        return false;
+
+    while (from < to)
+    {
+        const auto bytes_read =
+            MP_FILEOPS.read(file, buffer.data(), std::min(static_cast<qint64>(buffer.size()), to - from));
+        if (bytes_read <= 0)
+            return false;
+
+        hash.add_data(buffer.data(), bytes_read);
+        from += bytes_read;
+    }
+
+    return true;
+}
+
+// What it takes to pick up an interrupted download where it stopped
+struct PartialDownload
+{
+    QString url;
+    QByteArray validator; // a strong ETag or a Last-Modified date, for If-Range
+    qint64 bytes;
+};
+
+std::optional<PartialDownload> read_journal(const QString& path)
+{
+    QFile journal{path};
+    if (!journal.open(QIODevice::ReadOnly))
+        return std::nullopt;
+
+    const auto json = QJsonDocument::fromJson(journal.readAll()).object();
+    PartialDownload partial{json["url"].toString(), json["validator"].toString().toUtf8(),
+                            static_cast<qint64>(json["bytes"].toDouble())};
+
+    if (partial.url.isEmpty() || partial.validator.isEmpty() || partial.bytes <= 0)
+        return std::nullopt;
+
+    return partial;
+}
+
+bool write_journal(const QString& path, const PartialDownload& partial)
+{
+    QJsonObject json;
+    json.insert("url", partial.url);
+    json.insert("validator", QString::fromUtf8(partial.validator));
+    json.insert("bytes", partial.bytes);
+
+    QSaveFile journal{path};
+    return journal.open(QIODevice::WriteOnly) && journal.write(QJsonDocument{json}.toJson()) != -1 &&
+           journal.commit();
+}
+
+// Weak ETags cannot be used in If-Range, so fall back to the modification date for those
+QByteArray validator_for(const QNetworkReply* reply)
+{
+    const auto etag = reply->rawHeader("ETag");
+    if (!etag.isEmpty() && !etag.startsWith("W/"))
+        return etag;
+
+    return reply->rawHeader("Last-Modified");
+}
 
 auto make_network_manager(const mp::Path& cache_dir_path)
 {
@@ -73,31 +160,99 @@ void wait_for_reply(QNetworkReply* reply, QTimer& download_timeout)
     event_loop.exec();
 }
 
-template <typename ProgressAction, typename DownloadAction, typename ErrorAction, typename Time>
-QByteArray download(QNetworkAccessManager* manager, const Time& timeout, QUrl const& url, ProgressAction&& on_progress,
-                    DownloadAction&& on_download, ErrorAction&& on_error, const std::atomic_bool& abort_download,
-                    const bool force_cache = false)
+using BookTransfer = std::function<std::chrono::steady_clock::duration(qint64 bytes)>;
+
+/*
+ * Has read, which returns how much it took, take in what the reply brings, but not before book_transfer allows for what
+ * was taken the last time. Nothing sleeps: while reading is held off, data waits in the reply's read buffer, which is
+ * kept small under a bandwidth limit so that Qt stops taking more off the socket. The download timeout is stopped
+ * meanwhile, as it is not the server that keeps us waiting, and whatever is left when the reply finishes is read
+ * straight away.
+ */
+template <typename Read>
+void connect_paced(QNetworkReply* reply, QTimer& download_timeout, const BookTransfer& book_transfer, Read&& read)
 {
-    QTimer download_timeout;
-    download_timeout.setInterval(timeout);
+    if (!book_transfer)
+    {
+        QObject::connect(reply, &QNetworkReply::readyRead, std::forward<Read>(read));
+        return;
+    }
+
+    auto hold_off = new QTimer{reply};
+    hold_off->setSingleShot(true);
+    auto data_waiting = std::make_shared<bool>(false);
+
+    auto read_available = [hold_off, data_waiting, &download_timeout, book_transfer,
+                           read = std::function<qint64()>{std::forward<Read>(read)}] {
+        *data_waiting = hold_off->isActive();
+        if (*data_waiting)
+            return;
+
+        if (const auto delay = book_transfer(read()); delay > delay.zero())
+        {
+            download_timeout.stop();
+            hold_off->start(std::chrono::ceil<std::chrono::milliseconds>(delay));
+        }
+    };
+
+    auto resume = [reply, hold_off, data_waiting, &download_timeout, read_available] {
+        hold_off->stop();
+        if (reply->error() != QNetworkReply::NoError)
+            return;
+
+        download_timeout.start();
+        if (std::exchange(*data_waiting, false) || reply->bytesAvailable() > 0)
+            read_available();
+    };
 
+    QObject::connect(reply, &QNetworkReply::readyRead, read_available);
+    QObject::connect(hold_off, &QTimer::timeout, resume);
+    QObject::connect(reply, &QNetworkReply::finished, [hold_off, resume] {
+        if (hold_off->isActive())
+            resume();
+    });
+}
+
+QNetworkRequest make_request(const QUrl& url)
+{
     QNetworkRequest request{url};
     request.setRawHeader("Connection", "Keep-Alive");
     request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
     request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
-    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute,
-                         force_cache ? QNetworkRequest::AlwaysCache : QNetworkRequest::PreferNetwork);
     request.setHeader(
         QNetworkRequest::UserAgentHeader,
         QString::fromStdString(fmt::format("Multipass/{} ({}; {})", multipass::version_string,
                                            mp::platform::host_version(), QSysInfo::currentCpuArchitecture())));
 
+    return request;
+}
+
+// on_download returns how much it took from the reply, which is what the bandwidth limit is kept by
+template <typename ProgressAction, typename DownloadAction, typename ErrorAction, typename Time>
+QByteArray download(QNetworkAccessManager* manager, const Time& timeout, QUrl const& url, ProgressAction&& on_progress,
+                    DownloadAction&& on_download, ErrorAction&& on_error, const std::atomic_bool& abort_download,
+                    const RawHeaders& raw_headers = {}, const bool force_cache = false,
+                    const qint64 read_buffer_size = 0, const BookTransfer& book_transfer = {})
+{
+    QTimer download_timeout;
+    download_timeout.setInterval(timeout);
+
+    auto request = make_request(url);
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute,
+                         force_cache           ? QNetworkRequest::AlwaysCache
+                         : raw_headers.empty() ? QNetworkRequest::PreferNetwork
+                                               : QNetworkRequest::AlwaysNetwork);
+    for (const auto& [header, value] : raw_headers)
+        request.setRawHeader(header, value);
+
     NetworkReplyUPtr reply{manager->get(request)};
+    reply->setReadBufferSize(read_buffer_size);
 
     QObject::connect(reply.get(), &QNetworkReply::downloadProgress, [&](qint64 bytes_received, qint64 bytes_total) {
         on_progress(reply.get(), bytes_received, bytes_total);
     });
-    QObject::connect(reply.get(), &QNetworkReply::readyRead, [&]() { on_download(reply.get(), download_timeout); });
+    connect_paced(reply.get(), download_timeout, book_transfer,
+                  [&]() { return on_download(reply.get(), download_timeout); });
 
     wait_for_reply(reply.get(), download_timeout);
 
@@ -119,7 +274,8 @@ QByteArray download(QNetworkAccessManager* manager, const Time& timeout, QUrl co
         {
             mpl::log(mpl::Level::warning, category,
                      fmt::format("Error getting {}: {} - trying cache.", url.toString(), msg));
-            return ::download(manager, timeout, url, on_progress, on_download, on_error, abort_download, true);
+            return ::download(manager, timeout, url, on_progress, on_download, on_error, abort_download, {}, true,
+                              read_buffer_size, book_transfer);
         }
     }
 
@@ -155,6 +311,217 @@ auto get_header(QNetworkAccessManager* manager, const QUrl& url, const QNetworkR
 
     return reply->header(header);
 }
+
+// What ranged requests need to know about a resource up front
+struct RangedResource
+{
+    qint64 length;
+    QByteArray validator; // sent in If-Range, so that no range comes from a different version of the resource
+};
+
+// The resource, if the server accepts byte ranges for it and tells us how to recognise the version we started on
+template <typename Time>
+std::optional<RangedResource> ranged_resource(QNetworkAccessManager* manager, const QUrl& url, const Time& timeout)
+{
+    QTimer download_timeout;
+    download_timeout.setInterval(timeout);
+
+    auto request = make_request(url);
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+
+    NetworkReplyUPtr reply{manager->head(request)};
+
+    wait_for_reply(reply.get(), download_timeout);
+
+    const auto length = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    auto validator = validator_for(reply.get());
+    if (reply->error() != QNetworkReply::NoError || reply->rawHeader("Accept-Ranges") != "bytes" || length <= 0 ||
+        validator.isEmpty())
+        return std::nullopt;
+
+    return RangedResource{length, std::move(validator)};
+}
+
+/*
+ * Fetches [0, length) in concurrent ranged requests, each writing at its own offset. The segments all run on this
+ * thread's event loop, so seeking before each write is as good as a positional write. Returns false if the server did
+ * not honour the ranges or a segment failed, in which case the caller should start over in a single stream.
+ *
+ * Every range carries If-Range with the validator from the HEAD request. Should the resource change in the meantime,
+ * the server answers with the whole new version (200) instead of a piece of it, so that versions are never mixed.
+ *
+ * The hash is fed in file order: data that extends the hashed prefix goes straight in, and the rest is read back from
+ * the file (most likely still in the page cache) as soon as the gap before it is filled.
+ */
+template <typename ProgressAction, typename Time>
+bool download_ranges(QNetworkAccessManager* manager, const Time& timeout, const QUrl& url,
+                     const RangedResource& resource, QFile& file, mp::Sha256Hash& hash, ProgressAction&& on_progress,
+                     std::atomic_bool& abort_download, const std::atomic_bool& abort_downloads)
+{
+    struct Segment
+    {
+        qint64 next_offset;
+        qint64 last_offset;
+        NetworkReplyUPtr reply;
+        std::unique_ptr<QTimer> download_timeout;
+    };
+
+    const auto length = resource.length;
+    const auto expected_length = QByteArray::fromStdString(fmt::format("/{}", length));
+    const auto segment_count = static_cast<int>(std::clamp(length / min_segment_size, qint64{1}, qint64{max_segments}));
+    const auto segment_size = (length + segment_count - 1) / segment_count;
+
+    std::vector<Segment> segments(segment_count);
+    QEventLoop event_loop;
+    auto pending = segment_count;
+    auto failed = false;
+    qint64 bytes_received = 0;
+    qint64 bytes_hashed = 0;
+
+    auto contiguous_bytes = [&segments, length] {
+        for (const auto& segment : segments)
+            if (segment.next_offset <= segment.last_offset)
+                return segment.next_offset;
+
+        return length;
+    };
+
+    auto abort_all = [&segments] {
+        for (auto& segment : segments)
+            if (segment.reply && !segment.reply->isFinished())
+                segment.reply->abort();
+    };
+
+    auto fail = [&failed, &abort_all](const std::string& reason) {
+        if (!failed)
+            mpl::log(mpl::Level::warning, category, fmt::format("Ranged download failed: {}", reason));
+
+        failed = true;
+        abort_all();
+    };
+
+    if (!MP_FILEOPS.resize(file, length))
+        return false;
+
+    for (auto i = 0; i < segment_count; ++i)
+    {
+        auto& segment = segments[i];
+        segment.next_offset = i * segment_size;
+        segment.last_offset = std::min(segment.next_offset + segment_size, length) - 1;
+        segment.download_timeout = std::make_unique<QTimer>();
+        segment.download_timeout->setInterval(timeout);
+
+        auto request = make_request(url);
+        request.setRawHeader("Range", QByteArray::fromStdString(
+                                          fmt::format("bytes={}-{}", segment.next_offset, segment.last_offset)));
+        request.setRawHeader("If-Range", resource.validator);
+        request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+        request.setAttribute(QNetworkRequest::CacheSaveControlAttribute, false);
+
+        segment.reply.reset(manager->get(request));
+        auto reply = segment.reply.get();
+
+        QObject::connect(reply, &QNetworkReply::readyRead, [&, reply, &segment = segment] {
+            if (abort_download || abort_downloads)
+            {
+                abort_download = true;
+                abort_all();
+                return;
+            }
+
+            const auto status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+            if (status == 200)
+                return fail("the resource changed on the server");
+
+            if (status != 206 || !reply->rawHeader("Content-Range").endsWith(expected_length))
+                return fail("the server ignored the requested range");
+
+            const auto data = reply->readAll();
+            if (segment.next_offset + data.size() > segment.last_offset + 1)
+                return fail("the server sent more than the requested range");
+
+            if (!MP_FILEOPS.seek(file, segment.next_offset) || MP_FILEOPS.write(file, data) < 0)
+            {
+                mpl::log(mpl::Level::error, category, fmt::format("error writing image: {}", file.errorString()));
+                abort_download = true;
+                abort_all();
+                return;
+            }
+
+            if (segment.next_offset == bytes_hashed)
+            {
+                hash.add_data(data);
+                bytes_hashed += data.size();
+            }
+
+            segment.next_offset += data.size();
+            bytes_received += data.size();
+
+            if (const auto end = contiguous_bytes(); end > bytes_hashed)
+            {
+                if (!hash_file_range(file, bytes_hashed, end, hash))
+                {
+                    mpl::log(mpl::Level::error, category, fmt::format("error reading image: {}", file.errorString()));
+                    abort_download = true;
+                    abort_all();
+                    return;
+                }
+
+                bytes_hashed = end;
+            }
+
+            segment.download_timeout->start();
+
+            if (!on_progress(bytes_received, length))
+            {
+                abort_download = true;
+                abort_all();
+            }
+        });
+
+        QObject::connect(reply, &QNetworkReply::finished, [&, reply, &segment = segment] {
+            segment.download_timeout->stop();
+
+            if (reply->error() != QNetworkReply::NoError && !abort_download)
+                fail(reply->errorString().toStdString());
+
+            if (--pending == 0)
+                event_loop.quit();
+        });
+
+        QObject::connect(segment.download_timeout.get(), &QTimer::timeout, [&fail] { fail("network timeout"); });
+        segment.download_timeout->start();
+    }
+
+    event_loop.exec();
+
+    if (abort_download)
+        throw mp::AbortedDownloadException{"Download aborted"};
+
+    return !failed && std::all_of(segments.cbegin(), segments.cend(), [](const auto& segment) {
+        return segment.next_offset == segment.last_offset + 1;
+    });
+}
+// The reporter returns whether to carry on
+auto make_progress_reporter(const mp::ProgressMonitor& monitor, const int download_type, const int64_t size,
+                            const std::atomic_bool& abort_downloads)
+{
+    return [&monitor, download_type, size, &abort_downloads,
+            last_progress_printed = -1](qint64 bytes_received, qint64 bytes_total) mutable {
+        if (bytes_received == 0)
+            return true;
+
+        if (bytes_total == -1 && size > 0)
+            bytes_total = size;
+
+        auto progress = (size < 0) ? size : (100 * bytes_received + bytes_total / 2) / bytes_total;
+
+        auto carry_on = !abort_downloads && (last_progress_printed == progress || monitor(download_type, progress));
+        last_progress_printed = progress;
+
+        return carry_on;
+    };
+}
 } // namespace
 
 mp::NetworkManagerFactory::NetworkManagerFactory(const Singleton<NetworkManagerFactory>::PrivatePass& pass) noexcept
@@ -177,61 +544,420 @@ mp::URLDownloader::URLDownloader(const mp::Path& cache_dir, std::chrono::millise
 {
 }
 
-void mp::URLDownloader::download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+QStringList mp::URLDownloader::partial_download_files(const QString& dir_path)
+{
+    QStringList files;
+    const QStringList patterns{QString{"*"} + partial_suffix, QString{"*"} + journal_suffix};
+    for (const auto& entry : QDir{dir_path}.entryInfoList(patterns, QDir::Files | QDir::Hidden))
+        files << entry.absoluteFilePath();
+
+    return files;
+}
+
+/*
+ * The download goes to a ".part" file next to file_name, which is only moved into place once complete. When the
+ * download fails or is aborted and the server gave us a validator for the resource, the partial file is kept along with
+ * a small journal, so that a later download of the same URL to the same place can ask for the rest with If-Range.
+ *
+ * The file is hashed as it is written, so callers can verify it without reading it all back.
+ */
+QString mp::URLDownloader::download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
                                     const mp::ProgressMonitor& monitor)
 {
     std::atomic_bool abort_download{false};
     auto manager{MP_NETMGRFACTORY.make_network_manager(cache_dir_path)};
 
-    QFile file{file_name};
-    file.open(QIODevice::ReadWrite | QIODevice::Truncate);
+    const auto journal_name = file_name + journal_suffix;
+    QFile file{file_name + partial_suffix};
+    PartialDownload partial{url.toString(), {}, 0};
+    RawHeaders resume_headers;
+    mp::Sha256Hash hash;
 
-    auto progress_monitor = [this, &abort_download, &monitor, download_type,
-                             size](QNetworkReply* reply, qint64 bytes_received, qint64 bytes_total) {
-        static int last_progress_printed = -1;
-        if (bytes_received == 0)
+    // Whatever is already there gets hashed up front; resumes are rare enough for that read to be worth it
+    if (auto journal = read_journal(journal_name); journal && journal->url == partial.url &&
+                                                   QFileInfo{file}.size() >= journal->bytes &&
+                                                   file.open(QIODevice::ReadWrite) &&
+                                                   hash_file_range(file, 0, journal->bytes, hash))
+    {
+        partial = *journal;
+        resume_headers = {{"Range", QByteArray::fromStdString(fmt::format("bytes={}-", partial.bytes))},
+                          {"If-Range", partial.validator}};
+
+        MP_FILEOPS.resize(file, partial.bytes); // drop anything written after the journal was last updated
+    }
+    else
+    {
+        file.close();
+        file.open(QIODevice::ReadWrite | QIODevice::Truncate);
+        hash.reset();
+    }
+
+    const auto resume_from = partial.bytes;
+    const auto expected_range = QByteArray::fromStdString(fmt::format("bytes {}-", resume_from));
+    auto resume_pending = resume_from > 0;
+    QNetworkReply* current_reply = nullptr;
+    qint64 reply_offset = 0; // where the data of the current reply starts in the file
+    qint64 journalled_bytes = 0;
+    auto discard_partial = false;
+
+    // Decides, once per reply, whether the reply continues the partial file or replaces it
+    auto start_reply = [&](QNetworkReply* reply) {
+        if (reply == current_reply)
             return;
 
-        if (bytes_total == -1 && size > 0)
-            bytes_total = size;
+        current_reply = reply;
+        const auto resumed = std::exchange(resume_pending, false) &&
+                             reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 206 &&
+                             reply->rawHeader("Content-Range").startsWith(expected_range);
 
-        auto progress = (size < 0) ? size : (100 * bytes_received + bytes_total / 2) / bytes_total;
+        if (resumed)
+        {
+            mpl::log(mpl::Level::info, category,
+                     fmt::format("Resuming download of {} from byte {}", url.toString(), resume_from));
+        }
+        else
+        {
+            if (partial.bytes > 0)
+            {
+                mpl::log(mpl::Level::debug, category, fmt::format("Downloading {} from the start", url.toString()));
+                MP_FILEOPS.resize(file, 0);
+                MP_FILEOPS.seek(file, 0);
+                hash.reset();
+            }
 
-        abort_download = abort_downloads || (last_progress_printed != progress && !monitor(download_type, progress));
-        last_progress_printed = progress;
+            partial.bytes = 0;
+            partial.validator = validator_for(reply);
+        }
 
-        if (abort_download)
+        reply_offset = partial.bytes;
+    };
+
+    auto save_journal = [&] {
+        file.flush();
+        if (write_journal(journal_name, partial))
+            journalled_bytes = partial.bytes;
+    };
+
+    auto report_progress = make_progress_reporter(monitor, download_type, size, abort_downloads);
+
+    // Progress covers the whole file, including whatever an earlier attempt left behind
+    auto progress_monitor = [&](QNetworkReply* reply, qint64 bytes_received, qint64 bytes_total) {
+        start_reply(reply);
+
+        if (!report_progress(reply_offset + bytes_received, bytes_total < 0 ? bytes_total : reply_offset + bytes_total))
         {
+            abort_download = true;
             reply->abort();
         }
     };
 
-    auto on_download = [this, &abort_download, &file](QNetworkReply* reply, QTimer& download_timeout) {
+    auto on_download = [&](QNetworkReply* reply, QTimer& download_timeout) -> qint64 {
         abort_download = abort_download || abort_downloads;
 
         if (abort_download)
         {
             reply->abort();
-            return;
+            return qint64{0};
         }
 
         if (download_timeout.isActive())
             download_timeout.stop();
         else
-            return;
+            return qint64{0};
+
+        start_reply(reply);
 
-        if (MP_FILEOPS.write(file, reply->readAll()) < 0)
+        const auto data = reply->readAll();
+        if (MP_FILEOPS.write(file, data) < 0)
         {
             mpl::log(mpl::Level::error, category, fmt::format("error writing image: {}", file.errorString()));
             abort_download = true;
+            discard_partial = true;
             reply->abort();
         }
+        else
+        {
+            hash.add_data(data);
+            partial.bytes += data.size();
+            if (!partial.validator.isEmpty() && partial.bytes - journalled_bytes >= journal_interval)
+                save_journal();
+        }
+
         download_timeout.start();
+        return data.size();
+    };
+
+    auto on_error = [&] {
+        if (discard_partial || partial.validator.isEmpty() || partial.bytes == 0)
+        {
+            file.remove();
+            QFile::remove(journal_name);
+            return;
+        }
+
+        save_journal();
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Keeping {} bytes of {} to resume the download later", partial.bytes, url.toString()));
+    };
+
+    auto finish = [&] {
+        file.close();
+        QFile::remove(file_name);
+
+        if (!MP_FILEOPS.rename(file, file_name))
+            throw mp::DownloadException{url.toString().toStdString(),
+                                        fmt::format("cannot move download into place: {}", file.errorString())};
+
+        QFile::remove(journal_name);
+
+        return hash.hex_result();
+    };
+
+    // Resuming takes precedence: the ranges would not know what is already there. Neither would parallel ranges gain
+    // anything under a bandwidth limit.
+    if (size >= ranged_download_threshold && resume_headers.empty() && bandwidth_limit == 0)
+    {
+        if (auto resource = ranged_resource(manager.get(), url, timeout))
+        {
+            try
+            {
+                if (download_ranges(manager.get(), timeout, url, *resource, file, hash, report_progress,
+                                    abort_download, abort_downloads))
+                    return finish();
+            }
+            catch (const mp::AbortedDownloadException&)
+            {
+                on_error();
+                throw;
+            }
+
+            mpl::log(mpl::Level::info, category,
+                     fmt::format("Downloading {} again in a single stream", url.toString()));
+            MP_FILEOPS.resize(file, 0);
+            MP_FILEOPS.seek(file, 0);
+            hash.reset();
+        }
+    }
+
+    ::download(manager.get(), timeout, url, progress_monitor, on_download, on_error, abort_download, resume_headers,
+               false, read_buffer_size(), pacing());
+    return finish();
+}
+
+/*
+ * Nothing compressed is written: the data goes straight through the decoder, so decoding overlaps with the download.
+ * There is no partial file to resume from, so a failed download leaves nothing behind and starts over next time.
+ */
+QString mp::URLDownloader::download_decoded_to(const QUrl& url, const QString& decoded_file_name, int64_t size,
+                                               const int download_type, const ProgressMonitor& monitor)
+{
+    std::atomic_bool abort_download{false};
+    auto manager{MP_NETMGRFACTORY.make_network_manager(cache_dir_path)};
+
+    std::unique_ptr<mp::StreamDecoder> decoder;
+    mp::Sha256Hash hash;
+    QNetworkReply* current_reply = nullptr;
+
+    auto report_progress = make_progress_reporter(monitor, download_type, size, abort_downloads);
+
+    auto progress_monitor = [&abort_download, &report_progress](QNetworkReply* reply, qint64 bytes_received,
+                                                                qint64 bytes_total) {
+        if (!report_progress(bytes_received, bytes_total))
+        {
+            abort_download = true;
+            reply->abort();
+        }
+    };
+
+    auto on_download = [&](QNetworkReply* reply, QTimer& download_timeout) {
+        abort_download = abort_download || abort_downloads;
+
+        if (abort_download)
+        {
+            reply->abort();
+            return qint64{0};
+        }
+
+        if (download_timeout.isActive())
+            download_timeout.stop();
+        else
+            return qint64{0};
+
+        qint64 bytes_taken{0};
+        try
+        {
+            // A reply that follows a failed one (e.g. from the cache) brings the whole stream again
+            if (reply != current_reply)
+            {
+                current_reply = reply;
+                decoder.reset();
+                decoder = mp::vault::make_stream_decoder(url.path(), decoded_file_name);
+                hash.reset();
+            }
+
+            const auto data = reply->readAll();
+            bytes_taken = data.size();
+            hash.add_data(data);
+            decoder->feed(data.constData(), data.size());
+        }
+        catch (const std::runtime_error& e)
+        {
+            mpl::log(mpl::Level::error, category, fmt::format("error decoding image: {}", e.what()));
+            abort_download = true;
+            reply->abort();
+        }
+
+        download_timeout.start();
+        return bytes_taken;
+    };
+
+    auto on_error = [&decoder, &decoded_file_name] {
+        decoder.reset();
+        QFile::remove(decoded_file_name);
+    };
+
+    ::download(manager.get(), timeout, url, progress_monitor, on_download, on_error, abort_download, {}, false,
+               read_buffer_size(), pacing());
+
+    try
+    {
+        if (!decoder)
+            decoder = mp::vault::make_stream_decoder(url.path(), decoded_file_name);
+
+        decoder->finish();
+    }
+    catch (const std::runtime_error& e)
+    {
+        on_error();
+        throw mp::DownloadException{url.toString().toStdString(), e.what()};
+    }
+
+    return hash.hex_result();
+}
+
+/*
+ * Up to max_segments ranges are in flight at a time, each written where it belongs in the file. Nothing is hashed: the
+ * caller has the rest of the file and checks all of it once the ranges are in.
+ */
+void mp::URLDownloader::download_ranges_to(const QUrl& url, const QString& file_name,
+                                           const std::vector<std::pair<qint64, qint64>>& ranges,
+                                           const int download_type, const ProgressMonitor& monitor)
+{
+    std::atomic_bool abort_download{false};
+    auto manager{MP_NETMGRFACTORY.make_network_manager(cache_dir_path)};
+
+    QFile file{file_name};
+    if (!file.open(QIODevice::ReadWrite))
+        throw mp::DownloadException{url.toString().toStdString(),
+                                    fmt::format("cannot open {}: {}", file_name, file.errorString())};
+
+    const auto total = std::accumulate(ranges.cbegin(), ranges.cend(), qint64{0},
+                                       [](qint64 sum, const auto& range) { return sum + range.second; });
+    auto report_progress = make_progress_reporter(monitor, download_type, total, abort_downloads);
+
+    QEventLoop event_loop;
+    auto next_range = ranges.cbegin();
+    auto in_flight = 0;
+    qint64 bytes_received = 0;
+    std::string failure;
+
+    auto abort_all = [&manager] {
+        for (auto reply : manager->findChildren<QNetworkReply*>())
+            if (!reply->isFinished())
+                reply->abort();
     };
 
-    auto on_error = [&file]() { file.remove(); };
+    auto fail = [&failure, &abort_all](const std::string& reason) {
+        if (failure.empty())
+            failure = reason;
+
+        abort_all();
+    };
+
+    const auto book_transfer = pacing();
+    std::function<void()> start_ranges = [&] {
+        while (failure.empty() && !abort_download && next_range != ranges.cend() && in_flight < max_segments)
+        {
+            const auto [offset, length] = *next_range++;
+            const auto end = offset + length;
+
+            auto request = make_request(url);
+            request.setRawHeader("Range", QByteArray::fromStdString(fmt::format("bytes={}-{}", offset, end - 1)));
+            request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+            request.setAttribute(QNetworkRequest::CacheSaveControlAttribute, false);
+
+            auto reply = manager->get(request);
+            reply->setReadBufferSize(read_buffer_size());
+            auto download_timeout = new QTimer{reply};
+            auto next_offset = std::make_shared<qint64>(offset);
+            ++in_flight;
+
+            auto read_range = [&, reply, download_timeout, next_offset, end]() -> qint64 {
+                if (abort_download || abort_downloads)
+                {
+                    abort_download = true;
+                    abort_all();
+                    return qint64{0};
+                }
+
+                if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 206)
+                {
+                    fail("the server ignored the requested range");
+                    return qint64{0};
+                }
+
+                const auto data = reply->readAll();
+                if (*next_offset + data.size() > end)
+                    fail("the server sent more than the requested range");
+                else if (!MP_FILEOPS.seek(file, *next_offset) || MP_FILEOPS.write(file, data) < 0)
+                    fail(fmt::format("error writing image: {}", file.errorString()));
+                else
+                {
+                    *next_offset += data.size();
+                    bytes_received += data.size();
+                    download_timeout->start();
+
+                    if (!report_progress(bytes_received, total))
+                    {
+                        abort_download = true;
+                        abort_all();
+                    }
+                }
 
-    ::download(manager.get(), timeout, url, progress_monitor, on_download, on_error, abort_download);
+                return data.size();
+            };
+
+            connect_paced(reply, *download_timeout, book_transfer, read_range);
+
+            QObject::connect(reply, &QNetworkReply::finished, [&, reply, download_timeout, next_offset, end] {
+                download_timeout->stop();
+
+                if (reply->error() != QNetworkReply::NoError && !abort_download)
+                    fail(reply->errorString().toStdString());
+                else if (*next_offset != end && !abort_download)
+                    fail("the server sent less than the requested range");
+
+                --in_flight;
+                start_ranges();
+                if (in_flight == 0)
+                    event_loop.quit();
+            });
+
+            QObject::connect(download_timeout, &QTimer::timeout, [&fail] { fail("Network timeout"); });
+            download_timeout->setInterval(timeout);
+            download_timeout->start();
+        }
+    };
+
+    start_ranges();
+    if (in_flight > 0)
+        event_loop.exec();
+
+    if (abort_download)
+        throw mp::AbortedDownloadException{"Download aborted"};
+
+    if (!failure.empty())
+        throw mp::DownloadException{url.toString().toStdString(), failure};
 }
 
 QByteArray mp::URLDownloader::download(const QUrl& url)
@@ -244,16 +970,69 @@ QByteArray mp::URLDownloader::download(const QUrl& url)
         if (abort_downloads)
         {
             reply->abort();
-            return;
+            return qint64{0};
         }
 
         download_timeout.start();
+        return qint64{0};
     };
 
     return ::download(
         manager.get(), timeout, url, [](QNetworkReply*, qint64, qint64) {}, on_download, [] {}, abort_downloads);
 }
 
+/*
+ * Asks the network directly rather than letting Qt revalidate its cache, which would answer a 304 with the cached body.
+ * That still falls back to the cache when the network fails, as download does.
+ */
+std::optional<QByteArray> mp::URLDownloader::download_if_modified(const QUrl& url, HttpValidators& validators)
+{
+    auto manager{MP_NETMGRFACTORY.make_network_manager(cache_dir_path)};
+
+    QTimer download_timeout;
+    download_timeout.setInterval(timeout);
+
+    auto request = make_request(url);
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+    if (!validators.etag.isEmpty())
+        request.setRawHeader("If-None-Match", validators.etag);
+    if (!validators.last_modified.isEmpty())
+        request.setRawHeader("If-Modified-Since", validators.last_modified);
+
+    NetworkReplyUPtr reply{manager->get(request)};
+    QObject::connect(reply.get(), &QNetworkReply::readyRead, [this, &reply, &download_timeout]() {
+        if (abort_downloads)
+            reply->abort();
+        else
+            download_timeout.start();
+    });
+
+    wait_for_reply(reply.get(), download_timeout);
+
+    if (reply->error() != QNetworkReply::NoError)
+    {
+        const auto msg = download_timeout.isActive() ? reply->errorString().toStdString() : "Network timeout";
+
+        if (reply->error() == QNetworkReply::ProxyAuthenticationRequiredError || abort_downloads)
+            throw mp::AbortedDownloadException{msg};
+
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Error getting {}: {} - trying cache.", url.toString(), msg));
+        return ::download(
+            manager.get(), timeout, url, [](QNetworkReply*, qint64, qint64) {},
+            [](QNetworkReply*, QTimer&) { return qint64{0}; }, [] {}, abort_downloads, {}, true);
+    }
+
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304)
+    {
+        mpl::log(mpl::Level::trace, category, fmt::format("{} is not modified", url.toString()));
+        return std::nullopt;
+    }
+
+    validators = {reply->rawHeader("ETag"), reply->rawHeader("Last-Modified")};
+    return reply->readAll();
+}
+
 QDateTime mp::URLDownloader::last_modified(const QUrl& url)
 {
     auto manager{MP_NETMGRFACTORY.make_network_manager(cache_dir_path)};
@@ -265,3 +1044,41 @@ void mp::URLDownloader::abort_all_downloads()
 {
     abort_downloads = true;
 }
+
+void mp::URLDownloader::set_bandwidth_limit(qint64 bytes_per_second)
+{
+    bandwidth_limit = std::max(bytes_per_second, qint64{0});
+}
+
+qint64 mp::URLDownloader::read_buffer_size() const
+{
+    return bandwidth_limit > 0 ? throttled_read_buffer_size : 0;
+}
+
+auto mp::URLDownloader::pacing() -> std::function<std::chrono::steady_clock::duration(qint64)>
+{
+    if (bandwidth_limit <= 0)
+        return {};
+
+    return [this](qint64 bytes) { return book_transfer(bytes); };
+}
+
+/*
+ * Every download books the time its data takes at the limit on a shared timeline, and holds off reading until its
+ * booking ends. Idle time is not banked, so the limit holds from the first byte after a pause.
+ */
+std::chrono::steady_clock::duration mp::URLDownloader::book_transfer(qint64 bytes)
+{
+    const auto limit = bandwidth_limit.load();
+    if (limit <= 0 || bytes <= 0)
+        return {};
+
+    const auto transfer_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>{static_cast<double>(bytes) / limit});
+
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<decltype(booking_mutex)> lock{booking_mutex};
+    next_transfer_time = std::max(next_transfer_time, now) + transfer_time;
+
+    return next_transfer_time - now;
+}
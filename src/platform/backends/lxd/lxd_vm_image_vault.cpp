@@ -80,7 +80,7 @@ QString post_process_downloaded_image(const QString& image_path, const mp::Progr
 {
     QString new_image_path{image_path};
 
-    if (image_path.endsWith(".xz"))
+    if (!mp::vault::compression_suffix(image_path).isEmpty())
     {
         new_image_path = mp::vault::extract_image(image_path, monitor, true);
     }
@@ -436,6 +436,12 @@ void mp::LXDVMImageVault::update_images(const FetchType& fetch_type, const Prepa
     }
 }
 
+void mp::LXDVMImageVault::scrub_images(const FetchType& /*fetch_type*/, const PrepareAction& /*prepare*/,
+                                       const ProgressMonitor& /*monitor*/)
+{
+    // LXD verifies the images it stores itself
+}
+
 mp::MemorySize mp::LXDVMImageVault::minimum_image_size_for(const std::string& id)
 {
     MemorySize lxd_image_size{"10G"};
@@ -460,6 +466,31 @@ mp::MemorySize mp::LXDVMImageVault::minimum_image_size_for(const std::string& id
     return lxd_image_size;
 }
 
+void mp::LXDVMImageVault::flatten(const std::string& /*name*/)
+{
+    // LXD manages instance storage itself, so instances never depend on files in this vault
+}
+
+std::vector<mp::VMImage> mp::LXDVMImageVault::cached_images()
+{
+    return {}; // LXD keeps its images to itself
+}
+
+void mp::LXDVMImageVault::set_size_budget(const MemorySize& /*size_budget*/)
+{
+    // LXD manages the space its images take
+}
+
+void mp::LXDVMImageVault::set_max_downloads(int /*max_downloads*/)
+{
+    // LXD downloads its images itself
+}
+
+mp::ImageCacheUsage mp::LXDVMImageVault::cache_usage()
+{
+    return {};
+}
+
 void mp::LXDVMImageVault::lxd_download_image(const VMImageInfo& info, const Query& query,
                                              const ProgressMonitor& monitor, const QString& last_used)
 {
@@ -503,12 +534,13 @@ void mp::LXDVMImageVault::url_download_image(const VMImageInfo& info, const QStr
 {
     mp::vault::DeleteOnException image_file{image_path};
 
-    url_downloader->download_to(info.image_location, image_path, info.size, LaunchProgress::IMAGE, monitor);
+    const auto download_hash =
+        url_downloader->download_to(info.image_location, image_path, info.size, LaunchProgress::IMAGE, monitor);
 
     if (info.verify)
     {
         monitor(LaunchProgress::VERIFY, -1);
-        mp::vault::verify_image_download(image_path, info.id);
+        mp::vault::verify_image_download(image_path, info.id, download_hash);
     }
 }
 
@@ -47,7 +47,14 @@ public:
     void prune_expired_images() override;
     void update_images(const FetchType& fetch_type, const PrepareAction& prepare,
                        const ProgressMonitor& monitor) override;
+    void scrub_images(const FetchType& fetch_type, const PrepareAction& prepare,
+                      const ProgressMonitor& monitor) override;
     MemorySize minimum_image_size_for(const std::string& id) override;
+    void flatten(const std::string& name) override;
+    std::vector<VMImage> cached_images() override;
+    void set_size_budget(const MemorySize& size_budget) override;
+    void set_max_downloads(int max_downloads) override;
+    ImageCacheUsage cache_usage() override;
 
 private:
     void lxd_download_image(const VMImageInfo& info, const Query& query, const ProgressMonitor& monitor,
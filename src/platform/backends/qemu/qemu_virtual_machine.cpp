@@ -620,7 +620,7 @@ void mp::QemuVirtualMachine::resize_disk(const MemorySize& new_size)
 {
     assert(new_size > desc.disk_space);
 
-    mp::backend::resize_instance_image(new_size, desc.image.image_path);
+    mp::backend::resize_instance_image(new_size, desc.image.image_path, desc.image.backing_path);
     desc.disk_space = new_size;
 }
 
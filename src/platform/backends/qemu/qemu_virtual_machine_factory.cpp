@@ -18,10 +18,12 @@
 #include "qemu_virtual_machine_factory.h"
 #include "qemu_virtual_machine.h"
 
+#include <multipass/constants.h>
 #include <multipass/format.h>
 #include <multipass/logging/log.h>
 #include <multipass/platform.h>
 #include <multipass/process/simple_process_spec.h>
+#include <multipass/settings/settings.h>
 #include <multipass/virtual_machine_description.h>
 
 #include <shared/qemu_img_utils/qemu_img_utils.h>
@@ -62,7 +64,12 @@ mp::VMImage mp::QemuVirtualMachineFactory::prepare_source_image(const mp::VMImag
 void mp::QemuVirtualMachineFactory::prepare_instance_image(const mp::VMImage& instance_image,
                                                            const VirtualMachineDescription& desc)
 {
-    mp::backend::resize_instance_image(desc.disk_space, instance_image.image_path);
+    mp::backend::resize_instance_image(desc.disk_space, instance_image.image_path, instance_image.backing_path);
+}
+
+bool mp::QemuVirtualMachineFactory::use_backing_images() const
+{
+    return MP_SETTINGS.get_as<bool>(mp::thin_disks_key);
 }
 
 void mp::QemuVirtualMachineFactory::hypervisor_health_check()
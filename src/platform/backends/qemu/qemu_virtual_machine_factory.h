@@ -43,6 +43,9 @@ public:
     QString get_backend_directory_name() override;
     std::vector<NetworkInterfaceInfo> networks() const override;
 
+protected:
+    bool use_backing_images() const override;
+
 private:
     QemuPlatform::UPtr qemu_platform;
 };
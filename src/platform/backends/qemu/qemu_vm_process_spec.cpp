@@ -175,9 +175,10 @@ profile %1 flags=(attach_disconnected) {
   # Disk images
   %6 rwk,  # QCow2 filesystem image
   %7 rk,   # cloud-init ISO
+  %8
 
   # allow full access just to user-specified mount directories on the host
-  %8
+  %9
 }
     )END");
 
@@ -186,6 +187,10 @@ profile %1 flags=(attach_disconnected) {
     QString signal_peer; // who can send kill signal to qemu
     QString firmware;    // location of bootloader firmware needed by qemu
     QString mount_dirs;  // directories on host that are mounted
+    QString backing;     // the cached image that the instance image is an overlay on, if any
+
+    if (!desc.image.backing_path.isEmpty())
+        backing = desc.image.backing_path + " rk,  # QCow2 backing image";
 
     for (const auto& [_, mount_data] : mount_args)
     {
@@ -207,7 +212,7 @@ profile %1 flags=(attach_disconnected) {
     }
 
     return profile_template.arg(apparmor_profile_name(), signal_peer, firmware, root_dir, program(),
-                                desc.image.image_path, desc.cloud_init_iso, mount_dirs);
+                                desc.image.image_path, desc.cloud_init_iso, backing, mount_dirs);
 }
 
 QString mp::QemuVMProcessSpec::identifier() const
@@ -55,7 +55,7 @@ public:
                                           const days& days_to_expire) override
     {
         return std::make_unique<DefaultVMImageVault>(image_hosts, downloader, cache_dir_path, data_dir_path,
-                                                     days_to_expire);
+                                                     days_to_expire, use_backing_images());
     };
 
     void configure(VirtualMachineDescription& vm_desc) override;
@@ -66,6 +66,12 @@ public:
     };
 
 protected:
+    // Whether instance images should be qcow2 overlays on the cached images rather than copies of them
+    virtual bool use_backing_images() const
+    {
+        return false;
+    }
+
     std::string create_bridge_with(const NetworkInterfaceInfo& interface) override
     {
         throw NotImplementedOnThisBackendException{"bridge creation"};
@@ -19,6 +19,8 @@
 
 #include <multipass/constants.h>
 #include <multipass/format.h>
+#include <multipass/image_format.h>
+#include <multipass/logging/log.h>
 #include <multipass/memory_size.h>
 #include <multipass/platform.h>
 #include <multipass/process/qemuimg_process_spec.h>
@@ -29,13 +31,43 @@
 #include <QStringList>
 
 namespace mp = multipass;
+namespace mpl = multipass::logging;
 
-void mp::backend::resize_instance_image(const MemorySize& disk_space, const mp::Path& image_path)
+namespace
 {
+constexpr auto category = "qemu-img";
+
+mp::Path convert_raw_to_qcow2(const mp::Path& image_path, const mp::Path& qcow2_path)
+{
+    auto qemuimg_convert_spec = std::make_unique<mp::QemuImgProcessSpec>(
+        QStringList{"convert", "-p", "-O", "qcow2", image_path, qcow2_path}, image_path, qcow2_path);
+    auto qemuimg_convert_process = mp::platform::make_process(std::move(qemuimg_convert_spec));
+    auto process_state = qemuimg_convert_process->execute(mp::image_resize_timeout);
+
+    if (!process_state.completed_successfully())
+    {
+        throw std::runtime_error(
+            fmt::format("Failed to convert image format: qemu-img failed ({}) with output:\n{}",
+                        process_state.failure_message(), qemuimg_convert_process->read_all_standard_error()));
+    }
+
+    return qcow2_path;
+}
+} // namespace
+
+void mp::backend::resize_instance_image(const MemorySize& disk_space, const mp::Path& image_path,
+                                        const mp::Path& backing_path)
+{
+    if (const auto info = mp::probe_image_format(image_path); info && info->virtual_size == disk_space.in_bytes())
+    {
+        mpl::log(mpl::Level::debug, category, fmt::format("{} is already {} bytes", image_path, info->virtual_size));
+        return;
+    }
+
     auto disk_size = QString::number(disk_space.in_bytes()); // format documented in `man qemu-img` (look for "size")
     QStringList qemuimg_parameters{{"resize", image_path, disk_size}};
-    auto qemuimg_process =
-        mp::platform::make_process(std::make_unique<mp::QemuImgProcessSpec>(qemuimg_parameters, "", image_path));
+    auto qemuimg_process = mp::platform::make_process(
+        std::make_unique<mp::QemuImgProcessSpec>(qemuimg_parameters, backing_path, image_path));
 
     auto process_state = qemuimg_process->execute(mp::image_resize_timeout);
     if (!process_state.completed_successfully())
@@ -52,6 +84,14 @@ mp::Path mp::backend::convert_to_qcow_if_necessary(const mp::Path& image_path)
     // TODO: we could support converting from other the image formats that qemu-img can deal with
     const auto qcow2_path{image_path + ".qcow2"};
 
+    // The header usually tells; qemu-img only needs asking about formats that are not read here
+    const auto info = mp::probe_image_format(image_path);
+    if (info && info->format == ImageFormatInfo::Format::qcow2)
+        return image_path;
+
+    if (info && info->format == ImageFormatInfo::Format::raw)
+        return convert_raw_to_qcow2(image_path, qcow2_path);
+
     auto qemuimg_info_spec =
         std::make_unique<mp::QemuImgProcessSpec>(QStringList{"info", "--output=json", image_path}, image_path);
     auto qemuimg_info_process = mp::platform::make_process(std::move(qemuimg_info_spec));
@@ -68,22 +108,7 @@ mp::Path mp::backend::convert_to_qcow_if_necessary(const mp::Path& image_path)
     auto image_record = QJsonDocument::fromJson(QString(image_info).toUtf8(), nullptr).object();
 
     if (image_record["format"].toString() == "raw")
-    {
-        auto qemuimg_convert_spec = std::make_unique<mp::QemuImgProcessSpec>(
-            QStringList{"convert", "-p", "-O", "qcow2", image_path, qcow2_path}, image_path, qcow2_path);
-        auto qemuimg_convert_process = mp::platform::make_process(std::move(qemuimg_convert_spec));
-        process_state = qemuimg_convert_process->execute(mp::image_resize_timeout);
-
-        if (!process_state.completed_successfully())
-        {
-            throw std::runtime_error(
-                fmt::format("Failed to convert image format: qemu-img failed ({}) with output:\n{}",
-                            process_state.failure_message(), qemuimg_convert_process->read_all_standard_error()));
-        }
-        return qcow2_path;
-    }
+        return convert_raw_to_qcow2(image_path, qcow2_path);
     else
-    {
         return image_path;
-    }
 }
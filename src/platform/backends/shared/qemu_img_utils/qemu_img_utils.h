@@ -26,7 +26,9 @@ class MemorySize;
 
 namespace backend
 {
-void resize_instance_image(const MemorySize& disk_space, const multipass::Path& image_path);
+// backing_path is the image that image_path is an overlay on, if any, which qemu-img needs to read
+void resize_instance_image(const MemorySize& disk_space, const multipass::Path& image_path,
+                           const multipass::Path& backing_path = {});
 Path convert_to_qcow_if_necessary(const Path& image_path);
 } // namespace backend
 } // namespace multipass
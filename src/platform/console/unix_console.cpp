@@ -89,6 +89,11 @@ mp::UnixConsole::~UnixConsole()
     }
 }
 
+bool mp::UnixConsole::is_interactive() const
+{
+    return term->is_live();
+}
+
 void mp::UnixConsole::setup_environment()
 {
 }
@@ -39,6 +39,7 @@ public:
     void read_console() override{};
     void write_console() override{};
     void exit_console() override{};
+    bool is_interactive() const override;
 
     static void setup_environment();
 
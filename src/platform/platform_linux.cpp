@@ -59,8 +59,11 @@
 #include <QTextStream>
 
 #include <errno.h>
+#include <linux/fs.h>
 #include <linux/if_arp.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -178,6 +181,66 @@ std::string get_alias_script_path(const std::string& alias)
 
     return aliases_folder.absoluteFilePath(QString::fromStdString(alias)).toStdString();
 }
+
+// Hands each run of data in the source to copy_range(offset, length), skipping holes so that they stay holes
+template <typename CopyRange>
+bool copy_data_runs(int source_fd, off_t size, CopyRange&& copy_range)
+{
+    for (off_t data = 0; data < size;)
+    {
+        data = ::lseek(source_fd, data, SEEK_DATA);
+        if (data < 0)
+            return errno == ENXIO; // only a hole is left
+
+        const auto hole = ::lseek(source_fd, data, SEEK_HOLE);
+        if (hole < 0 || !copy_range(data, hole - data))
+            return false;
+
+        data = hole;
+    }
+
+    return true;
+}
+
+bool copy_with_copy_file_range(int source_fd, int target_fd, off_t size)
+{
+    return copy_data_runs(source_fd, size, [source_fd, target_fd](off_t offset, off_t length) {
+        loff_t source_offset = offset, target_offset = offset;
+        while (length > 0)
+        {
+            const auto copied = ::copy_file_range(source_fd, &source_offset, target_fd, &target_offset, length, 0);
+            if (copied < 0 && errno == EINTR)
+                continue;
+            if (copied <= 0)
+                return false;
+
+            length -= copied;
+        }
+
+        return true;
+    });
+}
+
+bool copy_with_sendfile(int source_fd, int target_fd, off_t size)
+{
+    return copy_data_runs(source_fd, size, [source_fd, target_fd](off_t offset, off_t length) {
+        if (::lseek(target_fd, offset, SEEK_SET) != offset)
+            return false;
+
+        while (length > 0)
+        {
+            const auto sent = ::sendfile(target_fd, source_fd, &offset, length);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+
+            length -= sent;
+        }
+
+        return true;
+    });
+}
 } // namespace
 
 std::unique_ptr<QFile> multipass::platform::detail::find_os_release()
@@ -279,6 +342,27 @@ bool mp::platform::Platform::link(const char* target, const char* link) const
     return ::link(target, link) == 0;
 }
 
+bool mp::platform::Platform::copy_file_data(int source_fd, int target_fd) const
+{
+    struct stat source_stat;
+    if (::fstat(source_fd, &source_stat) != 0 || !S_ISREG(source_stat.st_mode))
+        return false;
+
+    // A reflink shares the source's extents, so nothing is copied at all (btrfs, XFS)
+    if (::ioctl(target_fd, FICLONE, source_fd) == 0)
+        return true;
+
+    // Otherwise let the kernel copy, which can still offload to the filesystem or storage
+    for (auto copy : {copy_with_copy_file_range, copy_with_sendfile})
+    {
+        if (::ftruncate(target_fd, 0) == 0 && copy(source_fd, target_fd, source_stat.st_size) &&
+            ::ftruncate(target_fd, source_stat.st_size) == 0)
+            return true;
+    }
+
+    return false;
+}
+
 QDir mp::platform::Platform::get_alias_scripts_folder() const
 {
     QDir aliases_folder;
@@ -21,10 +21,126 @@
 
 #include "ssh_client_key_provider.h"
 
+#include <libssh/callbacks.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+#include <poll.h>
+#include <unistd.h>
+#endif
+
 namespace mp = multipass;
 
 namespace
 {
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+constexpr auto pipe_buffer_size = 256 * 1024;
+
+// Shuttles non-interactive stdin/stdout/stderr through the channel. Unlike libssh's connectors, which move a few KiB
+// at a time, this reads stdin in large chunks, but only as much as the remote window accepts, so that writes to the
+// channel never block; polling of stdin resumes once the peer opens the window again. Output is written straight from
+// libssh's buffers, and a slow reader holds back the remote side through the window rather than buffering locally.
+class ChannelPipe
+{
+public:
+    ChannelPipe(ssh_session session, ssh_channel channel)
+        : channel{channel}, event{ssh_event_new(), ssh_event_free}, buffer(pipe_buffer_size)
+    {
+        ssh_callbacks_init(&cb);
+        cb.channel_data_function = on_channel_data;
+        cb.channel_write_wontblock_function = on_channel_writable;
+        cb.userdata = this;
+        ssh_add_channel_callbacks(channel, &cb);
+
+        ssh_event_add_session(event.get(), session);
+    }
+
+    ~ChannelPipe()
+    {
+        want_stdin = false;
+        update_stdin_polling();
+        ssh_event_remove_session(event.get(), ssh_channel_get_session(channel));
+        ssh_remove_channel_callbacks(channel, &cb);
+    }
+
+    void run()
+    {
+        while (ssh_channel_is_open(channel) && !ssh_channel_is_eof(channel))
+        {
+            update_stdin_polling();
+            ssh_event_dopoll(event.get(), 60000);
+        }
+    }
+
+private:
+    // Only called between polls: adding or removing stdin from within libssh's callbacks would change the set of
+    // polled descriptors while libssh walks it
+    void update_stdin_polling()
+    {
+        const auto poll_stdin = want_stdin && !stdin_eof;
+        if (poll_stdin == stdin_polled)
+            return;
+
+        if (poll_stdin)
+            ssh_event_add_fd(event.get(), in_fd, POLLIN, on_stdin, this);
+        else
+            ssh_event_remove_fd(event.get(), in_fd);
+
+        stdin_polled = poll_stdin;
+    }
+
+    static int on_stdin(socket_t, int, void* userdata)
+    {
+        auto pipe = static_cast<ChannelPipe*>(userdata);
+
+        const auto window = ssh_channel_window_size(pipe->channel);
+        if (window == 0)
+        {
+            pipe->want_stdin = false; // wait for the peer to make room, see on_channel_writable
+            return 0;
+        }
+
+        const auto to_read = std::min<std::size_t>(window, pipe->buffer.size());
+        const auto bytes_read = ::read(pipe->in_fd, pipe->buffer.data(), to_read);
+        if (bytes_read > 0)
+        {
+            ssh_channel_write(pipe->channel, pipe->buffer.data(), bytes_read);
+        }
+        else if (bytes_read == 0 || (errno != EINTR && errno != EAGAIN))
+        {
+            pipe->stdin_eof = true;
+            ssh_channel_send_eof(pipe->channel);
+        }
+
+        return 0;
+    }
+
+    static int on_channel_writable(ssh_session, ssh_channel, uint32_t, void* userdata)
+    {
+        static_cast<ChannelPipe*>(userdata)->want_stdin = true;
+        return 0;
+    }
+
+    static int on_channel_data(ssh_session, ssh_channel, void* data, uint32_t len, int is_stderr, void*)
+    {
+        mp::utils::write_all(is_stderr ? STDERR_FILENO : STDOUT_FILENO, static_cast<const char*>(data), len);
+        return len; // consumed either way; a closed output would otherwise stall the channel
+    }
+
+    const int in_fd{STDIN_FILENO};
+    ssh_channel channel;
+    std::unique_ptr<ssh_event_struct, void (*)(ssh_event)> event;
+    ssh_channel_callbacks_struct cb{};
+    std::vector<char> buffer;
+    bool want_stdin{true};
+    bool stdin_polled{false};
+    bool stdin_eof{false};
+};
+#endif
+
 mp::SSHClient::ChannelUPtr make_channel(ssh_session session)
 {
     mp::SSHClient::ChannelUPtr channel{ssh_channel_new(session), ssh_channel_free};
@@ -60,6 +176,11 @@ int mp::SSHClient::exec(const std::vector<std::string>& args)
 }
 
 int mp::SSHClient::exec(const std::vector<std::vector<std::string>>& args_list)
+{
+    return exec_string(to_cmd_line(args_list));
+}
+
+std::string mp::SSHClient::to_cmd_line(const std::vector<std::vector<std::string>>& args_list)
 {
     std::string cmd_line;
 
@@ -71,11 +192,19 @@ int mp::SSHClient::exec(const std::vector<std::vector<std::string>>& args_list)
             cmd_line += "&&" + utils::to_cmd(*args_it, mp::utils::QuoteType::quote_every_arg);
     }
 
-    return exec_string(cmd_line);
+    return cmd_line;
 }
 
 void mp::SSHClient::handle_ssh_events()
 {
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+    if (!console->is_interactive()) // no pty was requested, so we're shuttling plain data
+    {
+        ChannelPipe{*ssh_session, channel.get()}.run();
+        return;
+    }
+#endif
+
     using ConnectorUPtr = std::unique_ptr<ssh_connector_struct, void (*)(ssh_connector)>;
     std::unique_ptr<ssh_event_struct, void (*)(ssh_event)> event{ssh_event_new(), ssh_event_free};
 
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/constants.h>
+#include <multipass/exceptions/ssh_exception.h>
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/ssh/ssh_mux.h>
+#include <multipass/standard_paths.h>
+#include <multipass/utils.h>
+
+#include <scope_guard.hpp>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+
+#include <algorithm>
+#include <array>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "ssh mux";
+constexpr auto header_size = 5u;
+constexpr auto agent_start_timeout = std::chrono::seconds(2);
+constexpr auto agent_start_poll_interval = std::chrono::milliseconds(50);
+
+volatile std::sig_atomic_t window_changed = 0;
+
+void on_window_change(int)
+{
+    window_changed = 1;
+}
+
+int connect_to(const QString& path)
+{
+    const auto path_bytes = path.toLocal8Bit();
+
+    sockaddr_un address{};
+    if (static_cast<std::size_t>(path_bytes.size()) >= sizeof(address.sun_path))
+        return -1;
+
+    address.sun_family = AF_UNIX;
+    std::copy(path_bytes.cbegin(), path_bytes.cend(), address.sun_path);
+
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+        return fd;
+
+    ::close(fd);
+    return -1;
+}
+
+int connect_or_start_agent(std::chrono::seconds idle_timeout)
+{
+    const auto path = mp::ssh_mux::socket_path();
+    if (auto fd = connect_to(path); fd >= 0)
+        return fd;
+
+    const auto agent = QDir{QCoreApplication::applicationDirPath()}.filePath(mp::ssh_mux::agent_name);
+    if (!QProcess::startDetached(agent, {path, QString::number(idle_timeout.count())}))
+    {
+        mpl::log(mpl::Level::debug, category, fmt::format("Could not start {}", agent));
+        return -1;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + agent_start_timeout;
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(agent_start_poll_interval);
+        if (auto fd = connect_to(path); fd >= 0)
+            return fd;
+    }
+
+    mpl::log(mpl::Level::debug, category, "Timed out waiting for the multiplexing agent");
+    return -1;
+}
+
+std::pair<int, int> terminal_size(int fd)
+{
+    struct winsize win = {0, 0, 0, 0};
+    ioctl(fd, TIOCGWINSZ, &win);
+
+    return {win.ws_col, win.ws_row};
+}
+
+QJsonObject make_request(const mp::ssh_mux::Target& target, const std::string& cmd_line, bool interactive)
+{
+    QJsonObject request;
+    request.insert("host", QString::fromStdString(target.host));
+    request.insert("port", target.port);
+    request.insert("username", QString::fromStdString(target.username));
+    request.insert("key", QString::fromStdString(target.priv_key_blob));
+    request.insert("ciphers", QString::fromStdString(target.ciphers));
+    request.insert("command", QString::fromStdString(cmd_line));
+    request.insert("pty", interactive);
+
+    if (interactive)
+    {
+        const char* term_type = std::getenv("TERM");
+        const auto [columns, rows] = terminal_size(STDOUT_FILENO);
+
+        request.insert("term", term_type ? term_type : "xterm");
+        request.insert("columns", columns);
+        request.insert("rows", rows);
+    }
+
+    return request;
+}
+} // namespace
+
+void mp::ssh_mux::FrameReader::feed(const char* data, std::size_t size)
+{
+    buffer.append(data, size);
+}
+
+auto mp::ssh_mux::FrameReader::next() -> std::optional<Frame>
+{
+    if (buffer.size() < header_size)
+        return std::nullopt;
+
+    std::uint32_t size = 0;
+    for (auto i = 1u; i < header_size; ++i)
+        size = (size << 8) | static_cast<unsigned char>(buffer[i]);
+
+    const auto type = static_cast<unsigned char>(buffer[0]);
+    if (type > static_cast<unsigned char>(FrameType::refused) || size > max_frame_payload)
+        throw std::runtime_error(fmt::format("malformed frame (type {}, size {})", type, size));
+
+    if (buffer.size() < header_size + size)
+        return std::nullopt;
+
+    Frame frame{static_cast<FrameType>(type), buffer.substr(header_size, size)};
+    buffer.erase(0, header_size + size);
+
+    return frame;
+}
+
+std::string mp::ssh_mux::encode_frame(FrameType type, const std::string& payload)
+{
+    const auto size = static_cast<std::uint32_t>(payload.size());
+
+    std::string frame;
+    frame.reserve(header_size + size);
+    frame.push_back(static_cast<char>(type));
+    for (auto shift = 24; shift >= 0; shift -= 8)
+        frame.push_back(static_cast<char>((size >> shift) & 0xff));
+    frame.append(payload);
+
+    return frame;
+}
+
+bool mp::ssh_mux::write_frame(int fd, FrameType type, const std::string& payload)
+{
+    const auto frame = encode_frame(type, payload);
+    return mp::utils::write_all(fd, frame.data(), frame.size());
+}
+
+QString mp::ssh_mux::socket_path()
+{
+    const auto runtime_dir = QDir{MP_STDPATHS.writableLocation(mp::StandardPaths::RuntimeLocation)};
+    return runtime_dir.filePath(QStringLiteral("%1-ssh-mux.sock").arg(mp::client_name));
+}
+
+std::optional<int> mp::ssh_mux::exec(const Target& target, const std::string& cmd_line,
+                                     std::chrono::seconds idle_timeout)
+{
+    const auto fd = connect_or_start_agent(idle_timeout);
+    if (fd < 0)
+        return std::nullopt;
+
+    auto fd_guard = sg::make_scope_guard([fd]() noexcept { ::close(fd); });
+
+    const auto interactive = isatty(STDIN_FILENO) == 1 && isatty(STDOUT_FILENO) == 1;
+    const auto request = QJsonDocument{make_request(target, cmd_line, interactive)}.toJson(QJsonDocument::Compact);
+    if (!write_frame(fd, FrameType::request, request.toStdString()))
+        return std::nullopt;
+
+    FrameReader reader;
+    std::array<char, 65536> buffer;
+
+    // Nothing has been consumed from stdin until the agent confirms the command runs, so falling back is still safe
+    std::optional<Frame> answer;
+    while (!answer)
+    {
+        auto bytes_read = ::read(fd, buffer.data(), buffer.size());
+        if (bytes_read < 0 && errno == EINTR)
+            continue;
+        if (bytes_read <= 0)
+            return std::nullopt;
+
+        reader.feed(buffer.data(), bytes_read);
+        answer = reader.next();
+    }
+
+    if (answer->type != FrameType::started)
+    {
+        mpl::log(mpl::Level::debug, category, fmt::format("The multiplexing agent refused: {}", answer->payload));
+        return std::nullopt;
+    }
+
+    // From here on, the agent owns the conversation: failures are reported rather than falling back
+    struct termios saved_terminal;
+    struct sigaction old_winch_action;
+    if (interactive)
+    {
+        struct termios raw_terminal;
+        tcgetattr(STDIN_FILENO, &saved_terminal);
+        raw_terminal = saved_terminal;
+        cfmakeraw(&raw_terminal);
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw_terminal);
+
+        struct sigaction winch_action;
+        sigemptyset(&winch_action.sa_mask);
+        winch_action.sa_flags = 0; // no SA_RESTART, so that poll() wakes up to forward the new size
+        winch_action.sa_handler = on_window_change;
+        sigaction(SIGWINCH, &winch_action, &old_winch_action);
+    }
+
+    auto terminal_guard = sg::make_scope_guard([interactive, &saved_terminal, &old_winch_action]() noexcept {
+        if (interactive)
+        {
+            tcsetattr(STDIN_FILENO, TCSANOW, &saved_terminal);
+            sigaction(SIGWINCH, &old_winch_action, nullptr);
+        }
+    });
+
+    auto stdin_open = true;
+
+    while (true)
+    {
+        if (window_changed)
+        {
+            window_changed = 0;
+            const auto [columns, rows] = terminal_size(STDOUT_FILENO);
+            write_frame(fd, FrameType::window_change, fmt::format("{} {}", columns, rows));
+        }
+
+        std::array<pollfd, 2> fds{pollfd{fd, POLLIN, 0}, pollfd{STDIN_FILENO, POLLIN, 0}};
+        if (::poll(fds.data(), stdin_open ? 2 : 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw mp::SSHException(fmt::format("[ssh mux] poll failed: {}", std::strerror(errno)));
+        }
+
+        if (stdin_open && fds[1].revents)
+        {
+            auto bytes_read = ::read(STDIN_FILENO, buffer.data(), buffer.size());
+            if (bytes_read > 0)
+            {
+                write_frame(fd, FrameType::stdin_data, std::string(buffer.data(), bytes_read));
+            }
+            else if (bytes_read == 0 || (errno != EINTR && errno != EAGAIN))
+            {
+                stdin_open = false;
+                write_frame(fd, FrameType::stdin_eof, {});
+            }
+        }
+
+        if (fds[0].revents)
+        {
+            auto bytes_read = ::read(fd, buffer.data(), buffer.size());
+            if (bytes_read < 0 && errno == EINTR)
+                continue;
+            if (bytes_read <= 0)
+                throw mp::SSHException("[ssh mux] lost connection to the multiplexing agent");
+
+            reader.feed(buffer.data(), bytes_read);
+            while (auto frame = reader.next())
+            {
+                switch (frame->type)
+                {
+                case FrameType::stdout_data:
+                    mp::utils::write_all(STDOUT_FILENO, frame->payload.data(), frame->payload.size());
+                    break;
+                case FrameType::stderr_data:
+                    mp::utils::write_all(STDERR_FILENO, frame->payload.data(), frame->payload.size());
+                    break;
+                case FrameType::exit_status:
+                    return std::stoi(frame->payload);
+                case FrameType::error:
+                    throw mp::SSHException(frame->payload);
+                default:
+                    throw mp::SSHException("[ssh mux] unexpected frame from the multiplexing agent");
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,558 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ssh_mux_agent.h"
+#include "ssh_client_key_provider.h"
+
+#include <multipass/exceptions/ssh_exception.h>
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+namespace mux = multipass::ssh_mux;
+
+namespace
+{
+constexpr auto category = "ssh mux agent";
+constexpr auto idle_poll_timeout = std::chrono::milliseconds(1000);
+constexpr auto busy_poll_timeout = std::chrono::milliseconds(50); // libssh may hold data we haven't been woken for
+constexpr auto listen_backlog = 16;
+constexpr auto max_backlog = 1024u * 1024u; // per direction and conversation, before reading from the other end pauses
+
+sockaddr_un make_address(const std::string& path)
+{
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error(fmt::format("socket path too long: {}", path));
+
+    address.sun_family = AF_UNIX;
+    std::copy(path.cbegin(), path.cend(), address.sun_path);
+
+    return address;
+}
+
+bool another_agent_listens(const sockaddr_un& address)
+{
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    auto connected = ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    ::close(fd);
+
+    return connected;
+}
+
+std::string session_id_for(const QJsonObject& request)
+{
+    return fmt::format("{}@{}:{}#{}/{}", request["username"].toString(), request["host"].toString(),
+                       request["port"].toInt(), std::hash<std::string>{}(request["key"].toString().toStdString()),
+                       request["ciphers"].toString());
+}
+} // namespace
+
+mp::SSHMuxAgent::SSHMuxAgent(const std::string& socket_path, std::chrono::seconds idle_timeout)
+    : socket_path{socket_path}, idle_timeout{idle_timeout}, last_activity{Clock::now()}
+{
+    const auto address = make_address(socket_path);
+
+    if (another_agent_listens(address))
+        throw std::runtime_error(fmt::format("another agent is already listening on {}", socket_path));
+
+    ::unlink(socket_path.c_str()); // stale socket from an agent that did not shut down cleanly
+
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+        throw std::runtime_error(fmt::format("cannot create socket: {}", std::strerror(errno)));
+
+    const auto old_umask = ::umask(0177); // the socket hands out sessions authenticated with the user's keys
+    const auto bound = ::bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    ::umask(old_umask);
+
+    if (!bound || ::listen(listen_fd, listen_backlog) != 0)
+    {
+        const auto error = std::strerror(errno);
+        ::close(listen_fd);
+        throw std::runtime_error(fmt::format("cannot listen on {}: {}", socket_path, error));
+    }
+}
+
+mp::SSHMuxAgent::~SSHMuxAgent()
+{
+    for (auto& conversation : conversations)
+        if (conversation.stage != Stage::closed)
+            ::close(conversation.fd);
+
+    ::close(listen_fd);
+    ::unlink(socket_path.c_str());
+}
+
+void mp::SSHMuxAgent::run()
+{
+    while (true)
+    {
+        std::vector<pollfd> fds{pollfd{listen_fd, POLLIN, 0}};
+        std::vector<Conversation*> polled_conversations;
+
+        for (auto& conversation : conversations)
+        {
+            short events = 0;
+            if (conversation.stage != Stage::closing && conversation.to_channel.size() < max_backlog)
+                events |= POLLIN;
+            if (!conversation.to_client.empty())
+                events |= POLLOUT;
+
+            fds.push_back(pollfd{events ? conversation.fd : -1, events, 0});
+            polled_conversations.push_back(&conversation);
+        }
+
+        auto connecting = false;
+        for (const auto& [id, session] : sessions)
+        {
+            connecting |= !session.session;
+            if (session.session && session.conversations > 0)
+                fds.push_back(pollfd{ssh_get_fd(*session.session), POLLIN, 0});
+        }
+
+        const auto timeout = conversations.empty() && !connecting ? idle_poll_timeout : busy_poll_timeout;
+        if (::poll(fds.data(), fds.size(), timeout.count()) < 0 && errno != EINTR)
+            throw std::runtime_error(fmt::format("poll failed: {}", std::strerror(errno)));
+
+        for (auto i = 0u; i < polled_conversations.size(); ++i)
+        {
+            auto& conversation = *polled_conversations[i];
+            const auto revents = fds[i + 1].revents;
+
+            if (revents & POLLOUT)
+                flush_to_client(conversation);
+            if ((revents & ~POLLOUT) && conversation.stage != Stage::closing && conversation.stage != Stage::closed)
+                serve_client(conversation);
+        }
+
+        collect_connections();
+
+        for (auto& conversation : conversations)
+        {
+            if (conversation.stage == Stage::running)
+                pump_channel(conversation);
+            else if (conversation.stage != Stage::awaiting_request && conversation.stage < Stage::running)
+                set_up(conversation);
+        }
+
+        if (fds[0].revents & POLLIN)
+            accept_conversation();
+
+        conversations.remove_if([](const auto& conversation) { return conversation.stage == Stage::closed; });
+
+        drop_idle_sessions();
+
+        if (conversations.empty() && sessions.empty() && Clock::now() - last_activity >= idle_timeout)
+        {
+            mpl::log(mpl::Level::debug, category, "Idle, shutting down");
+            return;
+        }
+    }
+}
+
+void mp::SSHMuxAgent::accept_conversation()
+{
+    auto fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0)
+        return;
+
+    last_activity = Clock::now();
+    conversations.emplace_back();
+    conversations.back().fd = fd;
+}
+
+void mp::SSHMuxAgent::serve_client(Conversation& conversation)
+{
+    std::array<char, 65536> buffer;
+    auto bytes_read = ::read(conversation.fd, buffer.data(), buffer.size());
+
+    if (bytes_read < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+
+    if (bytes_read <= 0)
+    {
+        // The client went away (e.g. it was interrupted); whatever it was running goes with it
+        abandon(conversation);
+        return;
+    }
+
+    last_activity = Clock::now();
+
+    try
+    {
+        conversation.reader.feed(buffer.data(), bytes_read);
+        while (auto frame = conversation.reader.next())
+        {
+            handle_frame(conversation, *frame);
+            if (conversation.stage == Stage::closing || conversation.stage == Stage::closed)
+                return;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        finish(conversation, mux::FrameType::error, e.what());
+    }
+}
+
+void mp::SSHMuxAgent::handle_frame(Conversation& conversation, const ssh_mux::Frame& frame)
+{
+    if (frame.type == mux::FrameType::request)
+    {
+        if (conversation.stage != Stage::awaiting_request)
+            throw std::runtime_error("duplicate request");
+
+        conversation.request = QJsonDocument::fromJson(QByteArray::fromStdString(frame.payload)).object();
+        conversation.session_id = session_id_for(conversation.request);
+        conversation.stage = Stage::connecting;
+        return;
+    }
+
+    if (conversation.stage != Stage::running)
+        throw std::runtime_error("data before the command started");
+
+    switch (frame.type)
+    {
+    case mux::FrameType::stdin_data:
+        conversation.to_channel.append(frame.payload);
+        flush_to_channel(conversation);
+        break;
+    case mux::FrameType::stdin_eof:
+        conversation.eof_pending = true;
+        flush_to_channel(conversation);
+        break;
+    case mux::FrameType::window_change:
+    {
+        int columns = 0, rows = 0;
+        if (std::sscanf(frame.payload.c_str(), "%d %d", &columns, &rows) == 2)
+            ssh_channel_change_pty_size(conversation.channel.get(), columns, rows);
+        break;
+    }
+    default:
+        throw std::runtime_error("unexpected frame from client");
+    }
+}
+
+void mp::SSHMuxAgent::set_up(Conversation& conversation)
+{
+    try
+    {
+        if (conversation.stage == Stage::connecting)
+        {
+            auto it = sessions.find(conversation.session_id);
+            if (it == sessions.end())
+            {
+                connect(conversation);
+                return;
+            }
+
+            auto& session = it->second;
+            if (!session.session)
+                return;
+
+            conversation.channel = ChannelUPtr{ssh_channel_new(*session.session), ssh_channel_free};
+            if (!conversation.channel)
+                throw mp::SSHException(
+                    fmt::format("[ssh mux] channel creation failed: '{}'", ssh_get_error(*session.session)));
+
+            ++session.conversations;
+            conversation.stage = Stage::opening;
+        }
+
+        const auto& request = conversation.request;
+        auto channel = conversation.channel.get();
+
+        if (conversation.stage == Stage::opening)
+        {
+            const auto ret = ssh_channel_open_session(channel);
+            if (ret == SSH_AGAIN)
+                return;
+
+            if (ret != SSH_OK)
+            {
+                auto& session = sessions.at(conversation.session_id);
+                const auto error = fmt::format("[ssh mux] channel creation failed: '{}'", ssh_get_error(*session.session));
+                if (!conversation.may_reconnect || session.conversations > 1)
+                    throw mp::SSHException(error);
+
+                // The cached session went stale (e.g. the instance restarted); connect afresh
+                release_channel(conversation);
+                sessions.erase(conversation.session_id);
+                conversation.stage = Stage::connecting;
+                return;
+            }
+
+            conversation.stage = request["pty"].toBool() ? Stage::requesting_pty : Stage::requesting_command;
+        }
+
+        if (conversation.stage == Stage::requesting_pty)
+        {
+            const auto ret = ssh_channel_request_pty_size(channel, request["term"].toString().toStdString().c_str(),
+                                                          request["columns"].toInt(), request["rows"].toInt());
+            if (ret == SSH_AGAIN)
+                return;
+            if (ret != SSH_OK)
+                throw mp::SSHException("[ssh mux] pty request failed");
+
+            conversation.stage = Stage::requesting_command;
+        }
+
+        const auto command = request["command"].toString().toStdString();
+        const auto ret =
+            command.empty() ? ssh_channel_request_shell(channel) : ssh_channel_request_exec(channel, command.c_str());
+        if (ret == SSH_AGAIN)
+            return;
+        if (ret != SSH_OK)
+            throw mp::SSHException(fmt::format("[ssh mux] {} request failed", command.empty() ? "shell" : "exec"));
+
+        conversation.stage = Stage::running;
+        queue(conversation, mux::FrameType::started, {});
+        flush_to_client(conversation);
+    }
+    catch (const std::exception& e)
+    {
+        // Nothing ran yet, so the client may still connect by itself
+        finish(conversation, mux::FrameType::refused, e.what());
+    }
+}
+
+void mp::SSHMuxAgent::connect(Conversation& conversation)
+{
+    const auto& request = conversation.request;
+
+    mpl::log(mpl::Level::debug, category, fmt::format("Connecting to {}", conversation.session_id));
+
+    conversation.may_reconnect = false;
+
+    // Each session gets the ciphers its client asked for, so connections may overlap however their preferences differ
+    auto connecting = std::async(std::launch::async, [host = request["host"].toString().toStdString(),
+                                                      port = request["port"].toInt(),
+                                                      username = request["username"].toString().toStdString(),
+                                                      key = request["key"].toString().toStdString(),
+                                                      ciphers = request["ciphers"].toString().toStdString()] {
+        mp::SSHClientKeyProvider key_provider{key};
+        return std::make_unique<mp::SSHSession>(host, port, username, key_provider, std::chrono::seconds(20), ciphers);
+    });
+
+    sessions.emplace(conversation.session_id, Session{nullptr, std::move(connecting), 0, Clock::now()});
+}
+
+void mp::SSHMuxAgent::collect_connections()
+{
+    for (auto it = sessions.begin(); it != sessions.end();)
+    {
+        auto& session = it->second;
+        if (session.session || session.connecting.wait_for(std::chrono::seconds::zero()) != std::future_status::ready)
+        {
+            ++it;
+            continue;
+        }
+
+        try
+        {
+            session.session = session.connecting.get();
+            ssh_set_blocking(*session.session, 0);
+            session.last_used = Clock::now();
+            ++it;
+        }
+        catch (const std::exception& e)
+        {
+            for (auto& conversation : conversations)
+                if (conversation.stage == Stage::connecting && conversation.session_id == it->first)
+                    finish(conversation, mux::FrameType::refused, e.what());
+
+            it = sessions.erase(it);
+        }
+    }
+}
+
+void mp::SSHMuxAgent::pump_channel(Conversation& conversation)
+{
+    std::array<char, 65536> buffer;
+    auto channel = conversation.channel.get();
+
+    try
+    {
+        flush_to_channel(conversation);
+
+        for (const auto is_stderr : {0, 1})
+        {
+            const auto type = is_stderr ? mux::FrameType::stderr_data : mux::FrameType::stdout_data;
+
+            int bytes_read = 0;
+            while (conversation.to_client.size() < max_backlog &&
+                   (bytes_read = ssh_channel_read_nonblocking(channel, buffer.data(), buffer.size(), is_stderr)) > 0)
+            {
+                last_activity = Clock::now();
+                queue(conversation, type, std::string(buffer.data(), bytes_read));
+            }
+
+            if (bytes_read == SSH_ERROR)
+                throw mp::SSHException(fmt::format("[ssh mux] read from channel failed: '{}'",
+                                                   ssh_get_error(*sessions.at(conversation.session_id).session)));
+        }
+    }
+    catch (const std::exception& e)
+    {
+        finish(conversation, mux::FrameType::error, e.what());
+        return;
+    }
+
+    flush_to_client(conversation);
+
+    // A slow client holds back the remote side through the window, rather than having the agent buffer everything
+    if (conversation.stage != Stage::running || conversation.to_client.size() >= max_backlog)
+        return;
+
+    if (ssh_channel_is_eof(channel) || !ssh_channel_is_open(channel))
+    {
+        // The exit status usually comes right after the end of output; it is only given up on once the channel closes
+        const auto exit_status = ssh_channel_get_exit_status(channel);
+        if (exit_status != -1 || !ssh_channel_is_open(channel))
+            finish(conversation, mux::FrameType::exit_status, std::to_string(exit_status));
+    }
+}
+
+void mp::SSHMuxAgent::flush_to_channel(Conversation& conversation)
+{
+    auto channel = conversation.channel.get();
+
+    while (!conversation.to_channel.empty())
+    {
+        const auto room = std::min<std::size_t>(ssh_channel_window_size(channel), conversation.to_channel.size());
+        if (room == 0)
+            break;
+
+        const auto written = ssh_channel_write(channel, conversation.to_channel.data(), room);
+        if (written == SSH_ERROR)
+            throw mp::SSHException(fmt::format("write to channel failed: '{}'",
+                                               ssh_get_error(*sessions.at(conversation.session_id).session)));
+        if (written <= 0)
+            break;
+
+        conversation.to_channel.erase(0, written);
+    }
+
+    if (conversation.eof_pending && conversation.to_channel.empty())
+    {
+        ssh_channel_send_eof(channel);
+        conversation.eof_pending = false;
+    }
+}
+
+void mp::SSHMuxAgent::flush_to_client(Conversation& conversation)
+{
+    while (!conversation.to_client.empty())
+    {
+        const auto written = ::send(conversation.fd, conversation.to_client.data(), conversation.to_client.size(),
+                                    MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+
+            abandon(conversation);
+            return;
+        }
+
+        conversation.to_client.erase(0, written);
+    }
+
+    if (conversation.stage == Stage::closing)
+    {
+        ::close(conversation.fd);
+        conversation.stage = Stage::closed;
+    }
+}
+
+void mp::SSHMuxAgent::queue(Conversation& conversation, ssh_mux::FrameType type, const std::string& payload)
+{
+    conversation.to_client.append(mux::encode_frame(type, payload));
+}
+
+void mp::SSHMuxAgent::finish(Conversation& conversation, ssh_mux::FrameType type, const std::string& payload)
+{
+    release_channel(conversation);
+    queue(conversation, type, payload);
+    conversation.stage = Stage::closing;
+
+    flush_to_client(conversation);
+}
+
+void mp::SSHMuxAgent::abandon(Conversation& conversation)
+{
+    mpl::log(mpl::Level::debug, category, "Client disconnected");
+
+    release_channel(conversation);
+    ::close(conversation.fd);
+    conversation.stage = Stage::closed;
+}
+
+void mp::SSHMuxAgent::release_channel(Conversation& conversation)
+{
+    if (conversation.channel)
+    {
+        ssh_channel_close(conversation.channel.get());
+        conversation.channel.reset();
+
+        auto& session = sessions.at(conversation.session_id);
+        --session.conversations;
+        session.last_used = Clock::now();
+    }
+}
+
+void mp::SSHMuxAgent::drop_idle_sessions()
+{
+    const auto now = Clock::now();
+
+    for (auto it = sessions.begin(); it != sessions.end();)
+    {
+        const auto& session = it->second;
+        if (session.session && session.conversations == 0 &&
+            (now - session.last_used >= idle_timeout || !ssh_is_connected(*session.session)))
+        {
+            mpl::log(mpl::Level::debug, category, fmt::format("Dropping session {}", it->first));
+            it = sessions.erase(it);
+        }
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SSH_MUX_AGENT_H
+#define MULTIPASS_SSH_MUX_AGENT_H
+
+#include <multipass/disabled_copy_move.h>
+#include <multipass/ssh/ssh_mux.h>
+#include <multipass/ssh/ssh_session.h>
+
+#include <QJsonObject>
+
+#include <chrono>
+#include <future>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace multipass
+{
+// Serves multiplexed exec/shell conversations (see ssh_mux.h) over a single thread, which owns all SSH sessions. The
+// thread never blocks on a single conversation: sessions are connected on worker threads, channels are non-blocking
+// and what either end cannot take yet is buffered per conversation.
+class SSHMuxAgent : private DisabledCopyMove
+{
+public:
+    SSHMuxAgent(const std::string& socket_path, std::chrono::seconds idle_timeout);
+    ~SSHMuxAgent();
+
+    // Returns once nothing has used the agent for idle_timeout
+    void run();
+
+private:
+    using ChannelUPtr = std::unique_ptr<ssh_channel_struct, void (*)(ssh_channel)>;
+    using Clock = std::chrono::steady_clock;
+
+    struct Session
+    {
+        std::unique_ptr<SSHSession> session;                 // null until connecting completes
+        std::future<std::unique_ptr<SSHSession>> connecting; // valid while connecting, off the serving thread
+        int conversations;
+        Clock::time_point last_used;
+    };
+
+    // Every step that would wait on the instance is retried on later turns of the loop instead
+    enum class Stage
+    {
+        awaiting_request,
+        connecting,
+        opening,
+        requesting_pty,
+        requesting_command,
+        running,
+        closing, // the last frames are still on their way to the client
+        closed
+    };
+
+    struct Conversation
+    {
+        int fd;
+        ssh_mux::FrameReader reader;
+        QJsonObject request;
+        std::string session_id;
+        ChannelUPtr channel{nullptr, ssh_channel_free};
+        Stage stage = Stage::awaiting_request;
+        bool may_reconnect = true; // a cached session that fails to open a channel is replaced, once
+        std::string to_channel;    // stdin the remote window has no room for yet
+        bool eof_pending = false;  // stdin ended, to be passed on once to_channel drains
+        std::string to_client;     // frames the client socket has no room for yet
+    };
+
+    void accept_conversation();
+    void serve_client(Conversation& conversation);
+    void handle_frame(Conversation& conversation, const ssh_mux::Frame& frame);
+    void set_up(Conversation& conversation);
+    void connect(Conversation& conversation);
+    void collect_connections();
+    void pump_channel(Conversation& conversation);
+    void flush_to_channel(Conversation& conversation);
+    void flush_to_client(Conversation& conversation);
+    void queue(Conversation& conversation, ssh_mux::FrameType type, const std::string& payload);
+    void finish(Conversation& conversation, ssh_mux::FrameType type, const std::string& payload);
+    void abandon(Conversation& conversation);
+    void release_channel(Conversation& conversation);
+    void drop_idle_sessions();
+
+    const std::string socket_path;
+    const std::chrono::seconds idle_timeout;
+    int listen_fd;
+    std::unordered_map<std::string, Session> sessions;
+    std::list<Conversation> conversations;
+    Clock::time_point last_activity;
+};
+} // namespace multipass
+#endif // MULTIPASS_SSH_MUX_AGENT_H
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ssh_mux_agent.h"
+
+#include <multipass/logging/log.h>
+#include <multipass/logging/standard_logger.h>
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <unistd.h>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        cerr << "Usage: " << argv[0] << " <socket path> <idle timeout in seconds>" << endl;
+        exit(2);
+    }
+
+    const auto socket_path = string(argv[1]);
+    const auto idle_timeout = chrono::seconds(atoi(argv[2]));
+
+    mpl::set_logger(std::make_shared<mpl::StandardLogger>(mpl::Level::warning));
+
+    // Detach from the client that spawned us, so that its terminal's signals do not reach the agent
+    setsid();
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        mp::SSHMuxAgent agent{socket_path, idle_timeout};
+        agent.run();
+        exit(0);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+    }
+    return 1;
+}
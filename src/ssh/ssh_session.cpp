@@ -27,13 +27,72 @@
 
 #include <QDir>
 
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(_M_X64)
+#include <intrin.h>
+#elif defined(__aarch64__) && defined(MULTIPASS_PLATFORM_LINUX)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 
+namespace
+{
+// AES-GCM is several times faster than ChaCha20 where the CPU implements AES, and slower where it does not
+constexpr auto aes_first_ciphers =
+    "aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,aes256-ctr";
+constexpr auto chacha_first_ciphers = "chacha20-poly1305@openssh.com,aes256-ctr";
+constexpr std::array<std::string_view, 10> supported_ciphers{
+    "aes128-gcm@openssh.com", "aes256-gcm@openssh.com", "chacha20-poly1305@openssh.com", "aes128-ctr", "aes192-ctr",
+    "aes256-ctr", "aes128-cbc", "aes192-cbc", "aes256-cbc", "3des-cbc"};
+
+std::mutex cipher_preference_mutex;
+std::string cipher_preference;
+
+std::string ciphers_for(const std::string& ciphers)
+{
+    if (!ciphers.empty())
+        return ciphers;
+
+    static const std::string cpu_ciphers =
+        mp::SSHSession::has_hardware_aes() ? aes_first_ciphers : chacha_first_ciphers;
+
+    std::lock_guard<std::mutex> lock{cipher_preference_mutex};
+    return cipher_preference.empty() ? cpu_ciphers : cipher_preference;
+}
+} // namespace
+
+bool mp::SSHSession::has_hardware_aes()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES);
+#elif defined(_M_X64)
+    int info[4];
+    __cpuid(info, 1);
+    return info[2] & (1 << 25);
+#elif defined(__aarch64__) && defined(MULTIPASS_PLATFORM_LINUX)
+    return getauxval(AT_HWCAP) & HWCAP_AES;
+#elif defined(__aarch64__) && defined(MULTIPASS_PLATFORM_APPLE)
+    return true; // every Apple silicon chip has the ARMv8 crypto extensions
+#else
+    return false;
+#endif
+}
+
 mp::SSHSession::SSHSession(const std::string& host, int port, const std::string& username,
-                           const SSHKeyProvider* key_provider, const std::chrono::milliseconds timeout)
+                           const SSHKeyProvider* key_provider, const std::chrono::milliseconds timeout,
+                           const std::string& ciphers)
     : session{ssh_new(), ssh_free}
 {
     if (session == nullptr)
@@ -41,6 +100,7 @@ mp::SSHSession::SSHSession(const std::string& host, int port, const std::string&
 
     const long timeout_secs = std::chrono::duration_cast<std::chrono::seconds>(timeout).count();
     const int nodelay{1};
+    const auto session_ciphers = ciphers_for(ciphers);
     auto ssh_dir = QDir(MP_STDPATHS.writableLocation(StandardPaths::AppConfigLocation)).filePath("ssh").toStdString();
 
     set_option(SSH_OPTIONS_HOST, host.c_str());
@@ -48,8 +108,8 @@ mp::SSHSession::SSHSession(const std::string& host, int port, const std::string&
     set_option(SSH_OPTIONS_USER, username.c_str());
     set_option(SSH_OPTIONS_TIMEOUT, &timeout_secs);
     set_option(SSH_OPTIONS_NODELAY, &nodelay);
-    set_option(SSH_OPTIONS_CIPHERS_C_S, "chacha20-poly1305@openssh.com,aes256-ctr");
-    set_option(SSH_OPTIONS_CIPHERS_S_C, "chacha20-poly1305@openssh.com,aes256-ctr");
+    set_option(SSH_OPTIONS_CIPHERS_C_S, session_ciphers.c_str());
+    set_option(SSH_OPTIONS_CIPHERS_S_C, session_ciphers.c_str());
     set_option(SSH_OPTIONS_SSH_DIR, ssh_dir.c_str());
 
     SSH::throw_on_error(session, "ssh connection failed", ssh_connect);
@@ -61,8 +121,9 @@ mp::SSHSession::SSHSession(const std::string& host, int port, const std::string&
 }
 
 mp::SSHSession::SSHSession(const std::string& host, int port, const std::string& username,
-                           const SSHKeyProvider& key_provider, const std::chrono::milliseconds timeout)
-    : SSHSession(host, port, username, &key_provider, timeout)
+                           const SSHKeyProvider& key_provider, const std::chrono::milliseconds timeout,
+                           const std::string& ciphers)
+    : SSHSession(host, port, username, &key_provider, timeout, ciphers)
 {
 }
 
@@ -90,6 +151,29 @@ mp::SSHSession::operator ssh_session() const
     return session.get();
 }
 
+void mp::SSHSession::set_cipher_preference(const std::string& ciphers)
+{
+    std::lock_guard<std::mutex> lock{cipher_preference_mutex};
+    cipher_preference = ciphers;
+}
+
+std::vector<std::string> mp::SSHSession::unknown_ciphers(const std::string& ciphers)
+{
+    std::vector<std::string> unknown;
+    if (ciphers.empty())
+        return unknown;
+
+    std::istringstream names{ciphers};
+    for (std::string name; std::getline(names, name, ',');)
+        if (std::find(supported_ciphers.cbegin(), supported_ciphers.cend(), name) == supported_ciphers.cend())
+            unknown.push_back(name);
+
+    if (ciphers.back() == ',') // getline does not report the empty name after a trailing comma
+        unknown.emplace_back();
+
+    return unknown;
+}
+
 namespace
 {
 const char* name_for(ssh_options_e type)
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/block_map.h>
+
+#include <multipass/format.h>
+#include <multipass/sha256_hash.h>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mp = multipass;
+
+namespace
+{
+constexpr auto block_hash_size = 16;
+constexpr qint64 max_block_size = 64LL * 1024 * 1024;
+
+QByteArray block_hash(mp::Sha256Hash& hash, const char* data, qint64 size)
+{
+    hash.reset();
+    hash.add_data(data, size);
+    return QByteArray::fromHex(hash.hex_result().toLatin1()).left(block_hash_size);
+}
+
+// Calls action(offset, data, size) for each block of the file, in order
+template <typename BlockAction>
+void for_each_block(const mp::Path& file_path, qint64 block_size, BlockAction&& action)
+{
+    QFile file{file_path};
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error(fmt::format("cannot open {}: {}", file_path, file.errorString()));
+
+    std::vector<char> buffer(block_size);
+    qint64 offset = 0;
+    qint64 bytes_read;
+
+    while ((bytes_read = file.read(buffer.data(), block_size)) > 0)
+    {
+        action(offset, buffer.data(), bytes_read);
+        offset += bytes_read;
+    }
+
+    if (bytes_read < 0)
+        throw std::runtime_error(fmt::format("cannot read {}: {}", file_path, file.errorString()));
+}
+} // namespace
+
+mp::BlockMap mp::make_block_map(const Path& file_path, qint64 block_size)
+{
+    BlockMap block_map{block_size, 0, {}, {}};
+    mp::Sha256Hash file_hash, hash;
+    for_each_block(file_path, block_size, [&](qint64 offset, const char* data, qint64 size) {
+        file_hash.add_data(data, size);
+        block_map.block_hashes.push_back(block_hash(hash, data, size));
+        block_map.size = offset + size;
+    });
+
+    block_map.sha256 = file_hash.hex_result();
+    return block_map;
+}
+
+QByteArray mp::block_map_to_json(const BlockMap& block_map)
+{
+    QByteArray hashes;
+    for (const auto& hash : block_map.block_hashes)
+        hashes.append(hash);
+
+    QJsonObject json;
+    json.insert("block_size", block_map.block_size);
+    json.insert("size", block_map.size);
+    json.insert("sha256", block_map.sha256);
+    json.insert("hashes", QString::fromLatin1(hashes.toBase64()));
+
+    return QJsonDocument{json}.toJson(QJsonDocument::Compact);
+}
+
+std::optional<mp::BlockMap> mp::block_map_from_json(const QByteArray& json)
+{
+    const auto object = QJsonDocument::fromJson(json).object();
+    const auto block_size = static_cast<qint64>(object["block_size"].toDouble());
+    const auto size = static_cast<qint64>(object["size"].toDouble());
+    const auto hashes = QByteArray::fromBase64(object["hashes"].toString().toLatin1());
+
+    if (block_size <= 0 || block_size > max_block_size || size < 0 ||
+        hashes.size() != (size + block_size - 1) / block_size * block_hash_size)
+        return std::nullopt;
+
+    BlockMap block_map{block_size, size, object["sha256"].toString(), {}};
+    for (auto i = 0; i < hashes.size(); i += block_hash_size)
+        block_map.block_hashes.push_back(hashes.mid(i, block_hash_size));
+
+    return block_map;
+}
+
+mp::DeltaPlan mp::plan_delta(const BlockMap& block_map, const Path& seed_path)
+{
+    mp::Sha256Hash hash;
+    std::unordered_map<std::string, qint64> seed_blocks;
+    for_each_block(seed_path, block_map.block_size, [&](qint64 offset, const char* data, qint64 size) {
+        seed_blocks.emplace(block_hash(hash, data, size).toStdString(), offset);
+    });
+
+    DeltaPlan plan{{}, {}, 0};
+    if (block_map.block_hashes.empty())
+        return plan;
+
+    const auto zeros = std::vector<char>(block_map.block_size, '\0');
+    const auto full_zero_block = block_hash(hash, zeros.data(), block_map.block_size);
+    const auto block_count = static_cast<qint64>(block_map.block_hashes.size());
+    const auto last_block_size = block_map.size - (block_count - 1) * block_map.block_size;
+    const auto last_zero_block = block_hash(hash, zeros.data(), last_block_size);
+
+    for (qint64 i = 0; i < block_count; ++i)
+    {
+        const auto& block = block_map.block_hashes[i];
+        const auto offset = i * block_map.block_size;
+        const auto size = i + 1 == block_count ? last_block_size : block_map.block_size;
+
+        if (block == (size == block_map.block_size ? full_zero_block : last_zero_block))
+        {
+            plan.reused_bytes += size;
+        }
+        else if (const auto seed_block = seed_blocks.find(block.toStdString()); seed_block != seed_blocks.end())
+        {
+            plan.copies.emplace_back(offset, seed_block->second);
+            plan.reused_bytes += size;
+        }
+        else if (!plan.missing.empty() && plan.missing.back().first + plan.missing.back().second == offset)
+        {
+            plan.missing.back().second += size;
+        }
+        else
+        {
+            plan.missing.emplace_back(offset, size);
+        }
+    }
+
+    return plan;
+}
+
+void mp::copy_reused_blocks(const BlockMap& block_map, const DeltaPlan& plan, const Path& seed_path, QFile& file)
+{
+    QFile seed{seed_path};
+    if (!seed.open(QIODevice::ReadOnly))
+        throw std::runtime_error(fmt::format("cannot open {}: {}", seed_path, seed.errorString()));
+
+    // Anything not written below stays a hole, which is what the blocks of zeros are
+    if (!file.resize(0) || !file.resize(block_map.size))
+        throw std::runtime_error(fmt::format("cannot resize {}: {}", file.fileName(), file.errorString()));
+
+    std::vector<char> buffer(block_map.block_size);
+    for (const auto& [offset, seed_offset] : plan.copies)
+    {
+        const auto size = std::min(block_map.block_size, block_map.size - offset);
+        if (!seed.seek(seed_offset) || seed.read(buffer.data(), size) != size)
+            throw std::runtime_error(fmt::format("cannot read {}: {}", seed_path, seed.errorString()));
+
+        if (!file.seek(offset) || file.write(buffer.data(), size) != size)
+            throw std::runtime_error(fmt::format("cannot write {}: {}", file.fileName(), file.errorString()));
+    }
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <multipass/image_format.h>
+
+#include <QByteArray>
+#include <QFile>
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace mp = multipass;
+
+namespace
+{
+constexpr auto qcow2_magic = "QFI\xfb";
+constexpr auto qcow2_header_size = 72; // version 2; version 3 headers only add fields after these
+constexpr auto max_backing_file_size = 1023u;
+
+// Signatures at the start of the other formats that qemu-img probes for, which must not be mistaken for raw
+constexpr std::array other_format_signatures{"QED",                     // QED
+                                             "KDMV",                    // VMDK sparse extent
+                                             "COWD",                    // VMDK ESX sparse extent
+                                             "# Disk DescriptorFile",   // VMDK descriptor
+                                             "vhdxfile",                // VHDX
+                                             "conectix",                // VPC/VHD
+                                             "LUKS\xba\xbe",            // LUKS
+                                             "WithoutFreeSpace",        // Parallels
+                                             "WithouFreSpacExt",        // Parallels
+                                             "Bochs Virtual HD Image",  // Bochs
+                                             "#!/bin/sh\n#V2.0 Format", // cloop
+                                             "<<< "};                   // VDI, whose header starts with a banner
+
+std::uint64_t read_be(const QByteArray& data, int offset, int size)
+{
+    std::uint64_t value = 0;
+    for (auto i = 0; i < size; ++i)
+        value = (value << 8) | static_cast<unsigned char>(data[offset + i]);
+
+    return value;
+}
+
+std::optional<mp::ImageFormatInfo> parse_qcow2(QFile& image_file, const QByteArray& header)
+{
+    if (header.size() < qcow2_header_size)
+        return std::nullopt;
+
+    const auto version = read_be(header, 4, 4);
+    const auto backing_file_offset = read_be(header, 8, 8);
+    const auto backing_file_size = read_be(header, 16, 4);
+    const auto cluster_bits = read_be(header, 20, 4);
+    const auto virtual_size = read_be(header, 24, 8);
+    const auto l1_size = read_be(header, 36, 4);
+    const auto l1_table_offset = read_be(header, 40, 8);
+    const auto refcount_table_offset = read_be(header, 48, 8);
+    const auto refcount_table_clusters = read_be(header, 56, 4);
+
+    if ((version != 2 && version != 3) || cluster_bits < 9 || cluster_bits > 21 ||
+        virtual_size > static_cast<std::uint64_t>(std::numeric_limits<qint64>::max()) ||
+        backing_file_size > max_backing_file_size)
+        return std::nullopt;
+
+    // The tables that map the image's clusters must be cluster-aligned and lie within the file
+    const auto cluster_size = std::uint64_t{1} << cluster_bits;
+    const auto file_size = static_cast<std::uint64_t>(image_file.size());
+    if (l1_table_offset % cluster_size || refcount_table_offset % cluster_size || l1_table_offset > file_size ||
+        refcount_table_offset > file_size || l1_size * 8 > file_size - l1_table_offset ||
+        refcount_table_clusters * cluster_size > file_size - refcount_table_offset)
+        return std::nullopt;
+
+    mp::ImageFormatInfo info{mp::ImageFormatInfo::Format::qcow2, static_cast<qint64>(virtual_size),
+                             static_cast<int>(version), qint64{1} << cluster_bits, {}};
+
+    if (backing_file_offset)
+    {
+        if (backing_file_offset > static_cast<std::uint64_t>(image_file.size()) ||
+            !image_file.seek(static_cast<qint64>(backing_file_offset)))
+            return std::nullopt;
+
+        const auto backing_file = image_file.read(backing_file_size);
+        if (backing_file.size() != static_cast<int>(backing_file_size))
+            return std::nullopt;
+
+        info.backing_file = QString::fromUtf8(backing_file);
+    }
+
+    return info;
+}
+} // namespace
+
+std::optional<mp::ImageFormatInfo> mp::probe_image_format(const Path& image_path)
+{
+    QFile image_file{image_path};
+    if (!image_file.open(QIODevice::ReadOnly))
+        return std::nullopt;
+
+    // Enough for every signature above and for the fields of a qcow2 header that matter here
+    const auto header = image_file.read(qcow2_header_size);
+    if (header.startsWith(qcow2_magic))
+        return parse_qcow2(image_file, header);
+
+    for (const auto* signature : other_format_signatures)
+    {
+        if (header.startsWith(signature))
+            return std::nullopt;
+    }
+
+    return ImageFormatInfo{ImageFormatInfo::Format::raw, image_file.size(), 0, 0, {}};
+}
+
+bool mp::has_sane_header(const Path& image_path)
+{
+    QFile image_file{image_path};
+    if (!image_file.open(QIODevice::ReadOnly))
+        return false;
+
+    const auto header = image_file.read(qcow2_header_size);
+    return !header.isEmpty() && (!header.startsWith(qcow2_magic) || parse_qcow2(image_file, header).has_value());
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <multipass/sha256_hash.h>
+
+#include <openssl/evp.h>
+
+#include <stdexcept>
+
+namespace mp = multipass;
+
+mp::Sha256Hash::Sha256Hash() : context{EVP_MD_CTX_new(), EVP_MD_CTX_free}
+{
+    if (!context)
+        throw std::runtime_error("Cannot allocate a SHA-256 context");
+
+    reset();
+}
+
+void mp::Sha256Hash::add_data(const char* data, std::size_t size)
+{
+    if (!EVP_DigestUpdate(context.get(), data, size))
+        throw std::runtime_error("Cannot compute SHA-256 hash");
+}
+
+void mp::Sha256Hash::add_data(const QByteArray& data)
+{
+    add_data(data.constData(), data.size());
+}
+
+void mp::Sha256Hash::reset()
+{
+    if (!EVP_DigestInit_ex(context.get(), EVP_sha256(), nullptr))
+        throw std::runtime_error("Cannot initialize SHA-256 hash");
+}
+
+QString mp::Sha256Hash::hex_result()
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+
+    if (!EVP_DigestFinal_ex(context.get(), digest, &size))
+        throw std::runtime_error("Cannot compute SHA-256 hash");
+
+    return QByteArray(reinterpret_cast<const char*>(digest), size).toHex();
+}
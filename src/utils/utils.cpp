@@ -40,6 +40,8 @@
 #include <array>
 #include <cassert>
 #include <cctype>
+#include <cerrno>
+#include <cstring>
 #include <fstream>
 #include <random>
 #include <regex>
@@ -48,6 +50,12 @@
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 
@@ -404,6 +412,73 @@ void mp::utils::remove_directories(const std::vector<QString>& dirs)
     }
 }
 
+bool mp::utils::write_sparse(QFileDevice& file, const char* data, qint64 size)
+{
+    // Only whole blocks, aligned to the file offset, are skipped, so that holes line up with filesystem blocks
+    constexpr qint64 block_size = 4096;
+    static const std::array<char, block_size> zeros{};
+
+    const auto start = file.pos();
+    auto write_run = [&file, data, start](qint64 from, qint64 to) {
+        return from == to || (file.seek(start + from) && file.write(data + from, to - from) == to - from);
+    };
+
+    qint64 run_start = 0;
+    for (qint64 offset = 0; offset < size;)
+    {
+        const auto length = std::min(block_size - (start + offset) % block_size, size - offset);
+        if (length == block_size && std::memcmp(data + offset, zeros.data(), block_size) == 0)
+        {
+            if (!write_run(run_start, offset))
+                return false;
+            run_start = offset + length;
+        }
+
+        offset += length;
+    }
+
+    return write_run(run_start, size) && file.seek(start + size);
+}
+
+bool mp::utils::finish_sparse(QFileDevice& file)
+{
+    const auto end = file.pos();
+    return file.flush() && (file.size() >= end || file.resize(end));
+}
+
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+bool mp::utils::write_all(int fd, const char* data, std::size_t size)
+{
+    auto is_socket = true;
+    while (size > 0)
+    {
+        auto written = is_socket ? ::send(fd, data, size, MSG_NOSIGNAL) : ::write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == ENOTSOCK && is_socket)
+            {
+                is_socket = false;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                pollfd pfd{fd, POLLOUT, 0};
+                ::poll(&pfd, 1, -1);
+                continue;
+            }
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+#endif
+
 QString mp::utils::backend_directory_path(const mp::Path& path, const QString& subdirectory)
 {
     if (subdirectory.isEmpty())
@@ -478,6 +553,24 @@ void mp::utils::validate_server_address(const std::string& address)
         throw std::runtime_error(fmt::format("invalid port number in address '{}'", address));
 }
 
+QString mp::utils::unix_socket_path(const std::string& server_address)
+{
+    const auto tokens = mp::utils::split(server_address, ":");
+    if (tokens.size() != 2u || tokens[0] != "unix")
+        return {};
+
+    return QString::fromStdString(tokens[1]);
+}
+
+QString mp::utils::instance_names_file_for(const std::string& server_address)
+{
+    const auto socket_path = unix_socket_path(server_address);
+    if (socket_path.isEmpty())
+        return {};
+
+    return QFileInfo{socket_path}.dir().filePath(mp::instance_names_file);
+}
+
 std::string mp::utils::filename_for(const std::string& path)
 {
     return QFileInfo(QString::fromStdString(path)).fileName().toStdString();
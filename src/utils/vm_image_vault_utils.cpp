@@ -16,16 +16,27 @@
  */
 
 #include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/platform.h>
+#include <multipass/sha256_hash.h>
+#include <multipass/utils.h>
 #include <multipass/vm_image_host.h>
 #include <multipass/vm_image_vault.h>
 #include <multipass/xz_image_decoder.h>
+#include <multipass/zstd_image_decoder.h>
 
-#include <QCryptographicHash>
 #include <QFileInfo>
 
 #include <stdexcept>
+#include <vector>
 
 namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "vault";
+} // namespace
 
 QString mp::vault::filename_for(const mp::Path& path)
 {
@@ -44,7 +55,34 @@ QString mp::vault::copy(const QString& file_name, const QDir& output_dir)
     QFileInfo info{file_name};
     const auto source_name = info.fileName();
     auto new_path = output_dir.filePath(source_name);
-    QFile::copy(file_name, new_path);
+
+    // Copied by hand rather than with QFile::copy() so that the holes in sparse images are kept
+    QFile source{file_name}, destination{new_path};
+    if (!source.open(QFile::ReadOnly) || !destination.open(QFile::WriteOnly | QFile::Truncate))
+        throw std::runtime_error(fmt::format("failed to copy {} to {}", file_name, new_path));
+
+    // Reflinks and in-kernel copies avoid moving the data through here, where the filesystem allows them
+    if (!MP_PLATFORM.copy_file_data(source.handle(), destination.handle()))
+    {
+        mpl::log(mpl::Level::debug, category, fmt::format("Copying {} through a buffer", file_name));
+
+        if (!source.seek(0) || !destination.resize(0) || !destination.seek(0))
+            throw std::runtime_error(fmt::format("failed to copy {} to {}", file_name, new_path));
+
+        std::vector<char> buffer(1024 * 1024);
+        qint64 bytes_read;
+        while ((bytes_read = source.read(buffer.data(), buffer.size())) > 0)
+        {
+            if (!mp::utils::write_sparse(destination, buffer.data(), bytes_read))
+                break;
+        }
+
+        if (bytes_read != 0 || !mp::utils::finish_sparse(destination))
+            throw std::runtime_error(fmt::format("failed to copy {} to {}: {}", file_name, new_path,
+                                                 destination.errorString()));
+    }
+
+    destination.setPermissions(source.permissions());
     return new_path;
 }
 
@@ -62,18 +100,25 @@ QString mp::vault::compute_image_hash(const mp::Path& image_path)
         throw std::runtime_error("Cannot open image file for computing hash");
     }
 
-    QCryptographicHash hash(QCryptographicHash::Sha256);
-    if (!hash.addData(&image_file))
+    mp::Sha256Hash hash;
+    std::vector<char> buffer(1024 * 1024);
+    qint64 bytes_read;
+
+    while ((bytes_read = image_file.read(buffer.data(), buffer.size())) > 0)
+        hash.add_data(buffer.data(), bytes_read);
+
+    if (bytes_read < 0)
     {
         throw std::runtime_error("Cannot read image file to compute hash");
     }
 
-    return hash.result().toHex();
+    return hash.hex_result();
 }
 
-void mp::vault::verify_image_download(const mp::Path& image_path, const QString& image_hash)
+void mp::vault::verify_image_download(const mp::Path& image_path, const QString& image_hash,
+                                      const QString& download_hash)
 {
-    auto computed_hash = compute_image_hash(image_path);
+    auto computed_hash = download_hash.isEmpty() ? compute_image_hash(image_path) : download_hash;
 
     if (computed_hash != image_hash)
     {
@@ -81,14 +126,44 @@ void mp::vault::verify_image_download(const mp::Path& image_path, const QString&
     }
 }
 
-QString mp::vault::extract_image(const mp::Path& image_path, const mp::ProgressMonitor& monitor, const bool delete_file)
+QString mp::vault::compression_suffix(const QString& file_name)
 {
-    mp::XzImageDecoder xz_decoder(image_path);
-    QString new_image_path{image_path};
+    for (const auto suffix : {".xz", ".zst"})
+    {
+        if (file_name.endsWith(suffix))
+            return suffix;
+    }
+
+    return {};
+}
+
+std::unique_ptr<mp::StreamDecoder> mp::vault::make_stream_decoder(const QString& compressed_file_name,
+                                                                  const mp::Path& decoded_file_path)
+{
+    if (compression_suffix(compressed_file_name) == ".zst")
+        return std::make_unique<mp::ZstdStreamDecoder>(decoded_file_path);
+
+    return std::make_unique<mp::XzStreamDecoder>(decoded_file_path);
+}
+
+QString mp::vault::decode_image(const mp::Path& compressed_path, const mp::Path& decoded_path,
+                                const mp::ProgressMonitor& monitor)
+{
+    if (compression_suffix(compressed_path) == ".zst")
+        return mp::ZstdImageDecoder{compressed_path}.decode_to(decoded_path, monitor);
 
-    new_image_path.remove(".xz");
+    return mp::XzImageDecoder{compressed_path}.decode_to(decoded_path, monitor);
+}
+
+QString mp::vault::extract_image(const mp::Path& image_path, const mp::ProgressMonitor& monitor, const bool delete_file,
+                                 QString* decoded_hash)
+{
+    QString new_image_path{image_path};
+    new_image_path.chop(compression_suffix(image_path).size());
 
-    xz_decoder.decode_to(new_image_path, monitor);
+    const auto hash = decode_image(image_path, new_image_path, monitor);
+    if (decoded_hash)
+        *decoded_hash = hash;
 
     mp::vault::delete_file(image_path);
 
@@ -20,13 +20,171 @@
 #include <multipass/rpc/multipass.grpc.pb.h>
 
 #include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/sha256_hash.h>
+#include <multipass/utils.h>
 
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <optional>
 #include <vector>
 
 namespace mp = multipass;
+namespace mpl = multipass::logging;
 
 namespace
 {
+constexpr auto category = "xz decoder";
+constexpr auto max_size = 65536u;
+constexpr auto stream_header_size = 12;
+constexpr auto stream_footer_size = 12;
+constexpr qint64 max_block_size = 512LL * 1024 * 1024;     // blocks are decoded in memory
+constexpr qint64 max_bytes_in_flight = 1024LL * 1024 * 1024; // across all blocks being decoded or waiting to be written
+
+// Where a block sits in the file, as recorded in the stream index
+struct XzBlock
+{
+    qint64 offset;
+    qint64 unpadded_size;
+    qint64 uncompressed_size;
+};
+
+struct DecodedBlock
+{
+    QByteArray data;
+    std::string error;
+};
+
+qint64 padded(qint64 size)
+{
+    return (size + 3) & ~qint64{3};
+}
+
+std::uint32_t read_le32(const char* data)
+{
+    std::uint32_t value = 0;
+    for (auto i = 3; i >= 0; --i)
+        value = (value << 8) | static_cast<unsigned char>(data[i]);
+
+    return value;
+}
+
+void append_le32(QByteArray& data, std::uint32_t value)
+{
+    for (auto i = 0; i < 4; ++i)
+        data.append(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+std::optional<std::uint64_t> read_varint(const QByteArray& data, int& pos)
+{
+    std::uint64_t value = 0;
+    for (auto shift = 0; shift < 63 && pos < data.size(); shift += 7)
+    {
+        const auto byte = static_cast<unsigned char>(data[pos++]);
+        value |= std::uint64_t{byte & 0x7fu} << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+
+    return std::nullopt;
+}
+
+void append_varint(QByteArray& data, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        data.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    data.append(static_cast<char>(value));
+}
+
+std::uint32_t crc32(const QByteArray& data, int from = 0)
+{
+    return xz_crc32(reinterpret_cast<const std::uint8_t*>(data.constData()) + from, data.size() - from, 0);
+}
+
+/*
+ * Reads the block layout from the index at the end of the file. Returns nothing when the file is not a single stream
+ * with a well-formed index (e.g. concatenated streams), in which case it is only decoded as a stream.
+ */
+std::optional<std::vector<XzBlock>> read_block_index(QFile& file)
+{
+    const auto file_size = file.size();
+    if (file_size < stream_header_size + stream_footer_size || !file.seek(file_size - stream_footer_size))
+        return std::nullopt;
+
+    const auto footer = file.read(stream_footer_size);
+    if (footer.size() != stream_footer_size || !footer.endsWith("YZ") ||
+        read_le32(footer.constData()) != crc32(footer.left(10), 4))
+        return std::nullopt;
+
+    const qint64 index_size = (qint64{read_le32(footer.constData() + 4)} + 1) * 4;
+    const auto index_offset = file_size - stream_footer_size - index_size;
+    if (index_offset < stream_header_size || !file.seek(index_offset))
+        return std::nullopt;
+
+    const auto index = file.read(index_size);
+    if (index.size() != index_size || index[0] != '\0' ||
+        read_le32(index.constData() + index_size - 4) != crc32(index.left(index_size - 4)))
+        return std::nullopt;
+
+    auto pos = 1;
+    const auto record_count = read_varint(index, pos);
+    if (!record_count)
+        return std::nullopt;
+
+    std::vector<XzBlock> blocks;
+    qint64 offset = stream_header_size;
+    for (auto i = std::uint64_t{0}; i < *record_count; ++i)
+    {
+        const auto unpadded_size = read_varint(index, pos);
+        const auto uncompressed_size = read_varint(index, pos);
+        if (!unpadded_size || !uncompressed_size || *unpadded_size > static_cast<std::uint64_t>(index_offset))
+            return std::nullopt;
+
+        blocks.push_back({offset, static_cast<qint64>(*unpadded_size), static_cast<qint64>(*uncompressed_size)});
+        offset += padded(*unpadded_size);
+    }
+
+    if (offset != index_offset)
+        return std::nullopt;
+
+    return blocks;
+}
+
+/*
+ * xz-embedded only decodes whole streams, so each block is wrapped in a stream of its own: the original stream header,
+ * the block, and an index and footer describing just that block.
+ */
+QByteArray make_single_block_stream(const QByteArray& stream_header, const QByteArray& block_data,
+                                    const XzBlock& block)
+{
+    QByteArray index;
+    index.append('\0');
+    append_varint(index, 1);
+    append_varint(index, block.unpadded_size);
+    append_varint(index, block.uncompressed_size);
+    while (index.size() % 4)
+        index.append('\0');
+    append_le32(index, crc32(index));
+
+    QByteArray footer;
+    append_le32(footer, index.size() / 4 - 1);
+    footer.append(stream_header.mid(6, 2)); // stream flags
+    QByteArray stream{stream_header};
+    stream.append(block_data).append(index);
+    append_le32(stream, crc32(footer));
+    stream.append(footer).append("YZ");
+
+    return stream;
+}
+
 bool verify_decode(const xz_ret& ret)
 {
     switch (ret)
@@ -52,67 +210,212 @@ bool verify_decode(const xz_ret& ret)
 
     return true;
 }
+
+DecodedBlock decode_block(const QByteArray& stream, qint64 uncompressed_size)
+{
+    DecodedBlock decoded{QByteArray(static_cast<int>(uncompressed_size), Qt::Uninitialized), {}};
+    mp::XzImageDecoder::XzDecoderUPtr xz_decoder{xz_dec_init(XZ_SINGLE, 0), xz_dec_end};
+
+    struct xz_buf decode_buf
+    {
+    };
+    decode_buf.in = reinterpret_cast<const unsigned char*>(stream.constData());
+    decode_buf.in_size = stream.size();
+    decode_buf.out = reinterpret_cast<unsigned char*>(decoded.data.data());
+    decode_buf.out_size = decoded.data.size();
+
+    try
+    {
+        if (verify_decode(xz_dec_run(xz_decoder.get(), &decode_buf)) || decode_buf.out_pos != decode_buf.out_size)
+            throw std::runtime_error("xz file is corrupt");
+    }
+    catch (const std::runtime_error& e)
+    {
+        decoded.error = e.what();
+    }
+
+    return decoded;
+}
 } // namespace
 
-mp::XzImageDecoder::XzImageDecoder(const Path& xz_file_path)
-    : xz_file{xz_file_path}, xz_decoder{xz_dec_init(XZ_DYNALLOC, 1u << 26), xz_dec_end}
+mp::XzStreamDecoder::XzStreamDecoder(const Path& decoded_file_path)
+    : decoded_file{decoded_file_path},
+      xz_decoder{xz_dec_init(XZ_DYNALLOC, 1u << 26), xz_dec_end},
+      decoded_data(max_size),
+      decode_buf{}
 {
     xz_crc32_init();
     xz_crc64_init();
+
+    if (!decoded_file.open(QIODevice::WriteOnly))
+        throw std::runtime_error(fmt::format("failed to open {} for writing", decoded_file.fileName()));
+
+    decode_buf.out = reinterpret_cast<unsigned char*>(decoded_data.data());
+    decode_buf.out_size = decoded_data.size();
 }
 
-void mp::XzImageDecoder::decode_to(const Path& decoded_image_path, const ProgressMonitor& monitor)
+void mp::XzStreamDecoder::feed(const char* data, std::size_t size)
+{
+    if (size > 0)
+        run(data, size);
+}
+
+QString mp::XzStreamDecoder::finish()
+{
+    // Let the decoder drain whatever output it still holds
+    run(nullptr, 0);
+
+    if (!stream_ended)
+        throw std::runtime_error("xz file is truncated");
+
+    if (!mp::utils::finish_sparse(decoded_file))
+        throw std::runtime_error(fmt::format("failed to write {}: {}", decoded_file.fileName(),
+                                             decoded_file.errorString()));
+
+    decoded_file.close();
+    return hash.hex_result();
+}
+
+void mp::XzStreamDecoder::run(const char* data, std::size_t size)
+{
+    decode_buf.in = reinterpret_cast<const unsigned char*>(data);
+    decode_buf.in_pos = 0;
+    decode_buf.in_size = size;
+
+    // The decoder returns when it runs out of input or of room for output, so keep going until it asks for more input
+    while (!stream_ended)
+    {
+        stream_ended = !verify_decode(xz_dec_run(xz_decoder.get(), &decode_buf));
+
+        const auto output_full = decode_buf.out_pos == decode_buf.out_size;
+        if (output_full || stream_ended)
+            flush();
+
+        if (!output_full && decode_buf.in_pos == decode_buf.in_size)
+            break;
+    }
+}
+
+void mp::XzStreamDecoder::flush()
+{
+    if (!mp::utils::write_sparse(decoded_file, decoded_data.data(), decode_buf.out_pos))
+        throw std::runtime_error(fmt::format("failed to write {}: {}", decoded_file.fileName(),
+                                             decoded_file.errorString()));
+
+    hash.add_data(decoded_data.data(), decode_buf.out_pos);
+    decode_buf.out_pos = 0;
+}
+
+mp::XzImageDecoder::XzImageDecoder(const Path& xz_file_path, int max_threads)
+    : xz_file{xz_file_path}, max_threads{max_threads > 0 ? max_threads : QThread::idealThreadCount()}
+{
+}
+
+QString mp::XzImageDecoder::decode_to(const Path& decoded_image_path, const ProgressMonitor& monitor)
 {
     if (!xz_file.open(QIODevice::ReadOnly))
         throw std::runtime_error(fmt::format("failed to open {} for reading", xz_file.fileName()));
 
+    const auto blocks = max_threads > 1 ? read_block_index(xz_file) : std::nullopt;
+    if (!blocks || blocks->size() < 2 ||
+        std::any_of(blocks->cbegin(), blocks->cend(), [](const auto& block) {
+            return block.uncompressed_size > max_block_size || padded(block.unpadded_size) > max_block_size;
+        }))
+        return decode_stream_to(decoded_image_path, monitor);
+
+    mpl::log(mpl::Level::debug, category,
+             fmt::format("Decoding {} blocks of {} on {} threads", blocks->size(), xz_file.fileName(), max_threads));
+
+    xz_crc32_init();
+    xz_crc64_init();
+
     QFile decoded_file{decoded_image_path};
     if (!decoded_file.open(QIODevice::WriteOnly))
         throw std::runtime_error(fmt::format("failed to open {} for writing", decoded_file.fileName()));
 
-    struct xz_buf decode_buf
+    xz_file.seek(0);
+    const auto stream_header = xz_file.read(stream_header_size);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(max_threads);
+
+    // Blocks are read and written in order on this thread; only the decoding happens on the pool
+    std::deque<std::pair<QFuture<DecodedBlock>, const XzBlock*>> in_flight;
+    qint64 bytes_in_flight = 0;
+    qint64 bytes_read = 0;
+    const auto file_size = xz_file.size();
+    auto last_progress = -1;
+    auto next_block = blocks->cbegin();
+    mp::Sha256Hash hash;
+
+    while (next_block != blocks->cend() || !in_flight.empty())
     {
-    };
-    const auto max_size = 65536u;
+        while (next_block != blocks->cend() && static_cast<int>(in_flight.size()) < 2 * max_threads &&
+               (in_flight.empty() || bytes_in_flight + next_block->uncompressed_size <= max_bytes_in_flight))
+        {
+            const auto& block = *next_block++;
+            const auto block_data = xz_file.read(padded(block.unpadded_size));
+            if (block_data.size() != padded(block.unpadded_size))
+                throw std::runtime_error("xz file is truncated");
 
-    std::vector<char> read_data, write_data;
-    read_data.reserve(max_size);
-    write_data.reserve(max_size);
+            bytes_read += block_data.size();
+            bytes_in_flight += block.uncompressed_size;
 
-    decode_buf.in = reinterpret_cast<unsigned char*>(read_data.data());
-    decode_buf.in_pos = 0;
-    decode_buf.in_size = 0;
-    decode_buf.out = reinterpret_cast<unsigned char*>(write_data.data());
-    decode_buf.out_pos = 0;
-    decode_buf.out_size = max_size;
+            auto stream = make_single_block_stream(stream_header, block_data, block);
+            in_flight.emplace_back(QtConcurrent::run(&pool, [stream = std::move(stream), &block] {
+                                       return decode_block(stream, block.uncompressed_size);
+                                   }),
+                                   &block);
+        }
+
+        auto [future, block] = in_flight.front();
+        in_flight.pop_front();
+
+        const auto decoded = future.result();
+        if (!decoded.error.empty())
+            throw std::runtime_error(decoded.error);
+
+        if (!mp::utils::write_sparse(decoded_file, decoded.data.constData(), decoded.data.size()))
+            throw std::runtime_error(fmt::format("failed to write {}: {}", decoded_file.fileName(),
+                                                 decoded_file.errorString()));
+
+        hash.add_data(decoded.data);
+        bytes_in_flight -= block->uncompressed_size;
+
+        auto progress = (bytes_read / (float)file_size) * 100;
+        if (last_progress != progress)
+            monitor(LaunchProgress::EXTRACT, progress);
+        last_progress = progress;
+    }
+
+    if (!mp::utils::finish_sparse(decoded_file))
+        throw std::runtime_error(fmt::format("failed to write {}: {}", decoded_file.fileName(),
+                                             decoded_file.errorString()));
+
+    return hash.hex_result();
+}
+
+QString mp::XzImageDecoder::decode_stream_to(const Path& decoded_image_path, const ProgressMonitor& monitor)
+{
+    xz_file.seek(0);
+    XzStreamDecoder decoder{decoded_image_path};
+    std::vector<char> read_data(max_size);
 
     const auto file_size = xz_file.size();
     qint64 total_bytes_extracted{0};
 
     auto last_progress = -1;
-    while (true)
+    qint64 bytes_read;
+    while ((bytes_read = xz_file.read(read_data.data(), read_data.size())) > 0)
     {
-        if (decode_buf.in_pos == decode_buf.in_size)
-        {
-            decode_buf.in_size = xz_file.read(read_data.data(), max_size);
-            decode_buf.in_pos = 0;
-            total_bytes_extracted += decode_buf.in_size;
-            auto progress = (total_bytes_extracted / (float)file_size) * 100;
-            if (last_progress != progress)
-                monitor(LaunchProgress::EXTRACT, progress);
-            last_progress = progress;
-        }
-
-        if (!verify_decode(xz_dec_run(xz_decoder.get(), &decode_buf)))
-        {
-            decoded_file.write(write_data.data(), decode_buf.out_pos);
-            return;
-        }
+        total_bytes_extracted += bytes_read;
+        auto progress = (total_bytes_extracted / (float)file_size) * 100;
+        if (last_progress != progress)
+            monitor(LaunchProgress::EXTRACT, progress);
+        last_progress = progress;
 
-        if (decode_buf.out_pos == max_size)
-        {
-            decoded_file.write(write_data.data(), decode_buf.out_pos);
-            decode_buf.out_pos = 0;
-        }
+        decoder.feed(read_data.data(), bytes_read);
     }
+
+    return decoder.finish();
 }
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/zstd_image_decoder.h>
+
+#include <multipass/rpc/multipass.grpc.pb.h>
+
+#include <multipass/format.h>
+#include <multipass/utils.h>
+
+#include <zstd.h>
+
+#include <stdexcept>
+#include <vector>
+
+namespace mp = multipass;
+
+namespace
+{
+constexpr auto read_size = 1024 * 1024;
+
+std::size_t verify_decode(std::size_t ret)
+{
+    if (ZSTD_isError(ret))
+        throw std::runtime_error(fmt::format("zstd file is corrupt: {}", ZSTD_getErrorName(ret)));
+
+    return ret;
+}
+} // namespace
+
+void mp::ZstdStreamDecoder::ContextDeleter::operator()(ZSTD_DCtx_s* context) const
+{
+    ZSTD_freeDCtx(context);
+}
+
+mp::ZstdStreamDecoder::ZstdStreamDecoder(const Path& decoded_file_path)
+    : decoded_file{decoded_file_path}, context{ZSTD_createDCtx()}, decoded_data(ZSTD_DStreamOutSize())
+{
+    if (!context)
+        throw std::runtime_error("zstd decoder memory allocation failed");
+
+    if (!decoded_file.open(QIODevice::WriteOnly))
+        throw std::runtime_error(fmt::format("failed to open {} for writing", decoded_file.fileName()));
+}
+
+void mp::ZstdStreamDecoder::feed(const char* data, std::size_t size)
+{
+    ZSTD_inBuffer input{data, size, 0};
+    auto output_full = false;
+
+    // A full output buffer means the decoder may still hold decoded data, so keep going until it has room to spare
+    while (input.pos < input.size || output_full)
+    {
+        ZSTD_outBuffer output{decoded_data.data(), decoded_data.size(), 0};
+        frame_ended = verify_decode(ZSTD_decompressStream(context.get(), &output, &input)) == 0;
+        flush(output.pos);
+
+        output_full = output.pos == output.size;
+    }
+}
+
+QString mp::ZstdStreamDecoder::finish()
+{
+    // A frame that is cut short leaves the decoder expecting more input
+    if (!frame_ended)
+        throw std::runtime_error("zstd file is truncated");
+
+    if (!mp::utils::finish_sparse(decoded_file))
+        throw std::runtime_error(fmt::format("failed to write {}: {}", decoded_file.fileName(),
+                                             decoded_file.errorString()));
+
+    decoded_file.close();
+    return hash.hex_result();
+}
+
+void mp::ZstdStreamDecoder::flush(std::size_t size)
+{
+    if (!mp::utils::write_sparse(decoded_file, decoded_data.data(), size))
+        throw std::runtime_error(fmt::format("failed to write {}: {}", decoded_file.fileName(),
+                                             decoded_file.errorString()));
+
+    hash.add_data(decoded_data.data(), size);
+}
+
+mp::ZstdImageDecoder::ZstdImageDecoder(const Path& zstd_file_path) : zstd_file{zstd_file_path}
+{
+}
+
+QString mp::ZstdImageDecoder::decode_to(const Path& decoded_image_path, const ProgressMonitor& monitor)
+{
+    if (!zstd_file.open(QIODevice::ReadOnly))
+        throw std::runtime_error(fmt::format("failed to open {} for reading", zstd_file.fileName()));
+
+    ZstdStreamDecoder decoder{decoded_image_path};
+    std::vector<char> read_data(read_size);
+
+    const auto file_size = zstd_file.size();
+    qint64 total_bytes_extracted{0};
+
+    auto last_progress = -1;
+    qint64 bytes_read;
+    while ((bytes_read = zstd_file.read(read_data.data(), read_data.size())) > 0)
+    {
+        total_bytes_extracted += bytes_read;
+        auto progress = (total_bytes_extracted / (float)file_size) * 100;
+        if (last_progress != progress)
+            monitor(LaunchProgress::EXTRACT, progress);
+        last_progress = progress;
+
+        decoder.feed(read_data.data(), bytes_read);
+    }
+
+    if (bytes_read < 0)
+        throw std::runtime_error(fmt::format("failed to read {}", zstd_file.fileName()));
+
+    return decoder.finish();
+}
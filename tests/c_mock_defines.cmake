@@ -43,6 +43,12 @@ add_c_mocks(
   ssh_channel_request_pty
   ssh_channel_change_pty_size
   ssh_channel_read_timeout
+  ssh_channel_read_nonblocking
+  ssh_channel_write
+  ssh_channel_window_size
+  ssh_channel_send_eof
+  ssh_channel_close
+  ssh_channel_request_pty_size
   ssh_channel_get_exit_status
   ssh_event_dopoll
   ssh_add_channel_callbacks
@@ -640,3 +640,22 @@ template grpc::Status mpt::DaemonTestFixture::call_daemon_slot(
     void (mp::Daemon::*)(const mp::InfoRequest*, grpc::ServerReaderWriterInterface<mp::InfoReply, mp::InfoRequest>*,
                          std::promise<grpc::Status>*),
     const mp::InfoRequest&, StrictMock<mpt::MockServerReaderWriter<mp::InfoReply, mp::InfoRequest>>&);
+template grpc::Status mpt::DaemonTestFixture::call_daemon_slot(
+    mp::Daemon&,
+    void (mp::Daemon::*)(const mp::FlattenRequest*,
+                         grpc::ServerReaderWriterInterface<mp::FlattenReply, mp::FlattenRequest>*,
+                         std::promise<grpc::Status>*),
+    const mp::FlattenRequest&, StrictMock<mpt::MockServerReaderWriter<mp::FlattenReply, mp::FlattenRequest>>&&);
+template grpc::Status mpt::DaemonTestFixture::call_daemon_slot(
+    mp::Daemon&,
+    void (mp::Daemon::*)(const mp::ImageCacheRequest*,
+                         grpc::ServerReaderWriterInterface<mp::ImageCacheReply, mp::ImageCacheRequest>*,
+                         std::promise<grpc::Status>*),
+    const mp::ImageCacheRequest&,
+    StrictMock<mpt::MockServerReaderWriter<mp::ImageCacheReply, mp::ImageCacheRequest>>&);
+template grpc::Status mpt::DaemonTestFixture::call_daemon_slot(
+    mp::Daemon&,
+    void (mp::Daemon::*)(const mp::DeleteRequest*,
+                         grpc::ServerReaderWriterInterface<mp::DeleteReply, mp::DeleteRequest>*,
+                         std::promise<grpc::Status>*),
+    const mp::DeleteRequest&, NiceMock<mpt::MockServerReaderWriter<mp::DeleteReply, mp::DeleteRequest>>&&);
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_FAKE_XZ_DATA_H
+#define MULTIPASS_FAKE_XZ_DATA_H
+
+#include <QByteArray>
+
+namespace multipass
+{
+namespace test
+{
+const QByteArray multi_block_decoded_data{"This is some data to put in a file when decoded in blocks."};
+
+// multi_block_decoded_data, compressed with `xz -C crc32 --block-size=20` into three blocks
+const QByteArray multi_block_xz{"\xfd\x37\x7a\x58\x5a\x00\x00\x01\x69\x22\xde\x36\x02\x00\x21\x01"
+                                "\x16\x00\x00\x00\x74\x2f\xe5\xa3\x01\x00\x13\x54\x68\x69\x73\x20"
+                                "\x69\x73\x20\x73\x6f\x6d\x65\x20\x64\x61\x74\x61\x20\x74\x6f\x00"
+                                "\xb2\xb1\x27\x1e\x02\x00\x21\x01\x16\x00\x00\x00\x74\x2f\xe5\xa3"
+                                "\x01\x00\x13\x20\x70\x75\x74\x20\x69\x6e\x20\x61\x20\x66\x69\x6c"
+                                "\x65\x20\x77\x68\x65\x6e\x20\x00\xef\x7d\xda\xfb\x02\x00\x21\x01"
+                                "\x16\x00\x00\x00\x74\x2f\xe5\xa3\x01\x00\x11\x64\x65\x63\x6f\x64"
+                                "\x65\x64\x20\x69\x6e\x20\x62\x6c\x6f\x63\x6b\x73\x2e\x00\x00\x00"
+                                "\x30\x5b\xe4\xac\x00\x03\x28\x14\x28\x14\x26\x12\xfc\x0d\x9b\x64"
+                                "\x3e\x30\x0d\x8b\x02\x00\x00\x00\x00\x01\x59\x5a",
+                                156};
+} // namespace test
+} // namespace multipass
+
+#endif // MULTIPASS_FAKE_XZ_DATA_H
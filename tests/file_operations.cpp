@@ -26,6 +26,8 @@
 #include <QFile>
 #include <QFileInfo>
 
+#include <cstdint>
+
 namespace mpt = multipass::test;
 
 QByteArray mpt::load(QString path)
@@ -65,3 +67,22 @@ qint64 mpt::make_file_with_content(const QString& file_name, const std::string&
     file.write(content.data(), content.size());
     return file.size();
 }
+
+std::string mpt::qcow2_header(qint64 virtual_size, const std::string& backing_file)
+{
+    constexpr auto header_size = 72;
+    auto append_be = [](std::string& data, std::uint64_t value, int size) {
+        for (auto shift = 8 * (size - 1); shift >= 0; shift -= 8)
+            data.push_back(static_cast<char>((value >> shift) & 0xff));
+    };
+
+    std::string header{"QFI\xfb"};
+    append_be(header, 3, 4);                                        // version
+    append_be(header, backing_file.empty() ? 0 : header_size, 8);   // backing file offset
+    append_be(header, backing_file.size(), 4);                      // backing file size
+    append_be(header, 16, 4);                                       // cluster bits
+    append_be(header, static_cast<std::uint64_t>(virtual_size), 8); // size
+    header.resize(header_size, '\0');
+
+    return header + backing_file;
+}
@@ -218,6 +218,29 @@ TEST_F(PlatformLinux, test_default_privileged_mounts)
     EXPECT_EQ(MP_PLATFORM.default_privileged_mounts(), "true");
 }
 
+TEST_F(PlatformLinux, copy_file_data_copies_contents_and_holes)
+{
+    mpt::TempDir temp_dir;
+    QFile source{QDir{temp_dir.path()}.filePath("source")}, target{QDir{temp_dir.path()}.filePath("target")};
+    ASSERT_TRUE(source.open(QFile::ReadWrite));
+    ASSERT_TRUE(target.open(QFile::WriteOnly));
+
+    // Data, a hole, more data and a trailing hole
+    ASSERT_EQ(source.write("head"), 4);
+    ASSERT_TRUE(source.seek(8 * 1024 * 1024));
+    ASSERT_EQ(source.write("tail"), 4);
+    ASSERT_TRUE(source.resize(16 * 1024 * 1024));
+    ASSERT_TRUE(source.flush());
+
+    // sendfile() handles regular files everywhere, even where neither reflinks nor copy_file_range() do
+    ASSERT_TRUE(MP_PLATFORM.copy_file_data(source.handle(), target.handle()));
+
+    target.close();
+    source.seek(0);
+    ASSERT_TRUE(target.open(QFile::ReadOnly));
+    EXPECT_EQ(target.readAll(), source.readAll());
+}
+
 TEST_F(PlatformLinux, test_autostart_desktop_file_properly_placed)
 {
     try
@@ -24,10 +24,10 @@ mpt::MischievousURLDownloader::MischievousURLDownloader(std::chrono::millisecond
 {
 }
 
-void mpt::MischievousURLDownloader::download_to(const QUrl& url, const QString& file_name, int64_t size,
-                                                const int download_type, const mp::ProgressMonitor& monitor)
+QString mpt::MischievousURLDownloader::download_to(const QUrl& url, const QString& file_name, int64_t size,
+                                                   const int download_type, const mp::ProgressMonitor& monitor)
 {
-    URLDownloader::download_to(choose_url(url), file_name, size, download_type, monitor);
+    return URLDownloader::download_to(choose_url(url), file_name, size, download_type, monitor);
 }
 
 QByteArray mpt::MischievousURLDownloader::download(const QUrl& url)
@@ -35,6 +35,12 @@ QByteArray mpt::MischievousURLDownloader::download(const QUrl& url)
     return URLDownloader::download(choose_url(url));
 }
 
+std::optional<QByteArray> mpt::MischievousURLDownloader::download_if_modified(const QUrl& url,
+                                                                             mp::HttpValidators& validators)
+{
+    return URLDownloader::download_if_modified(choose_url(url), validators);
+}
+
 QDateTime mpt::MischievousURLDownloader::last_modified(const QUrl& url)
 {
     return URLDownloader::last_modified(choose_url(url));
@@ -188,6 +188,19 @@ public:
                 (override));
     MOCK_METHOD((grpc::ClientAsyncReaderWriterInterface<multipass::AuthenticateRequest, multipass::AuthenticateReply>*),
                 PrepareAsyncauthenticateRaw, (grpc::ClientContext * context, grpc::CompletionQueue* cq), (override));
+    MOCK_METHOD((grpc::ClientReaderWriterInterface<multipass::ImageCacheRequest, multipass::ImageCacheReply>*),
+                image_cacheRaw, (grpc::ClientContext * context), (override));
+    MOCK_METHOD((grpc::ClientAsyncReaderWriterInterface<multipass::ImageCacheRequest, multipass::ImageCacheReply>*),
+                Asyncimage_cacheRaw, (grpc::ClientContext * context, grpc::CompletionQueue* cq, void* tag),
+                (override));
+    MOCK_METHOD((grpc::ClientAsyncReaderWriterInterface<multipass::ImageCacheRequest, multipass::ImageCacheReply>*),
+                PrepareAsyncimage_cacheRaw, (grpc::ClientContext * context, grpc::CompletionQueue* cq), (override));
+    MOCK_METHOD((grpc::ClientReaderWriterInterface<multipass::FlattenRequest, multipass::FlattenReply>*), flattenRaw,
+                (grpc::ClientContext * context), (override));
+    MOCK_METHOD((grpc::ClientAsyncReaderWriterInterface<multipass::FlattenRequest, multipass::FlattenReply>*),
+                AsyncflattenRaw, (grpc::ClientContext * context, grpc::CompletionQueue* cq, void* tag), (override));
+    MOCK_METHOD((grpc::ClientAsyncReaderWriterInterface<multipass::FlattenRequest, multipass::FlattenReply>*),
+                PrepareAsyncflattenRaw, (grpc::ClientContext * context, grpc::CompletionQueue* cq), (override));
 };
 } // namespace multipass::test
 
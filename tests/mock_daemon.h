@@ -72,6 +72,11 @@ struct MockDaemon : public Daemon
     MOCK_METHOD3(networks,
                  void(const NetworksRequest*, grpc::ServerReaderWriterInterface<NetworksReply, NetworksRequest>*,
                       std::promise<grpc::Status>*));
+    MOCK_METHOD3(image_cache,
+                 void(const ImageCacheRequest*, grpc::ServerReaderWriterInterface<ImageCacheReply, ImageCacheRequest>*,
+                      std::promise<grpc::Status>*));
+    MOCK_METHOD3(flatten, void(const FlattenRequest*, grpc::ServerReaderWriterInterface<FlattenReply, FlattenRequest>*,
+                               std::promise<grpc::Status>*));
     MOCK_METHOD3(authenticate, void(const AuthenticateRequest*,
                                     grpc::ServerReaderWriterInterface<AuthenticateReply, AuthenticateRequest>*,
                                     std::promise<grpc::Status>*));
@@ -29,8 +29,13 @@ struct MockURLDownloader : public multipass::URLDownloader
     MockURLDownloader() : URLDownloader{std::chrono::seconds(10)} {};
 
     MOCK_METHOD1(download, QByteArray(const QUrl&));
+    MOCK_METHOD2(download_if_modified, std::optional<QByteArray>(const QUrl&, HttpValidators&));
     MOCK_METHOD1(last_modified, QDateTime(const QUrl&));
-    MOCK_METHOD5(download_to, void(const QUrl&, const QString&, int64_t, const int, const ProgressMonitor&));
+    MOCK_METHOD5(download_to, QString(const QUrl&, const QString&, int64_t, const int, const ProgressMonitor&));
+    MOCK_METHOD5(download_decoded_to,
+                 QString(const QUrl&, const QString&, int64_t, const int, const ProgressMonitor&));
+    MOCK_METHOD5(download_ranges_to, void(const QUrl&, const QString&, const std::vector<std::pair<qint64, qint64>>&,
+                                          const int, const ProgressMonitor&));
 };
 } // namespace test
 } // namespace multipass
@@ -49,7 +49,13 @@ public:
     MOCK_METHOD1(has_record_for, bool(const std::string&));
     MOCK_METHOD0(prune_expired_images, void());
     MOCK_METHOD3(update_images, void(const FetchType&, const PrepareAction&, const ProgressMonitor&));
+    MOCK_METHOD3(scrub_images, void(const FetchType&, const PrepareAction&, const ProgressMonitor&));
     MOCK_METHOD1(minimum_image_size_for, MemorySize(const std::string&));
+    MOCK_METHOD1(flatten, void(const std::string&));
+    MOCK_METHOD0(cached_images, std::vector<VMImage>());
+    MOCK_METHOD1(set_size_budget, void(const MemorySize&));
+    MOCK_METHOD1(set_max_downloads, void(int));
+    MOCK_METHOD0(cache_usage, ImageCacheUsage());
     MOCK_CONST_METHOD1(image_host_for, VMImageHost*(const std::string&));
     MOCK_CONST_METHOD1(all_info_for, std::vector<std::pair<std::string, VMImageInfo>>(const Query&));
 
@@ -16,7 +16,9 @@
  */
 
 #include "tests/common.h"
+#include "tests/file_operations.h"
 #include "tests/mock_process_factory.h"
+#include "tests/temp_dir.h"
 
 #include <src/platform/backends/shared/qemu_img_utils/qemu_img_utils.h>
 
@@ -206,6 +208,40 @@ TEST(QemuImgUtils, image_resize_detects_resizing_crash_failure_and_throws)
     test_image_resizing(img, min_size, request_size, qemuimg_resize_result, throw_msg_matcher);
 }
 
+TEST(QemuImgUtils, image_resize_is_skipped_when_qcow2_header_has_requested_size)
+{
+    mpt::TempDir temp_dir;
+    const auto img = QDir{temp_dir.path()}.filePath("image.qcow2");
+    const auto size = mp::MemorySize{"3G"};
+    mpt::make_file_with_content(img, mpt::qcow2_header(size.in_bytes()));
+
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+
+    mp::backend::resize_instance_image(size, img);
+
+    EXPECT_TRUE(mock_factory_scope->process_list().empty());
+}
+
+TEST(QemuImgUtils, image_conversion_reads_format_from_header)
+{
+    mpt::TempDir temp_dir;
+    const auto qcow2_img = QDir{temp_dir.path()}.filePath("image.qcow2");
+    const auto raw_img = QDir{temp_dir.path()}.filePath("image.img");
+    mpt::make_file_with_content(qcow2_img, mpt::qcow2_header(1024 * 1024));
+    mpt::make_file_with_content(raw_img, std::string(4096, '\0'));
+
+    auto process_count = 0;
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([&](mpt::MockProcess* process) {
+        ASSERT_LE(++process_count, 1);
+        simulate_qemuimg_convert(process, raw_img, raw_img + ".qcow2", success);
+    });
+
+    EXPECT_EQ(mp::backend::convert_to_qcow_if_necessary(qcow2_img), qcow2_img);
+    EXPECT_EQ(mp::backend::convert_to_qcow_if_necessary(raw_img), raw_img + ".qcow2");
+    EXPECT_EQ(process_count, 1);
+}
+
 TEST_P(ImageConversionTestSuite, properly_handles_image_conversion)
 {
     const auto img_path = "/fake/img/path";
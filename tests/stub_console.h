@@ -31,6 +31,11 @@ struct StubConsole final : public multipass::Console
     void write_console() override{};
 
     void exit_console() override{};
+
+    bool is_interactive() const override
+    {
+        return false;
+    };
 };
 }
 }
@@ -45,11 +45,29 @@ struct StubVMImageVault final : public multipass::VMImageVault
     void update_images(const FetchType& fetch_type, const PrepareAction& prepare,
                        const ProgressMonitor& monitor) override{};
 
+    void scrub_images(const FetchType& fetch_type, const PrepareAction& prepare,
+                      const ProgressMonitor& monitor) override{};
+
     MemorySize minimum_image_size_for(const std::string& image) override
     {
         return MemorySize{};
     }
 
+    void flatten(const std::string& name) override{};
+
+    std::vector<VMImage> cached_images() override
+    {
+        return {};
+    }
+
+    void set_size_budget(const MemorySize& size_budget) override{};
+    void set_max_downloads(int max_downloads) override{};
+
+    ImageCacheUsage cache_usage() override
+    {
+        return {};
+    }
+
     VMImageHost* image_host_for(const std::string& remote_name) const override
     {
         return nullptr;
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "file_operations.h"
+#include "temp_dir.h"
+
+#include <multipass/block_map.h>
+
+#include <QDir>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace testing;
+
+namespace
+{
+using Range = std::pair<qint64, qint64>;
+
+struct BlockMap : public Test
+{
+    QString file_with(const std::string& contents, const QString& name)
+    {
+        const auto file_path = QDir{temp_dir.path()}.filePath(name);
+        mpt::make_file_with_content(file_path, contents);
+        return file_path;
+    }
+
+    mpt::TempDir temp_dir;
+    const std::string old_contents{"AAAABBBBCCCCDDDD"};
+    const std::string new_contents{std::string{"DDDDXXXXAAAA"} + std::string(4, '\0') + "BBYY"};
+};
+} // namespace
+
+TEST_F(BlockMap, survivesJson)
+{
+    const auto block_map = mp::make_block_map(file_with(new_contents, "new"), 4);
+    const auto parsed = mp::block_map_from_json(mp::block_map_to_json(block_map));
+
+    ASSERT_TRUE(parsed);
+    EXPECT_EQ(parsed->block_size, 4);
+    EXPECT_EQ(parsed->size, 20);
+    EXPECT_EQ(parsed->sha256, block_map.sha256);
+    EXPECT_EQ(parsed->block_hashes, block_map.block_hashes);
+}
+
+TEST_F(BlockMap, rejectsMalformedJson)
+{
+    EXPECT_FALSE(mp::block_map_from_json("not json"));
+    EXPECT_FALSE(mp::block_map_from_json(R"({"block_size": 4, "size": 20, "hashes": ""})"));
+}
+
+TEST_F(BlockMap, plansToReuseMovedBlocksAndZeros)
+{
+    const auto block_map = mp::make_block_map(file_with(new_contents, "new"), 4);
+    const auto plan = mp::plan_delta(block_map, file_with(old_contents, "old"));
+
+    EXPECT_THAT(plan.copies, ElementsAre(Range{0, 12}, Range{8, 0}));
+    EXPECT_THAT(plan.missing, ElementsAre(Range{4, 4}, Range{16, 4}));
+    EXPECT_EQ(plan.reused_bytes, 12);
+}
+
+TEST_F(BlockMap, mergesAdjacentMissingBlocks)
+{
+    const auto block_map = mp::make_block_map(file_with("XXXXYYYYAAAA", "new"), 4);
+    const auto plan = mp::plan_delta(block_map, file_with(old_contents, "old"));
+
+    EXPECT_THAT(plan.missing, ElementsAre(Range{0, 8}));
+}
+
+TEST_F(BlockMap, copiesReusedBlocksIntoPlace)
+{
+    const auto old_path = file_with(old_contents, "old");
+    const auto block_map = mp::make_block_map(file_with(new_contents, "new"), 4);
+    const auto plan = mp::plan_delta(block_map, old_path);
+
+    QFile rebuilt{QDir{temp_dir.path()}.filePath("rebuilt")};
+    ASSERT_TRUE(rebuilt.open(QIODevice::ReadWrite));
+    mp::copy_reused_blocks(block_map, plan, old_path, rebuilt);
+    rebuilt.seek(0);
+
+    auto expected = QByteArray::fromStdString(new_contents);
+    expected.replace(4, 4, QByteArray(4, '\0')).replace(16, 4, QByteArray(4, '\0'));
+    EXPECT_EQ(rebuilt.readAll(), expected);
+}
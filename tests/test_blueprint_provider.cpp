@@ -408,6 +408,7 @@ TEST_F(VMBlueprintProvider, doesNotUpdateBlueprintsWhenNotNeeded)
         .WillRepeatedly([](auto, const QString& file_name, auto...) {
             QFile file(file_name);
             file.open(QFile::WriteOnly);
+            return QString{};
         });
 
     mp::DefaultVMBlueprintProvider blueprint_provider{blueprints_zip_url, &mock_url_downloader, cache_dir.path(),
@@ -426,6 +427,8 @@ TEST_F(VMBlueprintProvider, updatesBlueprintsWhenNeeded)
 
             if (!file.exists())
                 file.open(QFile::WriteOnly);
+
+            return QString{};
         });
 
     mp::DefaultVMBlueprintProvider blueprint_provider{blueprints_zip_url, &mock_url_downloader, cache_dir.path(),
@@ -460,6 +463,7 @@ TEST_F(VMBlueprintProvider, downloadFailureDuringUpdateLogsErrorAndDoesNotThrow)
         .WillOnce([](auto, const QString& file_name, auto...) {
             QFile file(file_name);
             file.open(QFile::WriteOnly);
+            return QString{};
         })
         .WillRepeatedly(Throw(mp::DownloadException(url, error_msg)));
 
@@ -510,6 +514,7 @@ TEST_F(VMBlueprintProvider, generalExceptionDuringCallThrows)
         .WillOnce([](auto, const QString& file_name, auto...) {
             QFile file(file_name);
             file.open(QFile::WriteOnly);
+            return QString{};
         })
         .WillRepeatedly(Throw(std::runtime_error(error_msg)));
 
@@ -733,7 +738,7 @@ TEST_F(VMBlueprintProvider, v2ShaOnUrlIsCorrectlyPropagated)
     EXPECT_CALL(mock_url_downloader, download_to(_, _, _, _, _))
         .WillOnce([this](const QUrl& url, const QString& file_name, int64_t size, const int download_type,
                          const mp::ProgressMonitor& monitor) {
-            url_downloader.download_to(url, file_name, size, download_type, monitor);
+            return url_downloader.download_to(url, file_name, size, download_type, monitor);
         });
 
     mp::DefaultVMBlueprintProvider blueprint_provider{blueprints_zip_url, &mock_url_downloader, cache_dir.path(),
@@ -805,6 +810,7 @@ TEST_P(VMBlueprintFileLaunchFromFile, loadsFile)
         .WillRepeatedly([](auto, const QString& file_name, auto...) {
             QFile file(file_name);
             file.open(QFile::WriteOnly);
+            return QString{};
         });
 
     ON_CALL(*mock_platform, is_image_url_supported()).WillByDefault(Return(true));
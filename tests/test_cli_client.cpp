@@ -21,6 +21,7 @@
 #include "disabling_macros.h"
 #include "fake_alias_config.h"
 #include "fake_key_data.h"
+#include "file_operations.h"
 #include "mock_cert_provider.h"
 #include "mock_environment_helpers.h"
 #include "mock_file_ops.h"
@@ -40,6 +41,7 @@
 
 #include <src/client/cli/client.h>
 #include <src/client/cli/cmd/remote_settings_handler.h>
+#include <src/client/cli/cmd/ssh_info_cache.h>
 #include <src/daemon/daemon_rpc.h>
 
 #include <multipass/cli/client_platform.h>
@@ -47,6 +49,8 @@
 #include <multipass/exceptions/settings_exceptions.h>
 #include <multipass/exceptions/ssh_exception.h>
 
+#include <QDateTime>
+#include <QDirIterator>
 #include <QStringList>
 #include <QTemporaryFile>
 #include <QTimer>
@@ -136,15 +140,28 @@ struct MockDaemonRpc : public mp::DaemonRpc
                 (grpc::ServerContext * context,
                  (grpc::ServerReaderWriter<mp::AuthenticateReply, mp::AuthenticateRequest> * server)),
                 (override));
+    MOCK_METHOD(grpc::Status, flatten,
+                (grpc::ServerContext * context,
+                 (grpc::ServerReaderWriter<mp::FlattenReply, mp::FlattenRequest> * server)),
+                (override));
 };
 
 struct Client : public Test
 {
+    Client()
+    {
+        EXPECT_CALL(mpt::MockStandardPaths::mock_instance(), writableLocation(_)).Times(AnyNumber());
+        EXPECT_CALL(mpt::MockStandardPaths::mock_instance(), writableLocation(mp::StandardPaths::GenericCacheLocation))
+            .Times(AnyNumber())
+            .WillRepeatedly(Return(fake_cache_dir.path())); // keep cached SSH info from leaking between tests
+    }
+
     void SetUp() override
     {
         EXPECT_CALL(mock_settings, get(Eq(mp::petenv_key))).WillRepeatedly(Return(petenv_name));
         EXPECT_CALL(mock_settings, get(Eq(mp::winterm_key))).WillRepeatedly(Return("none"));
         EXPECT_CALL(mock_settings, get(Eq(mp::mounts_key))).WillRepeatedly(Return("true"));
+        EXPECT_CALL(mock_settings, get(Eq(mp::ssh_mux_key))).WillRepeatedly(Return("0"));
         EXPECT_CALL(mock_settings, register_handler(_)).WillRepeatedly(Return(nullptr));
         EXPECT_CALL(mock_settings, unregister_handler).Times(AnyNumber());
 
@@ -373,6 +390,7 @@ struct Client : public Test
     const grpc::Status ok{};
 
     mpt::MockSSHTestFixture mock_ssh_test_fixture;
+    QTemporaryDir fake_cache_dir;
 };
 
 struct ClientAlias : public Client, public FakeAliasConfig
@@ -1410,18 +1428,76 @@ TEST_F(Client, purge_cmd_help_ok)
     EXPECT_THAT(send_command({"purge", "-h"}), Eq(mp::ReturnCode::Ok));
 }
 
+// ssh info cache tests
+mp::SSHInfo cacheable_ssh_info()
+{
+    mp::SSHInfo ssh_info;
+    ssh_info.set_username("ubuntu");
+    ssh_info.set_cacheable(true);
+    return ssh_info;
+}
+
+TEST_F(Client, DISABLE_ON_WINDOWS(ssh_info_cache_is_private_to_the_user))
+{
+    mp::cmd::cache_ssh_info("unix:/one", "test-vm", cacheable_ssh_info());
+
+    const auto group_or_other = QFileDevice::ReadGroup | QFileDevice::WriteGroup | QFileDevice::ExeGroup |
+                                QFileDevice::ReadOther | QFileDevice::WriteOther | QFileDevice::ExeOther;
+    QDirIterator it{QDir{fake_cache_dir.path()}.filePath(QStringLiteral("%1/ssh-info").arg(mp::client_name)),
+                    QDir::AllEntries | QDir::NoDotAndDotDot, QDirIterator::Subdirectories};
+    auto entries = 0;
+    while (it.hasNext())
+    {
+        it.next();
+        ++entries;
+        EXPECT_FALSE(it.fileInfo().permissions() & group_or_other) << it.filePath().toStdString();
+    }
+
+    EXPECT_EQ(entries, 2); // the server's directory and the instance's entry
+}
+
+TEST_F(Client, ssh_info_cache_is_per_server)
+{
+    mp::cmd::cache_ssh_info("unix:/one", "test-vm", cacheable_ssh_info());
+
+    EXPECT_TRUE(mp::cmd::cached_ssh_info("unix:/one", "test-vm"));
+    EXPECT_FALSE(mp::cmd::cached_ssh_info("unix:/two", "test-vm"));
+}
+
+TEST_F(Client, ssh_info_cache_skips_what_the_daemon_says_not_to_cache)
+{
+    mp::cmd::cache_ssh_info("unix:/one", "test-vm", mp::SSHInfo{});
+
+    EXPECT_FALSE(mp::cmd::cached_ssh_info("unix:/one", "test-vm"));
+}
+
+TEST_F(Client, ssh_info_cache_deletes_expired_entries)
+{
+    mp::cmd::cache_ssh_info("unix:/one", "test-vm", cacheable_ssh_info());
+
+    QDirIterator it{fake_cache_dir.path(), {"test-vm"}, QDir::Files, QDirIterator::Subdirectories};
+    ASSERT_TRUE(it.hasNext());
+    const auto entry_path = it.next();
+    {
+        QFile entry{entry_path};
+        ASSERT_TRUE(entry.open(QIODevice::ReadWrite));
+        entry.setFileTime(QDateTime::currentDateTime().addSecs(-60), QFileDevice::FileModificationTime);
+    }
+
+    EXPECT_FALSE(mp::cmd::cached_ssh_info("unix:/one", "test-vm"));
+    EXPECT_FALSE(QFile::exists(entry_path));
+}
+
 // exec cli tests
 TEST_F(Client, exec_cmd_double_dash_ok_cmd_arg)
 {
     EXPECT_CALL(mock_daemon, ssh_info(_, _));
-    EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function());
     EXPECT_THAT(send_command({"exec", "foo", "--", "cmd"}), Eq(mp::ReturnCode::Ok));
 }
 
 TEST_F(Client, exec_cmd_double_dash_ok_cmd_arg_with_opts)
 {
     EXPECT_CALL(mock_daemon, ssh_info(_, _));
-    EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function());
     EXPECT_THAT(send_command({"exec", "foo", "--", "cmd", "--foo", "--bar"}), Eq(mp::ReturnCode::Ok));
 }
 
@@ -1433,14 +1509,12 @@ TEST_F(Client, exec_cmd_double_dash_fails_missing_cmd_arg)
 TEST_F(Client, exec_cmd_no_double_dash_ok_cmd_arg)
 {
     EXPECT_CALL(mock_daemon, ssh_info(_, _));
-    EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function());
     EXPECT_THAT(send_command({"exec", "foo", "cmd"}), Eq(mp::ReturnCode::Ok));
 }
 
 TEST_F(Client, exec_cmd_no_double_dash_ok_multiple_args)
 {
     EXPECT_CALL(mock_daemon, ssh_info(_, _));
-    EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function());
     EXPECT_THAT(send_command({"exec", "foo", "cmd", "bar"}), Eq(mp::ReturnCode::Ok));
 }
 
@@ -1532,10 +1606,20 @@ mp::SSHInfo make_ssh_info(const std::string& host = "222.222.222.222", int port
     return ssh_info;
 }
 
-mp::SSHInfoReply make_fake_ssh_info_response(const std::string& instance_name)
+mp::SSHInfoReply make_fake_ssh_info_response(const std::string& instance_name, const std::string& source_path = "",
+                                             const std::string& target_path = "")
 {
     mp::SSHInfoReply response;
-    (*response.mutable_ssh_info())[instance_name] = make_ssh_info();
+    auto ssh_info = make_ssh_info();
+
+    if (!source_path.empty() && !target_path.empty())
+    {
+        auto entry = ssh_info.mutable_mount_info()->add_mount_paths();
+        entry->set_source_path(source_path);
+        entry->set_target_path(target_path);
+    }
+
+    (*response.mutable_ssh_info())[instance_name] = ssh_info;
 
     return response;
 }
@@ -1560,7 +1644,6 @@ TEST_P(SSHClientReturnTest, execCmdWithoutDirWorks)
             return grpc::Status{};
         });
 
-    EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function());
 
     EXPECT_EQ(send_command({"exec", instance_name, "--", "cmd"}), failure_code);
 }
@@ -1654,7 +1737,6 @@ TEST_F(Client, execCmdFailsIfSshExecThrows)
                 return SSH_OK;
             }));
 
-    EXPECT_CALL(mock_daemon, info(_, _)).Times(AtMost(1)).WillRepeatedly(make_info_function());
 
     std::string instance_name{"instance"};
     mp::SSHInfoReply response = make_fake_ssh_info_response(instance_name);
@@ -1671,6 +1753,86 @@ TEST_F(Client, execCmdFailsIfSshExecThrows)
     EXPECT_THAT(cerr_stream.str(), HasSubstr("exec failed: some exception\n"));
 }
 
+TEST_F(Client, execCmdDoesNotRequestInfo)
+{
+    std::string instance_name{"instance"};
+    mp::SSHInfoReply response = make_fake_ssh_info_response(instance_name);
+
+    EXPECT_CALL(mock_daemon, info(_, _)).Times(0);
+    EXPECT_CALL(mock_daemon, ssh_info(_, _))
+        .WillOnce([&response](grpc::ServerContext* context,
+                              grpc::ServerReaderWriter<mp::SSHInfoReply, mp::SSHInfoRequest>* server) {
+            server->Write(response);
+            return grpc::Status{};
+        });
+
+    EXPECT_EQ(send_command({"exec", instance_name, "--", "cmd"}), mp::ReturnCode::Ok);
+}
+
+TEST_F(Client, execCmdMapsWorkingDirectoryFromSSHInfo)
+{
+    std::string instance_name{"instance"};
+    std::string cmd{"pwd"};
+    std::string source_dir{QDir::current().canonicalPath().toStdString()};
+    std::string target_dir{"/home/ubuntu/dir"};
+
+    REPLACE(ssh_channel_request_exec, ([&target_dir, &cmd](ssh_channel, const char* raw_cmd) {
+                EXPECT_THAT(raw_cmd, StartsWith("cd " + target_dir + "/"));
+                EXPECT_THAT(raw_cmd, HasSubstr("&&"));
+                EXPECT_THAT(raw_cmd, EndsWith(cmd)); // assuming that cmd does not have escaped characters!
+
+                return SSH_OK;
+            }));
+
+    mp::SSHInfoReply response = make_fake_ssh_info_response(instance_name, source_dir, target_dir);
+
+    EXPECT_CALL(mock_daemon, ssh_info(_, _))
+        .WillOnce([&response](grpc::ServerContext* context,
+                              grpc::ServerReaderWriter<mp::SSHInfoReply, mp::SSHInfoRequest>* server) {
+            server->Write(response);
+            return grpc::Status{};
+        });
+
+    EXPECT_EQ(send_command({"exec", instance_name, "--", cmd}), mp::ReturnCode::Ok);
+}
+
+TEST_F(Client, execCmdReusesCachedSSHInfo)
+{
+    std::string instance_name{"instance"};
+    mp::SSHInfoReply response = make_fake_ssh_info_response(instance_name);
+
+    EXPECT_CALL(mock_daemon, ssh_info(_, _))
+        .WillOnce([&response](grpc::ServerContext* context,
+                              grpc::ServerReaderWriter<mp::SSHInfoReply, mp::SSHInfoRequest>* server) {
+            server->Write(response);
+            return grpc::Status{};
+        });
+
+    EXPECT_EQ(send_command({"exec", instance_name, "--", "cmd"}), mp::ReturnCode::Ok);
+    EXPECT_EQ(send_command({"exec", instance_name, "--", "cmd"}), mp::ReturnCode::Ok);
+}
+
+TEST_F(Client, execCmdFallsBackToDaemonWhenCachedSSHInfoIsStale)
+{
+    std::string instance_name{"instance"};
+    mp::SSHInfoReply response = make_fake_ssh_info_response(instance_name);
+
+    EXPECT_CALL(mock_daemon, ssh_info(_, _))
+        .Times(2)
+        .WillRepeatedly([&response](grpc::ServerContext* context,
+                                    grpc::ServerReaderWriter<mp::SSHInfoReply, mp::SSHInfoRequest>* server) {
+            server->Write(response);
+            return grpc::Status{};
+        });
+
+    EXPECT_EQ(send_command({"exec", instance_name, "--", "cmd"}), mp::ReturnCode::Ok);
+
+    auto connect_calls = 0;
+    REPLACE(ssh_connect, [&connect_calls](auto...) { return ++connect_calls == 1 ? SSH_ERROR : SSH_OK; });
+
+    EXPECT_EQ(send_command({"exec", instance_name, "--", "cmd"}), mp::ReturnCode::Ok);
+}
+
 TEST_F(Client, execFailsOnArgumentClash)
 {
     std::stringstream cerr_stream;
@@ -1794,6 +1956,39 @@ TEST_F(Client, list_cmd_no_ipv4_ok)
     EXPECT_THAT(send_command({"list", "--no-ipv4"}), Eq(mp::ReturnCode::Ok));
 }
 
+TEST_F(Client, DISABLE_ON_WINDOWS(list_cmd_cached_prints_published_instances))
+{
+    const QTemporaryDir socket_dir;
+    const auto server_address = fmt::format("unix:{}/socket", socket_dir.path());
+    mpt::SetEnvScope server_address_env{"MULTIPASS_SERVER_ADDRESS", QByteArray::fromStdString(server_address)};
+
+    mpt::make_file_with_content(socket_dir.filePath("socket"));
+    mpt::make_file_with_content(mp::utils::instance_names_file_for(server_address), "foo,RUNNING\nbar,DELETED\n");
+
+    std::stringstream cout_stream;
+    EXPECT_CALL(mock_daemon, list).Times(0);
+    EXPECT_THAT(send_command({"list", "--format=csv", "--cached"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_EQ(cout_stream.str(), "Name,State\nfoo,Running\nbar,Deleted\n");
+}
+
+TEST_F(Client, DISABLE_ON_WINDOWS(list_cmd_cached_asks_daemon_when_published_instances_are_stale))
+{
+    const QTemporaryDir socket_dir;
+    const auto server_address = fmt::format("unix:{}/socket", socket_dir.path());
+    mpt::SetEnvScope server_address_env{"MULTIPASS_SERVER_ADDRESS", QByteArray::fromStdString(server_address)};
+
+    const auto names_path = mp::utils::instance_names_file_for(server_address);
+    mpt::make_file_with_content(names_path, "foo,RUNNING\n");
+    mpt::make_file_with_content(socket_dir.filePath("socket"));
+
+    QFile names_file{names_path};
+    ASSERT_TRUE(names_file.open(QIODevice::ReadWrite));
+    ASSERT_TRUE(names_file.setFileTime(QDateTime::currentDateTime().addSecs(-60), QFileDevice::FileModificationTime));
+
+    EXPECT_CALL(mock_daemon, list);
+    EXPECT_THAT(send_command({"list", "--format=csv", "--cached"}), Eq(mp::ReturnCode::Ok));
+}
+
 // mount cli tests
 // Note: mpt::test_data_path() returns an absolute path
 TEST_F(Client, mount_cmd_good_absolute_source_path)
@@ -1886,6 +2081,34 @@ TEST_F(Client, mountCmdFailsBogusMountType)
               mp::ReturnCode::CommandLineError);
 }
 
+// flatten cli tests
+TEST_F(Client, flatten_cmd_fails_no_args)
+{
+    EXPECT_THAT(send_command({"flatten"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, flatten_cmd_ok_with_one_arg)
+{
+    EXPECT_CALL(mock_daemon, flatten(_, _));
+    EXPECT_THAT(send_command({"flatten", "foo"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, flatten_cmd_succeeds_with_multiple_args)
+{
+    EXPECT_CALL(mock_daemon, flatten(_, _));
+    EXPECT_THAT(send_command({"flatten", "foo", "bar"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, flatten_cmd_help_ok)
+{
+    EXPECT_THAT(send_command({"flatten", "-h"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, flatten_cmd_fails_with_all)
+{
+    EXPECT_THAT(send_command({"flatten", "--all"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
 // recover cli tests
 TEST_F(Client, recover_cmd_fails_no_args)
 {
@@ -3474,7 +3697,6 @@ TEST_F(ClientAlias, execute_existing_alias)
 {
     populate_db_file(AliasesVector{{"some_alias", {"some_instance", "some_command", "map"}}});
 
-    EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function());
     EXPECT_CALL(mock_daemon, ssh_info(_, _));
 
     EXPECT_EQ(send_command({"some_alias"}), mp::ReturnCode::Ok);
@@ -3495,7 +3717,6 @@ TEST_F(ClientAlias, execute_alias_with_arguments)
 {
     populate_db_file(AliasesVector{{"some_alias", {"some_instance", "some_command", "map"}}});
 
-    EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function());
     EXPECT_CALL(mock_daemon, ssh_info(_, _));
 
     EXPECT_EQ(send_command({"some_alias", "some_argument"}), mp::ReturnCode::Ok);
@@ -3768,7 +3989,7 @@ TEST_F(ClientAlias, execAliasRewritesMountedDir)
     std::string source_dir{(current_dir.canonicalPath()).toStdString()};
     std::string target_dir{"/home/ubuntu/dir"};
 
-    EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function(source_dir, target_dir));
+    EXPECT_CALL(mock_daemon, info(_, _)).Times(0);
 
     populate_db_file(AliasesVector{{alias_name, {instance_name, cmd, "map"}}});
 
@@ -3780,7 +4001,7 @@ TEST_F(ClientAlias, execAliasRewritesMountedDir)
                 return SSH_OK;
             }));
 
-    mp::SSHInfoReply ssh_info_response = make_fake_ssh_info_response(instance_name);
+    mp::SSHInfoReply ssh_info_response = make_fake_ssh_info_response(instance_name, source_dir, target_dir);
 
     EXPECT_CALL(mock_daemon, ssh_info(_, _))
         .WillOnce([&ssh_info_response](grpc::ServerContext* context,
@@ -3809,10 +4030,7 @@ TEST_P(NotDirRewriteTestsuite, execAliasDoesNotRewriteMountedDir)
     std::string source_dir{source_qdir.toStdString()};
     std::string target_dir{"/home/ubuntu/dir"};
 
-    if (map_dir)
-        EXPECT_CALL(mock_daemon, info(_, _)).WillOnce(make_info_function(source_dir, target_dir));
-    else
-        EXPECT_CALL(mock_daemon, info(_, _)).Times(0);
+    EXPECT_CALL(mock_daemon, info(_, _)).Times(0);
 
     populate_db_file(AliasesVector{{alias_name, {instance_name, cmd, map_dir ? "map" : "default"}}});
 
@@ -3824,7 +4042,7 @@ TEST_P(NotDirRewriteTestsuite, execAliasDoesNotRewriteMountedDir)
                 return SSH_OK;
             }));
 
-    mp::SSHInfoReply ssh_info_response = make_fake_ssh_info_response(instance_name);
+    mp::SSHInfoReply ssh_info_response = make_fake_ssh_info_response(instance_name, source_dir, target_dir);
 
     EXPECT_CALL(mock_daemon, ssh_info(_, _))
         .WillOnce([&ssh_info_response](grpc::ServerContext* context,
@@ -20,6 +20,7 @@
 #include "daemon_test_fixture.h"
 #include "dummy_ssh_key_provider.h"
 #include "fake_alias_config.h"
+#include "file_operations.h"
 #include "json_utils.h"
 #include "mock_daemon.h"
 #include "mock_environment_helpers.h"
@@ -29,6 +30,7 @@
 #include "mock_platform.h"
 #include "mock_server_reader_writer.h"
 #include "mock_settings.h"
+#include "mock_ssh.h"
 #include "mock_standard_paths.h"
 #include "mock_utils.h"
 #include "mock_virtual_machine.h"
@@ -46,6 +48,7 @@
 #include <multipass/exceptions/blueprint_exceptions.h>
 #include <multipass/logging/log.h>
 #include <multipass/name_generator.h>
+#include <multipass/ssh/ssh_session.h>
 #include <multipass/version.h>
 #include <multipass/virtual_machine_factory.h>
 #include <multipass/vm_image_host.h>
@@ -66,6 +69,7 @@
 #include <stdexcept>
 #include <string>
 #include <variant>
+#include <vector>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -119,6 +123,11 @@ struct Daemon : public mpt::DaemonTestFixture
     {
         EXPECT_CALL(mock_settings, register_handler).WillRepeatedly(Return(nullptr));
         EXPECT_CALL(mock_settings, unregister_handler).Times(AnyNumber());
+        EXPECT_CALL(mock_settings, get(Eq(mp::warm_pool_key))).WillRepeatedly(Return(""));
+        EXPECT_CALL(mock_settings, get(Eq(mp::download_rate_key))).WillRepeatedly(Return(""));
+        EXPECT_CALL(mock_settings, get(Eq(mp::mirror_server_key))).WillRepeatedly(Return(""));
+        EXPECT_CALL(mock_settings, get(Eq(mp::image_cache_size_key))).WillRepeatedly(Return(""));
+        EXPECT_CALL(mock_settings, get(Eq(mp::max_downloads_key))).WillRepeatedly(Return("3"));
         EXPECT_CALL(mock_settings, get(Eq(mp::petenv_key))).WillRepeatedly(Return("pet-instance"));
         EXPECT_CALL(mock_settings, get(Eq(mp::mounts_key))).WillRepeatedly(Return("true")); /* TODO should probably add
                              a few more tests for `false`, since there are different portions of code depending on it */
@@ -180,6 +189,8 @@ TEST_F(Daemon, receives_commands_and_calls_corresponding_slot)
         .WillOnce(Invoke(&daemon, &mpt::MockDaemon::set_promise_value<mp::UmountRequest, mp::UmountReply>));
     EXPECT_CALL(daemon, networks(_, _, _))
         .WillOnce(Invoke(&daemon, &mpt::MockDaemon::set_promise_value<mp::NetworksRequest, mp::NetworksReply>));
+    EXPECT_CALL(daemon, flatten(_, _, _))
+        .WillOnce(Invoke(&daemon, &mpt::MockDaemon::set_promise_value<mp::FlattenRequest, mp::FlattenReply>));
 
     EXPECT_CALL(mock_settings, get(Eq("foo"))).WillRepeatedly(Return("bar"));
 
@@ -202,7 +213,8 @@ TEST_F(Daemon, receives_commands_and_calls_corresponding_slot)
                    {"find", "something"},
                    {"mount", ".", "target"},
                    {"umount", "instance"},
-                   {"networks"}});
+                   {"networks"},
+                   {"flatten", "foo"}});
 }
 
 TEST_F(Daemon, provides_version)
@@ -215,6 +227,53 @@ TEST_F(Daemon, provides_version)
     EXPECT_TRUE(call_daemon_slot(daemon, &mp::Daemon::version, mp::VersionRequest{}, mock_server).ok());
 }
 
+TEST_F(Daemon, applies_image_cache_size_budget)
+{
+    auto mock_image_vault = std::make_unique<NiceMock<mpt::MockVMImageVault>>();
+    EXPECT_CALL(*mock_image_vault, set_size_budget(Eq(mp::MemorySize{"10G"})));
+    EXPECT_CALL(mock_settings, get(Eq(mp::image_cache_size_key))).WillRepeatedly(Return("10G"));
+
+    config_builder.vault = std::move(mock_image_vault);
+    mp::Daemon daemon{config_builder.build()};
+}
+
+TEST_F(Daemon, applies_max_downloads)
+{
+    auto mock_image_vault = std::make_unique<NiceMock<mpt::MockVMImageVault>>();
+    EXPECT_CALL(*mock_image_vault, set_max_downloads(5));
+    EXPECT_CALL(mock_settings, get(Eq(mp::max_downloads_key))).WillRepeatedly(Return("5"));
+
+    config_builder.vault = std::move(mock_image_vault);
+    mp::Daemon daemon{config_builder.build()};
+}
+
+TEST_F(Daemon, reports_image_cache_usage)
+{
+    const auto last_used = std::chrono::system_clock::time_point{std::chrono::seconds{1700000000}};
+    const mp::ImageCacheUsage usage{{{"abc", "jammy", "release", 600, last_used, true},
+                                     {"def", "noble", "daily", 400, last_used, false}},
+                                    2048};
+
+    auto mock_image_vault = std::make_unique<NiceMock<mpt::MockVMImageVault>>();
+    EXPECT_CALL(*mock_image_vault, cache_usage).WillOnce(Return(usage));
+    config_builder.vault = std::move(mock_image_vault);
+    mp::Daemon daemon{config_builder.build()};
+
+    mp::ImageCacheReply reply;
+    StrictMock<mpt::MockServerReaderWriter<mp::ImageCacheReply, mp::ImageCacheRequest>> mock_server;
+    EXPECT_CALL(mock_server, Write(_, _)).WillOnce(DoAll(SaveArg<0>(&reply), Return(true)));
+
+    EXPECT_TRUE(call_daemon_slot(daemon, &mp::Daemon::image_cache, mp::ImageCacheRequest{}, mock_server).ok());
+
+    EXPECT_EQ(reply.total_size(), 1000);
+    EXPECT_EQ(reply.size_budget(), 2048);
+    ASSERT_EQ(reply.images_size(), 2);
+    EXPECT_EQ(reply.images(0).release(), "jammy");
+    EXPECT_EQ(reply.images(0).last_used(), 1700000000);
+    EXPECT_TRUE(reply.images(0).in_use());
+    EXPECT_FALSE(reply.images(1).in_use());
+}
+
 TEST_F(Daemon, failed_restart_command_returns_fulfilled_promise)
 {
     mp::Daemon daemon{config_builder.build()};
@@ -1994,6 +2053,37 @@ TEST_F(Daemon, setSetsSetting)
     EXPECT_TRUE(call_daemon_slot(daemon, &mp::Daemon::set, request, mock_server).ok());
 }
 
+TEST_F(Daemon, setAppliesSSHCiphersToLaterSessions)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    const auto ciphers = "aes256-ctr";
+
+    mp::SetRequest request;
+    request.set_key(mp::daemon_ssh_ciphers_key);
+    request.set_val(ciphers);
+
+    EXPECT_CALL(mock_settings, set(Eq(mp::daemon_ssh_ciphers_key), Eq(ciphers)));
+    EXPECT_CALL(mock_settings, get(Eq(mp::daemon_ssh_ciphers_key))).WillOnce(Return(ciphers));
+    auto reset_preference = sg::make_scope_guard([]() noexcept { mp::SSHSession::set_cipher_preference(""); });
+
+    EXPECT_TRUE(call_daemon_slot(daemon, &mp::Daemon::set, request,
+                                 StrictMock<mpt::MockServerReaderWriter<mp::SetReply, mp::SetRequest>>{})
+                    .ok());
+
+    std::vector<std::string> session_ciphers;
+    REPLACE(ssh_options_set, [&session_ciphers](auto, auto type, auto value) {
+        if (type == SSH_OPTIONS_CIPHERS_C_S || type == SSH_OPTIONS_CIPHERS_S_C)
+            session_ciphers.emplace_back(static_cast<const char*>(value));
+        return SSH_OK;
+    });
+    REPLACE(ssh_connect, [](auto...) { return SSH_OK; });
+
+    mp::SSHSession session{"theanswertoeverything", 42};
+
+    EXPECT_THAT(session_ciphers, ElementsAre(ciphers, ciphers));
+}
+
 using SetException = std::variant<mp::UnrecognizedSettingException, mp::InvalidSettingException, std::runtime_error>; /*
   We need to throw an exception of the ultimate type whose handling we're trying to test (to avoid slicing and enter the
   right catch block). Therefore, we can't just use a base exception type. Parameterized and typed tests don't mix in
@@ -2120,4 +2210,142 @@ TEST_F(Daemon, info_all_returns_all_instances)
 
     call_daemon_slot(daemon, &mp::Daemon::info, mp::InfoRequest{}, mock_server);
 }
+
+TEST_F(Daemon, flattens_the_disks_of_stopped_instances)
+{
+    const std::string name1{"some-instance"}, name2{"another-instance"};
+    const auto instances_json = fmt::format("{{{}, {}}}", fmt::format(valid_template, name1, "10"),
+                                            fmt::format(valid_template, name2, "11"));
+    const auto [temp_dir, __] = plant_instance_json(instances_json);
+    config_builder.data_directory = temp_dir->path();
+
+    auto mock_image_vault = std::make_unique<NiceMock<mpt::MockVMImageVault>>();
+    EXPECT_CALL(*mock_image_vault, flatten).Times(0);
+    EXPECT_CALL(*mock_image_vault, flatten(name1));
+    config_builder.vault = std::move(mock_image_vault);
+    mp::Daemon daemon{config_builder.build()};
+
+    mp::FlattenRequest request;
+    request.mutable_instance_names()->add_instance_name(name1);
+
+    EXPECT_TRUE(call_daemon_slot(daemon, &mp::Daemon::flatten, request,
+                                 StrictMock<mpt::MockServerReaderWriter<mp::FlattenReply, mp::FlattenRequest>>{})
+                    .ok());
+}
+
+TEST_F(Daemon, refuses_to_flatten_the_disks_of_running_instances)
+{
+    const std::string name{"running-instance"};
+    const auto [temp_dir, __] = plant_instance_json(fmt::format("{{{}}}", fmt::format(valid_template, name, "10")));
+    config_builder.data_directory = temp_dir->path();
+
+    auto mock_image_vault = std::make_unique<NiceMock<mpt::MockVMImageVault>>();
+    EXPECT_CALL(*mock_image_vault, flatten).Times(0);
+    config_builder.vault = std::move(mock_image_vault);
+
+    EXPECT_CALL(*use_a_mock_vm_factory(), create_virtual_machine).WillOnce(WithArg<0>([](const auto& desc) {
+        auto instance = std::make_unique<NiceMock<mpt::MockVirtualMachine>>(desc.vm_name);
+        ON_CALL(*instance, current_state).WillByDefault(Return(mp::VirtualMachine::State::running));
+        return instance;
+    }));
+
+    mp::Daemon daemon{config_builder.build()};
+
+    mp::FlattenRequest request;
+    request.mutable_instance_names()->add_instance_name(name);
+
+    auto status = call_daemon_slot(daemon, &mp::Daemon::flatten, request,
+                                   StrictMock<mpt::MockServerReaderWriter<mp::FlattenReply, mp::FlattenRequest>>{});
+
+    EXPECT_EQ(status.error_code(), grpc::StatusCode::FAILED_PRECONDITION);
+    EXPECT_THAT(status.error_message(), HasSubstr("must be stopped"));
+}
+
+TEST_F(Daemon, refuses_to_flatten_missing_instances)
+{
+    auto mock_image_vault = std::make_unique<NiceMock<mpt::MockVMImageVault>>();
+    EXPECT_CALL(*mock_image_vault, flatten).Times(0);
+    config_builder.vault = std::move(mock_image_vault);
+    mp::Daemon daemon{config_builder.build()};
+
+    mp::FlattenRequest request;
+    request.mutable_instance_names()->add_instance_name("nonexistent");
+
+    EXPECT_FALSE(call_daemon_slot(daemon, &mp::Daemon::flatten, request,
+                                  StrictMock<mpt::MockServerReaderWriter<mp::FlattenReply, mp::FlattenRequest>>{})
+                     .ok());
+}
+
+struct DaemonWarmPool : public Daemon
+{
+    void SetUp() override
+    {
+        Daemon::SetUp();
+        EXPECT_CALL(mock_settings, get(Eq(mp::warm_pool_key))).WillRepeatedly(Return("default=1"));
+        EXPECT_CALL(mock_settings, get(Eq(mp::warm_pool_memory_key))).WillRepeatedly(Return("4G"));
+    }
+
+    // Plants a user instance and a warm one, which the pool already accounts for, so that nothing gets launched
+    QString plant_instances()
+    {
+        const auto instances_json = fmt::format("{{{}, {}}}", fmt::format(valid_template, user_instance_name, "10"),
+                                                fmt::format(valid_template, warm_instance_name, "11"));
+        std::tie(temp_dir, std::ignore) = plant_instance_json(instances_json);
+        config_builder.data_directory = temp_dir->path();
+        config_builder.vault = std::make_unique<NiceMock<mpt::MockVMImageVault>>();
+
+        const auto warm_pool_db = temp_dir->filePath("multipassd-warm-pool.json");
+        mpt::make_file_with_content(warm_pool_db, fmt::format(R"({{"{}": "default/1/1073741824/"}})",
+                                                              warm_instance_name));
+        return warm_pool_db;
+    }
+
+    const std::string user_instance_name{"user-instance"}, warm_instance_name{"warm-instance"};
+    std::unique_ptr<mpt::TempDir> temp_dir;
+};
+
+TEST_F(DaemonWarmPool, info_all_leaves_out_warm_instances)
+{
+    plant_instances();
+    mp::Daemon daemon{config_builder.build()};
+
+    StrictMock<mpt::MockServerReaderWriter<mp::InfoReply, mp::InfoRequest>> mock_server{};
+    EXPECT_CALL(mock_server, Write(Property(&mp::InfoReply::info, ElementsAre(Property(&mp::InfoReply::Info::name,
+                                                                                       user_instance_name))),
+                                   _))
+        .WillOnce(Return(true));
+
+    call_daemon_slot(daemon, &mp::Daemon::info, mp::InfoRequest{}, mock_server);
+}
+
+TEST_F(DaemonWarmPool, delete_all_leaves_warm_instances_alone)
+{
+    const auto warm_pool_db = plant_instances();
+    EXPECT_CALL(*use_a_mock_vm_factory(), create_virtual_machine).WillRepeatedly(WithArg<0>([this](const auto& desc) {
+        auto instance = std::make_unique<NiceMock<mpt::MockVirtualMachine>>(desc.vm_name);
+        EXPECT_CALL(*instance, shutdown).Times(desc.vm_name == warm_instance_name ? 0 : 1);
+        return instance;
+    }));
+
+    mp::Daemon daemon{config_builder.build()};
+
+    call_daemon_slot(daemon, &mp::Daemon::delet, mp::DeleteRequest{},
+                     NiceMock<mpt::MockServerReaderWriter<mp::DeleteReply, mp::DeleteRequest>>{});
+
+    EXPECT_THAT(mpt::load(warm_pool_db).toStdString(), HasSubstr(warm_instance_name));
+}
+
+TEST_F(DaemonWarmPool, purging_a_warm_instance_takes_it_out_of_the_pool)
+{
+    const auto warm_pool_db = plant_instances();
+    mp::Daemon daemon{config_builder.build()};
+
+    mp::DeleteRequest request;
+    request.mutable_instance_names()->add_instance_name(warm_instance_name);
+    request.set_purge(true);
+    call_daemon_slot(daemon, &mp::Daemon::delet, request,
+                     NiceMock<mpt::MockServerReaderWriter<mp::DeleteReply, mp::DeleteRequest>>{});
+
+    EXPECT_THAT(mpt::load(warm_pool_db).toStdString(), Not(HasSubstr(warm_instance_name)));
+}
 } // namespace
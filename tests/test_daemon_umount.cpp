@@ -25,6 +25,8 @@
 #include "mock_virtual_machine.h"
 #include "mock_vm_image_vault.h"
 
+#include <multipass/constants.h>
+
 namespace mp = multipass;
 namespace mpt = multipass::test;
 
@@ -38,6 +40,11 @@ struct TestDaemonUmount : public mpt::DaemonTestFixture
     {
         EXPECT_CALL(mock_settings, register_handler).WillRepeatedly(Return(nullptr));
         EXPECT_CALL(mock_settings, unregister_handler).Times(AnyNumber());
+        EXPECT_CALL(mock_settings, get(Eq(mp::warm_pool_key))).WillRepeatedly(Return(""));
+        EXPECT_CALL(mock_settings, get(Eq(mp::download_rate_key))).WillRepeatedly(Return(""));
+        EXPECT_CALL(mock_settings, get(Eq(mp::mirror_server_key))).WillRepeatedly(Return(""));
+        EXPECT_CALL(mock_settings, get(Eq(mp::image_cache_size_key))).WillRepeatedly(Return(""));
+        EXPECT_CALL(mock_settings, get(Eq(mp::max_downloads_key))).WillRepeatedly(Return("3"));
 
         config_builder.vault = std::make_unique<NiceMock<mpt::MockVMImageVault>>();
 
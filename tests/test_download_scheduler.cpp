@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+
+#include <src/daemon/download_scheduler.h>
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace mp = multipass;
+
+using namespace std::chrono_literals;
+using namespace testing;
+
+namespace
+{
+using Priority = mp::DownloadScheduler::Priority;
+
+// Keeps the single slot of a scheduler busy until released
+struct BusySlot
+{
+    explicit BusySlot(mp::DownloadScheduler& scheduler)
+        : thread{[&scheduler, this] { scheduler.run(Priority::interactive, [this] { release.get_future().wait(); }); }}
+    {
+        while (scheduler.running() == 0)
+            std::this_thread::sleep_for(1ms);
+    }
+
+    ~BusySlot()
+    {
+        if (thread.joinable())
+            done();
+    }
+
+    void done()
+    {
+        release.set_value();
+        thread.join();
+    }
+
+    std::promise<void> release;
+    std::thread thread;
+};
+} // namespace
+
+TEST(DownloadScheduler, returnsWhatTheDownloadReturns)
+{
+    mp::DownloadScheduler scheduler{2};
+
+    EXPECT_EQ(scheduler.run(Priority::interactive, [] { return 42; }), 42);
+}
+
+TEST(DownloadScheduler, passesOnWhatTheDownloadThrowsAndFreesItsSlot)
+{
+    mp::DownloadScheduler scheduler{1};
+
+    EXPECT_THROW(scheduler.run(Priority::background, []() -> int { throw std::runtime_error{"boom"}; }),
+                 std::runtime_error);
+    EXPECT_EQ(scheduler.running(), 0);
+    EXPECT_EQ(scheduler.run(Priority::background, [] { return 1; }), 1);
+}
+
+TEST(DownloadScheduler, runsNoMoreThanTheCapAtOnce)
+{
+    constexpr auto cap = 2;
+    mp::DownloadScheduler scheduler{cap};
+    std::atomic_int running{0}, most_running{0};
+
+    std::vector<std::thread> threads;
+    for (auto i = 0; i < 6; ++i)
+        threads.emplace_back([&scheduler, &running, &most_running] {
+            scheduler.run(Priority::background, [&running, &most_running] {
+                auto now_running = ++running;
+                for (auto most = most_running.load(); now_running > most;)
+                    most_running.compare_exchange_weak(most, now_running);
+
+                std::this_thread::sleep_for(20ms);
+                --running;
+            });
+        });
+
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(most_running, cap);
+}
+
+TEST(DownloadScheduler, startsWaitingInteractiveDownloadsFirst)
+{
+    mp::DownloadScheduler scheduler{1};
+    std::mutex order_mutex;
+    std::vector<Priority> order;
+
+    auto record = [&scheduler, &order_mutex, &order](Priority priority) {
+        return std::thread{[&scheduler, &order_mutex, &order, priority] {
+            scheduler.run(priority, [&order_mutex, &order, priority] {
+                std::lock_guard<std::mutex> lock{order_mutex};
+                order.push_back(priority);
+            });
+        }};
+    };
+
+    BusySlot busy{scheduler};
+    auto background = record(Priority::background);
+    std::this_thread::sleep_for(20ms);
+    auto interactive = record(Priority::interactive);
+    std::this_thread::sleep_for(20ms);
+    busy.done();
+
+    background.join();
+    interactive.join();
+
+    EXPECT_THAT(order, ElementsAre(Priority::interactive, Priority::background));
+}
+
+TEST(DownloadScheduler, startsWaitingDownloadsWhenTheCapGoesUp)
+{
+    mp::DownloadScheduler scheduler{1};
+    BusySlot busy{scheduler};
+
+    auto waiting =
+        std::async(std::launch::async, [&scheduler] { return scheduler.run(Priority::background, [] { return 1; }); });
+    EXPECT_EQ(waiting.wait_for(20ms), std::future_status::timeout);
+
+    scheduler.set_max_concurrent(2);
+    EXPECT_EQ(waiting.get(), 1);
+}
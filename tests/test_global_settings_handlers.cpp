@@ -140,7 +140,10 @@ TEST_F(TestGlobalSettingsHandlers, clientsRegisterPersistentHandlerForClientSett
 
     inject_default_returning_mock_qsettings();
 
-    expect_setting_values({{mp::petenv_key, "primary"}, {mp::autostart_key, "true"}});
+    expect_setting_values({{mp::petenv_key, "primary"},
+                           {mp::autostart_key, "true"},
+                           {mp::ssh_mux_key, "0"},
+                           {mp::client_ssh_ciphers_key, ""}});
     EXPECT_EQ(QKeySequence{handler->get(mp::hotkey_key)}, QKeySequence{mp::hotkey_default});
 }
 
@@ -225,6 +228,40 @@ TEST_P(TestBadPetEnvSetting, clientsRegisterHandlerThatRejectsInvalidPetenv)
 
 INSTANTIATE_TEST_SUITE_P(TestBadPetEnvSetting, TestBadPetEnvSetting, Values("-", "-a-b-", "_asd", "_1", "1-2-3"));
 
+using RegisterHandlers = void (*)();
+struct TestSSHCiphersSetting : public TestGlobalSettingsHandlers,
+                               WithParamInterface<std::pair<const char*, RegisterHandlers>>
+{
+};
+
+TEST_P(TestSSHCiphersSetting, registersHandlerThatAcceptsKnownCiphers)
+{
+    const auto& [key, register_handlers] = GetParam();
+    const auto val = "aes256-gcm@openssh.com,chacha20-poly1305@openssh.com";
+    register_handlers();
+
+    EXPECT_CALL(*mock_qsettings, setValue(Eq(key), Eq(val)));
+    inject_mock_qsettings();
+
+    ASSERT_NO_THROW(handler->set(key, val));
+}
+
+TEST_P(TestSSHCiphersSetting, registersHandlerThatRejectsUnknownCiphers)
+{
+    const auto& [key, register_handlers] = GetParam();
+    const auto val = "aes256-gcm@openssh.com,chacha20";
+    register_handlers();
+
+    MP_ASSERT_THROW_THAT(handler->set(key, val), mp::InvalidSettingException,
+                         mpt::match_what(AllOf(HasSubstr(key), HasSubstr("Unknown cipher(s): 'chacha20'"))));
+}
+
+INSTANTIATE_TEST_SUITE_P(TestSSHCiphersSetting, TestSSHCiphersSetting,
+                         Values(std::make_pair(mp::client_ssh_ciphers_key,
+                                               RegisterHandlers{mp::client::register_global_settings_handlers}),
+                                std::make_pair(mp::daemon_ssh_ciphers_key,
+                                               RegisterHandlers{mp::daemon::register_global_settings_handlers})));
+
 TEST_F(TestGlobalSettingsHandlers, daemonRegistersPersistentHandlerWithDaemonFilename)
 {
     auto config_location = QStringLiteral("/a/b/c");
@@ -250,7 +287,17 @@ TEST_F(TestGlobalSettingsHandlers, daemonRegistersPersistentHandlerForDaemonSett
     mp::daemon::register_global_settings_handlers();
     inject_default_returning_mock_qsettings();
 
-    expect_setting_values({{mp::driver_key, driver}, {mp::bridged_interface_key, ""}, {mp::mounts_key, mount}});
+    expect_setting_values({{mp::driver_key, driver},
+                           {mp::bridged_interface_key, ""},
+                           {mp::mounts_key, mount},
+                           {mp::daemon_ssh_ciphers_key, ""},
+                           {mp::thin_disks_key, "false"},
+                           {mp::warm_pool_key, ""},
+                           {mp::warm_pool_memory_key, mp::warm_pool_memory_default},
+                           {mp::download_rate_key, ""},
+                           {mp::mirror_server_key, ""},
+                           {mp::image_cache_size_key, ""},
+                           {mp::max_downloads_key, mp::max_downloads_default}});
 }
 
 TEST_F(TestGlobalSettingsHandlers, daemonRegistersPersistentHandlerForDaemonPlatformSettings)
@@ -306,6 +353,92 @@ TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatRejectsInvalidBacke
                          mpt::match_what(AllOf(HasSubstr(key), HasSubstr(val))));
 }
 
+TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatAcceptsWarmPoolProfiles)
+{
+    const auto val = "22.04/2/4G=3,lts=1";
+
+    mp::daemon::register_global_settings_handlers();
+
+    EXPECT_CALL(*mock_qsettings, setValue(Eq(mp::warm_pool_key), Eq(val)));
+    inject_mock_qsettings();
+
+    ASSERT_NO_THROW(handler->set(mp::warm_pool_key, val));
+}
+
+TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatRejectsInvalidWarmPoolProfiles)
+{
+    auto key = mp::warm_pool_key, val = "22.04/lots=3";
+
+    mp::daemon::register_global_settings_handlers();
+
+    MP_ASSERT_THROW_THAT(handler->set(key, val), mp::InvalidSettingException,
+                         mpt::match_what(AllOf(HasSubstr(key), HasSubstr(val))));
+}
+
+TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatRejectsInvalidDownloadRate)
+{
+    auto key = mp::download_rate_key, val = "fast";
+
+    mp::daemon::register_global_settings_handlers();
+
+    MP_ASSERT_THROW_THAT(handler->set(key, val), mp::InvalidSettingException,
+                         mpt::match_what(AllOf(HasSubstr(key), HasSubstr(val))));
+}
+
+TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatAcceptsPlainHttpMirror)
+{
+    const auto val = "http://10.0.0.2:8080/";
+
+    mp::daemon::register_global_settings_handlers();
+
+    EXPECT_CALL(*mock_qsettings, setValue(Eq(mp::mirror_key), Eq(val)));
+    inject_mock_qsettings();
+
+    ASSERT_NO_THROW(handler->set(mp::mirror_key, val));
+}
+
+TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatAcceptsMirrorServerAddress)
+{
+    const auto val = "192.168.1.10:8080";
+
+    mp::daemon::register_global_settings_handlers();
+
+    EXPECT_CALL(*mock_qsettings, setValue(Eq(mp::mirror_server_key), Eq(val)));
+    inject_mock_qsettings();
+
+    ASSERT_NO_THROW(handler->set(mp::mirror_server_key, val));
+}
+
+TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatRejectsInvalidMirrorServerAddress)
+{
+    auto key = mp::mirror_server_key, val = "somewhere:http";
+
+    mp::daemon::register_global_settings_handlers();
+
+    MP_ASSERT_THROW_THAT(handler->set(key, val), mp::InvalidSettingException,
+                         mpt::match_what(AllOf(HasSubstr(key), HasSubstr(val))));
+}
+
+TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatRejectsInvalidImageCacheSize)
+{
+    auto key = mp::image_cache_size_key, val = "plenty";
+
+    mp::daemon::register_global_settings_handlers();
+
+    MP_ASSERT_THROW_THAT(handler->set(key, val), mp::InvalidSettingException,
+                         mpt::match_what(AllOf(HasSubstr(key), HasSubstr(val))));
+}
+
+TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatRejectsInvalidMaxDownloads)
+{
+    auto key = mp::max_downloads_key, val = "0";
+
+    mp::daemon::register_global_settings_handlers();
+
+    MP_ASSERT_THROW_THAT(handler->set(key, val), mp::InvalidSettingException,
+                         mpt::match_what(AllOf(HasSubstr(key), HasSubstr(val))));
+}
+
 TEST_F(TestGlobalSettingsHandlers, daemonRegistersHandlerThatAcceptsBoolMounts)
 {
     mp::daemon::register_global_settings_handlers();
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "common.h"
+#include "file_operations.h"
+#include "temp_dir.h"
+
+#include <multipass/image_format.h>
+
+#include <QDir>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace testing;
+
+namespace
+{
+struct ImageFormat : public Test
+{
+    QString image_with(const std::string& contents, const QString& name = "image")
+    {
+        const auto image_path = QDir{temp_dir.path()}.filePath(name);
+        mpt::make_file_with_content(image_path, contents);
+        return image_path;
+    }
+
+    mpt::TempDir temp_dir;
+};
+} // namespace
+
+TEST_F(ImageFormat, readsQcow2Header)
+{
+    const auto info = mp::probe_image_format(image_with(mpt::qcow2_header(10LL * 1024 * 1024 * 1024)));
+
+    ASSERT_TRUE(info);
+    EXPECT_EQ(info->format, mp::ImageFormatInfo::Format::qcow2);
+    EXPECT_EQ(info->virtual_size, 10LL * 1024 * 1024 * 1024);
+    EXPECT_EQ(info->version, 3);
+    EXPECT_EQ(info->cluster_size, 65536);
+    EXPECT_TRUE(info->backing_file.isEmpty());
+}
+
+TEST_F(ImageFormat, readsQcow2BackingFile)
+{
+    const auto info = mp::probe_image_format(image_with(mpt::qcow2_header(1024, "/some/base.img")));
+
+    ASSERT_TRUE(info);
+    EXPECT_EQ(info->backing_file, "/some/base.img");
+}
+
+TEST_F(ImageFormat, reportsUnknownContentsAsRaw)
+{
+    const auto info = mp::probe_image_format(image_with(std::string(12345, '\0')));
+
+    ASSERT_TRUE(info);
+    EXPECT_EQ(info->format, mp::ImageFormatInfo::Format::raw);
+    EXPECT_EQ(info->virtual_size, 12345);
+}
+
+TEST_F(ImageFormat, leavesOtherFormatsToQemuImg)
+{
+    EXPECT_FALSE(mp::probe_image_format(image_with("KDMV and the rest of a VMDK")));
+}
+
+TEST_F(ImageFormat, leavesMalformedQcow2ToQemuImg)
+{
+    auto header = mpt::qcow2_header(1024);
+    header[7] = 1; // qcow version 1
+
+    EXPECT_FALSE(mp::probe_image_format(image_with(header)));
+    EXPECT_FALSE(mp::probe_image_format(image_with("QFI\xfb", "truncated")));
+}
+
+TEST_F(ImageFormat, findsQcow2TablesBeyondTheEndMalformed)
+{
+    auto header = mpt::qcow2_header(1024);
+    header[45] = 1; // L1 table at 64 KiB, past the end of the file
+
+    EXPECT_FALSE(mp::probe_image_format(image_with(header)));
+}
+
+TEST_F(ImageFormat, acceptsSaneHeaders)
+{
+    EXPECT_TRUE(mp::has_sane_header(image_with(mpt::qcow2_header(1024), "qcow2")));
+    EXPECT_TRUE(mp::has_sane_header(image_with("raw data", "raw")));
+}
+
+TEST_F(ImageFormat, rejectsBrokenHeaders)
+{
+    auto header = mpt::qcow2_header(1024);
+    header[54] = 1; // refcount table at 256 bytes, not cluster-aligned
+
+    EXPECT_FALSE(mp::has_sane_header(image_with(header, "misaligned")));
+    EXPECT_FALSE(mp::has_sane_header(image_with("QFI\xfb", "truncated")));
+    EXPECT_FALSE(mp::has_sane_header(image_with("", "empty")));
+    EXPECT_FALSE(mp::has_sane_header(QDir{temp_dir.path()}.filePath("missing")));
+}
+
+TEST_F(ImageFormat, returnsNothingForMissingImage)
+{
+    EXPECT_FALSE(mp::probe_image_format(QDir{temp_dir.path()}.filePath("missing")));
+}
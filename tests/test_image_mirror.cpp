@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "file_operations.h"
+#include "temp_dir.h"
+
+#include <src/daemon/image_mirror.h>
+
+#include <multipass/block_map.h>
+#include <multipass/exceptions/download_exception.h>
+#include <multipass/url_downloader.h>
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpSocket>
+#include <QUrl>
+
+#include <atomic>
+#include <map>
+#include <thread>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace std::chrono_literals;
+using namespace testing;
+
+namespace
+{
+constexpr auto official_url = "https://images.example.com/releases/";
+constexpr auto manifest_path = "streams/v1/com.ubuntu.cloud:released:download.json";
+constexpr auto image_location = "server/releases/jammy/release-20240101/ubuntu-22.04-server-cloudimg-amd64.img";
+constexpr auto kernel_location =
+    "server/releases/jammy/release-20240101/unpacked/ubuntu-22.04-server-cloudimg-amd64-vmlinuz-generic";
+constexpr auto image_hash = "cafef00d";
+const std::string image_contents{"0123456789"};
+
+struct ManifestURLDownloader : public mp::URLDownloader
+{
+    ManifestURLDownloader() : mp::URLDownloader{std::chrono::seconds(10)}
+    {
+    }
+
+    QByteArray download(const QUrl& url) override
+    {
+        if (unreachable)
+            throw mp::DownloadException{url.toString().toStdString(), "unreachable"};
+
+        return responses.at(url.toString());
+    }
+
+    std::map<QString, QByteArray> responses;
+    std::atomic_bool unreachable{false};
+};
+
+QJsonObject version_with(const QString& path, const QString& sha256)
+{
+    return {{"items", QJsonObject{{"disk1.img", QJsonObject{{"path", path}, {"sha256", sha256}, {"size", 10}}}}}};
+}
+
+struct ImageMirror : public Test
+{
+    ImageMirror()
+    {
+        const QJsonObject index{
+            {"index", QJsonObject{{"com.ubuntu.cloud:released:download",
+                                   QJsonObject{{"datatype", "image-downloads"}, {"path", manifest_path}}}}}};
+        upstream_versions = QJsonObject{{"20240101", version_with(image_location, image_hash)},
+                                        {"20231201", version_with("server/releases/jammy/old.img", "0ld")}};
+        const QJsonObject manifest{
+            {"products",
+             QJsonObject{{"com.ubuntu.cloud:server:22.04:amd64",
+                          QJsonObject{{"arch", "amd64"}, {"release", "jammy"}, {"versions", upstream_versions}}},
+                         {"com.ubuntu.cloud:server:20.04:amd64",
+                          QJsonObject{{"arch", "amd64"},
+                                      {"release", "focal"},
+                                      {"versions", QJsonObject{{"20240101", version_with("focal.img", "f0ca1")}}}}}}}};
+
+        index_json = QJsonDocument{index}.toJson();
+        url_downloader.responses[QString{official_url} + "streams/v1/index.json"] = index_json;
+        url_downloader.responses[QString{official_url} + manifest_path] = QJsonDocument{manifest}.toJson();
+
+        image.id = image_hash;
+        image.image_path = images_dir.filePath("ubuntu-22.04-server-cloudimg-amd64.img");
+        image.kernel_path = images_dir.filePath("ubuntu-22.04-server-cloudimg-amd64-vmlinuz-generic");
+        mpt::make_file_with_content(image.image_path, image_contents);
+        mpt::make_file_with_content(image.kernel_path, "kernel");
+    }
+
+    mp::ImageMirror::Response get(const QByteArray& path, const mp::ImageMirror::Headers& headers = {})
+    {
+        return mirror.answer("GET", "/releases/" + path, headers);
+    }
+
+    static QByteArray header(const mp::ImageMirror::Response& response, const QByteArray& name)
+    {
+        for (const auto& [header, value] : response.headers)
+            if (header == name)
+                return value;
+
+        return {};
+    }
+
+    mpt::TempDir images_dir;
+    mp::VMImage image;
+    QByteArray index_json;
+    QJsonObject upstream_versions;
+    ManifestURLDownloader url_downloader;
+    mp::ImageMirror mirror{{{"releases/", official_url}}, &url_downloader, [this] { return std::vector{image}; }, 1h};
+};
+} // namespace
+
+TEST_F(ImageMirror, parsesListenAddresses)
+{
+    using Address = std::pair<QHostAddress, quint16>;
+
+    EXPECT_EQ(mp::ImageMirror::parse_listen_address("8080"), Address(QHostAddress::Any, 8080));
+    EXPECT_EQ(mp::ImageMirror::parse_listen_address("10.0.0.1:80"), Address(QHostAddress{"10.0.0.1"}, 80));
+    EXPECT_EQ(mp::ImageMirror::parse_listen_address("[::1]:80"), Address(QHostAddress{"::1"}, 80));
+    EXPECT_THROW(mp::ImageMirror::parse_listen_address("somewhere:80"), std::runtime_error);
+    EXPECT_THROW(mp::ImageMirror::parse_listen_address("10.0.0.1:0"), std::runtime_error);
+}
+
+TEST_F(ImageMirror, servesUpstreamIndex)
+{
+    mirror.refresh();
+
+    const auto response = get("streams/v1/index.json");
+
+    EXPECT_EQ(response.status, 200);
+    EXPECT_EQ(response.body, index_json);
+}
+
+TEST_F(ImageMirror, servesManifestCutDownToCachedVersions)
+{
+    mirror.refresh();
+
+    const auto response = get(manifest_path);
+    ASSERT_EQ(response.status, 200);
+
+    const auto products = QJsonDocument::fromJson(response.body).object()["products"].toObject();
+    ASSERT_THAT(products.keys(), ElementsAre("com.ubuntu.cloud:server:22.04:amd64"));
+
+    const auto versions = products["com.ubuntu.cloud:server:22.04:amd64"]["versions"].toObject();
+    ASSERT_THAT(versions.keys(), ElementsAre("20240101"));
+    EXPECT_EQ(versions["20240101"], upstream_versions["20240101"]);
+}
+
+TEST_F(ImageMirror, servesCachedImageAndKernelUnderUpstreamPaths)
+{
+    mirror.refresh();
+
+    const auto image_response = get(image_location);
+    EXPECT_EQ(image_response.status, 200);
+    EXPECT_EQ(image_response.file_path, image.image_path);
+    EXPECT_EQ(image_response.offset, 0);
+    EXPECT_EQ(image_response.length, static_cast<qint64>(image_contents.size()));
+    EXPECT_EQ(header(image_response, "ETag"), QByteArray{"\""} + image_hash + "\"");
+
+    const auto kernel_response = get(kernel_location);
+    EXPECT_EQ(kernel_response.status, 200);
+    EXPECT_EQ(kernel_response.file_path, image.kernel_path);
+}
+
+TEST_F(ImageMirror, servesBlockMapNextToCachedImage)
+{
+    mirror.refresh();
+
+    const auto response = get(QByteArray{image_location} + mp::block_map_suffix);
+    ASSERT_EQ(response.status, 200);
+
+    const auto block_map = mp::block_map_from_json(response.body);
+    ASSERT_TRUE(block_map);
+    EXPECT_EQ(block_map->size, static_cast<qint64>(image_contents.size()));
+    EXPECT_EQ(block_map->sha256, QCryptographicHash::hash(QByteArray::fromStdString(image_contents),
+                                                          QCryptographicHash::Sha256)
+                                     .toHex());
+}
+
+TEST_F(ImageMirror, doesNotServeImagesThatPreparingRenamed)
+{
+    image.image_path = images_dir.filePath("ubuntu-22.04-server-cloudimg-amd64.qcow2");
+    mpt::make_file_with_content(image.image_path, image_contents);
+
+    mirror.refresh();
+
+    EXPECT_EQ(get(image_location).status, 404);
+    const auto products = QJsonDocument::fromJson(get(manifest_path).body).object()["products"].toObject();
+    EXPECT_TRUE(products.isEmpty());
+}
+
+TEST_F(ImageMirror, answersRangeRequestsWithPartialContent)
+{
+    mirror.refresh();
+
+    const auto response = get(image_location, {{"range", "bytes=2-5"}});
+
+    EXPECT_EQ(response.status, 206);
+    EXPECT_EQ(response.offset, 2);
+    EXPECT_EQ(response.length, 4);
+    EXPECT_EQ(header(response, "Content-Range"), "bytes 2-5/10");
+}
+
+TEST_F(ImageMirror, answersSuffixRangeRequests)
+{
+    mirror.refresh();
+
+    const auto response = get(image_location, {{"range", "bytes=-3"}});
+
+    EXPECT_EQ(response.status, 206);
+    EXPECT_EQ(response.offset, 7);
+    EXPECT_EQ(response.length, 3);
+}
+
+TEST_F(ImageMirror, refusesRangesPastTheEnd)
+{
+    mirror.refresh();
+
+    const auto response = get(image_location, {{"range", "bytes=10-"}});
+
+    EXPECT_EQ(response.status, 416);
+    EXPECT_EQ(header(response, "Content-Range"), "bytes */10");
+}
+
+TEST_F(ImageMirror, servesEverythingWhenIfRangeDoesNotMatch)
+{
+    mirror.refresh();
+
+    const auto response = get(image_location, {{"range", "bytes=2-5"}, {"if-range", "\"something-else\""}});
+
+    EXPECT_EQ(response.status, 200);
+    EXPECT_EQ(response.length, static_cast<qint64>(image_contents.size()));
+}
+
+TEST_F(ImageMirror, answersMatchingConditionalRequestsWithNotModified)
+{
+    mirror.refresh();
+
+    const auto first = get(image_location);
+
+    EXPECT_EQ(get(image_location, {{"if-none-match", header(first, "ETag")}}).status, 304);
+    EXPECT_EQ(get(image_location, {{"if-modified-since", header(first, "Last-Modified")}}).status, 304);
+    EXPECT_EQ(get(image_location, {{"if-none-match", "\"other\""}}).status, 200);
+}
+
+TEST_F(ImageMirror, refusesUnknownPathsAndMethods)
+{
+    mirror.refresh();
+
+    EXPECT_EQ(get("server/releases/jammy/old.img").status, 404);
+    EXPECT_EQ(mirror.answer("PUT", QByteArray{"/releases/"} + image_location, {}).status, 405);
+}
+
+TEST_F(ImageMirror, keepsServingWhatItHadWhenUpstreamIsUnreachable)
+{
+    mirror.refresh();
+    url_downloader.unreachable = true;
+    mirror.refresh();
+
+    EXPECT_EQ(get(manifest_path).status, 200);
+    EXPECT_EQ(get(image_location).status, 200);
+}
+
+TEST_F(ImageMirror, servesRangesOverHttp)
+{
+    mirror.refresh();
+    mirror.listen(QHostAddress::LocalHost, 0);
+
+    std::atomic_bool done{false};
+    QByteArray reply;
+    std::thread client{[this, &done, &reply] {
+        QTcpSocket socket;
+        socket.connectToHost(QHostAddress::LocalHost, mirror.port());
+        if (socket.waitForConnected(5000))
+        {
+            socket.write(QByteArray{"GET /releases/"} + image_location +
+                         " HTTP/1.1\r\nHost: mirror\r\nRange: bytes=3-6\r\nConnection: close\r\n\r\n");
+            socket.waitForBytesWritten(5000);
+            while (socket.waitForReadyRead(5000))
+                reply += socket.readAll();
+        }
+        done = true;
+    }};
+
+    while (!done)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    client.join();
+
+    EXPECT_TRUE(reply.startsWith("HTTP/1.1 206 Partial Content\r\n"));
+    EXPECT_THAT(reply.toStdString(), HasSubstr("Content-Range: bytes 3-6/10\r\n"));
+    EXPECT_TRUE(reply.endsWith("\r\n\r\n3456"));
+}
@@ -17,6 +17,7 @@
 
 #include "common.h"
 #include "disabling_macros.h"
+#include "fake_xz_data.h"
 #include "file_operations.h"
 #include "mock_image_host.h"
 #include "mock_logger.h"
@@ -38,10 +39,16 @@
 #include <multipass/url_downloader.h>
 #include <multipass/utils.h>
 
+#include <QCryptographicHash>
 #include <QDateTime>
 #include <QThread>
 #include <QUrl>
 
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 namespace mpt = multipass::test;
@@ -51,16 +58,18 @@ using namespace testing;
 namespace
 {
 const QDateTime default_last_modified{QDate(2019, 6, 25), QTime(13, 15, 0)};
+const std::string vmdk_contents{"KDMV and some more"}; // a format that only qemu-img reads
 
 struct BadURLDownloader : public mp::URLDownloader
 {
     BadURLDownloader() : mp::URLDownloader{std::chrono::seconds(10)}
     {
     }
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const mp::ProgressMonitor&) override
+    QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                        const mp::ProgressMonitor&) override
     {
         mpt::make_file_with_content(file_name, "Bad hash");
+        return {};
     }
 
     QByteArray download(const QUrl& url) override
@@ -74,12 +83,13 @@ struct HttpURLDownloader : public mp::URLDownloader
     HttpURLDownloader() : mp::URLDownloader{std::chrono::seconds(10)}
     {
     }
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const mp::ProgressMonitor&) override
+    QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                        const mp::ProgressMonitor&) override
     {
         mpt::make_file_with_content(file_name, "");
         downloaded_urls << url.toString();
         downloaded_files << file_name;
+        return {};
     }
 
     QByteArray download(const QUrl& url) override
@@ -101,8 +111,8 @@ struct RunningURLDownloader : public mp::URLDownloader
     RunningURLDownloader() : mp::URLDownloader{std::chrono::seconds(10)}
     {
     }
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const mp::ProgressMonitor&) override
+    QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                        const mp::ProgressMonitor&) override
     {
         while (!abort_downloads)
             QThread::yieldCurrentThread();
@@ -116,6 +126,91 @@ struct RunningURLDownloader : public mp::URLDownloader
     }
 };
 
+// Reports the hash of what it downloads, like the real downloader does
+struct HashingURLDownloader : public mpt::TrackingURLDownloader
+{
+    using mpt::TrackingURLDownloader::TrackingURLDownloader;
+
+    QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                        const mp::ProgressMonitor& monitor) override
+    {
+        mpt::TrackingURLDownloader::download_to(url, file_name, size, download_type, monitor);
+        return QCryptographicHash::hash(QByteArray::fromStdString(content), QCryptographicHash::Sha256).toHex();
+    }
+};
+
+// Holds each download until another one starts, so it only gets through when files download side by side
+struct RendezvousURLDownloader : public mpt::TrackingURLDownloader
+{
+    QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                        const mp::ProgressMonitor& monitor) override
+    {
+        {
+            std::unique_lock<std::mutex> lock{rendezvous_mutex};
+            ++started;
+            arrived.notify_all();
+            if (!arrived.wait_for(lock, std::chrono::seconds(5), [this] { return started > 1; }))
+                throw std::runtime_error{"alone"};
+        }
+
+        return mpt::TrackingURLDownloader::download_to(url, file_name, size, download_type, monitor);
+    }
+
+    std::mutex rendezvous_mutex;
+    std::condition_variable arrived;
+    int started{0};
+};
+
+// Gets interrupted the first time, leaving a partial file and its journal behind like the real downloader does; then
+// notes whether they were still there to resume from
+struct ResumingURLDownloader : public mpt::TrackingURLDownloader
+{
+    QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                        const mp::ProgressMonitor& monitor) override
+    {
+        const auto partial_file = file_name + ".part";
+        const auto journal_file = file_name + ".part.journal";
+
+        if (attempts++ == 0)
+        {
+            mpt::make_file_with_content(partial_file, "half an image");
+            mpt::make_file_with_content(journal_file, "{}");
+            throw mp::AbortedDownloadException{"Aborted!"};
+        }
+
+        resumed = QFile::exists(partial_file) && QFile::exists(journal_file);
+        QFile::remove(partial_file);
+        QFile::remove(journal_file);
+
+        return mpt::TrackingURLDownloader::download_to(url, file_name, size, download_type, monitor);
+    }
+
+    int attempts{0};
+    bool resumed{false};
+};
+
+// Serves a multi-block xz image whichever way the vault asks for it, noting whether it was decoded while downloading
+struct XzURLDownloader : public mpt::TrackingURLDownloader
+{
+    QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                        const mp::ProgressMonitor& monitor) override
+    {
+        mpt::make_file_with_content(file_name, mpt::multi_block_xz.toStdString());
+        downloaded_files << file_name;
+        return {};
+    }
+
+    QString download_decoded_to(const QUrl& url, const QString& decoded_file_name, int64_t size,
+                                const int download_type, const mp::ProgressMonitor& monitor) override
+    {
+        mpt::make_file_with_content(decoded_file_name, mpt::multi_block_decoded_data.toStdString());
+        decoded_while_downloading = true;
+        return {};
+    }
+
+    bool decoded_while_downloading{false};
+};
+
 struct ImageVault : public testing::Test
 {
     void SetUp()
@@ -148,6 +243,26 @@ struct ImageVault : public testing::Test
             ON_CALL(*process, read_all_standard_error).WillByDefault(Return(produce_output));
     }
 
+    // Prepares images by writing content to a file, e.g. to give them a particular format
+    mp::VMImageVault::PrepareAction prepare_writing(const std::string& content)
+    {
+        return [this, content](const mp::VMImage& source_image) -> mp::VMImage {
+            const auto file_name = QDir{MP_UTILS.make_dir(cache_dir.path(), "images")}.filePath("mock_image.img");
+            mpt::make_file_with_content(file_name, content);
+            return {file_name, "", "", source_image.id, "", "", "", {}};
+        };
+    }
+
+    // Prepares images by writing size bytes to a file of their own directory, where eviction can find and remove them
+    mp::VMImageVault::PrepareAction prepare_sized(const QString& dir_name, int size)
+    {
+        return [this, dir_name, size](const mp::VMImage& source_image) -> mp::VMImage {
+            const auto file_name = QDir{MP_UTILS.make_dir(cache_dir.path(), dir_name)}.filePath("image.img");
+            mpt::make_file_with_content(file_name, std::string(size, 'x'));
+            return {file_name, "", "", source_image.id, "", "", "", {}};
+        };
+    }
+
     std::unique_ptr<mp::test::MockProcessFactory::Scope>
     inject_fake_qemuimg_callback(const mp::ProcessState& qemuimg_exit_status, const QByteArray& qemuimg_output)
     {
@@ -207,6 +322,34 @@ TEST_F(ImageVault, downloads_kernel_and_initrd)
     EXPECT_FALSE(vm_image.initrd_path.isEmpty());
 }
 
+TEST_F(ImageVault, DISABLE_ON_WINDOWS_AND_MACOS(downloads_kernel_and_initrd_side_by_side))
+{
+    mpt::TempFile file;
+    RendezvousURLDownloader rendezvous_url_downloader;
+    mp::DefaultVMImageVault vault{hosts, &rendezvous_url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto query = default_query;
+
+    query.release = file.url().toStdString();
+    query.query_type = mp::Query::Type::LocalFile;
+
+    vault.fetch_image(mp::FetchType::ImageKernelAndInitrd, query, stub_prepare, stub_monitor, false, std::nullopt);
+
+    EXPECT_THAT(rendezvous_url_downloader.downloaded_urls,
+                UnorderedElementsAre(host.kernel.url(), host.initrd.url()));
+}
+
+TEST_F(ImageVault, lists_cached_images_with_their_ids)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt);
+
+    const auto images = vault.cached_images();
+
+    ASSERT_EQ(images.size(), 1u);
+    EXPECT_EQ(images.front().id, mpt::default_id);
+    EXPECT_TRUE(QFile::exists(images.front().image_path));
+}
+
 TEST_F(ImageVault, calls_prepare)
 {
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
@@ -372,6 +515,138 @@ TEST_F(ImageVault, image_exists_not_expired)
     EXPECT_TRUE(QFileInfo::exists(file_name));
 }
 
+TEST_F(ImageVault, DISABLE_ON_WINDOWS_AND_MACOS(least_recently_used_image_is_evicted_beyond_size_budget))
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+    vault.set_size_budget(mp::MemorySize{"1500"});
+
+    const auto old_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_sized("old", 1000),
+                                             stub_monitor, false, std::nullopt);
+    mp::Query query{"valley-pied-piper-chat", "http://www.foo.com/fake.img", false, "", mp::Query::Type::HttpDownload};
+    const auto new_image = vault.fetch_image(mp::FetchType::ImageOnly, query, prepare_sized("new", 1000), stub_monitor,
+                                             false, std::nullopt);
+
+    vault.prune_expired_images();
+
+    EXPECT_FALSE(QFileInfo::exists(old_image.image_path));
+    EXPECT_TRUE(QFileInfo::exists(new_image.image_path));
+}
+
+TEST_F(ImageVault, DISABLE_ON_WINDOWS_AND_MACOS(previous_version_is_not_evicted_while_fetching_the_next))
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+    vault.set_size_budget(mp::MemorySize{"1000"});
+
+    const auto old_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_sized("old", 1000),
+                                             stub_monitor, false, std::nullopt);
+
+    auto next_image_info = host.mock_bionic_image_info;
+    next_image_info.id = "f0e4c2f76c58916ec258f246851bea091d14d4247a2fc3e18694461b1816e13b";
+    next_image_info.version = "20200601";
+    next_image_info.verify = false;
+    ON_CALL(host, info_for(_)).WillByDefault(Return(next_image_info));
+
+    auto old_image_kept = false;
+    const auto prepare_new = prepare_sized("new", 1000);
+    auto query = default_query;
+    query.name = "next-instance";
+    vault.fetch_image(
+        mp::FetchType::ImageOnly, query,
+        [&old_image_kept, &old_image, &prepare_new](const mp::VMImage& source_image) {
+            old_image_kept = QFileInfo::exists(old_image.image_path);
+            return prepare_new(source_image);
+        },
+        stub_monitor, false, std::nullopt);
+
+    EXPECT_TRUE(old_image_kept);
+}
+
+TEST_F(ImageVault, image_cache_usage_reports_stored_images)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+    vault.set_size_budget(mp::MemorySize{"1M"});
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_sized("cached", 1000), stub_monitor, false,
+                      std::nullopt);
+
+    const auto usage = vault.cache_usage();
+
+    EXPECT_EQ(usage.size_budget, 1048576);
+    ASSERT_EQ(usage.images.size(), 1u);
+    EXPECT_EQ(usage.images.front().id, mpt::default_id);
+    EXPECT_EQ(usage.images.front().release, default_query.release);
+    EXPECT_EQ(usage.images.front().size, 1000);
+    EXPECT_FALSE(usage.images.front().in_use);
+}
+
+TEST_F(ImageVault, scrubbing_quarantines_and_refetches_changed_image)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+    const auto prepare = prepare_sized("scrubbed", 1000);
+    const auto image =
+        vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor, false, std::nullopt);
+
+    vault.scrub_images(mp::FetchType::ImageOnly, prepare, stub_monitor);
+    ASSERT_THAT(url_downloader.downloaded_files.size(), Eq(1));
+
+    QFile image_file{image.image_path};
+    ASSERT_TRUE(image_file.open(QFile::ReadWrite));
+    image_file.write("rot");
+    image_file.close();
+
+    vault.scrub_images(mp::FetchType::ImageOnly, prepare, stub_monitor);
+
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(2));
+    EXPECT_TRUE(QFileInfo::exists(QDir{cache_dir.path()}.filePath("vault/quarantine/scrubbed/image.img")));
+    EXPECT_THAT(mp::utils::contents_of(image.image_path), StrEq(std::string(1000, 'x')));
+}
+
+TEST_F(ImageVault, scrubbing_catches_downloaded_image_changing_before_it_is_first_scrubbed)
+{
+    auto image_info = host.mock_bionic_image_info;
+    image_info.verify = false;
+    ON_CALL(host, info_for(_)).WillByDefault(Return(image_info));
+
+    HashingURLDownloader hashing_url_downloader{"an image as downloaded"};
+    mp::DefaultVMImageVault vault{hosts, &hashing_url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+    auto prepare = [](const mp::VMImage& source_image) { return source_image; };
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor, false, std::nullopt);
+    ASSERT_THAT(hashing_url_downloader.downloaded_files.size(), Eq(1));
+
+    QFile image_file{hashing_url_downloader.downloaded_files.front()};
+    ASSERT_TRUE(image_file.open(QFile::ReadWrite));
+    image_file.write("rot");
+    image_file.close();
+
+    vault.scrub_images(mp::FetchType::ImageOnly, prepare, stub_monitor);
+
+    EXPECT_THAT(hashing_url_downloader.downloaded_files.size(), Eq(2));
+}
+
+TEST_F(ImageVault, scrubbing_quarantines_image_with_broken_header)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_writing("QFI\xfb"), stub_monitor, false,
+                      std::nullopt);
+
+    vault.scrub_images(mp::FetchType::ImageOnly, stub_prepare, stub_monitor);
+
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(2));
+    EXPECT_TRUE(QFileInfo::exists(QDir{cache_dir.path()}.filePath("vault/quarantine/images/mock_image.img")));
+}
+
+TEST_F(ImageVault, scrubbing_keeps_sound_images)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+    const auto image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_sized("sound", 1000),
+                                         stub_monitor, false, std::nullopt);
+
+    vault.scrub_images(mp::FetchType::ImageOnly, stub_prepare, stub_monitor);
+    vault.scrub_images(mp::FetchType::ImageOnly, stub_prepare, stub_monitor);
+
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(1));
+    EXPECT_TRUE(QFileInfo::exists(image.image_path));
+}
+
 TEST_F(ImageVault, invalid_image_dir_is_removed)
 {
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
@@ -389,6 +664,123 @@ TEST_F(ImageVault, invalid_image_dir_is_removed)
     EXPECT_FALSE(QFileInfo::exists(invalid_image_dir.absolutePath()));
 }
 
+TEST_F(ImageVault, interrupted_download_survives_pruning_to_be_resumed)
+{
+    ResumingURLDownloader resuming_url_downloader;
+    mp::DefaultVMImageVault vault{hosts, &resuming_url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+
+    EXPECT_THROW(
+        vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt),
+        mp::AbortedDownloadException);
+
+    vault.prune_expired_images();
+
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt);
+
+    EXPECT_EQ(resuming_url_downloader.attempts, 2);
+    EXPECT_TRUE(resuming_url_downloader.resumed);
+}
+
+TEST_F(ImageVault, xz_image_is_downloaded_whole_and_decoded_on_all_cores)
+{
+    if (std::thread::hardware_concurrency() < 2)
+        GTEST_SKIP() << "Only hosts with several cores decode xz images after downloading them";
+
+    auto xz_image_info = host.mock_bionic_image_info;
+    xz_image_info.image_location += ".xz";
+    xz_image_info.verify = false;
+    ON_CALL(host, info_for(_)).WillByDefault(Return(xz_image_info));
+
+    XzURLDownloader xz_url_downloader;
+    mp::DefaultVMImageVault vault{hosts, &xz_url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto vm_image =
+        vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt);
+
+    EXPECT_FALSE(xz_url_downloader.decoded_while_downloading);
+    ASSERT_THAT(xz_url_downloader.downloaded_files, SizeIs(1));
+    EXPECT_TRUE(xz_url_downloader.downloaded_files.front().endsWith(".xz"));
+    EXPECT_FALSE(QFile::exists(xz_url_downloader.downloaded_files.front()));
+
+    QFile image_file{vm_image.image_path};
+    ASSERT_TRUE(image_file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(image_file.readAll(), mpt::multi_block_decoded_data);
+}
+
+TEST_F(ImageVault, instanceImageIsOverlayOnQcow2PreparedImage)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}, true};
+
+    QDir images_dir{MP_UTILS.make_dir(cache_dir.path(), "images")};
+    auto file_name = images_dir.filePath("mock_image.img");
+
+    auto prepare = [&file_name](const mp::VMImage& source_image) -> mp::VMImage {
+        mpt::make_file_with_content(file_name, mpt::qcow2_header(1024 * 1024));
+        return {file_name, "", "", source_image.id, "", "", "", {}};
+    };
+    auto vm_image =
+        vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor, false, std::nullopt);
+
+    EXPECT_EQ(vm_image.backing_path, file_name);
+    EXPECT_NE(vm_image.image_path, file_name);
+
+    const auto processes = mock_factory_scope->process_list();
+    ASSERT_EQ(processes.size(), 1u);
+    EXPECT_EQ(processes.front().command, "qemu-img");
+    EXPECT_EQ(processes.front().arguments,
+              QStringList({"create", "-f", "qcow2", "-F", "qcow2", "-b", file_name, vm_image.image_path}));
+}
+
+TEST_F(ImageVault, backingImageIsOnlyPrunedOnceItsInstanceIsGone)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}, true};
+
+    QDir images_dir{MP_UTILS.make_dir(cache_dir.path(), "images")};
+    auto file_name = images_dir.filePath("mock_image.img");
+
+    auto prepare = [&file_name](const mp::VMImage& source_image) -> mp::VMImage {
+        mpt::make_file_with_content(file_name, mpt::qcow2_header(1024 * 1024));
+        return {file_name, "", "", source_image.id, "", "", "", {}};
+    };
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor, false, std::nullopt);
+
+    vault.prune_expired_images();
+    EXPECT_TRUE(QFileInfo::exists(file_name));
+
+    vault.remove(instance_name);
+
+    vault.prune_expired_images();
+    EXPECT_FALSE(QFileInfo::exists(file_name));
+}
+
+TEST_F(ImageVault, backingImageIsOnlyPrunedOnceFlattened)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}, true};
+
+    QDir images_dir{MP_UTILS.make_dir(cache_dir.path(), "images")};
+    auto file_name = images_dir.filePath("mock_image.img");
+
+    auto prepare = [&file_name](const mp::VMImage& source_image) -> mp::VMImage {
+        mpt::make_file_with_content(file_name, mpt::qcow2_header(1024 * 1024));
+        return {file_name, "", "", source_image.id, "", "", "", {}};
+    };
+    auto vm_image =
+        vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor, false, std::nullopt);
+
+    vault.prune_expired_images();
+    EXPECT_TRUE(QFileInfo::exists(file_name));
+
+    vault.flatten(instance_name);
+    EXPECT_EQ(mock_factory_scope->process_list().back().arguments,
+              QStringList({"rebase", "-f", "qcow2", "-b", "", vm_image.image_path}));
+
+    vault.prune_expired_images();
+    EXPECT_FALSE(QFileInfo::exists(file_name));
+    EXPECT_TRUE(vault.has_record_for(instance_name));
+}
+
 TEST_F(ImageVault, DISABLE_ON_WINDOWS_AND_MACOS(file_based_fetch_copies_image_and_returns_expected_info))
 {
     mpt::TempFile file;
@@ -532,6 +924,62 @@ TEST_F(ImageVault, image_update_creates_new_dir_and_removes_old)
     EXPECT_FALSE(QFileInfo::exists(original_absolute_path));
 }
 
+TEST_F(ImageVault, DISABLE_ON_WINDOWS_AND_MACOS(image_with_stored_checksum_is_not_downloaded_again))
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    int prepare_called_count{0};
+    auto prepare = [&prepare_called_count](const mp::VMImage& source_image) -> mp::VMImage {
+        ++prepare_called_count;
+        return source_image;
+    };
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor, false, std::nullopt);
+
+    mp::Query query{"valley-pied-piper-chat", "http://www.foo.com/fake.img", false, "", mp::Query::Type::HttpDownload};
+    auto vm_image =
+        vault.fetch_image(mp::FetchType::ImageOnly, query, prepare, stub_monitor, false, std::string{mpt::default_id});
+
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(1));
+    EXPECT_THAT(prepare_called_count, Eq(1));
+    EXPECT_THAT(vm_image.id, Eq(mpt::default_id));
+}
+
+TEST_F(ImageVault, DISABLE_ON_WINDOWS_AND_MACOS(identical_download_is_stored_once))
+{
+    HashingURLDownloader hashing_url_downloader;
+    mp::DefaultVMImageVault vault{hosts, &hashing_url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    int prepare_called_count{0};
+    auto prepare = [&prepare_called_count](const mp::VMImage& source_image) -> mp::VMImage {
+        ++prepare_called_count;
+        return source_image;
+    };
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor, false, std::nullopt);
+
+    // The URL names no checksum, so the image can only be recognised once downloaded
+    mp::Query query{"valley-pied-piper-chat", "http://www.foo.com/fake.img", false, "", mp::Query::Type::HttpDownload};
+    vault.fetch_image(mp::FetchType::ImageOnly, query, prepare, stub_monitor, false, std::nullopt);
+
+    ASSERT_THAT(hashing_url_downloader.downloaded_files.size(), Eq(2));
+    EXPECT_THAT(prepare_called_count, Eq(1));
+    EXPECT_TRUE(QFileInfo::exists(hashing_url_downloader.downloaded_files[0]));
+    EXPECT_FALSE(QFileInfo::exists(hashing_url_downloader.downloaded_files[1]));
+}
+
+TEST_F(ImageVault, DISABLE_ON_WINDOWS_AND_MACOS(expired_image_is_kept_while_other_records_refer_to_it))
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt);
+
+    mp::Query query{"valley-pied-piper-chat", "http://www.foo.com/fake.img", false, "", mp::Query::Type::HttpDownload};
+    vault.fetch_image(mp::FetchType::ImageOnly, query, stub_prepare, stub_monitor, false, std::string{mpt::default_id});
+
+    ASSERT_THAT(url_downloader.downloaded_files.size(), Eq(1));
+    const auto image_file = url_downloader.downloaded_files[0];
+
+    vault.prune_expired_images();
+
+    EXPECT_TRUE(QFileInfo::exists(image_file));
+}
+
 TEST_F(ImageVault, aborted_download_throws)
 {
     RunningURLDownloader running_url_downloader;
@@ -545,6 +993,33 @@ TEST_F(ImageVault, aborted_download_throws)
 }
 
 TEST_F(ImageVault, minimum_image_size_returns_expected_size)
+{
+    const mp::MemorySize image_size{"1048576"};
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query,
+                                      prepare_writing(mpt::qcow2_header(image_size.in_bytes())), stub_monitor, false,
+                                      std::nullopt);
+
+    const auto size = vault.minimum_image_size_for(vm_image.id);
+
+    EXPECT_EQ(image_size, size);
+    EXPECT_TRUE(mock_factory_scope->process_list().empty());
+}
+
+TEST_F(ImageVault, minimum_image_size_of_raw_image_is_its_file_size)
+{
+    const std::string contents(4096, 'x');
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_writing(contents), stub_monitor,
+                                      false, std::nullopt);
+
+    EXPECT_EQ(vault.minimum_image_size_for(vm_image.id), mp::MemorySize{"4096"});
+}
+
+TEST_F(ImageVault, minimum_image_size_asks_qemuimg_about_formats_it_cannot_read)
 {
     const mp::MemorySize image_size{"1048576"};
     const mp::ProcessState qemuimg_exit_status{0, std::nullopt};
@@ -552,8 +1027,8 @@ TEST_F(ImageVault, minimum_image_size_returns_expected_size)
     auto mock_factory_scope = inject_fake_qemuimg_callback(qemuimg_exit_status, qemuimg_output);
 
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
-    auto vm_image =
-        vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt);
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_writing(vmdk_contents),
+                                      stub_monitor, false, std::nullopt);
 
     const auto size = vault.minimum_image_size_for(vm_image.id);
 
@@ -563,11 +1038,14 @@ TEST_F(ImageVault, minimum_image_size_returns_expected_size)
 TEST_F(ImageVault, DISABLE_ON_WINDOWS_AND_MACOS(file_based_minimum_size_returns_expected_size))
 {
     const mp::MemorySize image_size{"2097152"};
-    const mp::ProcessState qemuimg_exit_status{0, std::nullopt};
-    const QByteArray qemuimg_output(fake_img_info(image_size));
-    auto mock_factory_scope = inject_fake_qemuimg_callback(qemuimg_exit_status, qemuimg_output);
 
     mpt::TempFile file;
+    {
+        QFile image_file{file.name()};
+        ASSERT_TRUE(image_file.open(QFile::WriteOnly));
+        image_file.write(QByteArray::fromStdString(mpt::qcow2_header(image_size.in_bytes())));
+    }
+
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
     auto query = default_query;
 
@@ -597,8 +1075,8 @@ TEST_F(ImageVault, minimum_image_size_throws_when_qemuimg_info_crashes)
     auto mock_factory_scope = inject_fake_qemuimg_callback(qemuimg_exit_status, qemuimg_output);
 
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
-    auto vm_image =
-        vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt);
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_writing(vmdk_contents),
+                                      stub_monitor, false, std::nullopt);
 
     MP_EXPECT_THROW_THAT(vault.minimum_image_size_for(vm_image.id), std::runtime_error,
                          mpt::match_what(AllOf(HasSubstr("qemu-img failed"), HasSubstr("with output"))));
@@ -611,8 +1089,8 @@ TEST_F(ImageVault, minimum_image_size_throws_when_qemuimg_info_cannot_find_the_i
     auto mock_factory_scope = inject_fake_qemuimg_callback(qemuimg_exit_status, qemuimg_output);
 
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
-    auto vm_image =
-        vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt);
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_writing(vmdk_contents),
+                                      stub_monitor, false, std::nullopt);
 
     MP_EXPECT_THROW_THAT(vault.minimum_image_size_for(vm_image.id), std::runtime_error,
                          mpt::match_what(AllOf(HasSubstr("qemu-img failed"), HasSubstr("Could not find"))));
@@ -625,8 +1103,8 @@ TEST_F(ImageVault, minimum_image_size_throws_when_qemuimg_info_does_not_understa
     auto mock_factory_scope = inject_fake_qemuimg_callback(qemuimg_exit_status, qemuimg_output);
 
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
-    auto vm_image =
-        vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor, false, std::nullopt);
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare_writing(vmdk_contents),
+                                      stub_monitor, false, std::nullopt);
 
     MP_EXPECT_THROW_THAT(vault.minimum_image_size_for(vm_image.id), std::runtime_error,
                          mpt::match_what(HasSubstr("Could not obtain image's virtual size")));
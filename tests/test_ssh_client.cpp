@@ -25,11 +25,67 @@
 #include <multipass/ssh/ssh_client.h>
 #include <multipass/ssh/ssh_session.h>
 
+#include <array>
+#include <string>
+#include <vector>
+
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace mp = multipass;
 namespace mpt = multipass::test;
 
+using namespace testing;
+
 namespace
 {
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+// Points one of the standard descriptors at a pipe for as long as it lives
+class RedirectedFd
+{
+public:
+    explicit RedirectedFd(int fd) : fd{fd}, saved{::dup(fd)}
+    {
+        EXPECT_EQ(::pipe(ends.data()), 0);
+        ::dup2(fd == STDIN_FILENO ? ends[0] : ends[1], fd);
+        ::fcntl(ends[0], F_SETFL, O_NONBLOCK);
+    }
+
+    ~RedirectedFd()
+    {
+        ::dup2(saved, fd);
+        ::close(saved);
+        for (auto end : ends)
+            if (end >= 0)
+                ::close(end);
+    }
+
+    void feed_and_close(const std::string& data)
+    {
+        EXPECT_EQ(::write(ends[1], data.data(), data.size()), static_cast<ssize_t>(data.size()));
+        ::close(ends[1]);
+        ends[1] = -1;
+    }
+
+    std::string drain()
+    {
+        std::string data;
+        std::array<char, 4096> buffer;
+        for (ssize_t bytes_read; (bytes_read = ::read(ends[0], buffer.data(), buffer.size())) > 0;)
+            data.append(buffer.data(), bytes_read);
+
+        return data;
+    }
+
+private:
+    const int fd;
+    const int saved;
+    std::array<int, 2> ends{-1, -1};
+};
+#endif
+
 struct SSHClient : public testing::Test
 {
     mp::SSHClient make_ssh_client()
@@ -119,3 +175,112 @@ TEST_F(SSHClient, throw_when_request_exec_fails)
 
     EXPECT_THROW(client.exec({"foo"}), std::runtime_error);
 }
+
+#ifndef MULTIPASS_PLATFORM_WINDOWS
+TEST_F(SSHClient, pipeWritesChannelOutputToStdoutAndStderr)
+{
+    auto client = make_ssh_client();
+
+    ssh_channel_callbacks callbacks = nullptr;
+    REPLACE(ssh_add_channel_callbacks, [&callbacks](auto, auto cb) {
+        callbacks = cb;
+        return SSH_OK;
+    });
+
+    mock_ssh_test_fixture.is_eof.returnValue(0);
+    REPLACE(ssh_event_dopoll, [this, &callbacks](auto...) {
+        std::string out{"out"}, err{"err"};
+        callbacks->channel_data_function(nullptr, nullptr, out.data(), out.size(), 0, callbacks->userdata);
+        callbacks->channel_data_function(nullptr, nullptr, err.data(), err.size(), 1, callbacks->userdata);
+        mock_ssh_test_fixture.is_eof.returnValue(true);
+        return SSH_OK;
+    });
+
+    std::string out, err;
+    {
+        RedirectedFd redirected_stdout{STDOUT_FILENO}, redirected_stderr{STDERR_FILENO};
+        client.exec({"foo"});
+        out = redirected_stdout.drain();
+        err = redirected_stderr.drain();
+    }
+
+    EXPECT_EQ(out, "out");
+    EXPECT_EQ(err, "err");
+}
+
+TEST_F(SSHClient, pipeSendsStdinInChunksThatFitTheWindow)
+{
+    constexpr auto window = 4u;
+    std::string written;
+    std::vector<std::size_t> write_sizes;
+    auto eof_sent = false;
+
+    RedirectedFd redirected_stdin{STDIN_FILENO};
+    redirected_stdin.feed_and_close("hello world");
+
+    auto client = make_ssh_client();
+
+    mock_ssh_test_fixture.is_eof.returnValue(0);
+    REPLACE(ssh_channel_window_size, [](auto) { return window; });
+    REPLACE(ssh_channel_write, [&written, &write_sizes](auto, const void* data, uint32_t size) {
+        write_sizes.push_back(size);
+        written.append(static_cast<const char*>(data), size);
+        return static_cast<int>(size);
+    });
+    REPLACE(ssh_channel_send_eof, [this, &eof_sent](auto) {
+        eof_sent = true;
+        mock_ssh_test_fixture.is_eof.returnValue(true);
+        return SSH_OK;
+    });
+    REPLACE(ssh_event_dopoll, [](ssh_event event, int) { return ssh_event_dopoll(event, 0); }); // the real one
+
+    EXPECT_EQ(client.exec({"cat"}), SSH_OK);
+    EXPECT_EQ(written, "hello world");
+    EXPECT_THAT(write_sizes, Each(Le(window)));
+    EXPECT_TRUE(eof_sent);
+}
+
+TEST_F(SSHClient, pipeStopsReadingStdinWhileTheWindowIsClosed)
+{
+    auto polls = 0;
+    auto window = 0u;
+    std::string written;
+    std::vector<int> polls_at_write;
+    ssh_channel_callbacks callbacks = nullptr;
+
+    RedirectedFd redirected_stdin{STDIN_FILENO};
+    redirected_stdin.feed_and_close("hello");
+
+    REPLACE(ssh_add_channel_callbacks, [&callbacks](auto, auto cb) {
+        callbacks = cb;
+        return SSH_OK;
+    });
+
+    auto client = make_ssh_client();
+
+    mock_ssh_test_fixture.is_eof.returnValue(0);
+    REPLACE(ssh_channel_window_size, [&window](auto) { return window; });
+    REPLACE(ssh_channel_write, [&](auto, const void* data, uint32_t size) {
+        polls_at_write.push_back(polls);
+        written.append(static_cast<const char*>(data), size);
+        return static_cast<int>(size);
+    });
+    REPLACE(ssh_channel_send_eof, [this](auto) {
+        mock_ssh_test_fixture.is_eof.returnValue(true);
+        return SSH_OK;
+    });
+    REPLACE(ssh_event_dopoll, [&](ssh_event event, int) {
+        if (++polls == 2)
+        {
+            // the peer opens the window
+            window = 64;
+            callbacks->channel_write_wontblock_function(nullptr, nullptr, window, callbacks->userdata);
+        }
+        return ssh_event_dopoll(event, 0); // the real one
+    });
+
+    EXPECT_EQ(client.exec({"cat"}), SSH_OK);
+    EXPECT_EQ(written, "hello");
+    EXPECT_THAT(polls_at_write, Each(Gt(1)));
+}
+#endif
@@ -21,6 +21,11 @@
 
 #include <multipass/ssh/ssh_session.h>
 
+#include <scope_guard.hpp>
+
+#include <string>
+#include <vector>
+
 namespace mp = multipass;
 using namespace testing;
 
@@ -100,3 +105,92 @@ TEST(SSHSession, exec_succeeds)
 
     EXPECT_NO_THROW(session.exec("dummy"));
 }
+
+TEST(SSHSession, uses_preferred_ciphers)
+{
+    std::vector<std::string> ciphers;
+    REPLACE(ssh_options_set, [&ciphers](auto, auto type, auto value) {
+        if (type == SSH_OPTIONS_CIPHERS_C_S || type == SSH_OPTIONS_CIPHERS_S_C)
+            ciphers.emplace_back(static_cast<const char*>(value));
+        return SSH_OK;
+    });
+    REPLACE(ssh_connect, [](auto...) { return SSH_OK; });
+
+    mp::SSHSession::set_cipher_preference("aes256-ctr");
+    auto reset_preference = sg::make_scope_guard([]() noexcept { mp::SSHSession::set_cipher_preference(""); });
+
+    mp::SSHSession session{"theanswertoeverything", 42};
+
+    EXPECT_THAT(ciphers, ElementsAre("aes256-ctr", "aes256-ctr"));
+}
+
+TEST(SSHSession, uses_its_own_ciphers_over_the_preference)
+{
+    mp::test::StubSSHKeyProvider key_provider;
+    std::vector<std::string> ciphers;
+    REPLACE(ssh_options_set, [&ciphers](auto, auto type, auto value) {
+        if (type == SSH_OPTIONS_CIPHERS_C_S || type == SSH_OPTIONS_CIPHERS_S_C)
+            ciphers.emplace_back(static_cast<const char*>(value));
+        return SSH_OK;
+    });
+    REPLACE(ssh_connect, [](auto...) { return SSH_OK; });
+    REPLACE(ssh_userauth_publickey, [](auto...) { return SSH_AUTH_SUCCESS; });
+
+    mp::SSHSession::set_cipher_preference("aes256-ctr");
+    auto reset_preference = sg::make_scope_guard([]() noexcept { mp::SSHSession::set_cipher_preference(""); });
+
+    mp::SSHSession session{"theanswertoeverything", 42, "ubuntu", key_provider, std::chrono::seconds(20),
+                           "chacha20-poly1305@openssh.com"};
+
+    EXPECT_THAT(ciphers, ElementsAre("chacha20-poly1305@openssh.com", "chacha20-poly1305@openssh.com"));
+}
+
+namespace
+{
+std::vector<std::string> ciphers_picked_without_preference()
+{
+    std::vector<std::string> ciphers;
+    REPLACE(ssh_options_set, [&ciphers](auto, auto type, auto value) {
+        if (type == SSH_OPTIONS_CIPHERS_C_S || type == SSH_OPTIONS_CIPHERS_S_C)
+            ciphers.emplace_back(static_cast<const char*>(value));
+        return SSH_OK;
+    });
+    REPLACE(ssh_connect, [](auto...) { return SSH_OK; });
+
+    mp::SSHSession session{"theanswertoeverything", 42};
+
+    return ciphers;
+}
+} // namespace
+
+TEST(SSHSession, picks_aes_first_when_there_is_no_preference_and_the_cpu_has_aes)
+{
+    if (!mp::SSHSession::has_hardware_aes())
+        GTEST_SKIP() << "This CPU does not implement AES";
+
+    const auto expected = "aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,aes256-ctr";
+    EXPECT_THAT(ciphers_picked_without_preference(), ElementsAre(expected, expected));
+}
+
+TEST(SSHSession, picks_chacha_first_when_there_is_no_preference_and_the_cpu_lacks_aes)
+{
+    if (mp::SSHSession::has_hardware_aes())
+        GTEST_SKIP() << "This CPU implements AES";
+
+    const auto expected = "chacha20-poly1305@openssh.com,aes256-ctr";
+    EXPECT_THAT(ciphers_picked_without_preference(), ElementsAre(expected, expected));
+}
+
+TEST(SSHSession, finds_unknown_ciphers)
+{
+    EXPECT_THAT(mp::SSHSession::unknown_ciphers("aes128-gcm@openssh.com,blowfish,chacha20-poly1305@openssh.com,"),
+                ElementsAre("blowfish", ""));
+}
+
+TEST(SSHSession, knows_no_preference_and_every_default_cipher)
+{
+    EXPECT_THAT(mp::SSHSession::unknown_ciphers(""), IsEmpty());
+    EXPECT_THAT(mp::SSHSession::unknown_ciphers(
+                    "aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,aes256-ctr"),
+                IsEmpty());
+}
@@ -33,7 +33,9 @@
 
 #include <QUrl>
 
+#include <atomic>
 #include <cstddef>
+#include <mutex>
 #include <optional>
 #include <unordered_set>
 
@@ -92,6 +94,35 @@ struct UbuntuImageHost : public testing::Test
     mpt::MockSettings::GuardedMock mock_settings_injection = mpt::MockSettings::inject<StrictMock>();
     mpt::MockSettings& mock_settings = *mock_settings_injection.first;
 };
+
+// Serves each URL once, and says it was not modified when asked again
+struct NotModifiedURLDownloader : public mp::URLDownloader
+{
+    NotModifiedURLDownloader() : URLDownloader{std::chrono::seconds{10}}
+    {
+    }
+
+    std::optional<QByteArray> download_if_modified(const QUrl& url, mp::HttpValidators& validators) override
+    {
+        {
+            std::lock_guard<std::mutex> lock{served_mutex};
+            if (!served.insert(url.toString().toStdString()).second)
+                return std::nullopt;
+        }
+
+        return URLDownloader::download_if_modified(url, validators);
+    }
+
+    QByteArray download(const QUrl& url) override
+    {
+        ++downloads;
+        return URLDownloader::download(url);
+    }
+
+    std::mutex served_mutex;
+    std::unordered_set<std::string> served;
+    std::atomic_int downloads{0};
+};
 } // namespace
 
 TEST_F(UbuntuImageHost, returns_expected_info)
@@ -238,6 +269,20 @@ TEST_F(UbuntuImageHost, supports_multiple_manifests)
     EXPECT_THAT(xenial_info->id, Eq(expected_id));
 }
 
+TEST_F(UbuntuImageHost, finds_full_hash_in_any_remote)
+{
+    mp::UbuntuVMImageHost host{all_remote_specs, &url_downloader, default_ttl};
+
+    const auto daily_id = "c09f123b9589c504fe39ec6e9ebe5188c67be7d1fc4fb80c969bf877f5a8333a";
+    auto info = host.info_for_full_hash(daily_id);
+
+    EXPECT_THAT(info.id, Eq(daily_id));
+    EXPECT_THAT(info.image_location, Eq(daily_url + "newest-artful.img"));
+
+    MP_EXPECT_THROW_THAT(host.info_for_full_hash("abcde"), std::runtime_error,
+                         mpt::match_what(HasSubstr("Unable to find an image matching hash")));
+}
+
 TEST_F(UbuntuImageHost, looks_for_aliases_before_hashes)
 {
     mp::UbuntuVMImageHost host{all_remote_specs, &url_downloader, default_ttl};
@@ -389,6 +434,30 @@ TEST_F(UbuntuImageHost, handles_and_recovers_from_independent_server_failures)
     }
 }
 
+TEST_F(UbuntuImageHost, serves_stale_manifests_while_they_fail_to_update)
+{
+    const auto ttl = 0s; // so that every lookup finds the manifests expired
+    mp::UbuntuVMImageHost host{all_remote_specs, &url_downloader, ttl, 1h};
+
+    const auto query = make_query("xenial", release_remote_spec.first);
+    EXPECT_TRUE(host.info_for(query));
+
+    url_downloader.mischiefs = 1000;
+    for (auto i = 0; i < 3; ++i)
+        EXPECT_TRUE(host.info_for(query));
+}
+
+TEST_F(UbuntuImageHost, keeps_unmodified_manifests)
+{
+    NotModifiedURLDownloader not_modified_url_downloader;
+    mp::UbuntuVMImageHost host{all_remote_specs, &not_modified_url_downloader, 0s};
+
+    EXPECT_TRUE(host.info_for(make_query("xenial", release_remote_spec.first)));
+    EXPECT_TRUE(host.info_for(make_query("artful", daily_remote_spec.first)));
+
+    EXPECT_EQ(not_modified_url_downloader.downloads, 0);
+}
+
 TEST_F(UbuntuImageHost, throws_unsupported_image_when_image_not_supported)
 {
     mp::UbuntuVMImageHost host{all_remote_specs, &url_downloader, default_ttl};
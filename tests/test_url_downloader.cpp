@@ -16,6 +16,7 @@
  */
 
 #include "common.h"
+#include "file_operations.h"
 #include "mock_file_ops.h"
 #include "mock_logger.h"
 #include "mock_network.h"
@@ -24,8 +25,15 @@
 #include <multipass/exceptions/aborted_download_exception.h>
 #include <multipass/exceptions/download_exception.h>
 
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QTimer>
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 namespace mpt = multipass::test;
@@ -205,9 +213,10 @@ TEST_F(URLDownloader, fileDownloadNoErrorHasExpectedResults)
     mpt::TempDir file_dir;
     QString download_file{file_dir.path() + "/foo.txt"};
 
-    downloader.download_to(fake_url, download_file, test_data.size(), download_type, progress_monitor);
+    auto hash = downloader.download_to(fake_url, download_file, test_data.size(), download_type, progress_monitor);
 
     EXPECT_TRUE(progress_called);
+    EXPECT_EQ(hash, QCryptographicHash::hash(test_data, QCryptographicHash::Sha256).toHex());
 
     QFile test_file{download_file};
     ASSERT_TRUE(test_file.exists());
@@ -473,6 +482,477 @@ TEST_F(URLDownloader, fileDownloadWriteFailsLogsErrorAndThrows)
                  mp::AbortedDownloadException);
 }
 
+TEST_F(URLDownloader, fileDownloadAbortedKeepsPartialFileAndJournal)
+{
+    mpt::MockQNetworkReply* mock_reply = new mpt::MockQNetworkReply();
+    const QByteArray test_data{"This is some data"};
+
+    EXPECT_CALL(*mock_reply, abort()).WillOnce([&mock_reply] { mock_reply->abort_operation(); });
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(_, _, _)).WillOnce([&mock_reply](auto...) {
+        QTimer::singleShot(0, [&mock_reply] {
+            mock_reply->set_attribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+            mock_reply->set_raw_header("ETag", "\"some-etag\"");
+            mock_reply->readyRead();
+            mock_reply->downloadProgress(17, 1000);
+        });
+        return mock_reply;
+    });
+
+    EXPECT_CALL(*mock_reply, readData(_, _))
+        .WillOnce([&test_data](char* data, auto) {
+            memcpy(data, test_data.constData(), test_data.size());
+            return test_data.size();
+        })
+        .WillRepeatedly(Return(0));
+
+    auto progress_monitor = [](auto...) { return false; };
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+
+    mpt::TempDir file_dir;
+    QString download_file{file_dir.path() + "/foo.txt"};
+
+    EXPECT_THROW(downloader.download_to(fake_url, download_file, 1000, -1, progress_monitor),
+                 mp::AbortedDownloadException);
+
+    EXPECT_FALSE(QFile::exists(download_file));
+
+    QFile partial_file{download_file + ".part"};
+    ASSERT_TRUE(partial_file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(partial_file.readAll(), test_data);
+
+    QFile journal{download_file + ".part.journal"};
+    ASSERT_TRUE(journal.open(QIODevice::ReadOnly));
+    const auto json = QJsonDocument::fromJson(journal.readAll()).object();
+    EXPECT_EQ(json["url"].toString(), fake_url.toString());
+    EXPECT_EQ(json["validator"].toString(), "\"some-etag\"");
+    EXPECT_EQ(json["bytes"].toInt(), test_data.size());
+}
+
+TEST_F(URLDownloader, fileDownloadResumesFromJournal)
+{
+    mpt::MockQNetworkReply* mock_reply = new mpt::MockQNetworkReply();
+    const QByteArray test_data{"This is some data to put in a file when downloaded."};
+    const auto resume_from = 17;
+
+    mpt::TempDir file_dir;
+    QString download_file{file_dir.path() + "/foo.txt"};
+
+    // Trailing garbage past the journalled length must not survive
+    mpt::make_file_with_content(download_file + ".part", test_data.left(resume_from).toStdString() + "garbage");
+    mpt::make_file_with_content(
+        download_file + ".part.journal",
+        fmt::format(R"({{"url": "{}", "validator": "\"some-etag\"", "bytes": {}}})", fake_url.toString(), resume_from));
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(_, _, _))
+        .WillOnce([&mock_reply, &test_data](auto, const QNetworkRequest& request, auto) {
+            EXPECT_EQ(request.rawHeader("Range"), "bytes=17-");
+            EXPECT_EQ(request.rawHeader("If-Range"), "\"some-etag\"");
+
+            QTimer::singleShot(0, [&mock_reply, &test_data] {
+                mock_reply->set_attribute(QNetworkRequest::HttpStatusCodeAttribute, 206);
+                mock_reply->set_raw_header("Content-Range", "bytes 17-50/51");
+                mock_reply->downloadProgress(test_data.size() - resume_from, test_data.size() - resume_from);
+                mock_reply->readyRead();
+                mock_reply->finished();
+            });
+            return mock_reply;
+        });
+
+    EXPECT_CALL(*mock_reply, readData(_, _))
+        .WillOnce([&test_data](char* data, auto) {
+            memcpy(data, test_data.constData() + resume_from, test_data.size() - resume_from);
+            return test_data.size() - resume_from;
+        })
+        .WillRepeatedly(Return(0));
+
+    auto progress_monitor = [](auto, int progress) {
+        EXPECT_EQ(progress, 100);
+        return true;
+    };
+
+    logger_scope.mock_logger->screen_logs(mpl::Level::info);
+    logger_scope.mock_logger->expect_log(mpl::Level::info, "Resuming download");
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+
+    auto hash = downloader.download_to(fake_url, download_file, test_data.size(), -1, progress_monitor);
+
+    EXPECT_EQ(hash, QCryptographicHash::hash(test_data, QCryptographicHash::Sha256).toHex());
+
+    QFile test_file{download_file};
+    ASSERT_TRUE(test_file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(test_file.readAll(), test_data);
+    EXPECT_FALSE(QFile::exists(download_file + ".part"));
+    EXPECT_FALSE(QFile::exists(download_file + ".part.journal"));
+}
+
+TEST_F(URLDownloader, fileDownloadLargeFileFetchesRangesConcurrently)
+{
+    const qint64 size = 64 * 1024 * 1024;
+    const qint64 segment_size = size / 4;
+    std::vector<QByteArray> requested_ranges;
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::HeadOperation, _, _))
+        .WillOnce([size](auto...) {
+            auto mock_reply = new mpt::MockQNetworkReply();
+            mock_reply->set_raw_header("Accept-Ranges", "bytes");
+            mock_reply->set_raw_header("ETag", "\"some-etag\"");
+            mock_reply->set_header(QNetworkRequest::ContentLengthHeader, size);
+            QTimer::singleShot(0, [mock_reply] { mock_reply->finished(); });
+            return mock_reply;
+        });
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::GetOperation, _, _))
+        .Times(4)
+        .WillRepeatedly([&requested_ranges, size, segment_size](auto, const QNetworkRequest& request, auto) {
+            requested_ranges.push_back(request.rawHeader("Range"));
+            EXPECT_EQ(request.rawHeader("If-Range"), "\"some-etag\"");
+
+            // Fill each segment with its index, so that misplaced writes show
+            auto mock_reply = new mpt::MockQNetworkReply();
+            auto remaining = std::make_shared<qint64>(segment_size);
+            const char fill = static_cast<char>(requested_ranges.size());
+
+            mock_reply->set_attribute(QNetworkRequest::HttpStatusCodeAttribute, 206);
+            mock_reply->set_raw_header("Content-Range", "bytes " + request.rawHeader("Range").mid(6) + "/" +
+                                                            QByteArray::number(size));
+            EXPECT_CALL(*mock_reply, readData(_, _)).WillRepeatedly([remaining, fill](char* data, qint64 max_size) {
+                const auto chunk = std::min(*remaining, max_size);
+                memset(data, fill, chunk);
+                *remaining -= chunk;
+                return chunk;
+            });
+
+            QTimer::singleShot(0, [mock_reply] {
+                mock_reply->readyRead();
+                mock_reply->finished();
+            });
+            return mock_reply;
+        });
+
+    auto progress_monitor = [](auto...) { return true; };
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+
+    mpt::TempDir file_dir;
+    QString download_file{file_dir.path() + "/foo.img"};
+
+    auto hash = downloader.download_to(fake_url, download_file, size, -1, progress_monitor);
+
+    EXPECT_THAT(requested_ranges, ElementsAre("bytes=0-16777215", "bytes=16777216-33554431",
+                                              "bytes=33554432-50331647", "bytes=50331648-67108863"));
+
+    QFile file{download_file};
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    ASSERT_EQ(file.size(), size);
+    for (auto i = 0; i < 4; ++i)
+    {
+        file.seek(i * segment_size);
+        EXPECT_EQ(file.read(1), QByteArray(1, static_cast<char>(i + 1)));
+        file.seek((i + 1) * segment_size - 1);
+        EXPECT_EQ(file.read(1), QByteArray(1, static_cast<char>(i + 1)));
+    }
+
+    QCryptographicHash expected_hash{QCryptographicHash::Sha256};
+    for (auto i = 0; i < 4; ++i)
+        expected_hash.addData(QByteArray(segment_size, static_cast<char>(i + 1)));
+
+    EXPECT_EQ(hash, expected_hash.result().toHex());
+}
+
+TEST_F(URLDownloader, fileDownloadLargeFileChangedOnTheServerStartsOver)
+{
+    const qint64 size = 64 * 1024 * 1024;
+    const QByteArray new_data{"This is the new version of the file."};
+    auto ranged_requests = 0;
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::HeadOperation, _, _))
+        .WillOnce([size](auto...) {
+            auto mock_reply = new mpt::MockQNetworkReply();
+            mock_reply->set_raw_header("Accept-Ranges", "bytes");
+            mock_reply->set_raw_header("ETag", "\"old-etag\"");
+            mock_reply->set_header(QNetworkRequest::ContentLengthHeader, size);
+            QTimer::singleShot(0, [mock_reply] { mock_reply->finished(); });
+            return mock_reply;
+        });
+
+    // The If-Range no longer matches, so every range gets the whole new version back instead
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::GetOperation, _, _))
+        .WillRepeatedly([&new_data, &ranged_requests](auto, const QNetworkRequest& request, auto) {
+            auto mock_reply = new mpt::MockQNetworkReply();
+            mock_reply->set_attribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+
+            if (request.hasRawHeader("Range"))
+            {
+                EXPECT_EQ(request.rawHeader("If-Range"), "\"old-etag\"");
+                ++ranged_requests;
+                EXPECT_CALL(*mock_reply, readData(_, _)).WillRepeatedly(Return(0));
+            }
+            else
+            {
+                EXPECT_CALL(*mock_reply, readData(_, _))
+                    .WillOnce([&new_data](char* data, auto) {
+                        memcpy(data, new_data.constData(), new_data.size());
+                        return new_data.size();
+                    })
+                    .WillRepeatedly(Return(0));
+            }
+
+            QTimer::singleShot(0, [mock_reply] {
+                mock_reply->readyRead();
+                mock_reply->finished();
+            });
+            return mock_reply;
+        });
+
+    auto progress_monitor = [](auto...) { return true; };
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+
+    mpt::TempDir file_dir;
+    QString download_file{file_dir.path() + "/foo.img"};
+
+    auto hash = downloader.download_to(fake_url, download_file, size, -1, progress_monitor);
+
+    QFile file{download_file};
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(file.readAll(), new_data);
+    EXPECT_EQ(hash, QCryptographicHash::hash(new_data, QCryptographicHash::Sha256).toHex());
+    EXPECT_GT(ranged_requests, 0);
+}
+
+TEST_F(URLDownloader, fileDownloadLargeFileWithoutValidatorUsesSingleStream)
+{
+    const QByteArray test_data{"This is some data to put in a file when downloaded."};
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::HeadOperation, _, _))
+        .WillOnce([](auto...) {
+            auto mock_reply = new mpt::MockQNetworkReply();
+            mock_reply->set_raw_header("Accept-Ranges", "bytes");
+            mock_reply->set_raw_header("ETag", "W/\"weak-etag\"");
+            mock_reply->set_header(QNetworkRequest::ContentLengthHeader, 64 * 1024 * 1024);
+            QTimer::singleShot(0, [mock_reply] { mock_reply->finished(); });
+            return mock_reply;
+        });
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::GetOperation, _, _))
+        .WillOnce([&test_data](auto, const QNetworkRequest& request, auto) {
+            EXPECT_FALSE(request.hasRawHeader("Range"));
+
+            auto mock_reply = new mpt::MockQNetworkReply();
+            EXPECT_CALL(*mock_reply, readData(_, _))
+                .WillOnce([&test_data](char* data, auto) {
+                    memcpy(data, test_data.constData(), test_data.size());
+                    return test_data.size();
+                })
+                .WillRepeatedly(Return(0));
+
+            QTimer::singleShot(0, [mock_reply] {
+                mock_reply->readyRead();
+                mock_reply->finished();
+            });
+            return mock_reply;
+        });
+
+    auto progress_monitor = [](auto...) { return true; };
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+
+    mpt::TempDir file_dir;
+    QString download_file{file_dir.path() + "/foo.img"};
+
+    downloader.download_to(fake_url, download_file, 64 * 1024 * 1024, -1, progress_monitor);
+
+    QFile file{download_file};
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(file.readAll(), test_data);
+}
+
+TEST_F(URLDownloader, fileDownloadLargeFileWithoutRangeSupportUsesSingleStream)
+{
+    const QByteArray test_data{"This is some data to put in a file when downloaded."};
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::HeadOperation, _, _))
+        .WillOnce([](auto...) {
+            auto mock_reply = new mpt::MockQNetworkReply();
+            mock_reply->set_header(QNetworkRequest::ContentLengthHeader, 64 * 1024 * 1024);
+            QTimer::singleShot(0, [mock_reply] { mock_reply->finished(); });
+            return mock_reply;
+        });
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::GetOperation, _, _))
+        .WillOnce([&test_data](auto, const QNetworkRequest& request, auto) {
+            EXPECT_FALSE(request.hasRawHeader("Range"));
+
+            auto mock_reply = new mpt::MockQNetworkReply();
+            EXPECT_CALL(*mock_reply, readData(_, _))
+                .WillOnce([&test_data](char* data, auto) {
+                    memcpy(data, test_data.constData(), test_data.size());
+                    return test_data.size();
+                })
+                .WillRepeatedly(Return(0));
+
+            QTimer::singleShot(0, [mock_reply] {
+                mock_reply->readyRead();
+                mock_reply->finished();
+            });
+            return mock_reply;
+        });
+
+    auto progress_monitor = [](auto...) { return true; };
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+
+    mpt::TempDir file_dir;
+    QString download_file{file_dir.path() + "/foo.img"};
+
+    downloader.download_to(fake_url, download_file, 64 * 1024 * 1024, -1, progress_monitor);
+
+    QFile file{download_file};
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(file.readAll(), test_data);
+}
+
+TEST_F(URLDownloader, fileDownloadWithBandwidthLimitKeepsToItInASingleStream)
+{
+    const QByteArray test_data(2000, 'x');
+    const auto chunk_size = test_data.size() / 2;
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::HeadOperation, _, _)).Times(0);
+    EXPECT_CALL(*mock_network_access_manager, createRequest(QNetworkAccessManager::GetOperation, _, _))
+        .WillOnce([&test_data, chunk_size](auto...) {
+            auto mock_reply = new mpt::MockQNetworkReply();
+            EXPECT_CALL(*mock_reply, readData(_, _))
+                .WillOnce([&test_data, chunk_size](char* data, auto) {
+                    memcpy(data, test_data.constData(), chunk_size);
+                    return chunk_size;
+                })
+                .WillOnce(Return(0))
+                .WillOnce([&test_data, chunk_size, mock_reply](char* data, auto) {
+                    memcpy(data, test_data.constData() + chunk_size, chunk_size);
+                    QTimer::singleShot(0, [mock_reply] { mock_reply->finished(); });
+                    return chunk_size;
+                })
+                .WillRepeatedly(Return(0));
+
+            QTimer::singleShot(0, [mock_reply] {
+                mock_reply->readyRead();
+                mock_reply->readyRead();
+            });
+            return mock_reply;
+        });
+
+    auto progress_monitor = [](auto...) { return true; };
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+    downloader.set_bandwidth_limit(10000);
+
+    mpt::TempDir file_dir;
+    QString download_file{file_dir.path() + "/foo.img"};
+
+    // Holding off reading must leave the event loop free
+    const auto start = std::chrono::steady_clock::now();
+    auto ticked = start;
+    QTimer::singleShot(10ms, [&ticked] { ticked = std::chrono::steady_clock::now(); });
+
+    downloader.download_to(fake_url, download_file, 64 * 1024 * 1024, -1, progress_monitor);
+
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 100ms);
+    EXPECT_GT(ticked, start);
+    EXPECT_LT(ticked - start, 100ms);
+
+    QFile file{download_file};
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(file.readAll(), test_data);
+}
+
+TEST_F(URLDownloader, fileDownloadDecodedDecodesXzAsItArrives)
+{
+    mpt::MockQNetworkReply* mock_reply = new mpt::MockQNetworkReply();
+    const QByteArray decoded_data{"This is some data to put in a file when downloaded."};
+    const QByteArray xz_data{
+        "\xfd\x37\x7a\x58\x5a\x00\x00\x01\x69\x22\xde\x36\x02\x00\x21\x01"
+        "\x16\x00\x00\x00\x74\x2f\xe5\xa3\x01\x00\x32\x54\x68\x69\x73\x20"
+        "\x69\x73\x20\x73\x6f\x6d\x65\x20\x64\x61\x74\x61\x20\x74\x6f\x20"
+        "\x70\x75\x74\x20\x69\x6e\x20\x61\x20\x66\x69\x6c\x65\x20\x77\x68"
+        "\x65\x6e\x20\x64\x6f\x77\x6e\x6c\x6f\x61\x64\x65\x64\x2e\x00\x00"
+        "\x97\xda\x7e\x19\x00\x01\x47\x33\xff\x0d\x6e\x20\x90\x42\x99\x0d"
+        "\x01\x00\x00\x00\x00\x01\x59\x5a",
+        104};
+    const auto first_chunk = 40;
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(_, _, _)).WillOnce([&mock_reply](auto...) {
+        QTimer::singleShot(0, [&mock_reply] {
+            mock_reply->readyRead();
+            mock_reply->readyRead();
+            mock_reply->finished();
+        });
+        return mock_reply;
+    });
+
+    EXPECT_CALL(*mock_reply, readData(_, _))
+        .WillOnce([&xz_data](char* data, auto) {
+            memcpy(data, xz_data.constData(), first_chunk);
+            return first_chunk;
+        })
+        .WillOnce(Return(0))
+        .WillOnce([&xz_data](char* data, auto) {
+            memcpy(data, xz_data.constData() + first_chunk, xz_data.size() - first_chunk);
+            return xz_data.size() - first_chunk;
+        })
+        .WillRepeatedly(Return(0));
+
+    auto progress_monitor = [](auto...) { return true; };
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+
+    mpt::TempDir file_dir;
+    QString decoded_file{file_dir.path() + "/foo.img"};
+
+    auto hash = downloader.download_decoded_to(fake_url, decoded_file, xz_data.size(), -1, progress_monitor);
+
+    EXPECT_EQ(hash, QCryptographicHash::hash(xz_data, QCryptographicHash::Sha256).toHex());
+
+    QFile file{decoded_file};
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(file.readAll(), decoded_data);
+}
+
+TEST_F(URLDownloader, fileDownloadDecodedTruncatedXzThrows)
+{
+    mpt::MockQNetworkReply* mock_reply = new mpt::MockQNetworkReply();
+    const QByteArray xz_data{"\xfd\x37\x7a\x58\x5a\x00\x00\x01\x69\x22\xde\x36", 12};
+
+    EXPECT_CALL(*mock_network_access_manager, createRequest(_, _, _)).WillOnce([&mock_reply](auto...) {
+        QTimer::singleShot(0, [&mock_reply] {
+            mock_reply->readyRead();
+            mock_reply->finished();
+        });
+        return mock_reply;
+    });
+
+    EXPECT_CALL(*mock_reply, readData(_, _))
+        .WillOnce([&xz_data](char* data, auto) {
+            memcpy(data, xz_data.constData(), xz_data.size());
+            return xz_data.size();
+        })
+        .WillRepeatedly(Return(0));
+
+    auto progress_monitor = [](auto...) { return true; };
+
+    mp::URLDownloader downloader(cache_dir.path(), 1s);
+
+    mpt::TempDir file_dir;
+    QString decoded_file{file_dir.path() + "/foo.img"};
+
+    MP_EXPECT_THROW_THAT(downloader.download_decoded_to(fake_url, decoded_file, -1, -1, progress_monitor),
+                         mp::DownloadException, mpt::match_what(HasSubstr("xz file is truncated")));
+
+    EXPECT_FALSE(QFile::exists(decoded_file));
+}
+
 TEST_F(URLDownloader, lastModifiedHeaderReturnsExpectedData)
 {
     const QDateTime date_time{QDateTime::currentDateTimeUtc()};
@@ -20,6 +20,7 @@
 #include "mock_file_ops.h"
 #include "mock_logger.h"
 #include "mock_openssl_syscalls.h"
+#include "mock_platform.h"
 #include "mock_ssh.h"
 #include "mock_ssh_process_exit_status.h"
 #include "mock_ssh_test_fixture.h"
@@ -28,6 +29,7 @@
 #include "temp_dir.h"
 #include "temp_file.h"
 
+#include <multipass/constants.h>
 #include <multipass/format.h>
 #include <multipass/utils.h>
 #include <multipass/vm_image_vault.h>
@@ -339,6 +341,27 @@ TEST(Utils, make_file_with_content_throws_on_write_error)
                          mpt::match_what(HasSubstr("failed to write to file")));
 }
 
+TEST(Utils, write_sparse_keeps_contents_and_trailing_zeros)
+{
+    mpt::TempDir temp_dir;
+    QFile file{QDir(temp_dir.path()).filePath("sparse")};
+    ASSERT_TRUE(file.open(QFile::WriteOnly));
+
+    QByteArray contents(3 * 4096, '\0');
+    contents.replace(10, 4, "data");
+    contents.replace(2 * 4096 + 1, 4, "more");
+
+    // Write in uneven pieces so that zero blocks straddle calls
+    EXPECT_TRUE(mp::utils::write_sparse(file, contents.constData(), 5000));
+    EXPECT_TRUE(mp::utils::write_sparse(file, contents.constData() + 5000, contents.size() - 5000));
+    EXPECT_TRUE(mp::utils::write_sparse(file, QByteArray(2 * 4096, '\0').constData(), 2 * 4096));
+    EXPECT_TRUE(mp::utils::finish_sparse(file));
+    file.close();
+
+    ASSERT_TRUE(file.open(QFile::ReadOnly));
+    EXPECT_EQ(file.readAll(), contents + QByteArray(2 * 4096, '\0'));
+}
+
 TEST(Utils, expectedScryptHashReturned)
 {
     const auto passphrase = MP_UTILS.generate_scrypt_hash_for("passphrase");
@@ -556,6 +579,19 @@ TEST(Utils, validate_server_address_does_not_throw_on_good_address)
     EXPECT_NO_THROW(mp::utils::validate_server_address("test-server.net:123"));
 }
 
+TEST(Utils, instance_names_file_is_next_to_unix_socket)
+{
+    EXPECT_EQ(mp::utils::unix_socket_path("unix:/tmp/a_socket"), "/tmp/a_socket");
+    EXPECT_EQ(mp::utils::instance_names_file_for("unix:/tmp/a_socket"),
+              QString{"/tmp/%1"}.arg(mp::instance_names_file));
+}
+
+TEST(Utils, no_instance_names_file_for_network_address)
+{
+    EXPECT_TRUE(mp::utils::unix_socket_path("test-server.net:123").isEmpty());
+    EXPECT_TRUE(mp::utils::instance_names_file_for("test-server.net:123").isEmpty());
+}
+
 TEST(Utils, dir_is_a_dir)
 {
     mpt::TempDir temp_dir;
@@ -752,6 +788,39 @@ TEST(VaultUtils, copy_creates_new_file_and_returned_path_exists)
     EXPECT_TRUE(QFile::exists(new_file_path));
 }
 
+TEST(VaultUtils, copy_keeps_contents_of_file_with_zero_blocks)
+{
+    mpt::TempDir temp_dir1, temp_dir2;
+    auto orig_file_path = QDir(temp_dir1.path()).filePath("test_file");
+
+    QByteArray contents(3 * 1024 * 1024, '\0');
+    contents.replace(1024 * 1024 + 7, 9, "not zeros");
+    {
+        QFile orig_file{orig_file_path};
+        ASSERT_TRUE(orig_file.open(QFile::WriteOnly));
+        ASSERT_EQ(orig_file.write(contents), contents.size());
+    }
+
+    QFile new_file{mp::vault::copy(orig_file_path, temp_dir2.path())};
+
+    ASSERT_TRUE(new_file.open(QFile::ReadOnly));
+    EXPECT_EQ(new_file.readAll(), contents);
+}
+
+TEST(VaultUtils, copy_falls_back_to_buffered_copy_when_kernel_copy_fails)
+{
+    mpt::TempDir temp_dir1, temp_dir2;
+    auto orig_file_path = QDir(temp_dir1.path()).filePath("test_file");
+    mpt::make_file_with_content(orig_file_path, file_contents);
+
+    auto [mock_platform, guard] = mpt::MockPlatform::inject();
+    EXPECT_CALL(*mock_platform, copy_file_data(_, _)).WillOnce(Return(false));
+
+    QFile new_file{mp::vault::copy(orig_file_path, temp_dir2.path())};
+
+    check_file_contents(new_file, file_contents);
+}
+
 TEST(VaultUtils, copy_returns_empty_path_when_file_name_is_empty)
 {
     mpt::TempDir temp_dir;
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "temp_dir.h"
+
+#include <src/daemon/warm_pool.h>
+
+#include <QDir>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace testing;
+
+namespace
+{
+struct WarmPool : public Test
+{
+    mp::WarmPool make_pool(const QString& spec, const std::string& budget = "4G")
+    {
+        return {mp::WarmPool::parse_profiles(spec), mp::MemorySize{budget}, db_path};
+    }
+
+    mpt::TempDir data_dir;
+    QString db_path{QDir{data_dir.path()}.filePath("warm-pool.json")};
+};
+
+TEST_F(WarmPool, parsesProfilesWithLaunchDefaults)
+{
+    const auto profiles = mp::WarmPool::parse_profiles("22.04/2/4G/20G=3, release:lts=1");
+
+    ASSERT_EQ(profiles.size(), 2u);
+    EXPECT_EQ(profiles[0].image, "22.04");
+    EXPECT_EQ(profiles[0].num_cores, 2);
+    EXPECT_EQ(profiles[0].mem_size, mp::MemorySize{"4G"});
+    EXPECT_EQ(profiles[0].disk_space, mp::MemorySize{"20G"});
+    EXPECT_EQ(profiles[0].size, 3);
+
+    EXPECT_EQ(profiles[1].image, "release:lts");
+    EXPECT_EQ(profiles[1].num_cores, 1);
+    EXPECT_EQ(profiles[1].mem_size, mp::MemorySize{"1G"});
+    EXPECT_EQ(profiles[1].disk_space, std::nullopt);
+    EXPECT_EQ(profiles[1].size, 1);
+}
+
+TEST_F(WarmPool, rejectsInvalidProfiles)
+{
+    for (const auto spec : {"22.04", "22.04=many", "=2", "22.04/0=1", "22.04/2/lots=1", "22.04/2/1G/5G/x=1",
+                            "lts=1,lts/1/1G=2"})
+        EXPECT_THROW(mp::WarmPool::parse_profiles(spec), std::runtime_error) << spec;
+
+    EXPECT_TRUE(mp::WarmPool::parse_profiles("").empty());
+}
+
+TEST_F(WarmPool, matchesLaunchesWithTheSameParameters)
+{
+    const auto pool = make_pool("default=1,22.04/2/2G/10G=1");
+
+    EXPECT_NE(pool.profile_for("default", 0, mp::MemorySize{"1G"}, std::nullopt), nullptr);
+    EXPECT_NE(pool.profile_for("22.04", 2, mp::MemorySize{"2048M"}, mp::MemorySize{"10G"}), nullptr);
+    EXPECT_EQ(pool.profile_for("22.04", 2, mp::MemorySize{"2G"}, std::nullopt), nullptr);
+    EXPECT_EQ(pool.profile_for("default", 2, mp::MemorySize{"1G"}, std::nullopt), nullptr);
+}
+
+TEST_F(WarmPool, refillsUntilProfilesAreFull)
+{
+    auto pool = make_pool("default=2");
+
+    ASSERT_NE(pool.next_to_refill(), nullptr);
+    pool.add(*pool.next_to_refill(), "first");
+    ASSERT_NE(pool.next_to_refill(), nullptr);
+    pool.add(*pool.next_to_refill(), "second");
+    EXPECT_EQ(pool.next_to_refill(), nullptr);
+
+    pool.remove("first");
+    EXPECT_NE(pool.next_to_refill(), nullptr);
+}
+
+TEST_F(WarmPool, refillsWithinMemoryBudget)
+{
+    auto pool = make_pool("big/1/3G=1,default=3", "4G");
+
+    const auto big = pool.next_to_refill();
+    ASSERT_NE(big, nullptr);
+    EXPECT_EQ(big->image, "big");
+    pool.add(*big, "big-one");
+
+    const auto small = pool.next_to_refill();
+    ASSERT_NE(small, nullptr);
+    EXPECT_EQ(small->image, "default");
+    pool.add(*small, "small-one");
+
+    EXPECT_EQ(pool.next_to_refill(), nullptr);
+}
+
+TEST_F(WarmPool, remembersInstancesAcrossRestarts)
+{
+    {
+        auto pool = make_pool("default=1,22.04=1");
+        pool.add(*pool.profile_for("default", 1, mp::MemorySize{"1G"}, std::nullopt), "kept");
+        pool.add(*pool.profile_for("22.04", 1, mp::MemorySize{"1G"}, std::nullopt), "stray");
+    }
+
+    const auto pool = make_pool("default=1");
+
+    EXPECT_TRUE(pool.contains("kept"));
+    EXPECT_TRUE(pool.contains("stray"));
+    EXPECT_THAT(pool.instances_of(*pool.profile_for("default", 1, mp::MemorySize{"1G"}, std::nullopt)),
+                ElementsAre("kept"));
+    EXPECT_THAT(pool.stray_instances(), ElementsAre("stray"));
+}
+} // namespace
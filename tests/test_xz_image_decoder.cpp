@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "common.h"
+#include "fake_xz_data.h"
+#include "temp_dir.h"
+
+#include <multipass/xz_image_decoder.h>
+
+#include <QCryptographicHash>
+#include <QFile>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace testing;
+
+namespace
+{
+struct XzImageDecoder : public TestWithParam<int>
+{
+    XzImageDecoder()
+    {
+        write_xz_file(mpt::multi_block_xz);
+    }
+
+    void write_xz_file(const QByteArray& contents)
+    {
+        QFile xz_file{xz_path};
+        xz_file.open(QIODevice::WriteOnly);
+        xz_file.write(contents);
+    }
+
+    QByteArray decoded_file_contents()
+    {
+        QFile decoded_file{decoded_path};
+        decoded_file.open(QIODevice::ReadOnly);
+        return decoded_file.readAll();
+    }
+
+    mpt::TempDir temp_dir;
+    QString xz_path{temp_dir.path() + "/image.img.xz"};
+    QString decoded_path{temp_dir.path() + "/image.img"};
+    mp::ProgressMonitor monitor{[](auto...) { return true; }};
+};
+
+TEST_P(XzImageDecoder, decodesMultiBlockFile)
+{
+    const auto hash = mp::XzImageDecoder{xz_path, GetParam()}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded_file_contents(), mpt::multi_block_decoded_data);
+    EXPECT_EQ(hash, QCryptographicHash::hash(mpt::multi_block_decoded_data, QCryptographicHash::Sha256).toHex());
+}
+
+TEST_P(XzImageDecoder, throwsOnCorruptBlock)
+{
+    auto corrupt_xz = mpt::multi_block_xz;
+    corrupt_xz[60] = corrupt_xz[60] ^ 0x20; // inside the second block's data
+    write_xz_file(corrupt_xz);
+
+    EXPECT_THROW(mp::XzImageDecoder(xz_path, GetParam()).decode_to(decoded_path, monitor), std::runtime_error);
+}
+
+INSTANTIATE_TEST_SUITE_P(XzImageDecoder, XzImageDecoder, Values(1, 3)); // streamed and concurrent
+
+TEST(XzStreamDecoder, throwsOnTruncatedStream)
+{
+    mpt::TempDir temp_dir;
+    mp::XzStreamDecoder decoder{temp_dir.path() + "/image.img"};
+
+    decoder.feed(mpt::multi_block_xz.constData(), mpt::multi_block_xz.size() / 2);
+
+    EXPECT_THROW(decoder.finish(), std::runtime_error);
+}
+} // namespace
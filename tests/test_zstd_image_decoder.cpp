@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "temp_dir.h"
+
+#include <multipass/zstd_image_decoder.h>
+
+#include <QCryptographicHash>
+#include <QFile>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace testing;
+
+namespace
+{
+const QByteArray decoded_data{"This is some data to put in a file when decoded in blocks."};
+
+// decoded_data in a zstd frame holding one raw block
+const QByteArray raw_frame = QByteArray{"\x28\xb5\x2f\xfd\x20\x3a\xd1\x01\x00", 9} + decoded_data;
+
+// 8 KiB of zeros in a zstd frame holding one RLE block
+const QByteArray zeros_frame{"\x28\xb5\x2f\xfd\x60\x00\x1f\x03\x00\x01\x00", 11};
+
+struct ZstdImageDecoder : public Test
+{
+    void write_zstd_file(const QByteArray& contents)
+    {
+        QFile zstd_file{zstd_path};
+        zstd_file.open(QIODevice::WriteOnly);
+        zstd_file.write(contents);
+    }
+
+    QByteArray decoded_file_contents()
+    {
+        QFile decoded_file{decoded_path};
+        decoded_file.open(QIODevice::ReadOnly);
+        return decoded_file.readAll();
+    }
+
+    mpt::TempDir temp_dir;
+    QString zstd_path{temp_dir.path() + "/image.img.zst"};
+    QString decoded_path{temp_dir.path() + "/image.img"};
+    mp::ProgressMonitor monitor{[](auto...) { return true; }};
+};
+
+TEST_F(ZstdImageDecoder, decodesFile)
+{
+    write_zstd_file(raw_frame);
+
+    const auto hash = mp::ZstdImageDecoder{zstd_path}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded_file_contents(), decoded_data);
+    EXPECT_EQ(hash, QCryptographicHash::hash(decoded_data, QCryptographicHash::Sha256).toHex());
+}
+
+TEST_F(ZstdImageDecoder, decodesConcatenatedFrames)
+{
+    write_zstd_file(zeros_frame + raw_frame);
+
+    const auto expected = QByteArray(8192, '\0') + decoded_data;
+    const auto hash = mp::ZstdImageDecoder{zstd_path}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded_file_contents(), expected);
+    EXPECT_EQ(hash, QCryptographicHash::hash(expected, QCryptographicHash::Sha256).toHex());
+}
+
+TEST_F(ZstdImageDecoder, keepsTrailingZeros)
+{
+    write_zstd_file(raw_frame + zeros_frame);
+
+    mp::ZstdImageDecoder{zstd_path}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded_file_contents(), decoded_data + QByteArray(8192, '\0'));
+}
+
+TEST_F(ZstdImageDecoder, throwsOnBadData)
+{
+    write_zstd_file(QByteArray{"not zstd data at all"});
+
+    EXPECT_THROW(mp::ZstdImageDecoder{zstd_path}.decode_to(decoded_path, monitor), std::runtime_error);
+}
+
+TEST(ZstdStreamDecoder, decodesDataFedInPieces)
+{
+    mpt::TempDir temp_dir;
+    const auto decoded_path = temp_dir.path() + "/image.img";
+    mp::ZstdStreamDecoder decoder{decoded_path};
+
+    for (auto i = 0; i < raw_frame.size(); i += 5)
+        decoder.feed(raw_frame.constData() + i, std::min(5, raw_frame.size() - i));
+
+    EXPECT_EQ(decoder.finish(), QCryptographicHash::hash(decoded_data, QCryptographicHash::Sha256).toHex());
+}
+
+TEST(ZstdStreamDecoder, throwsOnTruncatedStream)
+{
+    mpt::TempDir temp_dir;
+    mp::ZstdStreamDecoder decoder{temp_dir.path() + "/image.img"};
+
+    decoder.feed(raw_frame.constData(), raw_frame.size() / 2);
+
+    EXPECT_THROW(decoder.finish(), std::runtime_error);
+}
+} // namespace
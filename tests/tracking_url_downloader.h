@@ -22,6 +22,8 @@
 
 #include <multipass/url_downloader.h>
 
+#include <mutex>
+
 namespace multipass
 {
 namespace test
@@ -36,12 +38,15 @@ struct TrackingURLDownloader : public URLDownloader
     {
     }
 
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const ProgressMonitor&) override
+    QString download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                        const ProgressMonitor&) override
     {
         make_file_with_content(file_name, content);
+
+        std::lock_guard<std::mutex> lock{mutex}; // the vault fetches some files side by side
         downloaded_urls << url.toString();
         downloaded_files << file_name;
+        return {};
     }
 
     QByteArray download(const QUrl& url) override
@@ -57,6 +62,7 @@ struct TrackingURLDownloader : public URLDownloader
     const std::string content;
     QStringList downloaded_files;
     QStringList downloaded_urls;
+    std::mutex mutex;
 };
 } // namespace test
 } // namespace multipass
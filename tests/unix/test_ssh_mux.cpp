@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <tests/common.h>
+#include <tests/mock_standard_paths.h>
+#include <tests/temp_dir.h>
+
+#include <multipass/exceptions/ssh_exception.h>
+#include <multipass/ssh/ssh_mux.h>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <array>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+namespace mux = multipass::ssh_mux;
+
+using namespace testing;
+
+namespace
+{
+// Stands in for the agent: takes one client, checks its request and answers with the given frames
+struct SSHMuxExec : public Test
+{
+    SSHMuxExec()
+    {
+        EXPECT_CALL(mpt::MockStandardPaths::mock_instance(), writableLocation(mp::StandardPaths::RuntimeLocation))
+            .WillRepeatedly(Return(temp_dir.path()));
+
+        const auto path = mux::socket_path().toStdString();
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::copy(path.cbegin(), path.cend(), address.sun_path);
+
+        listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        EXPECT_EQ(::bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+        EXPECT_EQ(::listen(listen_fd, 1), 0);
+    }
+
+    ~SSHMuxExec() override
+    {
+        if (agent.joinable())
+            agent.join();
+        ::close(listen_fd);
+    }
+
+    void answer_with(std::vector<std::pair<mux::FrameType, std::string>> answer)
+    {
+        agent = std::thread{[this, answer = std::move(answer)] {
+            auto fd = ::accept(listen_fd, nullptr, nullptr);
+
+            mux::FrameReader reader;
+            std::array<char, 4096> buffer;
+            std::optional<mux::Frame> frame;
+            while (!frame)
+            {
+                auto bytes_read = ::read(fd, buffer.data(), buffer.size());
+                if (bytes_read <= 0)
+                    break;
+
+                reader.feed(buffer.data(), bytes_read);
+                frame = reader.next();
+            }
+
+            if (frame)
+                request = QJsonDocument::fromJson(QByteArray::fromStdString(frame->payload)).object();
+
+            for (const auto& [type, payload] : answer)
+                mux::write_frame(fd, type, payload);
+
+            ::close(fd);
+        }};
+    }
+
+    std::optional<int> exec()
+    {
+        auto ret = mux::exec({"instance", 22, "ubuntu", "key", "aes256-ctr"}, "ls -l", std::chrono::seconds(1));
+        agent.join();
+        return ret;
+    }
+
+    mpt::TempDir temp_dir;
+    int listen_fd;
+    std::thread agent;
+    QJsonObject request;
+};
+} // namespace
+
+TEST(SSHMux, encodedFrameHasTypeLengthAndPayload)
+{
+    const auto frame = mux::encode_frame(mux::FrameType::stdout_data, "hello");
+
+    EXPECT_EQ(frame, std::string("\x04\x00\x00\x00\x05hello", 10));
+}
+
+TEST(SSHMux, readerDecodesEncodedFrames)
+{
+    mux::FrameReader reader;
+    const auto bytes = mux::encode_frame(mux::FrameType::request, R"({"command":"ls"})") +
+                       mux::encode_frame(mux::FrameType::stdin_eof, {});
+
+    reader.feed(bytes.data(), bytes.size());
+
+    auto first = reader.next();
+    ASSERT_TRUE(first);
+    EXPECT_EQ(first->type, mux::FrameType::request);
+    EXPECT_EQ(first->payload, R"({"command":"ls"})");
+
+    auto second = reader.next();
+    ASSERT_TRUE(second);
+    EXPECT_EQ(second->type, mux::FrameType::stdin_eof);
+    EXPECT_TRUE(second->payload.empty());
+
+    EXPECT_FALSE(reader.next());
+}
+
+TEST(SSHMux, readerWaitsForCompleteFrames)
+{
+    mux::FrameReader reader;
+    const auto bytes = mux::encode_frame(mux::FrameType::exit_status, "42");
+
+    for (auto i = 0u; i < bytes.size() - 1; ++i)
+    {
+        reader.feed(&bytes[i], 1);
+        EXPECT_FALSE(reader.next());
+    }
+
+    reader.feed(&bytes.back(), 1);
+
+    auto frame = reader.next();
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->type, mux::FrameType::exit_status);
+    EXPECT_EQ(frame->payload, "42");
+}
+
+TEST(SSHMux, readerRejectsUnknownFrameType)
+{
+    mux::FrameReader reader;
+    const std::string bytes("\x7f\x00\x00\x00\x00", 5);
+
+    reader.feed(bytes.data(), bytes.size());
+
+    EXPECT_THROW(reader.next(), std::runtime_error);
+}
+
+TEST(SSHMux, readerRejectsOversizedFrame)
+{
+    mux::FrameReader reader;
+    const std::string bytes("\x04\xff\xff\xff\xff", 5);
+
+    reader.feed(bytes.data(), bytes.size());
+
+    EXPECT_THROW(reader.next(), std::runtime_error);
+}
+
+TEST_F(SSHMuxExec, returnsRemoteExitStatus)
+{
+    answer_with({{mux::FrameType::started, {}}, {mux::FrameType::exit_status, "7"}});
+
+    EXPECT_EQ(exec(), 7);
+    EXPECT_EQ(request["host"].toString(), "instance");
+    EXPECT_EQ(request["command"].toString(), "ls -l");
+    EXPECT_EQ(request["ciphers"].toString(), "aes256-ctr");
+}
+
+TEST_F(SSHMuxExec, fallsBackWhenAgentRefuses)
+{
+    answer_with({{mux::FrameType::refused, "cannot connect"}});
+
+    EXPECT_EQ(exec(), std::nullopt);
+}
+
+TEST_F(SSHMuxExec, fallsBackWhenAgentHangsUpBeforeStarting)
+{
+    answer_with({});
+
+    EXPECT_EQ(exec(), std::nullopt);
+}
+
+TEST_F(SSHMuxExec, throwsOnErrorOnceStarted)
+{
+    answer_with({{mux::FrameType::started, {}}, {mux::FrameType::error, "channel broke"}});
+
+    EXPECT_THROW(exec(), mp::SSHException);
+}
+
+TEST_F(SSHMuxExec, throwsWhenAgentHangsUpOnceStarted)
+{
+    answer_with({{mux::FrameType::started, {}}});
+
+    EXPECT_THROW(exec(), mp::SSHException);
+}
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <tests/common.h>
+#include <tests/fake_key_data.h>
+#include <tests/mock_ssh_test_fixture.h>
+#include <tests/temp_dir.h>
+
+#include <src/ssh/ssh_mux_agent.h>
+
+#include <multipass/ssh/ssh_mux.h>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <array>
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+namespace mux = multipass::ssh_mux;
+
+using namespace testing;
+
+namespace
+{
+struct SSHMuxAgent : public Test
+{
+    SSHMuxAgent()
+    {
+        close_channel.returnValue(SSH_OK);
+        read_nonblocking.returnValue(0);
+    }
+
+    ~SSHMuxAgent() override
+    {
+        for (auto fd : clients)
+            ::close(fd);
+    }
+
+    // Clients connect before the agent runs, so that an agent without idle time does not exit before serving them
+    int connect_client(const std::string& host, const std::string& command = "ls")
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::copy(socket_path.cbegin(), socket_path.cend(), address.sun_path);
+
+        auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        EXPECT_EQ(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+
+        const timeval receive_timeout{5, 0}; // fail rather than hang if the agent never answers
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout));
+        clients.push_back(fd);
+
+        QJsonObject request{{"host", QString::fromStdString(host)},
+                            {"port", 22},
+                            {"username", "ubuntu"},
+                            {"key", mpt::fake_key_data},
+                            {"command", QString::fromStdString(command)}};
+        mux::write_frame(fd, mux::FrameType::request, QJsonDocument{request}.toJson().toStdString());
+
+        return fd;
+    }
+
+    // Reads frames until one that ends the conversation, or until the agent hangs up
+    std::vector<mux::Frame> read_frames(int fd, mux::FrameType until = mux::FrameType::exit_status)
+    {
+        std::vector<mux::Frame> frames;
+        mux::FrameReader reader;
+        std::array<char, 4096> buffer;
+
+        while (true)
+        {
+            auto bytes_read = ::read(fd, buffer.data(), buffer.size());
+            if (bytes_read <= 0)
+                return frames;
+
+            reader.feed(buffer.data(), bytes_read);
+            while (auto frame = reader.next())
+            {
+                frames.push_back(*frame);
+                if (frame->type == until || frame->type == mux::FrameType::error ||
+                    frame->type == mux::FrameType::refused)
+                    return frames;
+            }
+        }
+    }
+
+    mpt::TempDir temp_dir;
+    const std::string socket_path = temp_dir.filePath("mux.sock").toStdString();
+    mpt::MockSSHTestFixture mock_ssh_test_fixture;
+    decltype(MOCK(ssh_channel_close)) close_channel{MOCK(ssh_channel_close)};
+    decltype(MOCK(ssh_channel_read_nonblocking)) read_nonblocking{MOCK(ssh_channel_read_nonblocking)};
+    std::vector<int> clients;
+};
+
+MATCHER_P2(IsFrame, type, payload, "")
+{
+    return arg.type == type && arg.payload == payload;
+}
+} // namespace
+
+TEST_F(SSHMuxAgent, runsCommandAndForwardsItsOutputAndExitStatus)
+{
+    auto output_sent = false;
+    REPLACE(ssh_channel_read_nonblocking, [&output_sent](auto, void* dest, auto, int is_stderr) {
+        if (is_stderr || output_sent)
+            return 0;
+
+        output_sent = true;
+        std::copy_n("hi", 2, static_cast<char*>(dest));
+        return 2;
+    });
+    REPLACE(ssh_channel_get_exit_status, [](auto) { return 42; });
+
+    mp::SSHMuxAgent agent{socket_path, std::chrono::seconds::zero()};
+    auto fd = connect_client("instance");
+    agent.run();
+
+    EXPECT_THAT(read_frames(fd), ElementsAre(IsFrame(mux::FrameType::started, ""),
+                                             IsFrame(mux::FrameType::stdout_data, "hi"),
+                                             IsFrame(mux::FrameType::exit_status, "42")));
+}
+
+TEST_F(SSHMuxAgent, refusesWhenItCannotConnect)
+{
+    REPLACE(ssh_connect, [](auto) { return SSH_ERROR; });
+
+    mp::SSHMuxAgent agent{socket_path, std::chrono::seconds::zero()};
+    auto fd = connect_client("instance");
+    agent.run();
+
+    const auto frames = read_frames(fd);
+    ASSERT_THAT(frames, SizeIs(1));
+    EXPECT_EQ(frames.front().type, mux::FrameType::refused);
+}
+
+TEST_F(SSHMuxAgent, reusesSessionForTheSameInstance)
+{
+    auto connections = 0;
+    REPLACE(ssh_connect, [&connections](auto) {
+        ++connections;
+        return SSH_OK;
+    });
+
+    mp::SSHMuxAgent agent{socket_path, std::chrono::seconds::zero()};
+    auto first = connect_client("instance");
+    auto second = connect_client("instance");
+    agent.run();
+
+    EXPECT_THAT(read_frames(first), Contains(IsFrame(mux::FrameType::exit_status, "0")));
+    EXPECT_THAT(read_frames(second), Contains(IsFrame(mux::FrameType::exit_status, "0")));
+    EXPECT_EQ(connections, 1);
+}
+
+TEST_F(SSHMuxAgent, slowConnectionDoesNotHoldUpOtherConversations)
+{
+    std::promise<void> slow_connection_started, release_slow_connection;
+    auto released = release_slow_connection.get_future().share();
+    std::atomic_int connections{0};
+    REPLACE(ssh_connect, [&](auto) {
+        if (connections++ == 0)
+        {
+            slow_connection_started.set_value();
+            released.wait();
+        }
+        return SSH_OK;
+    });
+
+    mp::SSHMuxAgent agent{socket_path, std::chrono::seconds::zero()};
+    auto slow = connect_client("slow-instance");
+    std::thread agent_thread{[&agent] { agent.run(); }};
+
+    slow_connection_started.get_future().wait();
+    auto fast = connect_client("fast-instance");
+    const auto fast_frames = read_frames(fast);
+
+    release_slow_connection.set_value();
+    const auto slow_frames = read_frames(slow);
+    agent_thread.join();
+
+    EXPECT_THAT(fast_frames, Contains(IsFrame(mux::FrameType::exit_status, "0")));
+    EXPECT_THAT(slow_frames, Contains(IsFrame(mux::FrameType::exit_status, "0")));
+}
+
+TEST_F(SSHMuxAgent, passesStdinOnAsTheRemoteWindowAllows)
+{
+    constexpr auto window = 3u;
+    std::string written;
+    std::atomic_bool eof_sent{false};
+    std::vector<std::size_t> write_sizes;
+
+    REPLACE(ssh_channel_window_size, [](auto) { return window; });
+    REPLACE(ssh_channel_write, [&](auto, const void* data, auto size) {
+        write_sizes.push_back(size);
+        written.append(static_cast<const char*>(data), size);
+        return static_cast<int>(size);
+    });
+    REPLACE(ssh_channel_send_eof, [&eof_sent](auto) {
+        eof_sent = true;
+        return SSH_OK;
+    });
+    REPLACE(ssh_channel_is_eof, [&eof_sent](auto) { return eof_sent.load(); });
+
+    mp::SSHMuxAgent agent{socket_path, std::chrono::seconds::zero()};
+    auto fd = connect_client("instance", "cat");
+    std::thread agent_thread{[&agent] { agent.run(); }};
+
+    const auto started = read_frames(fd, mux::FrameType::started);
+    mux::write_frame(fd, mux::FrameType::stdin_data, "hello");
+    mux::write_frame(fd, mux::FrameType::stdin_eof, {});
+    const auto frames = read_frames(fd);
+    agent_thread.join();
+
+    EXPECT_THAT(started, ElementsAre(IsFrame(mux::FrameType::started, "")));
+    EXPECT_THAT(frames, ElementsAre(IsFrame(mux::FrameType::exit_status, "0")));
+    EXPECT_EQ(written, "hello");
+    EXPECT_THAT(write_sizes, Each(Le(window)));
+    EXPECT_TRUE(eof_sent);
+}
+
+TEST_F(SSHMuxAgent, dropsConversationWhenClientGoesAway)
+{
+    auto closed = 0;
+    REPLACE(ssh_channel_is_eof, [](auto) { return false; });
+    REPLACE(ssh_channel_close, [&closed](auto) {
+        ++closed;
+        return SSH_OK;
+    });
+
+    mp::SSHMuxAgent agent{socket_path, std::chrono::seconds::zero()};
+    auto fd = connect_client("instance");
+    std::thread agent_thread{[&agent] { agent.run(); }};
+
+    read_frames(fd, mux::FrameType::started);
+    ::shutdown(fd, SHUT_RDWR);
+    agent_thread.join();
+
+    EXPECT_EQ(closed, 1);
+}
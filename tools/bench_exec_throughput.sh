@@ -0,0 +1,103 @@
+#!/bin/sh
+#
+# Copyright (C) Canonical, Ltd.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 3 as
+# published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Measures how fast the `multipass exec` data path (SSHClient) pipes data through SSH, against a throwaway sshd on
+# the loopback interface, so that neither the network nor an instance gets in the way. Needs OpenSSH's sshd and
+# ssh-keygen, and the bench_ssh_exec target, which is not built by default:
+#
+#   cmake --build <build dir> --target bench_ssh_exec
+#
+# Usage: bench_exec_throughput.sh <build dir>/bin/bench_ssh_exec [size in MiB, default 2048] [port, default 2222]
+#                                  [ciphers]
+#
+# Without a cipher list, compares the AES-GCM-first list the daemon uses on CPUs with AES instructions against the
+# ChaCha20-first one it uses elsewhere (see the local.ssh.ciphers setting).
+
+set -eu
+
+BENCH_SSH_EXEC="${1:?usage: $0 <bench_ssh_exec> [size-MiB] [port] [ciphers]}"
+SIZE_MIB="${2:-2048}"
+PORT="${3:-2222}"
+CIPHER_LISTS="${4:-aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,aes256-ctr \
+chacha20-poly1305@openssh.com,aes256-ctr}"
+SSHD="$(command -v sshd || echo /usr/sbin/sshd)"
+
+WORK_DIR="$(mktemp -d)"
+SSHD_PID=""
+cleanup() {
+  if [ -n "${SSHD_PID}" ]; then
+    kill "${SSHD_PID}" 2>/dev/null || true
+  fi
+  rm -rf "${WORK_DIR}"
+}
+trap cleanup EXIT
+
+ssh-keygen -q -t ed25519 -N "" -f "${WORK_DIR}/host_key"
+ssh-keygen -q -t rsa -m PEM -N "" -f "${WORK_DIR}/client_key"
+cp "${WORK_DIR}/client_key.pub" "${WORK_DIR}/authorized_keys"
+
+cat > "${WORK_DIR}/sshd_config" <<CONFIG
+ListenAddress 127.0.0.1
+Port ${PORT}
+HostKey ${WORK_DIR}/host_key
+AuthorizedKeysFile ${WORK_DIR}/authorized_keys
+PidFile ${WORK_DIR}/sshd.pid
+StrictModes no
+UsePAM no
+CONFIG
+
+"${SSHD}" -D -e -f "${WORK_DIR}/sshd_config" 2>"${WORK_DIR}/sshd.log" &
+SSHD_PID=$!
+
+bench() {
+  # $1: command, $2: cipher list, empty for the default
+  "${BENCH_SSH_EXEC}" 127.0.0.1 "${PORT}" "$(id -un)" "${WORK_DIR}/client_key" "$1" ${2:+"$2"}
+}
+
+now() {
+  date +%s.%N
+}
+
+report() {
+  # $1: direction, $2: start, $3: end
+  echo "$1 $2 $3" | awk -v size="${SIZE_MIB}" '{
+    secs = $3 - $2
+    printf "%-8s %8d MiB in %7.2f s: %8.1f MiB/s\n", $1, size, secs, size / secs
+  }'
+}
+
+# Wait for sshd to take connections, which also warms up the client
+tries=0
+until bench true 2>/dev/null; do
+  tries=$((tries + 1))
+  if [ "${tries}" -ge 50 ]; then
+    cat "${WORK_DIR}/sshd.log" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+for ciphers in ${CIPHER_LISTS}; do
+  echo "${ciphers}"
+
+  start=$(now)
+  head -c "$((SIZE_MIB * 1024 * 1024))" /dev/zero | bench 'cat > /dev/null' "${ciphers}"
+  report upload "${start}" "$(now)"
+
+  start=$(now)
+  bench "head -c $((SIZE_MIB * 1024 * 1024)) /dev/zero" "${ciphers}" > /dev/null
+  report download "${start}" "$(now)"
+done
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Runs a command over SSH through SSHClient, the same data path `multipass exec` uses, with stdin, stdout and stderr
+ * passed through. Meant for bench_exec_throughput.sh, which points it at a loopback SSH server. Built by the
+ * bench_ssh_exec target.
+ *
+ * Usage: bench_ssh_exec <host> <port> <user> <private key file> <command> [ciphers]
+ *
+ * Without a cipher list, the session picks the same one the daemon would on this CPU.
+ */
+
+#include <ssh/ssh_client_key_provider.h>
+
+#include <multipass/console.h>
+#include <multipass/ssh/ssh_client.h>
+#include <multipass/ssh/ssh_session.h>
+#include <multipass/terminal.h>
+
+#include <QFile>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mp = multipass;
+
+int main(int argc, char* argv[])
+{
+    if (argc != 6 && argc != 7)
+    {
+        std::fprintf(stderr, "usage: %s <host> <port> <user> <private key file> <command> [ciphers]\n", argv[0]);
+        return 2;
+    }
+
+    QFile key_file{QString::fromLocal8Bit(argv[4])};
+    if (!key_file.open(QIODevice::ReadOnly))
+    {
+        std::fprintf(stderr, "cannot read %s\n", argv[4]);
+        return 2;
+    }
+
+    try
+    {
+        auto term = mp::Terminal::make_terminal();
+        auto session = std::make_unique<mp::SSHSession>(argv[1],
+                                                         std::atoi(argv[2]),
+                                                         argv[3],
+                                                         mp::SSHClientKeyProvider{key_file.readAll().toStdString()},
+                                                         std::chrono::seconds(20),
+                                                         argc == 7 ? argv[6] : "");
+        mp::SSHClient client{std::move(session),
+                             [&term](auto channel) { return mp::Console::make_console(channel, term.get()); }};
+
+        return client.exec(std::vector<std::string>{"sh", "-c", argv[5]});
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Measures how fast XzImageDecoder decodes a file, on one thread and on all of them, and how fast XzStreamDecoder does
+ * when fed the file in network-sized chunks, as it is while an image downloads.
+ *
+ * Usage: bench_xz_decode <file.xz> [output path, default: alongside the input]
+ *
+ * Only files with several blocks (e.g. made with `xz -T0`) can be decoded on more than one thread. Decoding while
+ * downloading only pays off when the link is slower than the streamed rate; otherwise the vault is better off waiting
+ * for the whole file and decoding it on all threads.
+ */
+
+#include <multipass/xz_image_decoder.h>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+
+namespace mp = multipass;
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "usage: %s <file.xz> [output]\n", argv[0]);
+        return 2;
+    }
+
+    const auto input = QString::fromLocal8Bit(argv[1]);
+    const auto output = argc > 2 ? QString::fromLocal8Bit(argv[2]) : input + ".bench-out";
+
+    try
+    {
+        for (auto threads : {1, QThread::idealThreadCount()})
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            const auto hash = mp::XzImageDecoder{input, threads}.decode_to(output, [](auto...) { return true; });
+
+            const auto seconds = timer.nsecsElapsed() / 1e9;
+            const auto mib = QFileInfo{output}.size() / (1024.0 * 1024.0);
+            std::printf("%2d thread(s): %.1f MiB in %.2f s, %.1f MiB/s (sha256 %s)\n", threads, mib, seconds,
+                        mib / seconds, qPrintable(hash));
+
+            QFile::remove(output);
+        }
+
+        QFile xz_file{input};
+        if (!xz_file.open(QIODevice::ReadOnly))
+            throw std::runtime_error{"cannot open " + input.toStdString()};
+
+        QElapsedTimer timer;
+        timer.start();
+
+        mp::XzStreamDecoder decoder{output};
+        std::vector<char> chunk(64 * 1024); // about what a network reply hands over at a time
+        qint64 bytes_read;
+        while ((bytes_read = xz_file.read(chunk.data(), chunk.size())) > 0)
+            decoder.feed(chunk.data(), bytes_read);
+        const auto hash = decoder.finish();
+
+        const auto seconds = timer.nsecsElapsed() / 1e9;
+        const auto mib = QFileInfo{output}.size() / (1024.0 * 1024.0);
+        std::printf("   streamed: %.1f MiB in %.2f s, %.1f MiB/s (sha256 %s)\n", mib, seconds, mib / seconds,
+                    qPrintable(hash));
+
+        QFile::remove(output);
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}